@@ -0,0 +1,238 @@
+#pragma once
+#ifndef _ROLO_BEAM_TABLE_H_
+#define _ROLO_BEAM_TABLE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rolo
+{
+
+//! 核函数使用的行号查找表，不持有内存
+//! 行号 = table[clamp(int((key - lo) * invStep) + 1, 0, size - 1)]，table首尾为-1，表示超出范围
+//! 按俯仰角查表时key为sin(elevation) = z / range，按ring查表时key为ring
+struct BeamLookup
+{
+    const float* table = nullptr;
+    int size = 0;
+    float lo = 0.0f;
+    float invStep = 0.0f;
+    bool fromRing = false;
+};
+
+//! 激光雷达各扫瞄线的俯仰角标定表，用于把点投影到距离图像的行。
+//! 行号按俯仰角从低到高排列，0为最低的扫瞄线，与原公式int((angle + 15) / 2 + 0.5)一致。
+//! 支持的标定文件格式：
+//!   1. 纯文本，每行一个俯仰角（degree），按驱动输出的ring顺序排列，'#'之后为注释
+//!   2. Ouster传感器的metadata json，读取beam_altitude_angles（degree，ring 0为最上方的线）
+//!   3. velodyne_pointcloud的标定yaml，读取各线的vert_correction（rad），ring按俯仰角从低到高编号
+class BeamTable
+{
+public:
+    //! 从标定文件构造，失败时error给出原因
+    bool load(const std::string& path, std::string& error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "cannot open beam angle file " + path;
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        std::string text = buffer.str();
+
+        std::vector<float> angles;
+        size_t pos = text.find("\"beam_altitude_angles\"");
+        if (pos != std::string::npos)
+        {
+            size_t begin = text.find('[', pos);
+            size_t end = begin == std::string::npos ? std::string::npos : text.find(']', begin);
+            if (end == std::string::npos)
+            {
+                error = "malformed beam_altitude_angles in " + path;
+                return false;
+            }
+            parseNumbers(text.substr(begin + 1, end - begin - 1), angles);
+        }
+        else if (text.find("vert_correction") != std::string::npos)
+        {
+            for (pos = text.find("vert_correction"); pos != std::string::npos; pos = text.find("vert_correction", pos + 1))
+            {
+                size_t colon = text.find(':', pos);
+                if (colon == std::string::npos)
+                    break;
+                angles.push_back(std::strtof(text.c_str() + colon + 1, nullptr) * 180.0f / (float)M_PI);
+            }
+            // velodyne_pointcloud按俯仰角排序后编号ring
+            std::sort(angles.begin(), angles.end());
+        }
+        else
+        {
+            std::istringstream lines(text);
+            std::string line;
+            while (std::getline(lines, line))
+                parseNumbers(line.substr(0, line.find('#')), angles);
+        }
+
+        if (!fromAngles(angles))
+        {
+            error = "beam angle file " + path + " must contain distinct elevation angles";
+            return false;
+        }
+        return true;
+    }
+
+    //! ringAngles[ring]为该ring的俯仰角，单位：degree
+    bool fromAngles(const std::vector<float>& ringAngles)
+    {
+        int n = ringAngles.size();
+        if (n == 0)
+            return false;
+        std::vector<int> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return ringAngles[a] < ringAngles[b]; });
+
+        elevations_.resize(n);
+        ringToRow_.assign(n + 2, -1.0f);
+        for (int row = 0; row < n; ++row)
+        {
+            elevations_[row] = ringAngles[order[row]];
+            ringToRow_[order[row] + 1] = row;
+            if (row > 0 && elevations_[row] <= elevations_[row - 1])
+                return false;
+        }
+
+        // 相邻两线俯仰角的中点为分界，首尾两线向外延伸半个线间距
+        boundaries_.resize(n + 1);
+        float firstGap = n > 1 ? elevations_[1] - elevations_[0] : 1.0f;
+        float lastGap = n > 1 ? elevations_[n - 1] - elevations_[n - 2] : 1.0f;
+        boundaries_[0] = elevations_[0] - 0.5f * firstGap;
+        boundaries_[n] = elevations_[n - 1] + 0.5f * lastGap;
+        for (int row = 1; row < n; ++row)
+            boundaries_[row] = 0.5f * (elevations_[row - 1] + elevations_[row]);
+
+        // 在sin(elevation)上等间隔划分，保证最窄的一行至少占kMinBinsPerRow格
+        float lo = sinDeg(std::max(boundaries_[0], -89.9f));
+        float hi = sinDeg(std::min(boundaries_[n], 89.9f));
+        float minWidth = hi - lo;
+        for (int row = 0; row < n; ++row)
+            minWidth = std::min(minWidth, sinDeg(boundaries_[row + 1]) - sinDeg(boundaries_[row]));
+        int bins = std::min<int>(kMaxBins, std::max<int>(n, (int)std::ceil((hi - lo) / minWidth * kMinBinsPerRow)));
+        float step = (hi - lo) / bins;
+
+        rowTable_.assign(bins + 2, -1.0f);
+        for (int b = 0; b < bins; ++b)
+        {
+            float center = std::asin(lo + (b + 0.5f) * step) * 180.0f / (float)M_PI;
+            rowTable_[b + 1] = rowOfElevation(center);
+        }
+        lo_ = lo;
+        invStep_ = 1.0f / step;
+        return true;
+    }
+
+    //! 俯仰角在[minAngle, minAngle + (beams - 1) * resolution]上均匀分布，即原来的线性公式
+    static BeamTable uniform(int beams, float minAngle, float resolution)
+    {
+        std::vector<float> angles(std::max(beams, 1));
+        for (size_t i = 0; i < angles.size(); ++i)
+            angles[i] = minAngle + i * resolution;
+        BeamTable table;
+        table.fromAngles(angles);
+        return table;
+    }
+
+    //! 直接使用点云的ring字段作为行号，没有俯仰角信息
+    //! descending为true表示ring 0为最上方的线（Ouster），否则ring 0为最下方的线（Velodyne）
+    static BeamTable ringOnly(int beams, bool descending)
+    {
+        std::vector<float> angles(std::max(beams, 1));
+        for (size_t i = 0; i < angles.size(); ++i)
+            angles[i] = descending ? -(float)i : (float)i;
+        BeamTable table;
+        table.fromAngles(angles);
+        table.useRing_ = true;
+        table.hasAngles_ = false;
+        return table;
+    }
+
+    //! 使用ring字段查表，由fromAngles得到的ring顺序映射为行号
+    void setUseRing(bool useRing) { useRing_ = useRing; }
+    bool usesRing() const { return useRing_; }
+    bool hasAngles() const { return hasAngles_; }
+
+    int beams() const { return elevations_.size(); }
+    //! 第row行的俯仰角，单位：degree
+    float elevation(int row) const { return elevations_[row]; }
+
+    //! 精确查找俯仰角对应的行号，超出范围返回-1
+    int rowOfElevation(float angle) const
+    {
+        if (boundaries_.empty() || angle < boundaries_.front() || angle >= boundaries_.back())
+            return -1;
+        return int(std::upper_bound(boundaries_.begin(), boundaries_.end(), angle) - boundaries_.begin()) - 1;
+    }
+
+    BeamLookup lookup() const
+    {
+        BeamLookup lut;
+        if (useRing_)
+        {
+            lut.table = ringToRow_.data();
+            lut.size = ringToRow_.size();
+            lut.lo = 0.0f;
+            lut.invStep = 1.0f;
+            lut.fromRing = true;
+        }
+        else
+        {
+            lut.table = rowTable_.data();
+            lut.size = rowTable_.size();
+            lut.lo = lo_;
+            lut.invStep = invStep_;
+        }
+        return lut;
+    }
+
+private:
+    enum { kMinBinsPerRow = 16, kMaxBins = 1 << 16 };
+
+    static float sinDeg(float angle) { return std::sin(angle * (float)M_PI / 180.0f); }
+
+    static void parseNumbers(const std::string& text, std::vector<float>& values)
+    {
+        const char* p = text.c_str();
+        while (*p)
+        {
+            char* end;
+            float v = std::strtof(p, &end);
+            if (end == p)
+            {
+                ++p;
+                continue;
+            }
+            values.push_back(v);
+            p = end;
+        }
+    }
+
+    std::vector<float> elevations_;  // 按行排列的俯仰角
+    std::vector<float> boundaries_;  // 各行的俯仰角分界，长度为beams + 1
+    std::vector<float> rowTable_;    // sin(elevation)到行号的查找表，首尾为-1
+    std::vector<float> ringToRow_;   // ring + 1到行号，首尾为-1
+    float lo_ = 0.0f;
+    float invStep_ = 0.0f;
+    bool useRing_ = false;
+    bool hasAngles_ = true;
+};
+
+} // namespace rolo
+
+#endif
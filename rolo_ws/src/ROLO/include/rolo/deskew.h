@@ -0,0 +1,117 @@
+#pragma once
+#ifndef _ROLO_DESKEW_H_
+#define _ROLO_DESKEW_H_
+
+#include <deque>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdDeque>
+
+#include "rolo/rangeProjection.h"
+
+namespace rolo
+{
+
+//! 按时间排列的位姿缓冲区，在SO(3)xR3上分段插值：旋转slerp，平移线性插值。
+//! 查询时间超出缓冲区时，用首/尾两个位姿的速度匀速外推
+class PoseBuffer
+{
+public:
+    struct Pose
+    {
+        double time;
+        Eigen::Quaterniond rotation;
+        Eigen::Vector3d translation;
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    //! 按时间顺序追加，时间不晚于最新位姿的消息被忽略
+    void push(double time, const Eigen::Quaterniond& rotation, const Eigen::Vector3d& translation)
+    {
+        if (!poses_.empty() && time <= poses_.back().time)
+            return;
+        Pose pose;
+        pose.time = time;
+        pose.rotation = rotation.normalized();
+        pose.translation = translation;
+        poses_.push_back(pose);
+    }
+
+    //! 删除早于time的位姿，至少保留keep个
+    void trimBefore(double time, size_t keep = 2)
+    {
+        while (poses_.size() > keep && poses_.front().time < time)
+            poses_.pop_front();
+    }
+
+    void clear() { poses_.clear(); }
+    size_t size() const { return poses_.size(); }
+    bool empty() const { return poses_.empty(); }
+    const Pose& front() const { return poses_.front(); }
+    const Pose& back() const { return poses_.back(); }
+
+    //! time时刻的位姿，少于两个位姿时返回false
+    bool interpolate(double time, Eigen::Quaterniond& rotation, Eigen::Vector3d& translation) const
+    {
+        if (poses_.size() < 2)
+            return false;
+        // 所在的区间[i, i+1]，超出范围时取首尾区间外推
+        size_t i = 0;
+        if (time >= poses_.back().time)
+            i = poses_.size() - 2;
+        else
+            while (i + 2 < poses_.size() && poses_[i + 1].time <= time)
+                ++i;
+        const Pose& a = poses_[i];
+        const Pose& b = poses_[i + 1];
+        double s = (time - a.time) / (b.time - a.time);
+
+        // slerp在s超出[0, 1]时同样成立：a * Exp(s * Log(a^-1 * b))
+        Eigen::Quaterniond relative = a.rotation.conjugate() * b.rotation;
+        if (relative.w() < 0)
+            relative.coeffs() *= -1.0; // 取较短的一侧
+        Eigen::AngleAxisd delta(relative);
+        rotation = a.rotation * Eigen::Quaterniond(Eigen::AngleAxisd(s * delta.angle(), delta.axis()));
+        translation = a.translation + s * (b.translation - a.translation);
+        return true;
+    }
+
+private:
+    std::deque<Pose, Eigen::aligned_allocator<Pose>> poses_;
+};
+
+//! 由位姿缓冲区构造去畸变表：扫描时间等分为bins段，第b个变换把b*binTime时刻的点变换到扫描开始时刻，
+//! 即T(scanStart + b*binTime)^-1 * T(scanStart)。每帧只计算bins+1个变换，与点数无关
+inline bool buildDeskewTable(const PoseBuffer& poses, double scanStart, float scanDuration, int bins, DeskewTable& table)
+{
+    Eigen::Quaterniond startRotation;
+    Eigen::Vector3d startTranslation;
+    if (!poses.interpolate(scanStart, startRotation, startTranslation))
+        return false;
+    Eigen::Isometry3d start = Eigen::Isometry3d::Identity();
+    start.linear() = startRotation.toRotationMatrix();
+    start.translation() = startTranslation;
+
+    table.resize(bins, scanDuration);
+    for (int b = 0; b <= table.bins(); ++b)
+    {
+        Eigen::Quaterniond rotation;
+        Eigen::Vector3d translation;
+        poses.interpolate(scanStart + (double)b * scanDuration / table.bins(), rotation, translation);
+        Eigen::Isometry3d current = Eigen::Isometry3d::Identity();
+        current.linear() = rotation.toRotationMatrix();
+        current.translation() = translation;
+        Eigen::Matrix<double, 3, 4> correction = (current.inverse() * start).matrix().topRows<3>();
+
+        float* T = table.transform(b);
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                T[4 * r + c] = (float)correction(r, c);
+    }
+    return true;
+}
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,128 @@
+#pragma once
+#ifndef _ROLO_FEATURE_KERNELS_H_
+#define _ROLO_FEATURE_KERNELS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "rolo/simdOps.h"
+
+namespace rolo
+{
+
+//! 特征提取的SoA缓冲区，长度为点数，每帧复用
+struct FeatureBuffer
+{
+    std::vector<float> curvature;   // 平滑度
+    std::vector<int32_t> picked;    // 1表示不可选为特征点（遮挡点、平行点、已选点及其邻近点）
+    std::vector<int32_t> label;     // 特征点类型，0为普通点，1为角点
+
+    // 第一遍扫描得到的事件标记，第二遍按滑动窗口展开到picked，前后各留kPad个0便于向量化读取
+    static const int kPad = 8;
+    std::vector<float> occludedBack;    // i遮挡了i+1，标记[i-5, i]
+    std::vector<float> occludedFront;   // i+1遮挡了i，标记[i+1, i+6]
+    std::vector<float> parallel;        // 平行点
+
+    void resize(int n)
+    {
+        curvature.resize(n);
+        picked.resize(n);
+        label.resize(n);
+        occludedBack.resize(n + 2 * kPad);
+        occludedFront.resize(n + 2 * kPad);
+        parallel.resize(n + 2 * kPad);
+    }
+    int size() const { return curvature.size(); }
+};
+
+//! 计算平滑度，标记遮挡点和平行点，并清空label。与LOAM相同的11点平滑度公式，两遍顺序扫描：
+//! 第一遍计算平滑度和每个点的遮挡/平行事件，第二遍把事件按窗口展开为picked
+//! range和col为按扫瞄线排列的点的距离和列号，buffer会被调整为n的长度
+void computeFeatureFlags(const float* range, const int32_t* col, int n, FeatureBuffer& buffer);
+
+//! 标量实现，用于对照测试
+void computeFeatureFlagsScalar(const float* range, const int32_t* col, int n, FeatureBuffer& buffer);
+
+//! 当前CPU是否使用AVX2实现
+bool featureKernelsUseAvx2();
+
+namespace detail
+{
+
+//! 第一遍：i在[begin, end)中，处理完整的向量宽度部分，返回处理到的位置。要求begin >= 5, end <= n - 5
+//! 平滑度的求和顺序与原实现一致，结果逐位相同
+template<class O>
+inline int featureEventKernel(const float* r, const int32_t* col, int begin, int end,
+                              float* curvature, float* occludedBack, float* occludedFront, float* parallel)
+{
+    typedef typename O::V V;
+    const V ten = O::set1(10.0f);
+    const V one = O::set1(1.0f);
+    const V zero = O::set1(0.0f);
+    const V colThreshold = O::set1(10.0f);
+    const V depthThreshold = O::set1(0.3f);
+    const V parallelRatio = O::set1(0.02f);
+
+    int i = begin;
+    for (; i + O::width <= end; i += O::width)
+    {
+        V c = O::load(r + i);
+        V diffRange = O::add(O::load(r + i - 5), O::load(r + i - 4));
+        diffRange = O::add(diffRange, O::load(r + i - 3));
+        diffRange = O::add(diffRange, O::load(r + i - 2));
+        diffRange = O::add(diffRange, O::load(r + i - 1));
+        diffRange = O::sub(diffRange, O::mul(c, ten));
+        V next = O::load(r + i + 1);
+        diffRange = O::add(diffRange, next);
+        diffRange = O::add(diffRange, O::load(r + i + 2));
+        diffRange = O::add(diffRange, O::load(r + i + 3));
+        diffRange = O::add(diffRange, O::load(r + i + 4));
+        diffRange = O::add(diffRange, O::load(r + i + 5));
+        O::store(curvature + i, O::mul(diffRange, diffRange));
+
+        // 遮挡点：列号相近但深度突变
+        V columnDiff = O::abs(O::sub(O::loadInt(col + i + 1), O::loadInt(col + i)));
+        V near = O::lt(columnDiff, colThreshold);
+        // 原实现与double类型的0.3比较，对float而言等价于>= 0.3f
+        V back = O::and_(near, O::ge(O::sub(c, next), depthThreshold));
+        V front = O::and_(near, O::ge(O::sub(next, c), depthThreshold));
+        O::store(occludedBack + i, O::select(back, one, zero));
+        O::store(occludedFront + i, O::select(front, one, zero));
+
+        // 平行点：与两侧点的深度差都很大
+        V diff1 = O::abs(O::sub(O::load(r + i - 1), c));
+        V diff2 = O::abs(O::sub(next, c));
+        V limit = O::mul(parallelRatio, c);
+        O::store(parallel + i, O::select(O::and_(O::gt(diff1, limit), O::gt(diff2, limit)), one, zero));
+    }
+    return i;
+}
+
+//! 第二遍：j在[begin, end)中，picked[j] = parallel[j] | occludedBack[j..j+5] | occludedFront[j-6..j-1]
+//! 事件数组前后有足够的0填充，可以直接越界读取
+template<class O>
+inline int featurePickedKernel(const float* occludedBack, const float* occludedFront, const float* parallel,
+                               int begin, int end, int32_t* picked, int32_t* label)
+{
+    typedef typename O::V V;
+    const V zero = O::set1(0.0f);
+    int j = begin;
+    for (; j + O::width <= end; j += O::width)
+    {
+        V m = O::load(parallel + j);
+        for (int k = 0; k <= 5; ++k)
+            m = O::max(m, O::load(occludedBack + j + k));
+        for (int k = 1; k <= 6; ++k)
+            m = O::max(m, O::load(occludedFront + j - k));
+        O::storeInt(picked + j, m);
+        O::storeInt(label + j, zero);
+    }
+    return j;
+}
+
+} // namespace detail
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,259 @@
+#pragma once
+#ifndef _ROLO_FRAME_RING_H_
+#define _ROLO_FRAME_RING_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rolo
+{
+
+//! 队列满时的处理策略
+enum class QueuePolicy { DROP_OLDEST, DROP_NEWEST, BLOCK };
+
+//! 解析参数中的队列策略字符串：drop_oldest, drop_newest, block
+inline bool queuePolicyFromString(const std::string& str, QueuePolicy& policy)
+{
+    if (str == "drop_oldest")
+        policy = QueuePolicy::DROP_OLDEST;
+    else if (str == "drop_newest")
+        policy = QueuePolicy::DROP_NEWEST;
+    else if (str == "block")
+        policy = QueuePolicy::BLOCK;
+    else
+        return false;
+    return true;
+}
+
+struct FrameRingStats
+{
+    size_t capacity;
+    size_t occupancy;   // 当前队列中的帧数
+    size_t highWater;   // 历史最大帧数
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t dropped;
+};
+
+//! 定长无锁环形队列，用于模块之间传递帧
+//! 一个生产者线程，一个消费者线程，槽位在构造时一次分配。每个槽位带序号（Vyukov队列），
+//! 因此DROP_OLDEST策略下生产者可以安全地从队头丢弃最旧的帧，而不必与消费者加锁。
+//! 互斥量和条件变量只用于让空闲的消费者或BLOCK策略下的生产者睡眠，不在数据通路上：
+//! 等待的一方先置位原子标志（consumerWaiting_/producerWaiting_）再检查队列，另一方修改size_后读取标志，
+//! 两边都是seq_cst，所以至少有一方看到对方的修改；只有标志置位时才加锁唤醒，对方不睡眠时push/pop不碰互斥量。
+template<typename T>
+class FrameRing
+{
+public:
+    FrameRing(size_t capacity, QueuePolicy policy)
+    : capacity_(std::max<size_t>(capacity, 1)),
+      policy_(policy),
+      // 序号方案至少需要两个槽位，容量为1时多出的槽位由size_限制不会被占用
+      cells_(std::max<size_t>(capacity_, 2)),
+      head_(0), tail_(0), size_(0), highWater_(0),
+      pushed_(0), popped_(0), dropped_(0), consumerWaiting_(false), producerWaiting_(false), closed_(false)
+    {
+        for (size_t i = 0; i < cells_.size(); ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    //! 生产者调用。返回false表示有帧被丢弃（DROP_NEWEST丢弃item本身，DROP_OLDEST丢弃队头），
+    //! 或者BLOCK策略下队列已关闭
+    bool push(T item)
+    {
+        bool dropped = false;
+        while (size_.load(std::memory_order_acquire) >= capacity_ || !tryPush(item))
+        {
+            if (policy_ == QueuePolicy::DROP_NEWEST)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (policy_ == QueuePolicy::DROP_OLDEST)
+            {
+                // 消费者可能同时取走队头，取不到时重试即可
+                T oldest;
+                if (tryPop(oldest))
+                {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    dropped = true;
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(waitMutex_);
+            if (closed_)
+                return false;
+            producerWaiting_.store(true, std::memory_order_seq_cst);
+            notFull_.wait_for(lock, std::chrono::milliseconds(10), [this] {
+                return closed_ || size_.load(std::memory_order_seq_cst) < capacity_;
+            });
+            producerWaiting_.store(false, std::memory_order_relaxed);
+        }
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+
+        size_t occupancy = size_.load(std::memory_order_relaxed);
+        if (occupancy > highWater_.load(std::memory_order_relaxed))
+            highWater_.store(occupancy, std::memory_order_relaxed);
+
+        if (consumerWaiting_.load(std::memory_order_seq_cst))
+        {
+            {
+                std::lock_guard<std::mutex> lock(waitMutex_);
+            }
+            notEmpty_.notify_one();
+        }
+        return !dropped;
+    }
+
+    //! 消费者调用，队列为空时立即返回false
+    bool pop(T& item)
+    {
+        if (!tryPop(item))
+            return false;
+        popped_.fetch_add(1, std::memory_order_relaxed);
+        if (policy_ == QueuePolicy::BLOCK && producerWaiting_.load(std::memory_order_seq_cst))
+        {
+            {
+                std::lock_guard<std::mutex> lock(waitMutex_);
+            }
+            notFull_.notify_one();
+        }
+        return true;
+    }
+
+    //! 消费者调用，队列为空时最多等待timeout，队列关闭后返回false
+    template<typename Rep, typename Period>
+    bool waitPop(T& item, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        if (pop(item))
+            return true;
+        {
+            std::unique_lock<std::mutex> lock(waitMutex_);
+            consumerWaiting_.store(true, std::memory_order_seq_cst);
+            notEmpty_.wait_for(lock, timeout, [this] {
+                return closed_ || size_.load(std::memory_order_seq_cst) > 0;
+            });
+            consumerWaiting_.store(false, std::memory_order_relaxed);
+        }
+        return pop(item);
+    }
+
+    //! 唤醒所有等待的线程，之后BLOCK策略下的push直接返回
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(waitMutex_);
+            closed_ = true;
+        }
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+    size_t size() const { return size_.load(std::memory_order_acquire); }
+    size_t capacity() const { return capacity_; }
+    QueuePolicy policy() const { return policy_; }
+
+    FrameRingStats stats() const
+    {
+        FrameRingStats stats;
+        stats.capacity = capacity_;
+        stats.occupancy = size_.load(std::memory_order_relaxed);
+        stats.highWater = highWater_.load(std::memory_order_relaxed);
+        stats.pushed = pushed_.load(std::memory_order_relaxed);
+        stats.popped = popped_.load(std::memory_order_relaxed);
+        stats.dropped = dropped_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    bool tryPush(T& item)
+    {
+        Cell* cell;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos % cells_.size()];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;   // 槽位仍被消费者占用
+            else
+                pos = tail_.load(std::memory_order_relaxed);
+        }
+        cell->data = std::move(item);
+        size_.fetch_add(1, std::memory_order_seq_cst);   // 与consumerWaiting_构成seq_cst的先写后读
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& item)
+    {
+        Cell* cell;
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos % cells_.size()];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;   // 队列为空
+            else
+                pos = head_.load(std::memory_order_relaxed);
+        }
+        item = std::move(cell->data);
+        cell->data = T();   // 槽位不再持有帧的引用
+        size_.fetch_sub(1, std::memory_order_seq_cst);   // 与producerWaiting_构成seq_cst的先写后读
+        cell->sequence.store(pos + cells_.size(), std::memory_order_release);
+        return true;
+    }
+
+    const size_t capacity_;
+    const QueuePolicy policy_;
+    std::vector<Cell> cells_;
+
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+    alignas(64) std::atomic<size_t> size_;
+
+    std::atomic<size_t> highWater_;
+    std::atomic<uint64_t> pushed_;
+    std::atomic<uint64_t> popped_;
+    std::atomic<uint64_t> dropped_;
+
+    alignas(64) std::atomic<bool> consumerWaiting_;   // 消费者在waitPop中等待
+    std::atomic<bool> producerWaiting_;               // BLOCK策略下生产者在push中等待
+
+    std::mutex waitMutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    bool closed_;
+};
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef _ROLO_GROUND_SEGMENTATION_H_
+#define _ROLO_GROUND_SEGMENTATION_H_
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+namespace rolo
+{
+
+struct GroundSegmentationParams
+{
+    int groundRows = 0;             // 距离图像最下方参与地面判断的行数，0表示不做地面分割
+    float maxSlope = 10.0f;         // 相邻两行的点连线与水平面的最大夹角，度
+    float sensorMountAngle = 0.0f;  // 雷达安装俯仰角，度
+};
+
+//! 地面分割，方法同LeGO-LOAM：对距离图像的每一列，比较最下方groundRows行中上下相邻的两个点，
+//! 两点连线与水平面的夹角（减去安装角）不超过maxSlope时，两个点都标记为地面。
+//! 要求第0行为俯仰角最小的扫瞄线。image为按行存储的有序点云，range中FLT_MAX为空像素，
+//! 结果写入ground（1为地面点），长度为rows*cols。各列相互独立，按列并行
+template<typename PointT>
+inline void segmentGround(const GroundSegmentationParams& params, int rows, int cols, const PointT* image, const float* range,
+                          uint8_t* ground, int threads = 1)
+{
+    const int groundRows = params.groundRows < rows ? params.groundRows : rows - 1;
+    const float maxSlope = params.maxSlope * (float)M_PI / 180.0f;
+    const float mountAngle = params.sensorMountAngle * (float)M_PI / 180.0f;
+
+    #pragma omp parallel for num_threads(threads) schedule(static)
+    for (int j = 0; j < cols; ++j)
+    {
+        for (int i = 0; i <= groundRows; ++i)
+            ground[j + i * cols] = 0;
+        for (int i = 0; i < groundRows; ++i)
+        {
+            const int lower = j + i * cols;
+            const int upper = lower + cols;
+            if (range[lower] == FLT_MAX || range[upper] == FLT_MAX)
+                continue;
+            float dx = image[upper].x - image[lower].x;
+            float dy = image[upper].y - image[lower].y;
+            float dz = image[upper].z - image[lower].z;
+            float angle = std::atan2(dz, std::sqrt(dx * dx + dy * dy));
+            if (std::fabs(angle - mountAngle) <= maxSlope)
+            {
+                ground[lower] = 1;
+                ground[upper] = 1;
+            }
+        }
+    }
+}
+
+} // namespace rolo
+
+#endif
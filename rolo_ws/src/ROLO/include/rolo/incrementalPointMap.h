@@ -0,0 +1,226 @@
+#pragma once
+#ifndef _ROLO_INCREMENTAL_POINT_MAP_H_
+#define _ROLO_INCREMENTAL_POINT_MAP_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+
+namespace rolo
+{
+
+//! 后端scan-to-map的局部地图：全局坐标系下的点按体素哈希增量维护，代替每帧拼接周围关键帧、降采样并重建KD树。
+//! 降采样体素（leafSize）中只保留离体素中心最近的一个点，同一关键帧重复插入不会产生重复的点；
+//! 点同时登记在边长cellSize的搜索网格中，近邻只在查询点所在及相邻的27个网格中搜索。
+//! 删除以网格为单位，删除立方体以外的整个网格，空出的点位由之后插入的点复用。
+//! 插入的代价与新点数成正比，查询不修改地图，可以在多个线程中并发调用
+template<typename PointT>
+class IncrementalPointMap
+{
+public:
+    //! cellSize不小于近邻搜索要求的距离，距离不超过cellSize的近邻是精确的
+    IncrementalPointMap(float leafSize, float cellSize)
+        : leafSize_(leafSize), cellSize_(std::max(cellSize, leafSize))
+    {
+    }
+
+    //! 插入全局坐标系下的点云
+    void insert(const pcl::PointCloud<PointT>& cloud)
+    {
+        for (const PointT& point : cloud.points)
+            insert(point);
+    }
+
+    //! 插入一个点，返回是否新增；体素中已有点时，新点离体素中心更近则替换之
+    bool insert(const PointT& point)
+    {
+        if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+            return false;
+
+        const uint64_t leaf = key(point, leafSize_);
+        auto found = leaves_.find(leaf);
+        if (found != leaves_.end())
+        {
+            PointT& kept = points_[found->second];
+            if (leafCenterDistance(point) >= leafCenterDistance(kept))
+                return false;
+            const uint64_t oldCell = key(kept, cellSize_);
+            const uint64_t newCell = key(point, cellSize_);
+            if (oldCell != newCell)
+            {
+                removeFromCell(oldCell, found->second);
+                cells_[newCell].push_back(found->second);
+            }
+            kept = point;
+            return false;
+        }
+
+        int index;
+        if (!free_.empty())
+        {
+            index = free_.back();
+            free_.pop_back();
+            points_[index] = point;
+        }
+        else
+        {
+            index = (int)points_.size();
+            points_.push_back(point);
+        }
+        leaves_.emplace(leaf, index);
+        cells_[key(point, cellSize_)].push_back(index);
+        return true;
+    }
+
+    //! 删除完全位于立方体（中心center，半边长halfSize）以外的网格，返回删除的点数
+    size_t removeOutside(const Eigen::Vector3f& center, float halfSize)
+    {
+        const Eigen::Array3f lower = (center.array() - halfSize) / cellSize_;
+        const Eigen::Array3f upper = (center.array() + halfSize) / cellSize_;
+        size_t removed = 0;
+        for (auto cell = cells_.begin(); cell != cells_.end();)
+        {
+            // 网格coord覆盖[coord, coord+1)*cellSize
+            const Eigen::Array3f coord = unpack(cell->first).template cast<float>();
+            if (((coord + 1.0f) > lower).all() && (coord < upper).all())
+            {
+                ++cell;
+                continue;
+            }
+            for (int index : cell->second)
+            {
+                leaves_.erase(key(points_[index], leafSize_));
+                free_.push_back(index);
+            }
+            removed += cell->second.size();
+            cell = cells_.erase(cell);
+        }
+        return removed;
+    }
+
+    //! 清空地图，保留点数组的容量
+    void clear()
+    {
+        points_.clear();
+        free_.clear();
+        leaves_.clear();
+        cells_.clear();
+    }
+
+    //! 最近的k个点在points中的索引和距离的平方，按距离升序，返回找到的个数（可能少于k）
+    int nearestKSearch(const PointT& query, int k, std::vector<int>& indices, std::vector<float>& sqDistances) const
+    {
+        k = std::max(k, 0);
+        indices.resize(k);
+        sqDistances.resize(k);
+        int found = 0;
+        const Eigen::Vector3i center = coord(query, cellSize_);
+        for (int dx = -1; dx <= 1; ++dx)
+        for (int dy = -1; dy <= 1; ++dy)
+        for (int dz = -1; dz <= 1; ++dz)
+        {
+            auto cell = cells_.find(pack(center + Eigen::Vector3i(dx, dy, dz)));
+            if (cell == cells_.end())
+                continue;
+            for (int index : cell->second)
+            {
+                const PointT& point = points_[index];
+                const float sqDistance = (point.x - query.x) * (point.x - query.x) + (point.y - query.y) * (point.y - query.y)
+                                       + (point.z - query.z) * (point.z - query.z);
+                if (found == k && (k == 0 || sqDistance >= sqDistances[k - 1]))
+                    continue;
+                // 插入排序，k很小
+                int j = found < k ? found++ : k - 1;
+                while (j > 0 && sqDistances[j - 1] > sqDistance)
+                {
+                    sqDistances[j] = sqDistances[j - 1];
+                    indices[j] = indices[j - 1];
+                    --j;
+                }
+                sqDistances[j] = sqDistance;
+                indices[j] = index;
+            }
+        }
+        indices.resize(found);
+        sqDistances.resize(found);
+        return found;
+    }
+
+    const PointT& point(int index) const { return points_[index]; }
+
+    size_t size() const { return leaves_.size(); }
+    bool empty() const { return leaves_.empty(); }
+
+    //! 地图中的所有点，用于可视化
+    void toCloud(pcl::PointCloud<PointT>& cloud) const
+    {
+        cloud.clear();
+        cloud.reserve(size());
+        for (const auto& cell : cells_)
+            for (int index : cell.second)
+                cloud.push_back(points_[index]);
+    }
+
+private:
+    // 每轴21位，偏移后为非负
+    static constexpr int kBits = 21;
+    static constexpr int kOffset = 1 << (kBits - 1);
+    static constexpr uint64_t kMask = (1ull << kBits) - 1;
+
+    static Eigen::Vector3i coord(const PointT& point, float size)
+    {
+        return Eigen::Vector3i((int)std::floor(point.x / size), (int)std::floor(point.y / size), (int)std::floor(point.z / size));
+    }
+
+    static uint64_t pack(const Eigen::Vector3i& c)
+    {
+        return ((uint64_t)((c.x() + kOffset) & kMask) << (2 * kBits)) | ((uint64_t)((c.y() + kOffset) & kMask) << kBits)
+             | (uint64_t)((c.z() + kOffset) & kMask);
+    }
+
+    static Eigen::Vector3i unpack(uint64_t packed)
+    {
+        return Eigen::Vector3i((int)((packed >> (2 * kBits)) & kMask) - kOffset, (int)((packed >> kBits) & kMask) - kOffset,
+                               (int)(packed & kMask) - kOffset);
+    }
+
+    static uint64_t key(const PointT& point, float size) { return pack(coord(point, size)); }
+
+    float leafCenterDistance(const PointT& point) const
+    {
+        const Eigen::Vector3f center = (coord(point, leafSize_).template cast<float>().array() + 0.5f) * leafSize_;
+        return (point.getVector3fMap() - center).squaredNorm();
+    }
+
+    void removeFromCell(uint64_t cellKey, int index)
+    {
+        auto cell = cells_.find(cellKey);
+        if (cell == cells_.end())
+            return;
+        std::vector<int>& indices = cell->second;
+        auto it = std::find(indices.begin(), indices.end(), index);
+        if (it != indices.end())
+        {
+            *it = indices.back();
+            indices.pop_back();
+        }
+        if (indices.empty())
+            cells_.erase(cell);
+    }
+
+    float leafSize_;
+    float cellSize_;
+    std::vector<PointT> points_;                          // 点位，删除的点位记在free_中
+    std::vector<int> free_;
+    std::unordered_map<uint64_t, int> leaves_;             // 降采样体素 -> 点位
+    std::unordered_map<uint64_t, std::vector<int>> cells_; // 搜索网格 -> 点位
+};
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+#ifndef _ROLO_KEYFRAME_CLOUD_CACHE_H_
+#define _ROLO_KEYFRAME_CLOUD_CACHE_H_
+
+#include <cmath>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <Eigen/Geometry>
+#include <pcl/point_cloud.h>
+
+namespace rolo
+{
+
+//! 变换到全局坐标系的关键帧角点和平面点的缓存，按关键帧索引查找，以共享指针保存，取用时不复制点云。
+//! 每个条目记录变换时的位姿作为版本：查询时的位姿与之相差超过容差（回环校正移动了该关键帧）才失效，
+//! 没有移动的关键帧在回环后仍然命中。总内存超过上限时淘汰最久未使用的条目。
+//! 查询和插入加锁，可以在建图线程和回环线程中同时使用；点云的变换由调用者在锁外进行
+template<typename PointT>
+class KeyframeCloudCache
+{
+public:
+    typedef typename pcl::PointCloud<PointT>::ConstPtr CloudConstPtr;
+
+    //! maxBytes为点云占用的内存上限，translationTolerance（m）、rotationTolerance（rad）为位姿视为未变的容差
+    KeyframeCloudCache(size_t maxBytes, float translationTolerance, float rotationTolerance)
+        : maxBytes_(maxBytes), translationTolerance_(translationTolerance), rotationTolerance_(rotationTolerance)
+    {
+    }
+
+    //! 命中时返回true并给出点云，未缓存或位姿已变化时返回false。cachedPose不为空时给出点云变换时的位姿（在容差内与pose不同）
+    bool find(int id, const Eigen::Affine3f& pose, CloudConstPtr& corner, CloudConstPtr& surf,
+              Eigen::Affine3f* cachedPose = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(id);
+        if (it == entries_.end() || !samePose(it->second.pose, pose))
+        {
+            misses_++;
+            return false;
+        }
+        // 移到LRU链表的头部
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        corner = it->second.corner;
+        surf = it->second.surf;
+        if (cachedPose)
+            *cachedPose = it->second.pose;
+        hits_++;
+        return true;
+    }
+
+    //! 插入或替换id的条目，之后按内存上限淘汰
+    void insert(int id, const Eigen::Affine3f& pose, const CloudConstPtr& corner, const CloudConstPtr& surf)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(id);
+        if (it != entries_.end())
+            erase(it);
+
+        Entry entry;
+        entry.pose = pose;
+        entry.corner = corner;
+        entry.surf = surf;
+        entry.bytes = (corner->size() + surf->size()) * sizeof(PointT);
+        lru_.push_front(id);
+        entry.lru = lru_.begin();
+        bytes_ += entry.bytes;
+        entries_.emplace(id, entry);
+
+        // 至少保留刚插入的条目
+        while (bytes_ > maxBytes_ && lru_.size() > 1)
+            erase(entries_.find(lru_.back()));
+    }
+
+    //! 位姿已变化时删除id的条目，返回是否删除
+    bool invalidate(int id, const Eigen::Affine3f& pose)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(id);
+        if (it == entries_.end() || samePose(it->second.pose, pose))
+            return false;
+        erase(it);
+        return true;
+    }
+
+    //! 两个位姿的差是否在容差以内
+    bool samePose(const Eigen::Affine3f& a, const Eigen::Affine3f& b) const
+    {
+        if ((a.translation() - b.translation()).norm() > translationTolerance_)
+            return false;
+        const Eigen::AngleAxisf delta(a.linear().transpose() * b.linear());
+        return std::fabs(delta.angle()) <= rotationTolerance_;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        lru_.clear();
+        bytes_ = 0;
+    }
+
+    size_t size() const { std::lock_guard<std::mutex> lock(mutex_); return entries_.size(); }
+    size_t bytes() const { std::lock_guard<std::mutex> lock(mutex_); return bytes_; }
+    size_t hits() const { std::lock_guard<std::mutex> lock(mutex_); return hits_; }
+    size_t misses() const { std::lock_guard<std::mutex> lock(mutex_); return misses_; }
+
+private:
+    struct Entry
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::Affine3f pose;   // 变换点云时的位姿
+        CloudConstPtr corner;
+        CloudConstPtr surf;
+        size_t bytes = 0;
+        typename std::list<int>::iterator lru;
+    };
+    typedef std::unordered_map<int, Entry, std::hash<int>, std::equal_to<int>,
+                               Eigen::aligned_allocator<std::pair<const int, Entry>>> EntryMap;
+
+    void erase(typename EntryMap::iterator it)
+    {
+        bytes_ -= it->second.bytes;
+        lru_.erase(it->second.lru);
+        entries_.erase(it);
+    }
+
+    size_t maxBytes_;
+    float translationTolerance_;
+    float rotationTolerance_;
+    mutable std::mutex mutex_;
+    EntryMap entries_;
+    std::list<int> lru_;    // 最近使用的在前
+    size_t bytes_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,151 @@
+#pragma once
+#ifndef _ROLO_LOCAL_VOXEL_MAP_H_
+#define _ROLO_LOCAL_VOXEL_MAP_H_
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+#include <pcl/point_cloud.h>
+
+#include <rot_gicp/gicp/vmp_voxel.hpp>
+
+namespace rolo
+{
+
+//! 里程计的局部地图：最近若干帧的特征点变换到世界坐标系后融合进体素地图，每个分辨率一张VmfVoxelMap（对应配准的体素金字塔）。
+//! 新帧的点增量插入；帧数超过maxFrames的最旧帧、以及距当前位置超过radius的帧，其点从体素中减去。
+//! 只有这些点所在的体素重新finalize，更新代价与一帧的点数成正比，不重新体素化整个地图。
+//! 为了能精确删除，环形缓冲保存各帧在世界坐标系下的点和单精度协方差（每点6个float），内存以maxFrames帧为上限，缓冲的容量在帧间复用
+template<typename PointT>
+class LocalVoxelMap
+{
+public:
+    typedef std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> CovarianceList;
+    typedef fast_gicp::VmfVoxelMap<PointT> VoxelMap;
+
+    //! resolutions按配准时的金字塔由粗到细给出，radius<=0表示只按帧数删除
+    LocalVoxelMap(const std::vector<double>& resolutions, int maxFrames, double radius)
+        : frames_(std::max(maxFrames, 1)), radius_(radius)
+    {
+        for (double resolution : resolutions)
+        {
+            std::shared_ptr<VoxelMap> map = std::make_shared<VoxelMap>(resolution, fast_gicp::VoxelAccumulationMode::ADDITIVE);
+            maps_.push_back(map);
+            constMaps_.push_back(map);
+        }
+    }
+
+    //! 插入一帧，cloud和covs在雷达坐标系下，pose为世界坐标系下的雷达位姿。先删除过期的帧，再插入新帧
+    void addFrame(const pcl::PointCloud<PointT>& cloud, const CovarianceList& covs, const Eigen::Isometry3d& pose)
+    {
+        while (count_ > 0 && (count_ == (int)frames_.size() || outOfRange(frames_[head_], pose)))
+            evictOldest();
+
+        Frame& frame = frames_[(head_ + count_) % frames_.size()];
+        const Eigen::Matrix4f transform = pose.matrix().cast<float>();
+        const Eigen::Matrix3d R = pose.linear();
+        frame.position = pose.translation();
+        frame.cloud.resize(cloud.size());
+        frame.covs.resize(cloud.size() * 6);
+        for (size_t i = 0; i < cloud.size(); ++i)
+        {
+            frame.cloud.points[i] = cloud.points[i];
+            frame.cloud.points[i].getVector4fMap() = transform * cloud.points[i].getVector4fMap();
+            const Eigen::Matrix3d cov = R * covs[i].template block<3, 3>(0, 0) * R.transpose();
+            float* packed = &frame.covs[i * 6];
+            packed[0] = cov(0, 0); packed[1] = cov(0, 1); packed[2] = cov(0, 2);
+            packed[3] = cov(1, 1); packed[4] = cov(1, 2); packed[5] = cov(2, 2);
+        }
+        count_++;
+
+        // 插入和删除都由保存的单精度数据转换，删除时减去的与插入的完全相同；删除和插入的体素一起finalize
+        for (size_t i = 0; i < frame.cloud.size(); ++i)
+        {
+            const Eigen::Vector4d point = frame.cloud.points[i].getVector4fMap().template cast<double>();
+            const Eigen::Matrix4d cov = unpack(&frame.covs[i * 6]);
+            for (auto& map : maps_)
+                map->insert(point, cov);
+        }
+        for (auto& map : maps_)
+            map->finalize();
+    }
+
+    //! 清空地图，保留容量
+    void clear()
+    {
+        for (auto& map : maps_)
+            map->clear();
+        head_ = 0;
+        count_ = 0;
+    }
+
+    //! 各分辨率的体素地图，由粗到细，用于RotVGICP::setTargetVoxelMaps
+    const std::vector<std::shared_ptr<const VoxelMap>>& voxelMaps() const { return constMaps_; }
+
+    bool empty() const { return count_ == 0; }
+    int frames() const { return count_; }
+
+    //! 地图中的点数
+    size_t points() const
+    {
+        size_t n = 0;
+        for (int i = 0; i < count_; ++i)
+            n += frames_[(head_ + i) % frames_.size()].cloud.size();
+        return n;
+    }
+
+private:
+    struct Frame
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        pcl::PointCloud<PointT> cloud;  // 世界坐标系
+        std::vector<float> covs;        // 协方差的上三角，每点6个
+        Eigen::Vector3d position = Eigen::Vector3d::Zero();
+    };
+
+    static Eigen::Matrix4d unpack(const float* packed)
+    {
+        Eigen::Matrix4d cov = Eigen::Matrix4d::Zero();
+        cov(0, 0) = packed[0];
+        cov(0, 1) = cov(1, 0) = packed[1];
+        cov(0, 2) = cov(2, 0) = packed[2];
+        cov(1, 1) = packed[3];
+        cov(1, 2) = cov(2, 1) = packed[4];
+        cov(2, 2) = packed[5];
+        return cov;
+    }
+
+    bool outOfRange(const Frame& frame, const Eigen::Isometry3d& pose) const
+    {
+        return radius_ > 0.0 && (frame.position - pose.translation()).norm() > radius_;
+    }
+
+    void evictOldest()
+    {
+        Frame& frame = frames_[head_];
+        for (size_t i = 0; i < frame.cloud.size(); ++i)
+        {
+            const Eigen::Vector4d point = frame.cloud.points[i].getVector4fMap().template cast<double>();
+            const Eigen::Matrix4d cov = unpack(&frame.covs[i * 6]);
+            for (auto& map : maps_)
+                map->evict(point, cov);
+        }
+        head_ = (head_ + 1) % frames_.size();
+        count_--;
+    }
+
+    std::vector<Frame, Eigen::aligned_allocator<Frame>> frames_;  // 环形缓冲，最旧的帧在head_
+    int head_ = 0;
+    int count_ = 0;
+    double radius_;
+    std::vector<std::shared_ptr<VoxelMap>> maps_;
+    std::vector<std::shared_ptr<const VoxelMap>> constMaps_;
+};
+
+} // namespace rolo
+
+#endif
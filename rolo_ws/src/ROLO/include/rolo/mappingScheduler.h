@@ -0,0 +1,61 @@
+#pragma once
+#ifndef _ROLO_MAPPING_SCHEDULER_H_
+#define _ROLO_MAPPING_SCHEDULER_H_
+
+#include <algorithm>
+
+namespace rolo
+{
+
+//! 后端扫描匹配的自适应调度，代替固定的mappingProcessInterval门限。
+//! 记录处理一帧耗时的滑动平均cost，处理间隔取cost/targetLoad，并限制在[minInterval, maxInterval]内：
+//! CPU充裕时间隔小于帧周期，每一帧都处理；负载升高时间隔随耗时拉长，均匀地跳过部分帧，而不是等输入队列溢出后成批丢帧。
+//! 只在扫描匹配线程中调用
+class MappingScheduler
+{
+public:
+    //! targetLoad为扫描匹配线程允许占用的时间比例，(0, 1]
+    MappingScheduler(double minInterval, double maxInterval, double targetLoad)
+        : minInterval_(minInterval), maxInterval_(std::max(minInterval, maxInterval)),
+          targetLoad_(std::min(std::max(targetLoad, 0.1), 1.0)), interval_(minInterval)
+    {
+    }
+
+    //! 时间戳为stamp的帧是否处理。帧周期的一成作为时间戳抖动的容差，间隔等于帧周期时不会隔帧处理
+    bool admit(double stamp)
+    {
+        if (lastSeen_ >= 0 && stamp > lastSeen_)
+            period_ = period_ > 0 ? 0.9 * period_ + 0.1 * (stamp - lastSeen_) : stamp - lastSeen_;
+        lastSeen_ = stamp;
+        // 第一帧，或者时间戳回退（回放重新开始）
+        if (lastProcessed_ < 0 || stamp < lastProcessed_)
+            return true;
+        return stamp - lastProcessed_ + 0.1 * std::max(period_, 0.0) >= interval_;
+    }
+
+    //! 时间戳为stamp的帧处理完毕，seconds为处理耗时
+    void processed(double stamp, double seconds)
+    {
+        lastProcessed_ = stamp;
+        cost_ = cost_ < 0 ? seconds : 0.8 * cost_ + 0.2 * seconds;
+        interval_ = std::min(std::max(cost_ / targetLoad_, minInterval_), maxInterval_);
+    }
+
+    double interval() const { return interval_; }
+    double cost() const { return std::max(cost_, 0.0); }
+    double period() const { return std::max(period_, 0.0); }
+
+private:
+    double minInterval_;
+    double maxInterval_;
+    double targetLoad_;
+    double interval_;           // 当前的处理间隔（s）
+    double cost_ = -1;          // 处理耗时的滑动平均（s）
+    double period_ = -1;        // 输入帧周期的滑动平均（s）
+    double lastSeen_ = -1;      // 上一个输入帧的时间戳
+    double lastProcessed_ = -1; // 上一个处理的帧的时间戳
+};
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,218 @@
+#pragma once
+#ifndef _ROLO_PIPELINE_H_
+#define _ROLO_PIPELINE_H_
+
+#include "rolo/utility.h"
+#include "rolo/frameRing.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace rolo
+{
+
+//! 各模块之间传递的一帧数据，与CloudInfoStamp一一对应
+//! 点云和数组都以共享指针持有，生成后只读，下游模块直接引用，不做拷贝和序列化
+struct CloudFrame
+{
+    std_msgs::Header header;
+
+    // 每条扫瞄线可以计算曲率的起止索引，以及有效点在距离图像中的行列号、距离和地面点标记
+    std::shared_ptr<const std::vector<int32_t>> startRingIndex;
+    std::shared_ptr<const std::vector<int32_t>> endRingIndex;
+    std::shared_ptr<const std::vector<int32_t>> pointRowInd;
+    std::shared_ptr<const std::vector<int32_t>> pointColInd;
+    std::shared_ptr<const std::vector<float>> pointRange;
+    std::shared_ptr<const std::vector<uint8_t>> pointGround;
+
+    // 前端里程计给出的初值
+    float initialGuessX = 0;
+    float initialGuessY = 0;
+    float initialGuessZ = 0;
+    float initialGuessRoll = 0;
+    float initialGuessPitch = 0;
+    float initialGuessYaw = 0;
+    bool odomAvailable = false;
+
+    pcl::PointCloud<PointType>::ConstPtr cloudProjected;
+    pcl::PointCloud<PointType>::ConstPtr extractedCorner;
+    pcl::PointCloud<PointType>::ConstPtr extractedSurface;
+    pcl::PointCloud<PointType>::ConstPtr extractedNormal;
+
+    // 由ROS消息解析得到的帧保留原消息，单独运行的节点转发时直接复用其中已序列化的点云
+    rolo::CloudInfoStampConstPtr sourceMsg;
+};
+
+typedef std::shared_ptr<CloudFrame> CloudFramePtr;
+typedef std::shared_ptr<const CloudFrame> CloudFrameConstPtr;
+typedef std::function<void(const CloudFrameConstPtr&)> FrameSink;
+
+//! 将ROS点云消息转换为pcl点云，空消息得到空点云
+inline pcl::PointCloud<PointType>::ConstPtr cloudFromMsg(const sensor_msgs::PointCloud2& msg)
+{
+    pcl::PointCloud<PointType>::Ptr cloud(new pcl::PointCloud<PointType>());
+    if (!msg.data.empty())
+        pcl::fromROSMsg(msg, *cloud);
+    return cloud;
+}
+
+//! 由cloud_info消息构造一帧数据，convertProjected为false时不解析cloud_projected
+inline CloudFramePtr frameFromMsg(const rolo::CloudInfoStampConstPtr& msg, bool convertProjected = true)
+{
+    CloudFramePtr frame = std::make_shared<CloudFrame>();
+    frame->header = msg->header;
+    frame->startRingIndex = std::make_shared<std::vector<int32_t>>(msg->startRingIndex);
+    frame->endRingIndex = std::make_shared<std::vector<int32_t>>(msg->endRingIndex);
+    frame->pointRowInd = std::make_shared<std::vector<int32_t>>(msg->pointRowInd);
+    frame->pointColInd = std::make_shared<std::vector<int32_t>>(msg->pointColInd);
+    frame->pointRange = std::make_shared<std::vector<float>>(msg->pointRange);
+    frame->pointGround = std::make_shared<std::vector<uint8_t>>(msg->pointGround);
+
+    frame->initialGuessX = msg->initialGuessX;
+    frame->initialGuessY = msg->initialGuessY;
+    frame->initialGuessZ = msg->initialGuessZ;
+    frame->initialGuessRoll = msg->initialGuessRoll;
+    frame->initialGuessPitch = msg->initialGuessPitch;
+    frame->initialGuessYaw = msg->initialGuessYaw;
+    frame->odomAvailable = msg->odomAvailable;
+
+    if (convertProjected)
+        frame->cloudProjected = cloudFromMsg(msg->cloud_projected);
+    else
+        frame->cloudProjected.reset(new pcl::PointCloud<PointType>());
+    frame->extractedCorner = cloudFromMsg(msg->extracted_corner);
+    frame->extractedSurface = cloudFromMsg(msg->extracted_surface);
+    frame->extractedNormal = cloudFromMsg(msg->extracted_normal);
+
+    frame->sourceMsg = msg;
+    return frame;
+}
+
+//! 将帧头和初值写入cloud_info消息，点云和数组由调用者按需填充
+inline void frameInfoToMsg(const CloudFrame& frame, rolo::CloudInfoStamp& msg)
+{
+    msg.header = frame.header;
+    msg.initialGuessX = frame.initialGuessX;
+    msg.initialGuessY = frame.initialGuessY;
+    msg.initialGuessZ = frame.initialGuessZ;
+    msg.initialGuessRoll = frame.initialGuessRoll;
+    msg.initialGuessPitch = frame.initialGuessPitch;
+    msg.initialGuessYaw = frame.initialGuessYaw;
+    msg.odomAvailable = frame.odomAvailable;
+}
+
+//! 模块的输入队列和处理线程
+//! 订阅回调或上游模块只负责入队，处理线程按队列策略逐帧取出处理；队列状态每秒发布到rolo/queue/<name>
+template<typename T>
+class StageQueue
+{
+public:
+    typedef std::function<void(const T&)> Consumer;
+
+    StageQueue(ros::NodeHandle& nh, const std::string& queueName, int capacity, QueuePolicy policy, const Consumer& consumer)
+    : name(queueName), ring(std::max(capacity, 1), policy), process(consumer), running(true)
+    {
+        pubStats = nh.advertise<std_msgs::Float64MultiArray>("rolo/queue/" + name, 1);
+        worker = std::thread(&StageQueue::run, this);
+    }
+
+    ~StageQueue()
+    {
+        running = false;
+        ring.close();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    //! 返回false表示有帧被丢弃（DROP_NEWEST策略下为item本身）
+    bool push(const T& item)
+    {
+        if (ring.push(item))
+            return true;
+        ROS_WARN_THROTTLE(1.0, "%s queue is full, %lu frames dropped so far.", name.c_str(), (unsigned long)ring.stats().dropped);
+        return false;
+    }
+
+    FrameRingStats stats() const { return ring.stats(); }
+
+private:
+    void run()
+    {
+        T item;
+        ros::WallTime lastStatsTime = ros::WallTime::now();
+        while (running && ros::ok())
+        {
+            if (ring.waitPop(item, std::chrono::milliseconds(100)))
+            {
+                process(item);
+                item = T(); // 处理完立即释放对帧的引用
+            }
+            ros::WallTime now = ros::WallTime::now();
+            if ((now - lastStatsTime).toSec() >= 1.0)
+            {
+                lastStatsTime = now;
+                publishStats();
+            }
+        }
+    }
+
+    //! data: [capacity, occupancy, high_water, pushed, popped, dropped]
+    void publishStats()
+    {
+        if (pubStats.getNumSubscribers() == 0)
+            return;
+        FrameRingStats queueStats = ring.stats();
+        std_msgs::Float64MultiArray msg;
+        msg.layout.dim.resize(1);
+        msg.layout.dim[0].label = "capacity,occupancy,high_water,pushed,popped,dropped";
+        msg.layout.dim[0].size = 6;
+        msg.layout.dim[0].stride = 6;
+        msg.data = {double(queueStats.capacity), double(queueStats.occupancy), double(queueStats.highWater),
+                    double(queueStats.pushed), double(queueStats.popped), double(queueStats.dropped)};
+        pubStats.publish(msg);
+    }
+
+    std::string name;
+    FrameRing<T> ring;
+    Consumer process;
+    std::atomic<bool> running;
+    std::thread worker;
+    ros::Publisher pubStats;
+};
+
+//! 流水线中的一个处理模块
+//! 单独运行时通过rolo/cloud_info话题收发数据；在rolo_pipeline中由上游直接调用pushFrame，
+//! 输出交给frameSink，不再发布cloud_info。两种方式下输入帧都先进入模块自己的StageQueue
+class PipelineStage
+{
+public:
+    virtual ~PipelineStage() {}
+
+    //! 接收上游模块的一帧数据，只入队，不在调用者线程中处理
+    virtual void pushFrame(const CloudFrameConstPtr& frame) {}
+
+    //! 设置下游模块，设置后输出不再经过ROS话题
+    void setFrameSink(const FrameSink& sink) { frameSink = sink; }
+
+    //! 启动和结束模块自带的线程
+    virtual void startThreads() {}
+    virtual void stopThreads() {}
+
+protected:
+    FrameSink frameSink;
+
+    bool hasFrameSink() const { return static_cast<bool>(frameSink); }
+};
+
+typedef std::shared_ptr<PipelineStage> PipelineStagePtr;
+
+// 各模块的构造函数，intraProcess为true时不订阅rolo/cloud_info，只通过pushFrame接收数据
+PipelineStagePtr createImageProjection();
+PipelineStagePtr createFeatureExtraction(bool intraProcess);
+PipelineStagePtr createLidarOdometry(bool intraProcess);
+PipelineStagePtr createBackMapping(bool intraProcess);
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,280 @@
+#pragma once
+#ifndef _ROLO_POINT_ADAPTERS_H_
+#define _ROLO_POINT_ADAPTERS_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+
+#include "rolo/rangeProjection.h"
+
+namespace rolo
+{
+
+// 各激光雷达驱动的点格式。字段类型在编译期确定，字段偏移在收到某个话题的第一帧时解析一次，
+// 之后直接从PointCloud2的字节流读取到PointSoA，不经过中间的PCL点云。
+// 消息中的字段类型与预期不一致时（例如不同版本的驱动），退回按datatype逐字段转换的通用路径。
+
+//! velodyne_pointcloud：time为相对帧头的秒数，ring 0为最下方的线
+struct VelodyneTraits
+{
+    typedef float IntensityType;
+    typedef uint16_t RingType;
+    typedef float TimeType;
+    static const char* name() { return "velodyne"; }
+    static const char* ringField() { return "ring"; }
+    static const char* timeField() { return "time"; }
+    static double timeScale() { return 1.0; }
+    enum { kAbsoluteTime = 0, kRingDescending = 0, kRingIsBeam = 1 };
+};
+
+//! ouster_ros：t为相对帧头的纳秒数，ring 0为最上方的线
+struct OusterTraits
+{
+    typedef float IntensityType;
+    typedef uint8_t RingType;
+    typedef uint32_t TimeType;
+    static const char* name() { return "ouster"; }
+    static const char* ringField() { return "ring"; }
+    static const char* timeField() { return "t"; }
+    static double timeScale() { return 1e-9; }
+    enum { kAbsoluteTime = 0, kRingDescending = 1, kRingIsBeam = 1 };
+};
+
+//! livox_ros_driver2的PointXYZRTLT：timestamp为绝对时间（纳秒），line为发射器编号而不是扫瞄线，行号按俯仰角确定
+struct LivoxTraits
+{
+    typedef float IntensityType;
+    typedef uint8_t RingType;
+    typedef double TimeType;
+    static const char* name() { return "livox"; }
+    static const char* ringField() { return "line"; }
+    static const char* timeField() { return "timestamp"; }
+    static double timeScale() { return 1e-9; }
+    enum { kAbsoluteTime = 1, kRingDescending = 0, kRingIsBeam = 0 };
+};
+
+//! Hesai驱动：timestamp为绝对时间（秒），ring 0为最上方的线
+struct HesaiTraits
+{
+    typedef float IntensityType;
+    typedef uint16_t RingType;
+    typedef double TimeType;
+    static const char* name() { return "hesai"; }
+    static const char* ringField() { return "ring"; }
+    static const char* timeField() { return "timestamp"; }
+    static double timeScale() { return 1.0; }
+    enum { kAbsoluteTime = 1, kRingDescending = 1, kRingIsBeam = 1 };
+};
+
+//! 字段在点中的字节偏移和类型，offset为-1表示消息中没有该字段
+struct FieldSlot
+{
+    int offset = -1;
+    uint8_t datatype = 0;
+    bool valid() const { return offset >= 0; }
+};
+
+//! 一个话题的点格式，由第一帧的fields解析
+struct PointLayout
+{
+    FieldSlot x, y, z, intensity, ring, time;
+    uint32_t pointStep = 0;
+    size_t fieldCount = 0;
+    bool typed = false;     // 字段类型与Traits一致，可以走编译期类型的快速路径
+
+    bool hasRing() const { return ring.valid(); }
+    bool hasTime() const { return time.valid(); }
+};
+
+namespace detail
+{
+
+template<typename T> struct FieldType;
+template<> struct FieldType<int8_t>   { enum { value = sensor_msgs::PointField::INT8 }; };
+template<> struct FieldType<uint8_t>  { enum { value = sensor_msgs::PointField::UINT8 }; };
+template<> struct FieldType<int16_t>  { enum { value = sensor_msgs::PointField::INT16 }; };
+template<> struct FieldType<uint16_t> { enum { value = sensor_msgs::PointField::UINT16 }; };
+template<> struct FieldType<int32_t>  { enum { value = sensor_msgs::PointField::INT32 }; };
+template<> struct FieldType<uint32_t> { enum { value = sensor_msgs::PointField::UINT32 }; };
+template<> struct FieldType<float>    { enum { value = sensor_msgs::PointField::FLOAT32 }; };
+template<> struct FieldType<double>   { enum { value = sensor_msgs::PointField::FLOAT64 }; };
+
+template<typename T>
+inline T loadField(const uint8_t* p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+//! 按datatype读取任意类型的字段
+inline double loadField(const uint8_t* p, uint8_t datatype)
+{
+    switch (datatype)
+    {
+        case sensor_msgs::PointField::INT8:    return loadField<int8_t>(p);
+        case sensor_msgs::PointField::UINT8:   return loadField<uint8_t>(p);
+        case sensor_msgs::PointField::INT16:   return loadField<int16_t>(p);
+        case sensor_msgs::PointField::UINT16:  return loadField<uint16_t>(p);
+        case sensor_msgs::PointField::INT32:   return loadField<int32_t>(p);
+        case sensor_msgs::PointField::UINT32:  return loadField<uint32_t>(p);
+        case sensor_msgs::PointField::FLOAT32: return loadField<float>(p);
+        case sensor_msgs::PointField::FLOAT64: return loadField<double>(p);
+        default:                               return 0.0;
+    }
+}
+
+template<typename T>
+inline bool slotIs(const FieldSlot& slot)
+{
+    return !slot.valid() || slot.datatype == FieldType<T>::value;
+}
+
+} // namespace detail
+
+//! 把某种驱动的PointCloud2直接转换为PointSoA：time为相对帧头的秒数，丢弃坐标非有限的点
+template<class Traits>
+class PointAdapter
+{
+public:
+    //! fields与上一帧不同时重新解析，返回true表示本帧重新解析了格式
+    bool resolve(const sensor_msgs::PointCloud2& msg)
+    {
+        if (layout_.fieldCount == msg.fields.size() && layout_.pointStep == msg.point_step)
+            return false;
+        layout_ = PointLayout();
+        layout_.pointStep = msg.point_step;
+        layout_.fieldCount = msg.fields.size();
+        for (const sensor_msgs::PointField& field : msg.fields)
+        {
+            FieldSlot slot;
+            slot.offset = field.offset;
+            slot.datatype = field.datatype;
+            if (field.name == "x") layout_.x = slot;
+            else if (field.name == "y") layout_.y = slot;
+            else if (field.name == "z") layout_.z = slot;
+            else if (field.name == "intensity") layout_.intensity = slot;
+            else if (field.name == Traits::ringField()) layout_.ring = slot;
+            else if (field.name == Traits::timeField()) layout_.time = slot;
+        }
+        layout_.typed = detail::slotIs<float>(layout_.x) && detail::slotIs<float>(layout_.y) && detail::slotIs<float>(layout_.z) &&
+                        detail::slotIs<typename Traits::IntensityType>(layout_.intensity) &&
+                        detail::slotIs<typename Traits::RingType>(layout_.ring) &&
+                        detail::slotIs<typename Traits::TimeType>(layout_.time);
+        return true;
+    }
+
+    const PointLayout& layout() const { return layout_; }
+    //! ring字段是否为扫瞄线编号，可以直接作为距离图像的行
+    bool ringIsBeam() const { return Traits::kRingIsBeam && layout_.hasRing(); }
+    bool ringDescending() const { return Traits::kRingDescending; }
+    const char* name() const { return Traits::name(); }
+
+    //! 转换一帧点云，msg缺少x/y/z字段时返回false
+    bool convert(const sensor_msgs::PointCloud2& msg, PointSoA& points)
+    {
+        resolve(msg);
+        if (!layout_.x.valid() || !layout_.y.valid() || !layout_.z.valid())
+            return false;
+        points.resize((size_t)msg.width * msg.height);
+        const double stamp = Traits::kAbsoluteTime ? msg.header.stamp.toSec() : 0.0;
+        size_t n = layout_.typed ? convertTyped(msg, stamp, points) : convertGeneric(msg, stamp, points);
+        points.resize(n);
+        return true;
+    }
+
+private:
+    //! 字段类型与Traits一致：按编译期类型读取
+    size_t convertTyped(const sensor_msgs::PointCloud2& msg, double stamp, PointSoA& points) const
+    {
+        const PointLayout& L = layout_;
+        const double scale = Traits::timeScale();
+        size_t n = 0;
+        for (uint32_t row = 0; row < msg.height; ++row)
+        {
+            const uint8_t* p = msg.data.data() + (size_t)row * msg.row_step;
+            for (uint32_t col = 0; col < msg.width; ++col, p += L.pointStep)
+            {
+                float x = detail::loadField<float>(p + L.x.offset);
+                float y = detail::loadField<float>(p + L.y.offset);
+                float z = detail::loadField<float>(p + L.z.offset);
+                if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+                    continue;
+                points.x[n] = x;
+                points.y[n] = y;
+                points.z[n] = z;
+                points.intensity[n] = L.intensity.valid() ? (float)detail::loadField<typename Traits::IntensityType>(p + L.intensity.offset) : 0.0f;
+                points.ring[n] = L.ring.valid() ? (float)detail::loadField<typename Traits::RingType>(p + L.ring.offset) : 0.0f;
+                points.time[n] = L.time.valid() ? (float)(detail::loadField<typename Traits::TimeType>(p + L.time.offset) * scale - stamp) : 0.0f;
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    //! 字段类型与预期不同：按datatype逐字段转换
+    size_t convertGeneric(const sensor_msgs::PointCloud2& msg, double stamp, PointSoA& points) const
+    {
+        const PointLayout& L = layout_;
+        const double scale = Traits::timeScale();
+        size_t n = 0;
+        for (uint32_t row = 0; row < msg.height; ++row)
+        {
+            const uint8_t* p = msg.data.data() + (size_t)row * msg.row_step;
+            for (uint32_t col = 0; col < msg.width; ++col, p += L.pointStep)
+            {
+                float x = (float)detail::loadField(p + L.x.offset, L.x.datatype);
+                float y = (float)detail::loadField(p + L.y.offset, L.y.datatype);
+                float z = (float)detail::loadField(p + L.z.offset, L.z.datatype);
+                if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+                    continue;
+                points.x[n] = x;
+                points.y[n] = y;
+                points.z[n] = z;
+                points.intensity[n] = L.intensity.valid() ? (float)detail::loadField(p + L.intensity.offset, L.intensity.datatype) : 0.0f;
+                points.ring[n] = L.ring.valid() ? (float)detail::loadField(p + L.ring.offset, L.ring.datatype) : 0.0f;
+                points.time[n] = L.time.valid() ? (float)(detail::loadField(p + L.time.offset, L.time.datatype) * scale - stamp) : 0.0f;
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    PointLayout layout_;
+};
+
+//! 运行时选择驱动的统一接口
+class CloudAdapter
+{
+public:
+    virtual ~CloudAdapter() {}
+    virtual bool convert(const sensor_msgs::PointCloud2& msg, PointSoA& points) = 0;
+    virtual const PointLayout& layout() const = 0;
+    virtual bool ringIsBeam() const = 0;
+    virtual bool ringDescending() const = 0;
+    virtual const char* name() const = 0;
+};
+
+template<class Traits>
+class CloudAdapterImpl : public CloudAdapter
+{
+public:
+    bool convert(const sensor_msgs::PointCloud2& msg, PointSoA& points) override { return adapter_.convert(msg, points); }
+    const PointLayout& layout() const override { return adapter_.layout(); }
+    bool ringIsBeam() const override { return adapter_.ringIsBeam(); }
+    bool ringDescending() const override { return adapter_.ringDescending(); }
+    const char* name() const override { return adapter_.name(); }
+
+private:
+    PointAdapter<Traits> adapter_;
+};
+
+} // namespace rolo
+
+#endif
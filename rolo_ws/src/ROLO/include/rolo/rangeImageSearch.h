@@ -0,0 +1,211 @@
+#pragma once
+#ifndef _ROLO_RANGE_IMAGE_SEARCH_H_
+#define _ROLO_RANGE_IMAGE_SEARCH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <pcl/point_cloud.h>
+
+#include <rot_gicp/gicp/neighbor_search.hpp>
+
+namespace rolo
+{
+
+//! 距离图像上的近邻搜索，代替KD树：点云中每个点带有ImageProjection给出的行列号，
+//! 查询点先投影到距离图像，只在以该像素为中心的窗口内按欧氏距离取k近邻。
+//! 建立索引为O(N)，每次查询只访问窗口内的像素
+template<typename PointT>
+class RangeImageSearch : public fast_gicp::NeighborSearch<PointT>
+{
+public:
+    typedef std::shared_ptr<RangeImageSearch<PointT>> Ptr;
+    typedef typename pcl::PointCloud<PointT>::ConstPtr CloudConstPtr;
+
+    RangeImageSearch(int rows, int cols) : rows_(rows), cols_(cols) {}
+
+    //! 搜索窗口为(2*rowRadius+1) x (2*colRadius+1)个像素
+    void setWindow(int rowRadius, int colRadius)
+    {
+        rowRadius_ = std::max(rowRadius, 0);
+        colRadius_ = std::max(colRadius, 0);
+    }
+
+    //! 邻域点到查询点的最大距离，0表示不限制
+    void setMaxDistance(float distance) { maxSqDistance_ = distance > 0 ? distance * distance : 0.0f; }
+
+    //! 查询点坐标系到图像坐标系的变换，默认为单位阵。knn返回的邻域点变换回查询点坐标系
+    void setQueryTransform(const Eigen::Isometry3f& imageFromQuery)
+    {
+        imageFromQuery_ = imageFromQuery;
+        queryFromImage_ = imageFromQuery.inverse();
+        identity_ = imageFromQuery.matrix().isIdentity();
+    }
+
+    //! cloud中第i个点位于距离图像的第row[i]行、第col[i]列，同一像素只能有一个点
+    void setInputCloud(const CloudConstPtr& cloud, const std::vector<int32_t>& row, const std::vector<int32_t>& col)
+    {
+        cloud_ = cloud;
+        pixels_.assign((size_t)rows_ * cols_, -1);
+
+        // 每行的平均sin(俯仰角)，用于把查询点映射到行
+        std::vector<double> rowSum(rows_, 0.0);
+        std::vector<int> rowCount(rows_, 0);
+        for (size_t i = 0; i < cloud->size(); ++i)
+        {
+            int r = row[i], c = col[i];
+            if (r < 0 || r >= rows_ || c < 0 || c >= cols_)
+                continue;
+            pixels_[r * cols_ + c] = i;
+            const PointT& p = cloud->points[i];
+            float range = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            if (range > 0)
+            {
+                rowSum[r] += p.z / range;
+                ++rowCount[r];
+            }
+        }
+        rowKeys_.clear();
+        for (int r = 0; r < rows_; ++r)
+            if (rowCount[r] > 0)
+                rowKeys_.emplace_back(float(rowSum[r] / rowCount[r]), r);
+        std::sort(rowKeys_.begin(), rowKeys_.end());
+    }
+
+    const CloudConstPtr& getInputCloud() const { return cloud_; }
+
+    //! 图像坐标系下的点p所在的像素，图像为空时返回false。列号与ImageProjection的展开方式一致
+    bool project(const Eigen::Vector3f& p, int& row, int& col) const
+    {
+        float range = p.norm();
+        if (rowKeys_.empty() || range <= 0)
+            return false;
+        std::pair<float, int> key(p.z() / range, -1);
+        auto it = std::lower_bound(rowKeys_.begin(), rowKeys_.end(), key);
+        if (it == rowKeys_.end() || (it != rowKeys_.begin() && key.first - std::prev(it)->first < it->first - key.first))
+            --it;
+        row = it->second;
+
+        float horizonAngle = std::atan2(p.x(), p.y()) * 180.0f / (float)M_PI;
+        col = -(int)std::round((horizonAngle - 90.0f) / (360.0f / cols_)) + cols_ / 2;
+        if (col >= cols_)
+            col -= cols_;
+        col = std::min(std::max(col, 0), cols_ - 1);
+        return true;
+    }
+
+    //! 图像坐标系下的k近邻，indices为输入点云中的索引，按距离从小到大排列，返回找到的个数。
+    //! indices和sqDistances直接作为前k个的插入排序缓冲区，调用方重复使用时不再分配内存
+    int nearestKSearch(const PointT& query, int k, std::vector<int>& indices, std::vector<float>& sqDistances) const
+    {
+        k = std::max(k, 0);
+        indices.resize(k);
+        sqDistances.resize(k);
+        int found = 0;
+        collect(Eigen::Vector3f(query.x, query.y, query.z), [&](float d2, int idx) {
+            if (found == k && (k == 0 || d2 >= sqDistances[k - 1]))
+                return;
+            int j = found < k ? found++ : k - 1;
+            for (; j > 0 && sqDistances[j - 1] > d2; --j)
+            {
+                sqDistances[j] = sqDistances[j - 1];
+                indices[j] = indices[j - 1];
+            }
+            sqDistances[j] = d2;
+            indices[j] = idx;
+        });
+        indices.resize(found);
+        sqDistances.resize(found);
+        return found;
+    }
+
+    //! neighbors（4 x k，由调用方按线程预分配）本身作为前k个的插入排序缓冲区：第4行暂存距离平方，最后改为1，
+    //! 每次查询不分配内存
+    int knn(const PointT& query, int k, Eigen::Matrix<double, 4, -1>& neighbors) const override
+    {
+        Eigen::Vector3f q(query.x, query.y, query.z);
+        if (!identity_)
+            q = imageFromQuery_ * q;
+
+        k = std::min<int>(k, neighbors.cols());
+        int found = 0;
+        collect(q, [&](float d2, int idx) {
+            if (found == k && (k == 0 || d2 >= neighbors(3, k - 1)))
+                return;
+            int j = found < k ? found++ : k - 1;
+            for (; j > 0 && neighbors(3, j - 1) > d2; --j)
+                neighbors.col(j) = neighbors.col(j - 1);
+            const PointT& p = cloud_->points[idx];
+            neighbors.col(j) << p.x, p.y, p.z, d2;
+        });
+        for (int j = 0; j < found; ++j)
+        {
+            if (!identity_)
+            {
+                Eigen::Vector3f n = queryFromImage_ * neighbors.col(j).template head<3>().template cast<float>();
+                neighbors.col(j).template head<3>() = n.cast<double>();
+            }
+            neighbors(3, j) = 1.0;
+        }
+        return found;
+    }
+
+private:
+    //! 对窗口内的每个点调用insert(距离平方, 点索引)，列方向首尾相接
+    template<typename Insert>
+    void collect(const Eigen::Vector3f& q, Insert&& insert) const
+    {
+        int row, col;
+        if (!cloud_ || !project(q, row, col))
+            return;
+        int rowBegin = std::max(row - rowRadius_, 0);
+        int rowEnd = std::min(row + rowRadius_, rows_ - 1);
+        for (int r = rowBegin; r <= rowEnd; ++r)
+        {
+            const int32_t* line = &pixels_[r * cols_];
+            for (int dc = -colRadius_; dc <= colRadius_; ++dc)
+            {
+                int c = col + dc;
+                if (c < 0)
+                    c += cols_;
+                else if (c >= cols_)
+                    c -= cols_;
+                int32_t idx = line[c];
+                if (idx < 0)
+                    continue;
+                const PointT& p = cloud_->points[idx];
+                float dx = p.x - q.x(), dy = p.y - q.y(), dz = p.z - q.z();
+                float d2 = dx * dx + dy * dy + dz * dz;
+                if (maxSqDistance_ > 0 && d2 > maxSqDistance_)
+                    continue;
+                insert(d2, idx);
+            }
+        }
+    }
+
+    int rows_;
+    int cols_;
+    int rowRadius_ = 2;
+    int colRadius_ = 5;
+    float maxSqDistance_ = 0.0f;
+
+    CloudConstPtr cloud_;
+    std::vector<int32_t> pixels_;                   // 像素到点索引，-1为空像素
+    std::vector<std::pair<float, int>> rowKeys_;    // (平均sin(俯仰角), 行号)，按俯仰角排序
+
+    // 不要求对齐，对象可以由std::make_shared创建
+    Eigen::Transform<float, 3, Eigen::Isometry, Eigen::DontAlign> imageFromQuery_ = Eigen::Isometry3f::Identity();
+    Eigen::Transform<float, 3, Eigen::Isometry, Eigen::DontAlign> queryFromImage_ = Eigen::Isometry3f::Identity();
+    bool identity_ = true;
+};
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,258 @@
+#pragma once
+#ifndef _ROLO_RANGE_PROJECTION_H_
+#define _ROLO_RANGE_PROJECTION_H_
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "rolo/beamTable.h"
+#include "rolo/simdOps.h"
+
+namespace rolo
+{
+
+//! 距离图像投影参数
+struct RangeProjectionParams
+{
+    int rows = 16;              // N_SCAN
+    int cols = 1800;            // Horizon_SCAN
+    int downsampleRate = 1;     // 只保留行号能被整除的扫瞄线
+    float minRange = 1.0f;
+    float maxRange = 1000.0f;
+};
+
+//! SoA格式的一帧点云，time为相对当前帧第一个点的时间，ring为驱动给出的扫瞄线编号
+struct PointSoA
+{
+    std::vector<float> x, y, z, intensity, time, ring;
+
+    void resize(size_t n)
+    {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        intensity.resize(n);
+        time.resize(n);
+        ring.resize(n);
+    }
+    size_t size() const { return x.size(); }
+};
+
+//! 去畸变变换表：将扫描时间等分为bins段，在bins+1个时刻预先计算把点变换到扫描开始时刻的刚体变换，
+//! 点按相对时间取最近的一个，而不是逐点构造变换。由deskew.h中的buildDeskewTable按位姿缓冲区填充
+class DeskewTable
+{
+public:
+    enum { kStride = 12 };  // 每个变换为3x4行优先矩阵[R | t]
+
+    void resize(int bins, float scanDuration)
+    {
+        bins_ = std::max(bins, 1);
+        float binTime = scanDuration / bins_;
+        invBinTime_ = binTime > 0 ? 1.0f / binTime : 0.0f;
+        transforms_.assign(kStride * (bins_ + 1), 0.0f);
+    }
+
+    //! 第b个时刻的变换，b在[0, bins]中
+    float* transform(int b) { return &transforms_[kStride * b]; }
+
+    //! 相对时间relTime处的变换
+    const float* transformAt(float relTime) const
+    {
+        int b = (int)(relTime * invBinTime_ + 0.5f);
+        b = std::min(std::max(b, 0), bins_);
+        return &transforms_[kStride * b];
+    }
+
+    const float* data() const { return transforms_.data(); }
+    int bins() const { return bins_; }
+    float invBinTime() const { return invBinTime_; }
+
+private:
+    std::vector<float> transforms_;
+    float invBinTime_ = 0.0f;
+    int bins_ = 0;
+};
+
+//! 计算每个点在距离图像中的像素索引row*cols+col和距离，无效点索引为-1，行号由beams查表得到
+//! 根据CPU在AVX2、SSE和标量实现中选择
+void computeProjectionIndices(const RangeProjectionParams& params, const BeamLookup& beams, const PointSoA& points,
+                              int32_t* index, float* range);
+
+//! 标量实现，同样使用多项式近似，用于对照测试
+void computeProjectionIndicesScalar(const RangeProjectionParams& params, const BeamLookup& beams, const PointSoA& points,
+                                    int32_t* index, float* range);
+
+//! 按点的相对时间查表去畸变，结果写入x, y, z，长度与points相同
+void computeDeskew(const DeskewTable& deskew, const PointSoA& points, float* x, float* y, float* z);
+
+//! 当前CPU是否使用AVX2实现
+bool projectionUsesAvx2();
+
+//! 距离图像投影：先向量化地计算所有点的像素索引和去畸变后的坐标，再按点的顺序写入图像（先到的点占据像素）
+class RangeProjector
+{
+public:
+    void setParams(const RangeProjectionParams& params) { params_ = params; }
+    const RangeProjectionParams& params() const { return params_; }
+
+    //! 扫瞄线标定表，决定点所在的行
+    void setBeamTable(const BeamTable& beams) { beams_ = beams; }
+    const BeamTable& beamTable() const { return beams_; }
+
+    //! rangeImage和fullCloud按行优先存储，长度为rows*cols；rangeImage中FLT_MAX表示空像素
+    //! deskew为空时不去畸变
+    template<typename PointT>
+    void project(const PointSoA& points, const DeskewTable* deskew, float* rangeImage, PointT* fullCloud)
+    {
+        int n = (int)points.size();
+        index_.resize(n);
+        range_.resize(n);
+        computeProjectionIndices(params_, beams_.lookup(), points, index_.data(), range_.data());
+
+        // 行列号按原始坐标计算，写入的坐标为去畸变后的坐标
+        const float* x = points.x.data();
+        const float* y = points.y.data();
+        const float* z = points.z.data();
+        if (deskew != nullptr)
+        {
+            deskewed_.x.resize(n);
+            deskewed_.y.resize(n);
+            deskewed_.z.resize(n);
+            computeDeskew(*deskew, points, deskewed_.x.data(), deskewed_.y.data(), deskewed_.z.data());
+            x = deskewed_.x.data();
+            y = deskewed_.y.data();
+            z = deskewed_.z.data();
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            int32_t idx = index_[i];
+            // 填充过的像素位置，不再填充新的值
+            if (idx < 0 || rangeImage[idx] != FLT_MAX)
+                continue;
+            rangeImage[idx] = range_[i];
+
+            PointT& po = fullCloud[idx];
+            po.x = x[i];
+            po.y = y[i];
+            po.z = z[i];
+            po.intensity = points.intensity[i];
+        }
+    }
+
+private:
+    RangeProjectionParams params_;
+    BeamTable beams_ = BeamTable::uniform(16, -15.0f, 2.0f);
+    std::vector<int32_t> index_;
+    std::vector<float> range_;
+    PointSoA deskewed_;     // 只使用x, y, z
+};
+
+namespace detail
+{
+
+//! 投影核函数，处理[begin, end)中完整的向量宽度部分，返回处理到的位置
+template<class O>
+inline int projectionIndicesKernel(const RangeProjectionParams& p, const BeamLookup& beams,
+                                   const float* x, const float* y, const float* z, const float* ring,
+                                   int begin, int end, int32_t* index, float* range)
+{
+    typedef typename O::V V;
+    const V radToDeg = O::set1(180.0f / (float)M_PI);
+    const V minRange = O::set1(p.minRange);
+    const V maxRange = O::set1(p.maxRange);
+    const V beamLo = O::set1(beams.lo);
+    const V beamInvStep = O::set1(beams.invStep);
+    const V one = O::set1(1.0f);
+    const V beamLast = O::set1((float)(beams.size - 1));
+    const V zero = O::set1(0.0f);
+    const V rows = O::set1((float)p.rows);
+    const V cols = O::set1((float)p.cols);
+    const V halfCols = O::set1((float)(p.cols / 2));
+    const V invColRes = O::set1((float)p.cols / 360.0f);
+    const V ninety = O::set1(90.0f);
+    const V downsample = O::set1((float)p.downsampleRate);
+    const V invDownsample = O::set1(1.0f / p.downsampleRate);
+    const V invalid = O::set1(-1.0f);
+
+    int i = begin;
+    for (; i + O::width <= end; i += O::width)
+    {
+        V px = O::load(x + i);
+        V py = O::load(y + i);
+        V pz = O::load(z + i);
+
+        V rxy2 = O::fmadd(px, px, O::mul(py, py));
+        V r = O::sqrt(O::fmadd(pz, pz, rxy2));
+        V valid = O::and_(O::ge(r, minRange), O::le(r, maxRange));
+
+        // 行索引：按sin(俯仰角)或ring查表，表首尾为-1，越界的点落在首尾
+        V key = beams.fromRing ? O::load(ring + i) : O::div(pz, O::max(r, O::set1(1e-6f)));
+        V slot = O::fmadd(O::sub(key, beamLo), beamInvStep, one);
+        slot = O::min(O::max(slot, zero), beamLast);
+        V row = O::gather(beams.table, slot);
+        valid = O::and_(valid, O::and_(O::ge(row, zero), O::lt(row, rows)));
+        if (p.downsampleRate > 1)
+            valid = O::and_(valid, O::eq(row, O::mul(O::trunc(O::mul(row, invDownsample)), downsample)));
+
+        // 列索引：以y轴负半轴为0展开的水平方位角
+        V horizonAngle = O::mul(simd::fastAtan2<O>(px, py), radToDeg);
+        V col = O::sub(halfCols, simd::roundAway<O>(O::mul(O::sub(horizonAngle, ninety), invColRes)));
+        col = O::select(O::ge(col, cols), O::sub(col, cols), col);
+        valid = O::and_(valid, O::and_(O::ge(col, zero), O::lt(col, cols)));
+
+        V idx = O::select(valid, O::fmadd(row, cols, col), invalid);
+        O::storeInt(index + i, idx);
+        O::store(range + i, r);
+    }
+    return i;
+}
+
+//! 去畸变核函数：按时间取变换表中最近的一项，p' = R * p + t
+template<class O>
+inline int deskewKernel(const float* table, int bins, float invBinTime, const float* time,
+                        const float* x, const float* y, const float* z, int begin, int end,
+                        float* ox, float* oy, float* oz)
+{
+    typedef typename O::V V;
+    const V half = O::set1(0.5f);
+    const V zero = O::set1(0.0f);
+    const V lastBin = O::set1((float)bins);
+    const V invBin = O::set1(invBinTime);
+    const V stride = O::set1((float)DeskewTable::kStride);
+
+    int i = begin;
+    for (; i + O::width <= end; i += O::width)
+    {
+        V b = O::trunc(O::fmadd(O::load(time + i), invBin, half));
+        b = O::min(O::max(b, zero), lastBin);
+        V base = O::mul(b, stride);
+        V px = O::load(x + i);
+        V py = O::load(y + i);
+        V pz = O::load(z + i);
+        V out[3];
+        for (int r = 0; r < 3; ++r)
+        {
+            const float* row = table + 4 * r;
+            V v = O::gather(row + 3, base);
+            v = O::fmadd(O::gather(row, base), px, v);
+            v = O::fmadd(O::gather(row + 1, base), py, v);
+            v = O::fmadd(O::gather(row + 2, base), pz, v);
+            out[r] = v;
+        }
+        O::store(ox + i, out[0]);
+        O::store(oy + i, out[1]);
+        O::store(oz + i, out[2]);
+    }
+    return i;
+}
+
+} // namespace detail
+
+} // namespace rolo
+
+#endif
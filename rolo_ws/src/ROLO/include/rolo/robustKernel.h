@@ -0,0 +1,45 @@
+#pragma once
+#ifndef _ROLO_ROBUST_KERNEL_H_
+#define _ROLO_ROBUST_KERNEL_H_
+
+#include <cmath>
+#include <string>
+
+namespace rolo
+{
+
+//! 后端scan-to-map求解的鲁棒核函数
+enum class RobustKernel { NONE, HUBER, CAUCHY };
+
+//! 解析参数中的鲁棒核字符串：none, huber, cauchy
+inline bool robustKernelFromString(const std::string& str, RobustKernel& kernel)
+{
+    if (str == "none")
+        kernel = RobustKernel::NONE;
+    else if (str == "huber")
+        kernel = RobustKernel::HUBER;
+    else if (str == "cauchy")
+        kernel = RobustKernel::CAUCHY;
+    else
+        return false;
+    return true;
+}
+
+//! 残差residual在迭代重加权最小二乘中的权重，delta为核函数的尺度（与残差同单位）
+inline double robustWeight(RobustKernel kernel, double residual, double delta)
+{
+    const double r = std::fabs(residual);
+    switch (kernel)
+    {
+    case RobustKernel::HUBER:
+        return r <= delta ? 1.0 : delta / r;
+    case RobustKernel::CAUCHY:
+        return 1.0 / (1.0 + (r / delta) * (r / delta));
+    default:
+        return 1.0;
+    }
+}
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+#ifndef _ROLO_SCAN_ASSOCIATION_H_
+#define _ROLO_SCAN_ASSOCIATION_H_
+
+#include <cmath>
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+#include <Eigen/Eigenvalues>
+
+namespace rolo
+{
+
+//! 后端点线、点面匹配中用近邻点拟合直线和平面，固定大小的Eigen矩阵，不分配内存，可以在OpenMP循环中逐点调用
+
+//! 用n个近邻点拟合直线：协方差矩阵的最大特征值超过次大特征值的3倍时视为线特征，返回true并给出中心点和单位方向。
+//! 3x3对称矩阵的特征分解用闭式解（computeDirect），代替迭代的cv::eigen
+inline bool fitLine(const Eigen::Vector3f* points, int n, Eigen::Vector3f& center, Eigen::Vector3f& direction)
+{
+    center.setZero();
+    for (int j = 0; j < n; j++)
+        center += points[j];
+    center /= n;
+
+    Eigen::Matrix3f covariance = Eigen::Matrix3f::Zero();
+    for (int j = 0; j < n; j++)
+    {
+        const Eigen::Vector3f d = points[j] - center;
+        covariance.noalias() += d * d.transpose();
+    }
+    covariance /= n;
+
+    // 特征值为升序
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> solver;
+    solver.computeDirect(covariance);
+    if (!(solver.eigenvalues()(2) > 3 * solver.eigenvalues()(1)))
+        return false;
+    direction = solver.eigenvectors().col(2);
+    return true;
+}
+
+//! 用n个近邻点拟合平面 a*x + b*y + c*z + d = 0（(a,b,c)为单位法向量）：最小二乘求解 [x y z] * X = -1，
+//! 所有点到平面的距离都不超过threshold时返回true。法方程 A^T*A*X = A^T*b 为3x3对称正定，用double的LDLT求解，
+//! 代替5x3的列主元QR；全局坐标较大时double保证法方程的精度
+inline bool fitPlane(const Eigen::Vector3f* points, int n, float threshold, Eigen::Vector4f& plane)
+{
+    Eigen::Matrix3d AtA = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d Atb = Eigen::Vector3d::Zero();
+    for (int j = 0; j < n; j++)
+    {
+        const Eigen::Vector3d p = points[j].cast<double>();
+        AtA.noalias() += p * p.transpose();
+        Atb -= p;
+    }
+    const Eigen::Vector3d X = AtA.ldlt().solve(Atb);
+    const double norm = X.norm();
+    if (!std::isfinite(norm) || norm == 0.0)
+        return false;
+    plane << (X / norm).cast<float>(), (float)(1.0 / norm);
+
+    // 检查平面是否合格，有点到平面的距离超过threshold说明这些点太分散，不构成平面
+    for (int j = 0; j < n; j++)
+    {
+        if (std::fabs(plane.head<3>().dot(points[j]) + plane(3)) > threshold)
+            return false;
+    }
+    return true;
+}
+
+} // namespace rolo
+
+#endif
@@ -0,0 +1,175 @@
+#pragma once
+#ifndef _ROLO_SIMD_OPS_H_
+#define _ROLO_SIMD_OPS_H_
+
+// 向量化核函数使用的最小运算集合。同一份核函数模板分别用ScalarOps、SseOps、Avx2Ops实例化：
+// SSE2是x86-64的基线指令集，可直接使用；AVX2版本只在以-mavx2 -mfma编译的源文件中可见，
+// 运行时根据CPU选择，避免整个工程开启AVX导致与PCL库的Eigen对齐方式不一致。
+// fmadd为先乘后加（两次舍入），各指令集的结果逐位一致；fma在有FMA指令时为融合乘加（一次舍入），结果可能相差最后一位，
+// 只用于不要求逐位一致的累加（配准的线性化）。
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace rolo
+{
+namespace simd
+{
+
+struct ScalarOps
+{
+    typedef float V;
+    static const int width = 1;
+
+    static V load(const float* p) { return *p; }
+    static void store(float* p, V a) { *p = a; }
+    static void storeInt(int32_t* p, V a) { *p = (int32_t)a; }
+    static V loadInt(const int32_t* p) { return (float)*p; }
+    static V set1(float v) { return v; }
+    static V gather(const float* table, V idx) { return table[(int32_t)idx]; }
+
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V fmadd(V a, V b, V c) { return a * b + c; }
+    static V fma(V a, V b, V c) { return a * b + c; }
+    static V sqrt(V a) { return std::sqrt(a); }
+    static V min(V a, V b) { return a < b ? a : b; }
+    static V max(V a, V b) { return a > b ? a : b; }
+    static V abs(V a) { return std::fabs(a); }
+    static V trunc(V a) { return (float)(int32_t)a; }
+    static V floor(V a) { return std::floor(a); }
+
+    // 比较结果作为掩码，标量版本用0/1表示
+    static V lt(V a, V b) { return a < b ? 1.f : 0.f; }
+    static V le(V a, V b) { return a <= b ? 1.f : 0.f; }
+    static V gt(V a, V b) { return a > b ? 1.f : 0.f; }
+    static V ge(V a, V b) { return a >= b ? 1.f : 0.f; }
+    static V eq(V a, V b) { return a == b ? 1.f : 0.f; }
+    static V and_(V a, V b) { return (a != 0.f && b != 0.f) ? 1.f : 0.f; }
+    static V select(V mask, V a, V b) { return mask != 0.f ? a : b; }
+};
+
+#if defined(__SSE2__)
+struct SseOps
+{
+    typedef __m128 V;
+    static const int width = 4;
+
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, V a) { _mm_storeu_ps(p, a); }
+    static void storeInt(int32_t* p, V a) { _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(a)); }
+    static V loadInt(const int32_t* p) { return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)p)); }
+    static V set1(float v) { return _mm_set1_ps(v); }
+    // SSE2没有gather指令，逐个读取
+    static V gather(const float* table, V idx)
+    {
+        alignas(16) int32_t i[4];
+        _mm_store_si128((__m128i*)i, _mm_cvttps_epi32(idx));
+        return _mm_setr_ps(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+    }
+
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V fmadd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    // SSE2没有融合乘加
+    static V fma(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static V sqrt(V a) { return _mm_sqrt_ps(a); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+    static V trunc(V a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a)); }
+    // SSE2没有floor指令，截断后对负数修正
+    static V floor(V a)
+    {
+        V t = trunc(a);
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.f)));
+    }
+
+    static V lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+    static V le(V a, V b) { return _mm_cmple_ps(a, b); }
+    static V gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+    static V ge(V a, V b) { return _mm_cmpge_ps(a, b); }
+    static V eq(V a, V b) { return _mm_cmpeq_ps(a, b); }
+    static V and_(V a, V b) { return _mm_and_ps(a, b); }
+    static V select(V mask, V a, V b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+};
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+struct Avx2Ops
+{
+    typedef __m256 V;
+    static const int width = 8;
+
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V a) { _mm256_storeu_ps(p, a); }
+    static void storeInt(int32_t* p, V a) { _mm256_storeu_si256((__m256i*)p, _mm256_cvttps_epi32(a)); }
+    static V loadInt(const int32_t* p) { return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)p)); }
+    static V set1(float v) { return _mm256_set1_ps(v); }
+    static V gather(const float* table, V idx) { return _mm256_i32gather_ps(table, _mm256_cvttps_epi32(idx), 4); }
+
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm256_div_ps(a, b); }
+    static V fmadd(V a, V b, V c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+    static V fma(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+    static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+    static V trunc(V a) { return _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+    static V floor(V a) { return _mm256_floor_ps(a); }
+
+    static V lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static V le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static V gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static V ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static V eq(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static V and_(V a, V b) { return _mm256_and_ps(a, b); }
+    static V select(V mask, V a, V b) { return _mm256_blendv_ps(b, a, mask); }
+};
+#endif
+
+//! 多项式近似的atan2(y, x)，最大误差约1e-5 rad
+template<class O>
+inline typename O::V fastAtan2(typename O::V y, typename O::V x)
+{
+    typedef typename O::V V;
+    const V zero = O::set1(0.f);
+    V ax = O::abs(x);
+    V ay = O::abs(y);
+    V a = O::div(O::min(ax, ay), O::max(O::max(ax, ay), O::set1(1e-30f)));
+    V s = O::mul(a, a);
+    V r = O::fmadd(O::set1(-0.0464964749f), s, O::set1(0.15931422f));
+    r = O::fmadd(r, s, O::set1(-0.327622764f));
+    r = O::fmadd(O::mul(r, s), a, a);
+    r = O::select(O::gt(ay, ax), O::sub(O::set1(1.57079637f), r), r);
+    r = O::select(O::lt(x, zero), O::sub(O::set1(3.14159274f), r), r);
+    r = O::select(O::lt(y, zero), O::sub(zero, r), r);
+    return r;
+}
+
+//! 四舍五入，.5时远离0，与std::round一致
+template<class O>
+inline typename O::V roundAway(typename O::V a)
+{
+    typename O::V r = O::floor(O::add(O::abs(a), O::set1(0.5f)));
+    return O::select(O::lt(a, O::set1(0.f)), O::sub(O::set1(0.f), r), r);
+}
+
+} // namespace simd
+} // namespace rolo
+
+#endif
@@ -58,13 +58,15 @@
 #include <thread>
 #include <mutex>
 #include "rolo/CloudInfoStamp.h"
+#include "rolo/frameRing.h"
+#include "rolo/robustKernel.h"
 #include <opencv2/opencv.hpp>
 #include <eigen3/Eigen/Dense>
 using namespace std;
 
 typedef pcl::PointXYZI PointType;
 
-enum class lidarType { VELODYNE, OUSTER };
+enum class lidarType { VELODYNE, OUSTER, LIVOX, HESAI };
 
 class ParamLoader
 {
@@ -95,6 +97,8 @@ public:
     int downsampleRate;
     float lidarMinRange;
     float lidarMaxRange;
+    std::string beamAngleFile;    // 各扫瞄线俯仰角标定文件，相对路径以beamDirectory为根
+    std::string beamDirectory;
     float lidarNoiseBound;
     bool deskewEnabled;
 
@@ -104,26 +108,59 @@ public:
     int edgeFeatureMinValidNum;
     int surfFeatureMinValidNum;
 
+    // Ground segmentation
+    int groundScanInd;          // 距离图像最下方参与地面判断的扫瞄线数，0表示不做地面分割
+    float groundDegreeThre;     // 地面点之间的最大坡度，度
+    float sensorMountAngle;     // 雷达安装俯仰角，度
+
     // voxel filter paprams
     float odometrySurfLeafSize;
+    float odometryGroundLeafSize;
     float mappingCornerLeafSize;
     float mappingSurfLeafSize ;
+    float mappingGroundLeafSize;
 
     float z_tollerance; 
     float rotation_tollerance;
 
     // CPU Params
     int numberOfCores;
-    double mappingProcessInterval;
+    double mappingProcessInterval;        // 后端处理两帧的最小间隔（s）
+    double mappingMaxInterval;            // 负载过高时处理间隔的上限（s）
+    double mappingTargetLoad;             // 扫描匹配线程允许占用的时间比例，耗时超过时拉长处理间隔
+
+    // Frame queues between modules
+    int frameQueueCapacity;
+    rolo::QueuePolicy frameQueuePolicy;
+    int cloudHoldBack; // 原始点云延后处理的帧数
 
     // Scan Registration
     float CT_lambda;
+    bool rangeImageCovariance; // 在距离图像上搜索近邻估计协方差，代替KD树
+    int odometryThreads;            // 配准工作线程数（含调用线程），0为odometryCores的个数，odometryCores也为空时为全部核
+    vector<int> odometryCores;      // 配准工作线程绑定的CPU编号，为空时不绑定
+    float covarianceVoxelSize; // >0时由同一体素内的点的散布矩阵估计协方差，代替KD树近邻（距离图像不可用时）
+    vector<double> voxelPyramidResolutions; // 由粗到细的体素分辨率，为空时只在1 m分辨率上配准
+    vector<int> voxelPyramidIterations;     // 各层的最大迭代次数
+    bool jointRegistration;               // 旋转和平移联合求解，代替旋转配准+平移配准两步
+    int correspondenceUpdateInterval;     // 配准时每隔几次线性化重新建立一次对应关系
+    float correspondenceUpdateAngle;      // 位姿变化超过该角度（度）时提前重新建立对应关系
+    float correspondenceUpdateDistance;   // 位姿变化超过该距离（m）时提前重新建立对应关系
+    int localMapFrames;                   // 与最近几帧融合的局部体素地图配准，0为只与上一帧配准
+    float localMapRadius;                 // 局部地图中离当前位置超过该距离（m）的帧被删除，0为不限制
+    float degeneracyRatio;                // 海森矩阵特征值小于同块最大特征值的该倍数时为退化方向，修正量在该方向上被去掉，0为不检测
+    float minInlierRatio;                 // 第一次建立对应关系后匹配点比例低于该值时放弃配准，保留预测的运动，0为不放弃
 
     // Surrounding map
     float surroundingkeyframeAddingDistThreshold; 
     float surroundingkeyframeAddingAngleThreshold; 
     float surroundingKeyframeDensity;
     float surroundingKeyframeSearchRadius;
+    int keyframeCacheMemory;              // 变换到全局坐标系的关键帧点云缓存的内存上限（MB）
+    float keyframeCacheTolerance;         // 回环校正后关键帧位姿的平移变化（m）不超过该值时缓存仍有效
+    float keyframeCacheAngleTolerance;    // 同上，旋转变化（度）
+    rolo::RobustKernel mappingRobustKernel; // scan-to-map求解的鲁棒核函数
+    float mappingRobustDelta;             // 鲁棒核函数的尺度（m），加权后的点线、点面距离超过该值时降权
     
     // Loop closure
     bool  loopClosureEnableFlag; // 回环检测使能位
@@ -164,14 +201,18 @@ public:
         {
             sensor = lidarType::OUSTER;
         }
-        // else if (sensorStr == "livox")
-        // {
-        //     sensor = lidarType::LIVOX;
-        // }
+        else if (sensorStr == "livox")
+        {
+            sensor = lidarType::LIVOX;
+        }
+        else if (sensorStr == "hesai")
+        {
+            sensor = lidarType::HESAI;
+        }
         else
         {
             ROS_ERROR_STREAM(
-                "Invalid sensor type (must be either 'velodyne' or 'ouster' or 'livox'): " << sensorStr);
+                "Invalid sensor type (must be either 'velodyne' or 'ouster' or 'livox' or 'hesai'): " << sensorStr);
             ros::shutdown();
         }
 
@@ -180,6 +221,8 @@ public:
         nh.param<int>("rolo/downsampleRate", downsampleRate, 1);
         nh.param<float>("rolo/lidarMinRange", lidarMinRange, 1.0);
         nh.param<float>("rolo/lidarMaxRange", lidarMaxRange, 1000.0);
+        nh.param<std::string>("rolo/beamAngleFile", beamAngleFile, "");
+        nh.param<std::string>("rolo/beamDirectory", beamDirectory, "");
         nh.param<float>("rolo/lidarNoiseBound", lidarNoiseBound, 0.05);
         nh.param<bool>("rolo/deskewEnabled", deskewEnabled, true);
 
@@ -188,22 +231,79 @@ public:
         nh.param<int>("rolo/edgeFeatureMinValidNum", edgeFeatureMinValidNum, 10);
         nh.param<int>("rolo/surfFeatureMinValidNum", surfFeatureMinValidNum, 100);
 
+        nh.param<int>("rolo/groundScanInd", groundScanInd, 0);
+        nh.param<float>("rolo/groundDegreeThre", groundDegreeThre, 10.0);
+        nh.param<float>("rolo/sensorMountAngle", sensorMountAngle, 0.0);
+
         nh.param<float>("rolo/odometrySurfLeafSize", odometrySurfLeafSize, 0.2);
+        nh.param<float>("rolo/odometryGroundLeafSize", odometryGroundLeafSize, 0.4);
         nh.param<float>("rolo/mappingCornerLeafSize", mappingCornerLeafSize, 0.2);
         nh.param<float>("rolo/mappingSurfLeafSize", mappingSurfLeafSize, 0.2);
+        nh.param<float>("rolo/mappingGroundLeafSize", mappingGroundLeafSize, 0.4);
 
         nh.param<float>("rolo/z_tollerance", z_tollerance, FLT_MAX);
         nh.param<float>("rolo/rotation_tollerance", rotation_tollerance, FLT_MAX);
 
         nh.param<int>("rolo/numberOfCores", numberOfCores, 2);
+        if (numberOfCores < 1)
+        {
+            // 后端按线程号索引预分配的缓冲区，线程数至少为1
+            ROS_WARN("rolo/numberOfCores must be at least 1, got %d, using 1", numberOfCores);
+            numberOfCores = 1;
+        }
         nh.param<double>("rolo/mappingProcessInterval", mappingProcessInterval, 0.15);
+        nh.param<double>("rolo/mappingMaxInterval", mappingMaxInterval, 1.0);
+        nh.param<double>("rolo/mappingTargetLoad", mappingTargetLoad, 0.9);
+
+        nh.param<int>("rolo/frameQueueCapacity", frameQueueCapacity, 2);
+        std::string queuePolicyStr;
+        nh.param<std::string>("rolo/frameQueuePolicy", queuePolicyStr, "drop_oldest");
+        if (!rolo::queuePolicyFromString(queuePolicyStr, frameQueuePolicy))
+        {
+            ROS_ERROR_STREAM(
+                "Invalid frame queue policy (must be either 'drop_oldest' or 'drop_newest' or 'block'): " << queuePolicyStr);
+            ros::shutdown();
+        }
+        nh.param<int>("rolo/cloudHoldBack", cloudHoldBack, 0);
 
         nh.param<float>("rolo/continuousTrajectoryWeight", CT_lambda, 1.0);
+        nh.param<bool>("rolo/rangeImageCovariance", rangeImageCovariance, false);
+        nh.param<float>("rolo/covarianceVoxelSize", covarianceVoxelSize, 0.0);
+        nh.param<int>("rolo/odometryThreads", odometryThreads, 0);
+        nh.param<vector<int>>("rolo/odometryCores", odometryCores, vector<int>());
+        nh.param<vector<double>>("rolo/voxelPyramidResolutions", voxelPyramidResolutions, vector<double>());
+        nh.param<vector<int>>("rolo/voxelPyramidIterations", voxelPyramidIterations, vector<int>());
+        nh.param<bool>("rolo/jointRegistration", jointRegistration, false);
+        nh.param<int>("rolo/correspondenceUpdateInterval", correspondenceUpdateInterval, 1);
+        nh.param<float>("rolo/correspondenceUpdateAngle", correspondenceUpdateAngle, 0.5);
+        nh.param<float>("rolo/correspondenceUpdateDistance", correspondenceUpdateDistance, 0.1);
+        nh.param<int>("rolo/localMapFrames", localMapFrames, 0);
+        nh.param<float>("rolo/localMapRadius", localMapRadius, 30.0);
+        nh.param<float>("rolo/degeneracyRatio", degeneracyRatio, 0.0);
+        nh.param<float>("rolo/minInlierRatio", minInlierRatio, 0.0);
         
         nh.param<float>("rolo/surroundingkeyframeAddingDistThreshold", surroundingkeyframeAddingDistThreshold, 1.0);
         nh.param<float>("rolo/surroundingkeyframeAddingAngleThreshold", surroundingkeyframeAddingAngleThreshold, 0.2);
         nh.param<float>("rolo/surroundingKeyframeDensity", surroundingKeyframeDensity, 1.0);
         nh.param<float>("rolo/surroundingKeyframeSearchRadius", surroundingKeyframeSearchRadius, 50.0);
+        nh.param<int>("rolo/keyframeCacheMemory", keyframeCacheMemory, 512);
+        nh.param<float>("rolo/keyframeCacheTolerance", keyframeCacheTolerance, 0.01);
+        nh.param<float>("rolo/keyframeCacheAngleTolerance", keyframeCacheAngleTolerance, 0.05);
+        std::string robustKernelStr;
+        nh.param<std::string>("rolo/mappingRobustKernel", robustKernelStr, "none");
+        if (!rolo::robustKernelFromString(robustKernelStr, mappingRobustKernel))
+        {
+            ROS_ERROR_STREAM(
+                "Invalid mapping robust kernel (must be either 'none' or 'huber' or 'cauchy'): " << robustKernelStr);
+            ros::shutdown();
+        }
+        nh.param<float>("rolo/mappingRobustDelta", mappingRobustDelta, 0.1);
+        if (mappingRobustKernel != rolo::RobustKernel::NONE && !(mappingRobustDelta > 0))
+        {
+            ROS_ERROR_STREAM("Invalid mapping robust delta (must be positive with kernel '" << robustKernelStr
+                             << "'): " << mappingRobustDelta);
+            ros::shutdown();
+        }
 
         nh.param<bool>("rolo/loopClosureEnableFlag", loopClosureEnableFlag, true);
         nh.param<float>("rolo/loopClosureFrequency", loopClosureFrequency, 1.0);
@@ -239,23 +339,23 @@ double GET_ROS_TIMESTAMP(T msg)
     return msg->header.stamp.toSec();
 }
 
-double radTodeg(double radians)
+inline double radTodeg(double radians)
 {
   return radians * 180.0 / M_PI;
 }
 
-double degTorad(double degrees)
+inline double degTorad(double degrees)
 {
   return degrees * M_PI / 180.0;
 }
 
-float pointDistance(PointType p)
+inline float pointDistance(PointType p)
 {
     return sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
 }
 
 
-float pointDistance(PointType p1, PointType p2)
+inline float pointDistance(PointType p1, PointType p2)
 {
     return sqrt((p1.x-p2.x)*(p1.x-p2.x) + (p1.y-p2.y)*(p1.y-p2.y) + (p1.z-p2.z)*(p1.z-p2.z));
 }
@@ -0,0 +1,130 @@
+#ifndef FAST_GICP_COVARIANCE_ESTIMATION_HPP
+#define FAST_GICP_COVARIANCE_ESTIMATION_HPP
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <pcl/point_cloud.h>
+
+#include <rot_gicp/gicp/gicp_settings.hpp>
+#include <rot_gicp/gicp/vmp_voxel.hpp>
+#include <rot_gicp/gicp/worker_pool.hpp>
+
+namespace fast_gicp {
+
+/**
+ * @brief Scatter of a neighborhood accumulated in fixed-size storage. Points are added relative to an anchor close to
+ *        the neighborhood (e.g. the query point) so that the single pass does not cancel large coordinates.
+ */
+struct ScatterAccumulator {
+  ScatterAccumulator() : n(0) {
+    sum.setZero();
+    sum_outer.setZero();
+  }
+
+  void add(const Eigen::Vector3d& d) {
+    n++;
+    sum += d;
+    sum_outer += d * d.transpose();
+  }
+
+  //! covariance of the added points (divided by n)
+  Eigen::Matrix3d covariance() const {
+    const Eigen::Vector3d mean = sum / n;
+    return sum_outer / n - mean * mean.transpose();
+  }
+
+  int n;
+  Eigen::Vector3d sum;
+  Eigen::Matrix3d sum_outer;
+};
+
+/**
+ * @brief Regularize a 3x3 point covariance. Same results as regularizing with the SVD of cov (U * values * V^T) for a
+ *        symmetric positive semi-definite cov, but computed with the closed-form 3x3 symmetric eigen solver.
+ */
+inline Eigen::Matrix4d regularize_point_covariance(const Eigen::Matrix3d& cov, RegularizationMethod method) {
+  Eigen::Matrix4d regularized = Eigen::Matrix4d::Zero();
+  if (method == RegularizationMethod::NONE) {
+    regularized.block<3, 3>(0, 0) = cov;
+    return regularized;
+  }
+  if (method == RegularizationMethod::FROBENIUS) {
+    double lambda = 1e-3;
+    Eigen::Matrix3d C = cov + lambda * Eigen::Matrix3d::Identity();
+    Eigen::Matrix3d C_inv = C.inverse();
+    regularized.block<3, 3>(0, 0) = (C_inv / C_inv.norm()).inverse();
+    return regularized;
+  }
+
+  // 特征值升序，翻转为与奇异值相同的降序
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eig;
+  eig.computeDirect(cov);
+  const Eigen::Vector3d eigenvalues = eig.eigenvalues().reverse().cwiseMax(0.0);
+  const Eigen::Matrix3d U = eig.eigenvectors().rowwise().reverse();
+  Eigen::Vector3d values;
+
+  switch (method) {
+    default:
+      std::cerr << "here must not be reached" << std::endl;
+      abort();
+    case RegularizationMethod::PLANE:
+      values = Eigen::Vector3d(1, 1, 1e-3);
+      break;
+    case RegularizationMethod::MIN_EIG:
+      values = eigenvalues.array().max(1e-3);
+      break;
+    case RegularizationMethod::NORMALIZED_MIN_EIG:
+      values = eigenvalues / eigenvalues.maxCoeff();
+      values = values.array().max(1e-3);
+      break;
+    case RegularizationMethod::PLANE_S:
+      values = eigenvalues / eigenvalues.sum();
+      values(2) = 1e-3;
+  }
+
+  regularized.block<3, 3>(0, 0) = U * values.asDiagonal() * U.transpose();
+  return regularized;
+}
+
+/**
+ * @brief Point covariances from the scatter of the points that share a voxel of the given size, instead of the k nearest
+ *        neighbors: one hash pass over the cloud and no KdTree. Points in voxels with fewer than 3 points get an
+ *        isotropic covariance, as with too few neighbors. voxels is scratch storage that keeps its capacity across calls.
+ */
+template <typename PointT>
+void estimate_voxel_covariances(const pcl::PointCloud<PointT>& cloud, RegularizationMethod method, VmfVoxelMap<PointT>& voxels,
+                                std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covariances, WorkerPool& pool) {
+  // 体素只累加点和以体素角点为原点的外积，散布矩阵由其减去均值的外积得到
+  voxels.clear();
+  for (int i = 0; i < (int)cloud.size(); i++) {
+    const Eigen::Vector4d point = cloud.at(i).getVector4fMap().template cast<double>();
+    const Eigen::Vector4d d = point - voxels.voxel_origin(voxels.voxel_coord(point));
+    Eigen::Matrix4d outer = Eigen::Matrix4d::Zero();
+    outer.block<3, 3>(0, 0) = d.head<3>() * d.head<3>().transpose();
+    voxels.insert(point, outer);
+  }
+  voxels.finalize();
+
+  covariances.resize(cloud.size());
+  pool.parallel_for((int)cloud.size(), 256, [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const VmfVoxel* voxel = voxels.lookup_voxel(voxels.voxel_coord(cloud.at(i).getVector4fMap().template cast<double>()));
+      if (voxel->num_points < 3) {
+        covariances[i].setZero();
+        covariances[i].template block<3, 3>(0, 0) = Eigen::Matrix3d::Identity();
+        continue;
+      }
+      const Eigen::Vector3d mean = (voxel->mean_dir - voxels.voxel_origin(voxel->coord)).template head<3>();
+      const Eigen::Matrix3d scatter = voxel->cov.template block<3, 3>(0, 0) - mean * mean.transpose();
+      covariances[i] = regularize_point_covariance(scatter, method);
+    }
+  });
+}
+
+}  // namespace fast_gicp
+
+#endif
@@ -10,6 +10,7 @@ LsqRegistration<PointTarget, PointSource>::LsqRegistration() {
   this->reg_name_ = "LsqRegistration";
   max_iterations_ = 64;
   rotation_epsilon_ = 2e-3;
+  epsilon_scale_ = 1.0;
   transformation_epsilon_ = 5e-4;
 
   // lsq_optimizer_type_ = LSQ_OPTIMIZER_TYPE::LevenbergMarquardt;
@@ -21,6 +22,15 @@ LsqRegistration<PointTarget, PointSource>::LsqRegistration() {
 
   final_hessian_.setIdentity();
   so3_final_hessian_.setIdentity();
+  t3_final_hessian_.setIdentity();
+  degeneracy_ratio_ = 0.0;
+  min_inlier_ratio_ = 0.0;
+
+  correspondence_update_interval_ = 1;
+  correspondence_rotation_threshold_ = 0.0;
+  correspondence_translation_threshold_ = 0.0;
+  correspondence_age_ = -1;
+  correspondence_pose_.setIdentity();
 }
 
 template <typename PointTarget, typename PointSource>
@@ -41,11 +51,78 @@ void LsqRegistration<PointTarget, PointSource>::setDebugPrint(bool lm_debug_prin
   lm_debug_print_ = lm_debug_print;
 }
 
+template <typename PointTarget, typename PointSource>
+void LsqRegistration<PointTarget, PointSource>::setCorrespondenceUpdate(int interval, double rotation_threshold, double translation_threshold) {
+  correspondence_update_interval_ = std::max(interval, 1);
+  correspondence_rotation_threshold_ = rotation_threshold;
+  correspondence_translation_threshold_ = translation_threshold;
+}
+
+template <typename PointTarget, typename PointSource>
+void LsqRegistration<PointTarget, PointSource>::setDegeneracyThreshold(double ratio) {
+  degeneracy_ratio_ = ratio;
+}
+
+template <typename PointTarget, typename PointSource>
+void LsqRegistration<PointTarget, PointSource>::setMinInlierRatio(double ratio) {
+  min_inlier_ratio_ = ratio;
+}
+
+template <typename PointTarget, typename PointSource>
+void LsqRegistration<PointTarget, PointSource>::analyze_block(const Eigen::Matrix3d& H, Eigen::Vector3d& eigenvalues, Eigen::Matrix3d& eigenvectors, int shift) {
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eig;
+  eig.computeDirect(H);
+  eigenvalues = eig.eigenvalues();
+  eigenvectors = eig.eigenvectors();
+  result_.degenerate_mask &= ~(7 << shift);
+  // 特征值升序，与最大特征值之比小于阈值的方向为退化方向，阈值为0时不做检测
+  result_.degenerate_mask |= RegistrationResult::degenerate_axes(eigenvalues, degeneracy_ratio_) << shift;
+}
+
+template <typename PointTarget, typename PointSource>
+void LsqRegistration<PointTarget, PointSource>::finish_result(int iterations) {
+  result_.iterations = iterations;
+  result_.converged = converged_;
+  result_.inlier_ratio = inlier_ratio();
+  result_.has_rotation = true;
+  if (lsq_optimizer_type_ == LSQ_OPTIMIZER_TYPE::SO3_LevenbergMarquardt) {
+    result_.rotation_hessian = so3_final_hessian_;
+    result_.has_translation = false;
+  } else {
+    result_.rotation_hessian = final_hessian_.block<3, 3>(0, 0);
+    result_.translation_hessian = final_hessian_.block<3, 3>(3, 3);
+    result_.has_translation = true;
+    analyze_block(result_.translation_hessian, result_.translation_eigenvalues, result_.translation_eigenvectors, 3);
+  }
+  analyze_block(result_.rotation_hessian, result_.rotation_eigenvalues, result_.rotation_eigenvectors, 0);
+}
+
+template <typename PointTarget, typename PointSource>
+bool LsqRegistration<PointTarget, PointSource>::should_update_correspondences(const Eigen::Isometry3d& x) {
+  if (correspondence_age_ >= 0 && correspondence_age_ + 1 < correspondence_update_interval_) {
+    // 距上次建立对应关系的位姿变化不大时沿用原对应关系
+    const Eigen::Isometry3d moved = correspondence_pose_.inverse() * x;
+    if (Eigen::AngleAxisd(moved.linear()).angle() < correspondence_rotation_threshold_ &&
+        moved.translation().norm() < correspondence_translation_threshold_) {
+      correspondence_age_++;
+      return false;
+    }
+  }
+  correspondence_age_ = 0;
+  correspondence_pose_ = x;
+  return true;
+}
+
 template <typename PointTarget, typename PointSource>
 const Eigen::Matrix<double, 6, 6>& LsqRegistration<PointTarget, PointSource>::getFinalHessian() const {
   return final_hessian_;
 }
 
+template <typename PointTarget, typename PointSource>
+Eigen::Matrix<double, 6, 6> LsqRegistration<PointTarget, PointSource>::getFinalCovariance() const {
+  return final_hessian_.ldlt().solve(Eigen::Matrix<double, 6, 6>::Identity());
+}
+
 template <typename PointTarget, typename PointSource>
 double LsqRegistration<PointTarget, PointSource>::evaluateCost(const Eigen::Matrix4f& relative_pose, Eigen::Matrix<double, 6, 6>* H, Eigen::Matrix<double, 6, 1>* b) {
   return this->linearize(Eigen::Isometry3f(relative_pose).cast<double>(), H, b);
@@ -58,10 +135,13 @@ void LsqRegistration<PointTarget, PointSource>::computeTranslation(PointCloudSou
   // Eigen::Vector3d t0 = Eigen::Vector3d(trans.template cast<double>());
   Eigen::Vector3d t0 = trans;
   lm_lambda_ = -1.0;
+  timing_.reset();
   bool t_converged_ = false;
 
+  int iterations = 0;
   for (int i = 0; i < max_iterations_ && !t_converged_; i++) {
     nr_iterations_ = i;
+    iterations++;
     Eigen::Vector3d delta_t;  // delta是每次迭代的变化量（更新量），x0为最终要输出的变换，x0=Sigma(delta)
     if (!step_t_optimize(t0, delta_t, init_guess, last_t0, interval_tn, interval_tn_1)) {
       std::cerr << "lm not converged!!" << std::endl;
@@ -77,6 +157,11 @@ void LsqRegistration<PointTarget, PointSource>::computeTranslation(PointCloudSou
   final_translation.matrix().col(3).head<3>() = t0.cast<float>();
   pcl::transformPointCloud(*input_, output, final_translation);
   trans = t0;
+
+  result_.iterations += iterations;
+  result_.translation_hessian = t3_final_hessian_;
+  result_.has_translation = true;
+  analyze_block(result_.translation_hessian, result_.translation_eigenvalues, result_.translation_eigenvectors, 3);
 }
 
 //! 用LM算法求解CT平移优化
@@ -99,8 +184,10 @@ bool LsqRegistration<PointTarget, PointSource>::step_t_optimize(Eigen::Vector3d&
   double nu = 2.0;
   for (int i = 0; i < lm_max_iterations_; i++) {
     // 利用Cholesky分解来求解线性方程组，Ax = b
+    auto solve_start = std::chrono::steady_clock::now();
     Eigen::LDLT<Eigen::Matrix<double, 6, 6>> solver(H + lm_lambda_ * Eigen::Matrix<double, 6, 6>::Identity());
     Eigen::Matrix<double, 6, 1> d = solver.solve(-b);
+    timing_.solve_ms += elapsed_ms(solve_start);
     // Eigen::Vector3d d_v(d(0), d(1), d(2));
     Eigen::Isometry3d delt_t = se3_exp(d); // SE3转换，得到deltT
     delta = delt_t.translation();
@@ -121,6 +208,7 @@ bool LsqRegistration<PointTarget, PointSource>::step_t_optimize(Eigen::Vector3d&
 
     if (rho < 0) {
       if (is_t_converged(delta)) {
+        t3_final_hessian_ = H.block<3, 3>(3, 3); // 在最终的x0处线性化
         return true;  // 判断是否收敛
       }
 
@@ -131,7 +219,7 @@ bool LsqRegistration<PointTarget, PointSource>::step_t_optimize(Eigen::Vector3d&
     // 方向不对，则减小步长，类似于GN
     x0 = xi;
     lm_lambda_ = lm_lambda_ * std::max(1.0 / 3.0, 1 - std::pow(2 * rho - 1, 3));
-    // so3_final_hessian_ = H; // 存储最新的海森矩阵
+    t3_final_hessian_ = H.block<3, 3>(3, 3); // 存储最新的海森矩阵
     return true;
   }
 
@@ -152,8 +240,7 @@ template <typename PointTarget, typename PointSource>
 void LsqRegistration<PointTarget, PointSource>::computeTransformation(PointCloudSource& output, const Matrix4& guess) {
   Eigen::Isometry3d x0 = Eigen::Isometry3d(guess.template cast<double>());
   // std::cout << "x00: " << x0.matrix() << std::endl;
-  lm_lambda_ = -1.0;
-  converged_ = false;
+  timing_.reset();
   
   if (lm_debug_print_) {
     std::cout << "********************************************" << std::endl;
@@ -161,8 +248,26 @@ void LsqRegistration<PointTarget, PointSource>::computeTransformation(PointCloud
     std::cout << "********************************************" << std::endl;
   }
 
-  for (int i = 0; i < max_iterations_ && !converged_; i++) {
+  result_.reset();
+  finish_result(optimize(x0, max_iterations_, 1.0));
+  // std::cout << "Optimized over!!" << std::endl;
+
+  final_transformation_ = x0.cast<float>().matrix();
+  pcl::transformPointCloud(*input_, output, final_transformation_);
+}
+
+template <typename PointTarget, typename PointSource>
+int LsqRegistration<PointTarget, PointSource>::optimize(Eigen::Isometry3d& x0, int max_iterations, double epsilon_scale) {
+  lm_lambda_ = -1.0;
+  converged_ = false;
+  epsilon_scale_ = epsilon_scale;
+  invalidate_correspondences();
+
+  const Eigen::Isometry3d guess = x0;
+  int iterations = 0;
+  for (int i = 0; i < max_iterations && !converged_; i++) {
     nr_iterations_ = i;
+    iterations++;
     // Isometry3d是指的一次欧式变换，[R | t]_{4*4}
     Eigen::Isometry3d delta;  // delta是每次迭代的变化量（更新量），x0为最终要输出的变换，x0=Sigma(delta)
     if (!step_optimize(x0, delta)) {
@@ -170,12 +275,23 @@ void LsqRegistration<PointTarget, PointSource>::computeTransformation(PointCloud
       break;
     }
 
+    // 第一次建立对应关系后，匹配上的点太少则放弃这一帧，不再继续迭代
+    if (i == 0 && inlier_ratio() < min_inlier_ratio_) {
+      x0 = guess;
+      result_.rejected = true;
+      break;
+    }
+
     converged_ = is_converged(delta);
+    // 沿用旧对应关系时收敛的只是旧对应关系下的最优解，重新建立对应关系后继续迭代
+    if (converged_ && correspondence_age_ > 0) {
+      invalidate_correspondences();
+      converged_ = false;
+    }
   }
-  // std::cout << "Optimized over!!" << std::endl;
 
-  final_transformation_ = x0.cast<float>().matrix();
-  pcl::transformPointCloud(*input_, output, final_transformation_);
+  epsilon_scale_ = 1.0;
+  return iterations;
 }
 //! 判断收敛，依据是，求出的变换矩阵变化幅度很小-->收敛
 template <typename PointTarget, typename PointSource>
@@ -184,8 +300,8 @@ bool LsqRegistration<PointTarget, PointSource>::is_converged(const Eigen::Isomet
   Eigen::Matrix3d R = delta.linear() - Eigen::Matrix3d::Identity();
   Eigen::Vector3d t = delta.translation();
 
-  Eigen::Matrix3d r_delta = 1.0 / rotation_epsilon_ * R.array().abs();
-  Eigen::Vector3d t_delta = 1.0 / transformation_epsilon_ * t.array().abs();
+  Eigen::Matrix3d r_delta = 1.0 / (epsilon_scale_ * rotation_epsilon_) * R.array().abs();
+  Eigen::Vector3d t_delta = 1.0 / (epsilon_scale_ * transformation_epsilon_) * t.array().abs();
 
   return std::max(r_delta.maxCoeff(), t_delta.maxCoeff()) < 1;
 }
@@ -199,6 +315,8 @@ bool LsqRegistration<PointTarget, PointSource>::step_optimize(Eigen::Isometry3d&
       return step_gn(x0, delta);
     case LSQ_OPTIMIZER_TYPE::SO3_LevenbergMarquardt:
       return rot_step_lm(x0, delta);
+    case LSQ_OPTIMIZER_TYPE::CT_LevenbergMarquardt:
+      return step_lm(x0, delta);  // 平移先验由linearize/compute_error加入
   }
 
   return step_lm(x0, delta);
@@ -210,8 +328,10 @@ bool LsqRegistration<PointTarget, PointSource>::step_gn(Eigen::Isometry3d& x0, E
   Eigen::Matrix<double, 6, 1> b;
   double y0 = linearize(x0, &H, &b);
 
+  auto solve_start = std::chrono::steady_clock::now();
   Eigen::LDLT<Eigen::Matrix<double, 6, 6>> solver(H);
   Eigen::Matrix<double, 6, 1> d = solver.solve(-b);
+  timing_.solve_ms += elapsed_ms(solve_start);
 
   delta = se3_exp(d);
 
@@ -233,8 +353,10 @@ bool LsqRegistration<PointTarget, PointSource>::step_lm(Eigen::Isometry3d& x0, E
   double nu = 2.0;
   for (int i = 0; i < lm_max_iterations_; i++) {
     // 利用Cholesky分解来求解线性方程组，Ax = b
+    auto solve_start = std::chrono::steady_clock::now();
     Eigen::LDLT<Eigen::Matrix<double, 6, 6>> solver(H + lm_lambda_ * Eigen::Matrix<double, 6, 6>::Identity());
     Eigen::Matrix<double, 6, 1> d = solver.solve(-b);
+    timing_.solve_ms += elapsed_ms(solve_start);
 
     delta = se3_exp(d); // SE3转换，得到deltT
 
@@ -252,6 +374,7 @@ bool LsqRegistration<PointTarget, PointSource>::step_lm(Eigen::Isometry3d& x0, E
 
     if (rho < 0) {
       if (is_converged(delta)) {
+        final_hessian_ = H; // 在最终的x0处线性化
         return true;  // 判断是否收敛
       }
 
@@ -285,8 +408,10 @@ bool LsqRegistration<PointTarget, PointSource>::rot_step_lm(Eigen::Isometry3d& x
   double nu = 2.0;
   for (int i = 0; i < lm_max_iterations_; i++) {
     // 利用Cholesky分解来求解线性方程组，Ax = b
+    auto solve_start = std::chrono::steady_clock::now();
     Eigen::LDLT<Eigen::Matrix<double, 3, 3>> solver(H + lm_lambda_ * Eigen::Matrix<double, 3, 3>::Identity());
     Eigen::Matrix<double, 3, 1> d = solver.solve(-b);
+    timing_.solve_ms += elapsed_ms(solve_start);
     // Eigen::Vector3d d_v(d(0), d(1), d(2));
     Eigen::Quaterniond q_delta = so3_exp(d); // 转换到SO3
     delta.setIdentity();
@@ -306,6 +431,7 @@ bool LsqRegistration<PointTarget, PointSource>::rot_step_lm(Eigen::Isometry3d& x
 
     if (rho < 0) {
       if (is_rot_converged(delta)) {
+        so3_final_hessian_ = H; // 在最终的x0处线性化
         return true;  // 判断是否收敛
       }
 
@@ -329,7 +455,7 @@ bool LsqRegistration<PointTarget, PointSource>::is_rot_converged(const Eigen::Is
   double accum = 0.0;
   Eigen::Matrix3d R = delta.linear() - Eigen::Matrix3d::Identity();
 
-  Eigen::Matrix3d r_delta = 1.0 / rotation_epsilon_ * R.array().abs();
+  Eigen::Matrix3d r_delta = 1.0 / (epsilon_scale_ * rotation_epsilon_) * R.array().abs();
 
   return r_delta.maxCoeff() < 1;
 }
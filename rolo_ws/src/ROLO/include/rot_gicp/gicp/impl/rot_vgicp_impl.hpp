@@ -2,6 +2,7 @@
 #define ROT_VGICP_IMPL_HPP
 
 #include <atomic>
+#include <thread>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
@@ -16,24 +17,42 @@
 
 namespace fast_gicp {
 
+//! 由核函数的累加量恢复6x6海森矩阵和偏置，旋转在前、平移在后
+inline void unpack_linearize_sums(const double* sums, Eigen::Matrix<double, 6, 6>& H, Eigen::Matrix<double, 6, 1>& b) {
+  const int upper[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      H(r, c) = sums[SUM_H_RR + upper[r][c]];
+      H(r, 3 + c) = sums[SUM_H_RT + 3 * r + c];
+      H(3 + c, r) = sums[SUM_H_RT + 3 * r + c];
+      H(3 + r, 3 + c) = sums[SUM_H_TT + upper[r][c]];
+    }
+    b(r) = sums[SUM_G_R + r];
+    b(3 + r) = sums[SUM_G_T + r];
+  }
+}
+
 template <typename PointSource, typename PointTarget>
 RotVGICP<PointSource, PointTarget>::RotVGICP() : LsqRegistration<PointSource, PointTarget>() {
-#ifdef _OPENMP
-  num_threads_ = omp_get_max_threads();
-#else
-  num_threads_ = 1;
-#endif
+  num_threads_ = std::max(1, (int)std::thread::hardware_concurrency());
 
   this->reg_name_ = "RotVGICP";
   k_correspondences_ = 20;
 
   regularization_method_ = RegularizationMethod::PLANE;
+  covariance_voxel_size_ = 0.0;
   search_source_.reset(new SearchMethodSource);
   search_target_.reset(new SearchMethodTarget);
   voxel_resolution_ = 1.0;
   lambda_ = 1.0;
+  ct_init_guess_.setZero();
+  ct_interval_ = 0.1;
   search_method_ = NeighborSearchMethod::DIRECT1;
   voxel_mode_ = VoxelAccumulationMode::ADDITIVE;
+  level_ = 0;
+  voxelmap_valid_ = false;
+  target_from_map_.setIdentity();
+  matched_points_ = 0;
 }
 
 template <typename PointSource, typename PointTarget>
@@ -42,6 +61,7 @@ RotVGICP<PointSource, PointTarget>::~RotVGICP() {}
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::setResolution(double resolution) {
   voxel_resolution_ = resolution;
+  voxelmap_valid_ = false;
 }
 
 template <typename PointSource, typename PointTarget>
@@ -49,30 +69,63 @@ void RotVGICP<PointSource, PointTarget>::setNeighborSearchMethod(NeighborSearchM
   search_method_ = method;
 }
 
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::setVoxelPyramid(const std::vector<VoxelPyramidLevel>& levels) {
+  pyramid_ = levels;
+  level_ = 0;
+  voxelmap_valid_ = false;
+}
+
+template <typename PointSource, typename PointTarget>
+VoxelPyramidLevel RotVGICP<PointSource, PointTarget>::level(int index) const {
+  if (pyramid_.empty()) {
+    return VoxelPyramidLevel{voxel_resolution_, search_method_, 0};
+  }
+  return pyramid_[index];
+}
+
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::setVoxelAccumulationMode(VoxelAccumulationMode mode) {
   voxel_mode_ = mode;
+  voxelmaps_.clear();
+  voxelmap_valid_ = false;
 }
 
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::swapSourceAndTarget() {
   input_.swap(target_);
   search_source_.swap(search_target_);
+  source_neighbor_search_.swap(target_neighbor_search_);
   source_covs_.swap(target_covs_);
-  voxelmap_.reset();
+  voxelmap_valid_ = false;
   voxel_correspondences_.clear();
-  voxel_mahalanobis_.clear();
+  correspondence_buffer_.resize(0);
+  this->invalidate_correspondences();
 }
 
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::setNumThreads(int n) {
-  num_threads_ = n;
+  num_threads_ = n > 0 ? n : std::max(1, (int)std::thread::hardware_concurrency());
+  // 线程数不同或是外部给定的池时，下次使用时重新建立
+  if (pool_ && (pool_->num_workers() != num_threads_ || pool_.use_count() > 1)) {
+    pool_.reset();
+  }
+}
+
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::setWorkerPool(const std::shared_ptr<WorkerPool>& pool) {
+  pool_ = pool;
+  if (pool_) {
+    num_threads_ = pool_->num_workers();
+  }
+}
 
-#ifdef _OPENMP
-  if (n == 0) {
-    num_threads_ = omp_get_max_threads();
+template <typename PointSource, typename PointTarget>
+WorkerPool& RotVGICP<PointSource, PointTarget>::pool() {
+  if (!pool_) {
+    pool_ = std::make_shared<WorkerPool>(num_threads_);
   }
-#endif
+  return *pool_;
 }
 
 template <typename PointSource, typename PointTarget>
@@ -85,16 +138,26 @@ void RotVGICP<PointSource, PointTarget>::setRegularizationMethod(RegularizationM
   regularization_method_ = method;
 }
 
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::setCovarianceVoxelSize(double size) {
+  covariance_voxel_size_ = size;
+}
+
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::clearSource() {
   input_.reset();
   source_covs_.clear();
+  source_neighbor_search_.reset();
 }
 
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::clearTarget() {
   target_.reset();
   target_covs_.clear();
+  target_neighbor_search_.reset();
+  target_voxelmaps_.clear();
+  target_from_map_.setIdentity();
+  voxelmap_valid_ = false;
 }
 
 template <typename PointSource, typename PointTarget>
@@ -103,11 +166,67 @@ void RotVGICP<PointSource, PointTarget>::setInputSource(const PointCloudSourceCo
     return;
   }
 
+  // KdTree is built lazily in calculate_covariances, skipped when covariances or a neighbor search backend are given
   pcl::Registration<PointSource, PointTarget, Scalar>::setInputSource(cloud);
-  search_source_->setInputCloud(cloud);
   source_covs_.clear();
 }
 
+template <typename PointSource, typename PointTarget>
+bool RotVGICP<PointSource, PointTarget>::reuseTargetAsSource(const PointCloudSourceConstPtr& cloud, const Eigen::Isometry3d& transform) {
+  if (!target_ || !cloud || cloud->size() != target_->size() || target_covs_.size() != target_->size()) {
+    return false;
+  }
+
+  pcl::Registration<PointSource, PointTarget, Scalar>::setInputSource(cloud);
+  source_neighbor_search_.reset();
+  source_covs_.swap(target_covs_);
+  // 点云刚体变换后近邻不变，协方差只需旋转：R * C * R^T
+  const Eigen::Matrix3d R = transform.linear();
+  pool().parallel_for(source_covs_.size(), 1024, [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      source_covs_[i].template block<3, 3>(0, 0) = R * source_covs_[i].template block<3, 3>(0, 0) * R.transpose();
+    }
+  });
+
+  target_.reset();
+  target_covs_.clear();
+  target_neighbor_search_.reset();
+  voxelmap_valid_ = false;
+  return true;
+}
+
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::setTargetVoxelMaps(const std::vector<std::shared_ptr<const VmfVoxelMap<PointTarget>>>& maps,
+                                                            const Eigen::Isometry3d& target_from_map) {
+  if (maps.empty()) {
+    clearTarget();
+    return;
+  }
+
+  if (placeholder_target_ == nullptr) {
+    PointCloudTargetPtr placeholder(new PointCloudTarget);
+    placeholder->push_back(PointTarget());
+    placeholder_target_ = placeholder;
+  }
+  // 目标点云只为满足align()的检查，不变时pcl不会重建其KdTree
+  if (target_ != placeholder_target_) {
+    pcl::Registration<PointSource, PointTarget, Scalar>::setInputTarget(placeholder_target_);
+  }
+  target_covs_.clear();
+  target_neighbor_search_.reset();
+  target_voxelmaps_ = maps;
+  target_from_map_ = target_from_map;
+  voxelmap_valid_ = false;
+}
+
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::calculateSourceCovariances() {
+  if (!input_ || source_covs_.size() == input_->size()) {
+    return;
+  }
+  estimate_covariances(input_, source_neighbor_search_, *search_source_, source_scatter_voxels_, source_covs_);
+}
+
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::setSourceCovariances(const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covs) {
   source_covs_ = covs;
@@ -116,6 +235,20 @@ void RotVGICP<PointSource, PointTarget>::setSourceCovariances(const std::vector<
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::setTargetCovariances(const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covs) {
   target_covs_ = covs;
+  voxelmap_valid_ = false;
+}
+
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::setSourceNeighborSearch(const typename NeighborSearch<PointSource>::ConstPtr& search) {
+  source_neighbor_search_ = search;
+  source_covs_.clear();
+}
+
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::setTargetNeighborSearch(const typename NeighborSearch<PointTarget>::ConstPtr& search) {
+  target_neighbor_search_ = search;
+  target_covs_.clear();
+  voxelmap_valid_ = false;
 }
 
 template <typename PointSource, typename PointTarget>
@@ -125,28 +258,54 @@ void RotVGICP<PointSource, PointTarget>::setInputTarget(const PointCloudTargetCo
   }
 
   pcl::Registration<PointSource, PointTarget, Scalar>::setInputTarget(cloud);
-  search_target_->setInputCloud(cloud);
   target_covs_.clear();
+  target_voxelmaps_.clear();
+  target_from_map_.setIdentity();
 
-  voxelmap_.reset();
+  voxelmap_valid_ = false;
 }
 
 template <typename PointSource, typename PointTarget>
 void RotVGICP<PointSource, PointTarget>::computeTransformation(PointCloudSource& output, const Matrix4& guess) {
-  voxelmap_.reset();
   // std::cout << "guess: " << guess.matrix() << std::endl;
 
   if (output.points.data() == input_->points.data() || output.points.data() == target_->points.data()) {
     throw std::invalid_argument("RotVGICP: destination cloud cannot be identical to source or target");
   }
-  if (source_covs_.size() != input_->size()) {
-    calculate_covariances(input_, *search_source_, source_covs_);
+  calculateSourceCovariances();
+  if (!target_voxelmaps_.empty()) {
+    if ((int)target_voxelmaps_.size() != num_levels()) {
+      throw std::invalid_argument("RotVGICP: the number of target voxel maps differs from the pyramid levels");
+    }
+  } else if (target_covs_.size() != target_->size()) {
+    estimate_covariances(target_, target_neighbor_search_, *search_target_, target_scatter_voxels_, target_covs_);
+    voxelmap_valid_ = false;
   }
-  if (target_covs_.size() != target_->size()) {
-    calculate_covariances(target_, *search_target_, target_covs_);
+
+  if (pyramid_.empty()) {
+    level_ = 0;
+    LsqRegistration<PointSource, PointTarget>::computeTransformation(output, guess);
+    return;
   }
 
-  LsqRegistration<PointSource, PointTarget>::computeTransformation(output, guess);
+  // 由粗到细逐层配准，上一层的结果作为下一层的初值；粗层的收敛阈值按分辨率放大，提前进入下一层
+  this->timing_.reset();
+  this->result_.reset();
+  Eigen::Isometry3d x0 = Eigen::Isometry3d(guess.template cast<double>());
+  const double finest = pyramid_.back().resolution;
+  int iterations = 0;
+  for (level_ = 0; level_ < (int)pyramid_.size() && !this->result_.rejected; level_++) {
+    const VoxelPyramidLevel& settings = pyramid_[level_];
+    const int max_iterations = settings.max_iterations > 0 ? settings.max_iterations : this->max_iterations_;
+    const double epsilon_scale = level_ + 1 < (int)pyramid_.size() ? 10.0 * settings.resolution / finest : 1.0;
+    iterations += this->optimize(x0, max_iterations, epsilon_scale);
+  }
+  level_ = pyramid_.size() - 1;
+  this->nr_iterations_ = iterations;
+  this->finish_result(iterations);
+
+  this->final_transformation_ = x0.cast<float>().matrix();
+  pcl::transformPointCloud(*input_, output, this->final_transformation_);
 }
 
 template <typename PointSource, typename PointTarget>
@@ -158,251 +317,265 @@ void RotVGICP<PointSource, PointTarget>::computeTranslation(PointCloudSource& ou
   // voxelmap_.reset();
 }
 
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::setTranslationPrior(const Eigen::Vector3d& init_guess, double interval_tn, float ct_lambda) {
+  ct_init_guess_ = init_guess;
+  ct_interval_ = interval_tn;
+  lambda_ = ct_lambda;
+}
+
 
 template <typename PointSource, typename PointTarget>
-void RotVGICP<PointSource, PointTarget>::update_correspondences(const Eigen::Isometry3d& trans) {
-  voxel_correspondences_.clear();
-  auto offsets = neighbor_offsets(search_method_);
-  // 多线程分块处理
-  std::vector<std::vector<std::pair<int, VmfVoxel::Ptr>>> corrs(num_threads_); // 第一维度是线程池
-  for (auto& c : corrs) {
-    c.reserve((input_->size() * offsets.size()) / num_threads_); // 预分配空间（元素数）
-  }
-
-#pragma omp parallel for num_threads(num_threads_) schedule(guided, 8)
-  for (int i = 0; i < input_->size(); i++) {
-    const Eigen::Vector4d mean_A = input_->at(i).getVector4fMap().template cast<double>();
-    Eigen::Vector4d transed_mean_A = trans * mean_A;
-    Eigen::Vector3i coord = voxelmap_->voxel_coord(transed_mean_A); // 取体素索引
-
-    for (const auto& offset : offsets) {
-      auto voxel = voxelmap_->lookup_voxel(coord + offset); // 寻找该点周围的体素
-      if (voxel != nullptr) {
-        corrs[omp_get_thread_num()].push_back(std::make_pair(i, voxel)); // 建立corrs对
-      }
-    }
+void RotVGICP<PointSource, PointTarget>::build_voxelmap() {
+  if (!target_voxelmaps_.empty()) {
+    // 外部维护的体素地图，目标点云不参与
+    voxelmap_valid_ = true;
+    this->invalidate_correspondences();
+    return;
   }
 
-  voxel_correspondences_.reserve(input_->size() * offsets.size());
-  for (const auto& c : corrs) { // 将correspondence逐一添加到voxel_correspondences_
-    voxel_correspondences_.insert(voxel_correspondences_.end(), c.begin(), c.end());
+  voxelmaps_.resize(num_levels());
+  for (int l = 0; l < num_levels(); l++) {
+    if (voxelmaps_[l] == nullptr || voxelmaps_[l]->resolution() != level(l).resolution) {
+      voxelmaps_[l].reset(new VmfVoxelMap<PointTarget>(level(l).resolution, voxel_mode_));
+    }
+    voxelmaps_[l]->clear();
   }
 
-  // precompute combined covariances
-  voxel_mahalanobis_.resize(voxel_correspondences_.size());
-
-#pragma omp parallel for num_threads(num_threads_) schedule(guided, 8)
-  for (int i = 0; i < voxel_correspondences_.size(); i++) {
-    const auto& corr = voxel_correspondences_[i]; // 点的pcl索引：voxel
-    const auto& cov_A = source_covs_[corr.first];
-    const auto& cov_B = corr.second->cov; // 取体素存储的协方差
-    // const auto& cov_B = corr.second->kappa; // 取体素存储的协方差
-    // std::cout << "cov_A: " << cov_A << std::endl;
-    // std::cout << "cov_B: " << cov_B << std::endl;
-    // std::cout << "num: " << corr.second->num_points << std::endl;
-
-    // 计算B+TAT^{T}
-    Eigen::Matrix4d RCR = cov_B + trans.matrix() * cov_A * trans.matrix().transpose();
-    RCR(3, 3) = 1.0;
-    // mahalanobis-马氏距离
-    voxel_mahalanobis_[i] = RCR.inverse();
-    voxel_mahalanobis_[i](3, 3) = 0.0;
-    // std::cout << "voxel_mahalanobis_: " << voxel_mahalanobis_[i] << std::endl;
+  // 各层在同一次遍历中插入，每个点只转换一次
+  for (int i = 0; i < target_->size(); i++) {
+    const Eigen::Vector4d point = target_->at(i).getVector4fMap().template cast<double>();
+    for (auto& voxelmap : voxelmaps_) {
+      voxelmap->insert(point, target_covs_[i]);
+    }
+  }
+  for (auto& voxelmap : voxelmaps_) {
+    voxelmap->finalize();
   }
+  voxelmap_valid_ = true;
+  this->invalidate_correspondences();
 }
 
 template <typename PointSource, typename PointTarget>
-double RotVGICP<PointSource, PointTarget>::linearize(const Eigen::Isometry3d& trans, Eigen::Matrix<double, 6, 6>* H, Eigen::Matrix<double, 6, 1>* b) {
-  // 若没有构建体素地图，先构建体素地图
-  if (voxelmap_ == nullptr) {
-    voxelmap_.reset(new VmfVoxelMap<PointTarget>(voxel_resolution_, voxel_mode_));
-    voxelmap_->create_voxelmap(*target_, target_covs_);
-  }
-
-  update_correspondences(trans); // 执行一次位姿更新后的correspondence
-  // 以下分别是总体误差，海森矩阵，偏置
-  double sum_errors = 0.0;
-  std::vector<Eigen::Matrix<double, 6, 6>, Eigen::aligned_allocator<Eigen::Matrix<double, 6, 6>>> Hs(num_threads_);
-  std::vector<Eigen::Matrix<double, 6, 1>, Eigen::aligned_allocator<Eigen::Matrix<double, 6, 1>>> bs(num_threads_);
-  for (int i = 0; i < num_threads_; i++) {
-    Hs[i].setZero();
-    bs[i].setZero();
+void RotVGICP<PointSource, PointTarget>::update_correspondences(const Eigen::Isometry3d& trans) {
+  auto start = std::chrono::steady_clock::now();
+  voxel_correspondences_.clear();
+  const VmfVoxelMap<PointTarget>& voxelmap = this->voxelmap(level_);
+  // 外部地图的体素坐标在地图坐标系下，查询点先变换到地图坐标系
+  const bool posed_map = !target_voxelmaps_.empty();
+  const Eigen::Isometry3d lookup_trans = posed_map ? target_from_map_.inverse() * trans : trans;
+  auto offsets = neighbor_offsets(level(level_).search_method);
+  // 源点分块处理，每块的对应关系写入各自的缓存，按块的顺序拼接，结果与线程数和调度无关
+  const int n = input_->size();
+  const int grain = 256;
+  const int chunks = (n + grain - 1) / grain;
+  if ((int)chunk_correspondences_.size() < chunks) {
+    chunk_correspondences_.resize(chunks);
   }
 
-#pragma omp parallel for num_threads(num_threads_) reduction(+ : sum_errors) schedule(guided, 8)
-  for (int i = 0; i < voxel_correspondences_.size(); i++) {
-    const auto& corr = voxel_correspondences_[i];
-    auto target_voxel = corr.second;
+  pool().parallel_for(n, grain, [&](int, int begin, int end) {
+    std::vector<VoxelCorrespondence>& corrs = chunk_correspondences_[begin / grain];
+    corrs.clear();
+    for (int i = begin; i < end; i++) {
+      const Eigen::Vector4d mean_A = input_->at(i).getVector4fMap().template cast<double>();
+      Eigen::Vector4d transed_mean_A = lookup_trans * mean_A;
+      Eigen::Vector3i coord = voxelmap.voxel_coord(transed_mean_A); // 取体素索引
+
+      for (const auto& offset : offsets) {
+        int voxel = voxelmap.lookup_index(coord + offset); // 寻找该点周围的体素
+        if (voxel >= 0) {
+          corrs.push_back(VoxelCorrespondence{(uint32_t)i, (uint32_t)voxel}); // 建立corrs对
+        }
+      }
+    }
+  });
 
-    const Eigen::Vector4d mean_A = input_->at(corr.first).getVector4fMap().template cast<double>();
-    const auto& cov_A = source_covs_[corr.first]; // 取协方差矩阵  
+  voxel_correspondences_.reserve(input_->size() * offsets.size());
+  for (int c = 0; c < chunks; c++) { // 将correspondence逐一添加到voxel_correspondences_
+    voxel_correspondences_.insert(voxel_correspondences_.end(), chunk_correspondences_[c].begin(), chunk_correspondences_[c].end());
+  }
+  // 对应关系按源点的顺序排列，统计至少有一个对应关系的源点数
+  matched_points_ = 0;
+  for (size_t i = 0; i < voxel_correspondences_.size(); i++) {
+    if (i == 0 || voxel_correspondences_[i].source != voxel_correspondences_[i - 1].source) {
+      matched_points_++;
+    }
+  }
 
-    const Eigen::Vector4d mean_B = corr.second->mean_dir; // 体素栅格内的均值和协方差
-    // const Eigen::Vector4d dir_B = mean_B.array().acos(); // 取方向余弦
-    const auto& cov_B = corr.second->cov;
+  // 预先计算单精度的对应关系：源点、当前位姿下的残差和乘以权重的马氏矩阵
+  correspondence_buffer_.resize(voxel_correspondences_.size());
+  double reference[12];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      reference[4 * r + c] = trans.matrix()(r, c);
+    }
+  }
+  correspondence_buffer_.setReferencePose(reference);
+  float* fields[CorrespondenceBuffer::kFields];
+  for (int f = 0; f < CorrespondenceBuffer::kFields; f++) {
+    fields[f] = correspondence_buffer_.field(f);
+  }
+  const Eigen::Matrix3d R = trans.linear();
+  const Eigen::Matrix3d R_map = target_from_map_.linear();
+
+  pool().parallel_for(voxel_correspondences_.size(), 256, [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const auto& corr = voxel_correspondences_[i]; // 点的pcl索引：体素索引
+      const VmfVoxel& target_voxel = voxelmap.voxel(corr.voxel);
+      const auto& point = input_->at(corr.source);
+      Eigen::Vector3d mean_B = target_voxel.mean_dir.template head<3>();
+      Eigen::Matrix3d cov_B = target_voxel.cov.template block<3, 3>(0, 0);
+      if (posed_map) {
+        mean_B = target_from_map_ * mean_B;
+        cov_B = R_map * cov_B * R_map.transpose();
+      }
+      const Eigen::Vector3d error = mean_B - trans * point.getVector3fMap().template cast<double>();
+
+      // 计算B+RAR^{T}，协方差的第4行和第4列为0，平移不影响结果，只需3x3部分
+      const Eigen::Matrix3d RCR = cov_B + R * source_covs_[corr.source].template block<3, 3>(0, 0) * R.transpose();
+      // mahalanobis-马氏距离，体素内点越多且越密集，权重越大
+      const Eigen::Matrix3d mahalanobis = std::sqrt((double)target_voxel.num_points) * RCR.inverse();
+
+      fields[CorrespondenceBuffer::AX][i] = point.x;
+      fields[CorrespondenceBuffer::AY][i] = point.y;
+      fields[CorrespondenceBuffer::AZ][i] = point.z;
+      fields[CorrespondenceBuffer::EX][i] = error.x();
+      fields[CorrespondenceBuffer::EY][i] = error.y();
+      fields[CorrespondenceBuffer::EZ][i] = error.z();
+      fields[CorrespondenceBuffer::M00][i] = mahalanobis(0, 0);
+      fields[CorrespondenceBuffer::M01][i] = mahalanobis(0, 1);
+      fields[CorrespondenceBuffer::M02][i] = mahalanobis(0, 2);
+      fields[CorrespondenceBuffer::M11][i] = mahalanobis(1, 1);
+      fields[CorrespondenceBuffer::M12][i] = mahalanobis(1, 2);
+      fields[CorrespondenceBuffer::M22][i] = mahalanobis(2, 2);
+    }
+  });
 
-    const Eigen::Vector4d transed_mean_A = trans * mean_A; // 变换点
-    // const Eigen::Vector4d dir_A = (transed_mean_A / transed_mean_A.norm()).array().acos();  // 取方向余弦
-    const Eigen::Vector4d error = mean_B - transed_mean_A; // 均值误差
+  this->timing_.association_ms += elapsed_ms(start);
+  this->timing_.associations++;
+}
 
-    double w = std::sqrt(target_voxel->num_points); // 体素内点越多且越密集，权重越大
-    sum_errors += w * error.transpose() * voxel_mahalanobis_[i] * error; // 残差计算
+template <typename PointSource, typename PointTarget>
+void RotVGICP<PointSource, PointTarget>::accumulate_correspondences(const Eigen::Isometry3d& trans, LinearizeMode mode, double* sums) {
+  auto start = std::chrono::steady_clock::now();
+  // 循环不变的变换只转换一次
+  double T[12];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      T[4 * r + c] = trans.matrix()(r, c);
+    }
+  }
 
-    if (H == nullptr || b == nullptr) {
-      continue;
+  // 按固定大小分块，每块累加到各自的和，再按块的顺序求和，结果与线程数和调度无关
+  const int n = correspondence_buffer_.size();
+  const int chunk = 1024;
+  const int chunks = (n + chunk - 1) / chunk;
+  chunk_sums_.resize((size_t)chunks * SUM_SIZE);
+
+  pool().parallel_for(n, chunk, [&](int, int begin, int end) {
+    double* chunk_sums = &chunk_sums_[(size_t)(begin / chunk) * SUM_SIZE];
+    std::fill(chunk_sums, chunk_sums + SUM_SIZE, 0.0);
+    linearizeCorrespondences(correspondence_buffer_, begin, end, T, mode, chunk_sums);
+  });
+
+  std::fill(sums, sums + SUM_SIZE, 0.0);
+  for (int c = 0; c < chunks; c++) {
+    for (int k = 0; k < SUM_SIZE; k++) {
+      sums[k] += chunk_sums_[(size_t)c * SUM_SIZE + k];
     }
-    // 利用李代数扰动模型，对位姿进行求导，得到雅可比矩阵
-    Eigen::Matrix<double, 4, 6> dtdx0 = Eigen::Matrix<double, 4, 6>::Zero();
-    dtdx0.block<3, 3>(0, 0) = skewd(transed_mean_A.head<3>());
-    dtdx0.block<3, 3>(0, 3) = -Eigen::Matrix3d::Identity();
+  }
+
+  this->timing_.linearization_ms += elapsed_ms(start);
+  this->timing_.linearizations++;
+}
 
-    Eigen::Matrix<double, 4, 6> jlossexp = dtdx0; // 雅可比矩阵
-    // 海森矩阵
-    Eigen::Matrix<double, 6, 6> Hi = w * jlossexp.transpose() * voxel_mahalanobis_[i] * jlossexp;
-    // 偏置
-    Eigen::Matrix<double, 6, 1> bi = w * jlossexp.transpose() * voxel_mahalanobis_[i] * error;
+template <typename PointSource, typename PointTarget>
+double RotVGICP<PointSource, PointTarget>::linearize(const Eigen::Isometry3d& trans, Eigen::Matrix<double, 6, 6>* H, Eigen::Matrix<double, 6, 1>* b) {
+  // 若没有构建体素地图，先构建体素地图
+  if (!voxelmap_valid_) {
+    build_voxelmap();
+  }
 
-    int thread_num = omp_get_thread_num();
-    Hs[thread_num] += Hi;
-    bs[thread_num] += bi;
+  // 对应关系过期或位姿变化超过阈值时才重新建立，否则沿用缓存的对应关系
+  if (this->should_update_correspondences(trans)) {
+    update_correspondences(trans);
   }
 
+  // 利用李代数扰动模型，雅可比矩阵为[skew(T*a), -I]，海森矩阵和偏置由核函数累加
+  double sums[SUM_SIZE];
+  accumulate_correspondences(trans, H && b ? LinearizeMode::SE3 : LinearizeMode::ERROR, sums);
   if (H && b) {
-    H->setZero();
-    b->setZero();
-    for (int i = 0; i < num_threads_; i++) {
-      (*H) += Hs[i];
-      (*b) += bs[i];
-    }
+    unpack_linearize_sums(sums, *H, *b);
+  }
+  if (this->lsq_optimizer_type_ == LSQ_OPTIMIZER_TYPE::CT_LevenbergMarquardt) {
+    return sums[SUM_ERROR] + translation_prior(trans, sums, H, b);
   }
 
-  return sum_errors;
+  return sums[SUM_ERROR];
 }
 
 template <typename PointSource, typename PointTarget>
 double RotVGICP<PointSource, PointTarget>::so3_linearize(const Eigen::Isometry3d& trans, Eigen::Matrix<double, 3, 3>* H, Eigen::Matrix<double, 3, 1>* b) {
   // 若没有构建体素地图，先构建体素地图
-  if (voxelmap_ == nullptr) {
-    voxelmap_.reset(new VmfVoxelMap<PointTarget>(voxel_resolution_, voxel_mode_));
-    voxelmap_->create_voxelmap(*target_, target_covs_);
-  }
-  // std::cout << target_covs_.size() << std::endl;
-  // std::cout << target_covs_[0] << std::endl;
-  // std::cout << "trans: " << trans.matrix() << std::endl;
-
-  update_correspondences(trans); // 执行一次位姿更新后的correspondence
-  // 以下分别是总体误差，海森矩阵，偏置
-  double sum_errors = 0.0;
-  std::vector<Eigen::Matrix<double, 3, 3>, Eigen::aligned_allocator<Eigen::Matrix<double, 3, 3>>> Hs(num_threads_);
-  std::vector<Eigen::Matrix<double, 3, 1>, Eigen::aligned_allocator<Eigen::Matrix<double, 3, 1>>> bs(num_threads_);
-  for (int i = 0; i < num_threads_; i++) {
-    Hs[i].setZero();
-    bs[i].setZero();
-  }
-
-#pragma omp parallel for num_threads(num_threads_) reduction(+ : sum_errors) schedule(guided, 8)
-  for (int i = 0; i < voxel_correspondences_.size(); i++) {
-    const auto& corr = voxel_correspondences_[i];
-    auto target_voxel = corr.second;
-
-    const Eigen::Vector4d mean_A = input_->at(corr.first).getVector4fMap().template cast<double>();
-    // std::cout << "mean_A" << mean_A << std::endl;
-    const auto& cov_A = source_covs_[corr.first]; // 取协方差矩阵  
-
-    const Eigen::Vector4d mean_B = corr.second->mean_dir; // 体素栅格内的均值和协方差
-    // const Eigen::Vector4d dir_B = mean_B.array().acos(); // 取方向余弦
-    // const auto& cov_B = corr.second->cov;
-
-    const Eigen::Vector4d transed_mean_A = trans * mean_A; // 变换点
-    // const Eigen::Vector3d transed_so3_A = transed_mean_A.head<3>();
-    // Eigen::Vector4d dir_A = (transed_mean_A / transed_so3_A.norm()).array().acos();  // 取方向余弦
-    // dir_A(3) = 0.0;
-    // std::cout << "dir_A" << dir_A << std::endl;  
-    // std::cout << "dir_B" << dir_B << std::endl;  
-
-    // const Eigen::Vector4d error = dir_B - dir_A;
-    const Eigen::Vector4d error = mean_B - transed_mean_A; // 均值误差
-
-    double w = std::sqrt(target_voxel->num_points); // 体素内点越多且越密集，权重越大
-    sum_errors += w * error.transpose() * voxel_mahalanobis_[i] * error; // 残差计算
-
-    if (H == nullptr || b == nullptr) {
-      continue;
-    }
-
-    // std::cout << "transed_mean_A" << transed_mean_A << std::endl;  
-    // std::cout << "voxel_mahalanobis_so3" << voxel_mahalanobis_[i] << std::endl;  
-
-    // 利用李代数扰动模型，对位姿进行求导，得到雅可比矩阵
-    Eigen::Matrix<double, 3, 3> dtdx0 = Eigen::Matrix<double, 3, 3>::Zero();
-    // std::cout << "transed_mean_A: " << transed_mean_A << std::endl; 
-    dtdx0 = skewd(transed_mean_A.head<3>());
-    // dtdx0.block<3, 3>(0, 3) = -Eigen::Matrix3d::Identity();
-
-    Eigen::Matrix<double, 3, 3> jlossexp = dtdx0; // 雅可比矩阵
-    Eigen::Matrix3d voxel_mahalanobis_so3 = voxel_mahalanobis_[i].block<3,3>(0,0).matrix();
-    // std::cout << "dtdx0" << dtdx0 << std::endl;
-    // std::cout << "voxel_mahalanobis_so3" << voxel_mahalanobis_so3 << std::endl;
-    // std::cout << "error" << error << std::endl;
-    if(std::isnan(w)){
-      std::cout << "target_voxel->num_points: " << target_voxel->num_points << std::endl;
-      std::cout << "target_voxel->kappa: " << target_voxel->kappa << std::endl;
-      std::cout << "target_voxel->r_bar: " << target_voxel->r_bar << std::endl;
-      std::cout << "target_voxel->cov: " << target_voxel->cov << std::endl;
-      std::cout << "target_voxel->mean_dir: " << target_voxel->mean_dir << std::endl;
-    }
-
-    // 海森矩阵
-    Eigen::Matrix<double, 3, 3> Hi = w * jlossexp.transpose() * voxel_mahalanobis_so3 * jlossexp;
-    // 偏置
-    Eigen::Matrix<double, 3, 1> bi = w * jlossexp.transpose() * voxel_mahalanobis_so3 * error.head<3>();
-    // std::cout << "Hi" << Hi << std::endl;  
-    // std::cout << "bi" << bi << std::endl;  
+  if (!voxelmap_valid_) {
+    build_voxelmap();
+  }
 
-    int thread_num = omp_get_thread_num();
-    Hs[thread_num] += Hi;
-    bs[thread_num] += bi;
+  // 对应关系过期或位姿变化超过阈值时才重新建立，否则沿用缓存的对应关系
+  if (this->should_update_correspondences(trans)) {
+    update_correspondences(trans);
   }
 
+  // 只对旋转求导，雅可比矩阵为skew(T*a)
+  double sums[SUM_SIZE];
+  accumulate_correspondences(trans, H && b ? LinearizeMode::SO3 : LinearizeMode::ERROR, sums);
   if (H && b) {
-    H->setZero();
-    b->setZero();
-    for (int i = 0; i < num_threads_; i++) {
-      (*H) += Hs[i];
-      (*b) += bs[i];
-    }
+    *H << sums[SUM_H_RR + 0], sums[SUM_H_RR + 1], sums[SUM_H_RR + 2],
+          sums[SUM_H_RR + 1], sums[SUM_H_RR + 3], sums[SUM_H_RR + 4],
+          sums[SUM_H_RR + 2], sums[SUM_H_RR + 4], sums[SUM_H_RR + 5];
+    *b << sums[SUM_G_R + 0], sums[SUM_G_R + 1], sums[SUM_G_R + 2];
   }
-  // std::cout << "H1: " << *H << std::endl;
-  // std::cout << "b1: " << *b << std::endl;
-  // std::cout << "sum_errors: " << sum_errors << std::endl;
 
-  return sum_errors;
+  return sums[SUM_ERROR];
 }
 // //! 计算残差块
 template <typename PointSource, typename PointTarget>
 double RotVGICP<PointSource, PointTarget>::compute_error(const Eigen::Isometry3d& trans) {
-  double sum_errors = 0.0;
-#pragma omp parallel for num_threads(num_threads_) reduction(+ : sum_errors)
-  for (int i = 0; i < voxel_correspondences_.size(); i++) {
-    const auto& corr = voxel_correspondences_[i];
-    auto target_voxel = corr.second;
-
-    const Eigen::Vector4d mean_A = input_->at(corr.first).getVector4fMap().template cast<double>();
-    const auto& cov_A = source_covs_[corr.first]; // 取协方差矩阵  
-
-    const Eigen::Vector4d mean_B = corr.second->mean_dir; // 体素栅格内的均值和协方差
+  double sums[SUM_SIZE];
+  accumulate_correspondences(trans, LinearizeMode::ERROR, sums);
+  if (this->lsq_optimizer_type_ == LSQ_OPTIMIZER_TYPE::CT_LevenbergMarquardt) {
+    return sums[SUM_ERROR] + translation_prior(trans, sums, nullptr, nullptr);
+  }
+  return sums[SUM_ERROR];
+}
 
-    const Eigen::Vector4d transed_mean_A = trans * mean_A; // 变换点
+template <typename PointSource, typename PointTarget>
+double RotVGICP<PointSource, PointTarget>::translation_prior(const Eigen::Isometry3d& trans, const double* sums,
+                                                             Eigen::Matrix<double, 6, 6>* H, Eigen::Matrix<double, 6, 1>* b) const {
+  if (correspondence_buffer_.size() == 0) {
+    return 0.0;
+  }
 
-    const Eigen::Vector4d error = mean_B - transed_mean_A; // 均值误差
+  // 与t3_linearize相同的连续时间约束，权重为sum(w*M)，平移t取当前变换的平移
+  const double k = (double)lambda_ / correspondence_buffer_.size();
+  const Eigen::Vector3d t = trans.translation();
+  const Eigen::Vector3d ct_error = -(ct_init_guess_ + t) / ct_interval_;
+  Eigen::Matrix3d sum_mahalanobis;
+  sum_mahalanobis << sums[SUM_H_TT + 0], sums[SUM_H_TT + 1], sums[SUM_H_TT + 2],
+                     sums[SUM_H_TT + 1], sums[SUM_H_TT + 3], sums[SUM_H_TT + 4],
+                     sums[SUM_H_TT + 2], sums[SUM_H_TT + 4], sums[SUM_H_TT + 5];
 
-    double w = std::sqrt(target_voxel->num_points); // 体素内点越多且越密集，权重越大
-    sum_errors += w * error.transpose() * voxel_mahalanobis_[i] * error; // 残差计算
+  if (H && b) {
+    // 左扰动下t' = t + omega x t + rho，ct_error的雅可比矩阵为[skew(t), -I] / interval_tn
+    Eigen::Matrix<double, 3, 6> J;
+    J.block<3, 3>(0, 0) = skewd(t) / ct_interval_;
+    J.block<3, 3>(0, 3) = -Eigen::Matrix3d::Identity() / ct_interval_;
+    *H += k * J.transpose() * sum_mahalanobis * J;
+    *b += k * J.transpose() * sum_mahalanobis * ct_error;
   }
 
-  return sum_errors;
+  return k * ct_error.dot(sum_mahalanobis * ct_error);
 }
-
 template <typename PointSource, typename PointTarget>
 template <typename PointT>
 bool RotVGICP<PointSource, PointTarget>::calculate_covariances(
@@ -414,232 +587,127 @@ bool RotVGICP<PointSource, PointTarget>::calculate_covariances(
   }
   covariances.resize(cloud->size());
 
-#pragma omp parallel for num_threads(num_threads_) schedule(guided, 8)
-  for (int i = 0; i < cloud->size(); i++) { // 为每个输入点云计算协方差
-    std::vector<int> k_indices;
-    std::vector<float> k_sq_distances;  // 利用kdtree 寻找最近的k_correspondences_个点
-    // std::cout << "size: " << cloud->size() << ", index: " << i << std::endl;
-    // std::cout << "point: " << cloud->at(i).x << ", " << cloud->at(i).y << ", " << cloud->at(i).z << std::endl;
-    kdtree.nearestKSearch(cloud->at(i), k_correspondences_, k_indices, k_sq_distances);
-
-    Eigen::Matrix<double, 4, -1> neighbors(4, k_correspondences_);
-    for (int j = 0; j < k_indices.size(); j++) {  // 存的是方向余弦
-      Eigen::Vector4d neibor = cloud->at(k_indices[j]).getVector4fMap().template cast<double>();
-      // neibor /= neibor.head<3>().norm(); // 归一化
-      // neibor(3) = 1.0;
-      neighbors.col(j) = neibor;
-    }
-    // // 以第i个点为平均方向，求其他角的方向余弦插值
-    // Eigen::Vector4d mean_dir = cloud->at(i).getVector4fMap().template cast<double>().normalized().acos();
-    // 利用矢量和求平均方向向量
-    // Eigen::Vector4d mean_dir = neighbors.rowwise().sum();
-    // mean_dir /= mean_dir.head<3>().norm(); // 单位化
-    // mean_dir(3) = 1.0; // se(3)影响
-    // mean_dir = mean_dir.array().acos().eval();
-    // // 协方差公式： dir-bar(dir)/K, bar(dir)是neibor的平均方向
-    // neighbors.colwise() -= mean_dir; // P-bar(P)
-    neighbors.colwise() -= neighbors.rowwise().mean().eval(); // P-bar(P)
-
-    Eigen::Matrix4d cov = neighbors * neighbors.transpose() / k_correspondences_;
-
-    if (regularization_method_ == RegularizationMethod::NONE) {
-      covariances[i] = cov;
-    } else if (regularization_method_ == RegularizationMethod::FROBENIUS) {
-      double lambda = 1e-3;
-      Eigen::Matrix3d C = cov.block<3, 3>(0, 0).cast<double>() + lambda * Eigen::Matrix3d::Identity();
-      Eigen::Matrix3d C_inv = C.inverse();
-      covariances[i].setZero();
-      covariances[i].template block<3, 3>(0, 0) = (C_inv / C_inv.norm()).inverse();
-    } else {
-      // SVD分解
-      Eigen::JacobiSVD<Eigen::Matrix3d> svd(cov.block<3, 3>(0, 0), Eigen::ComputeFullU | Eigen::ComputeFullV);
-      Eigen::Vector3d values;
-
-      switch (regularization_method_) {
-        default:
-          std::cerr << "here must not be reached" << std::endl;
-          abort();
-        case RegularizationMethod::PLANE:
-          values = Eigen::Vector3d(1, 1, 1e-3); // 利用SVD矩阵将协方差降维到2维xy平面上
-          break;
-        case RegularizationMethod::MIN_EIG:
-          values = svd.singularValues().array().max(1e-3);
-          break;
-        case RegularizationMethod::NORMALIZED_MIN_EIG:
-          values = svd.singularValues() / svd.singularValues().maxCoeff();
-          values = values.array().max(1e-3);
-          break;
-        case RegularizationMethod::PLANE_S:
-          values = svd.singularValues() / svd.singularValues().sum();
-          values(2) = 1e-3;
+  // 近邻的缓存每个工作线程一份，在调用之间复用，循环内不再分配
+  WorkerPool& workers = pool();
+  worker_indices_.resize(workers.num_workers());
+  worker_sq_distances_.resize(workers.num_workers());
+  workers.parallel_for(cloud->size(), 64, [&](int worker, int begin, int end) {
+    std::vector<int>& k_indices = worker_indices_[worker];
+    std::vector<float>& k_sq_distances = worker_sq_distances_[worker];
+    for (int i = begin; i < end; i++) { // 为每个输入点云计算协方差
+      kdtree.nearestKSearch(cloud->at(i), k_correspondences_, k_indices, k_sq_distances);
+
+      // 协方差公式：sum((P-bar(P))(P-bar(P))^T)/K，以查询点为原点一次累加
+      const Eigen::Vector3d query = cloud->at(i).getVector3fMap().template cast<double>();
+      ScatterAccumulator scatter;
+      for (int j = 0; j < k_indices.size(); j++) {
+        scatter.add(cloud->at(k_indices[j]).getVector3fMap().template cast<double>() - query);
       }
-
-      covariances[i].setZero();
-      covariances[i].template block<3, 3>(0, 0) = svd.matrixU() * values.asDiagonal() * svd.matrixV().transpose();
+      covariances[i] = regularize_point_covariance(scatter.covariance(), regularization_method_);
     }
-  }
+  });
 
   return true;
 }
 
 template <typename PointSource, typename PointTarget>
-double RotVGICP<PointSource, PointTarget>::t3_linearize(const Eigen::Vector3d& trans, const Eigen::Vector3d& init_guess, const Eigen::Vector3d& last_t0, 
-                                                        const double interval_tn, const double interval_tn_1,
-                                                        Eigen::Matrix<double, 6, 6>* H, Eigen::Matrix<double, 6, 1>* b) {
-  // 若没有构建体素地图，先构建体素地图
-  // if (voxelmap_ == nullptr) {
-  //   voxelmap_.reset(new VmfVoxelMap<PointTarget>(voxel_resolution_, voxel_mode_));
-  //   voxelmap_->create_voxelmap(*target_, target_covs_);
-  // }
-
-
-  // Eigen::Isometry3d tranform = Eigen::Isometry3d::Identity();
-  // tranform.matrix().col(3).head<3>() = trans;
-  // update_correspondences(tranform);
-  
-  double sum_errors = 0.0;
-  std::vector<Eigen::Matrix<double, 6, 6>, Eigen::aligned_allocator<Eigen::Matrix<double, 3, 3>>> Hs(num_threads_);
-  std::vector<Eigen::Matrix<double, 6, 1>, Eigen::aligned_allocator<Eigen::Matrix<double, 3, 1>>> bs(num_threads_);
-  for (int i = 0; i < num_threads_; i++) {
-    Hs[i].setZero();
-    bs[i].setZero();
-  }
-  size_t pt_size = voxel_correspondences_.size();
-
-#pragma omp parallel for num_threads(num_threads_) reduction(+ : sum_errors) schedule(guided, 8)
-  for (int i = 0; i < voxel_correspondences_.size(); i++) {
-    const auto& corr = voxel_correspondences_[i];
-    auto target_voxel = corr.second;
-
-    const Eigen::Vector4d mean_A = input_->at(corr.first).getVector4fMap().template cast<double>();
-    const auto& cov_A = source_covs_[corr.first]; // 取协方差矩阵  
-
-    const Eigen::Vector4d mean_B = corr.second->mean_dir; // 体素栅格内的均值和协方差
-
-    Eigen::Isometry3d transform = Eigen::Isometry3d::Identity();
-    transform(0,3) =  trans(0);
-    transform(1,3) =  trans(1);
-    transform(2,3) =  trans(2);
-    
-    Eigen::Isometry3d propagation_transform = Eigen::Isometry3d::Identity();
-    propagation_transform.matrix().col(3).head<3>() = init_guess;
-    Eigen::Vector4d last_transform = Eigen::Vector4d::Zero();
-    last_transform.matrix().col(3).head<3>() = last_t0;
-
-    const Eigen::Vector4d transed_mean_A = transform * mean_A; // 变换点
-
-    const Eigen::Vector4d begin_mean_A = propagation_transform.inverse() * mean_A; // 找到插值前的点
-
-    const Eigen::Vector4d error = mean_B - transed_mean_A; // 均值误差
-
-    const Eigen::Vector4d ct_error = (begin_mean_A - transed_mean_A)/interval_tn - last_transform/interval_tn_1;
-
-    double w = std::sqrt(target_voxel->num_points); // 体素内点越多且越密集，权重越大
-    const Eigen::Vector3d C_vel = (init_guess+trans)/interval_tn - last_t0/interval_tn_1;
-    // double iter_error = w * (error.transpose() * voxel_mahalanobis_[i] * error + lambda/pt_size * C_vel.transpose()*C_vel).value();
-    // sum_errors += iter_error; // 残差计算
-    sum_errors += w * (error.transpose() * voxel_mahalanobis_[i] * error + lambda_/pt_size * ct_error.transpose() * voxel_mahalanobis_[i] * ct_error).value();
+template <typename PointT>
+bool RotVGICP<PointSource, PointTarget>::calculate_covariances(
+  const typename pcl::PointCloud<PointT>::ConstPtr& cloud,
+  const NeighborSearch<PointT>& search,
+  std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covariances) {
+  covariances.resize(cloud->size());
 
-    if (H == nullptr || b == nullptr) {
-      continue;
+  WorkerPool& workers = pool();
+  worker_neighbors_.resize(workers.num_workers());
+  for (auto& neighbors : worker_neighbors_) {
+    if (neighbors.cols() != k_correspondences_) {
+      neighbors.resize(4, k_correspondences_);
     }
+  }
+  workers.parallel_for(cloud->size(), 64, [&](int worker, int begin, int end) {
+    Eigen::Matrix<double, 4, -1>& neighbors = worker_neighbors_[worker];
+    for (int i = begin; i < end; i++) {
+      int found = search.knn(cloud->at(i), k_correspondences_, neighbors);
+      // 邻域点太少时无法估计平面，退化为各向同性的点到点约束
+      if (found < 3) {
+        covariances[i].setZero();
+        covariances[i].template block<3, 3>(0, 0) = Eigen::Matrix3d::Identity();
+        continue;
+      }
 
-    // std::cout << "transed_mean_A" << transed_mean_A << std::endl;  
-    // std::cout << "voxel_mahalanobis_so3" << voxel_mahalanobis_[i] << std::endl;  
-    Eigen::Matrix3d voxel_mahalanobis_so3 = voxel_mahalanobis_[i].block<3,3>(0,0).matrix();
-  
-    if(std::isnan(w)){
-      std::cout << "target_voxel->num_points: " << target_voxel->num_points << std::endl;
-      std::cout << "target_voxel->kappa: " << target_voxel->kappa << std::endl;
-      std::cout << "target_voxel->r_bar: " << target_voxel->r_bar << std::endl;
-      std::cout << "target_voxel->cov: " << target_voxel->cov << std::endl;
-      std::cout << "target_voxel->mean_dir: " << target_voxel->mean_dir << std::endl;
+      const Eigen::Vector3d query = cloud->at(i).getVector3fMap().template cast<double>();
+      ScatterAccumulator scatter;
+      for (int j = 0; j < found; j++) {
+        scatter.add(neighbors.col(j).template head<3>() - query);
+      }
+      covariances[i] = regularize_point_covariance(scatter.covariance(), regularization_method_);
     }
+  });
 
-    // 利用李代数扰动模型，对位姿进行求导，得到雅可比矩阵
-    Eigen::Matrix<double, 4, 6> dtdx0 = Eigen::Matrix<double, 4, 6>::Zero();
-    dtdx0.block<3, 3>(0, 0) = skewd(transed_mean_A.head<3>());
-    dtdx0.block<3, 3>(0, 3) = -Eigen::Matrix3d::Identity();
+  return true;
+}
 
-    Eigen::Matrix<double, 4, 6> jlossexp1 = dtdx0; // 雅可比矩阵
-    Eigen::Matrix<double, 4, 6> jlossexp2 = 1.0 / interval_tn * dtdx0; // 雅可比矩阵
+template <typename PointSource, typename PointTarget>
+template <typename PointT>
+void RotVGICP<PointSource, PointTarget>::estimate_covariances(
+  const typename pcl::PointCloud<PointT>::ConstPtr& cloud,
+  const typename NeighborSearch<PointT>::ConstPtr& search,
+  pcl::search::Search<PointT>& kdtree,
+  std::unique_ptr<VmfVoxelMap<PointT>>& scatter_voxels,
+  std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covariances) {
+  if (search) {
+    calculate_covariances(cloud, *search, covariances);
+  } else if (covariance_voxel_size_ > 0.0) {
+    if (scatter_voxels == nullptr || scatter_voxels->resolution() != covariance_voxel_size_) {
+      scatter_voxels.reset(new VmfVoxelMap<PointT>(covariance_voxel_size_, VoxelAccumulationMode::ADDITIVE));
+    }
+    estimate_voxel_covariances(*cloud, regularization_method_, *scatter_voxels, covariances, pool());
+  } else {
+    calculate_covariances(cloud, kdtree, covariances);
+  }
+}
 
-    // 海森矩阵
-    Eigen::Matrix<double, 6, 6> Hi = w * (jlossexp1.transpose() * voxel_mahalanobis_[i] * jlossexp1 + lambda_/pt_size * jlossexp2.transpose() * voxel_mahalanobis_[i] * jlossexp2);
-    // 偏置
-    Eigen::Matrix<double, 6, 1> bi = w * (jlossexp1.transpose() * voxel_mahalanobis_[i] * error + lambda_/pt_size * jlossexp2.transpose() * voxel_mahalanobis_[i] * ct_error);
-    // std::cout << "Hi" << Hi << std::endl;  
-    // std::cout << "bi" << bi << std::endl;  
+template <typename PointSource, typename PointTarget>
+Eigen::Matrix4d RotVGICP<PointSource, PointTarget>::regularize_covariance(const Eigen::Matrix4d& cov) const {
+  return regularize_point_covariance(cov.block<3, 3>(0, 0), regularization_method_);
+}
 
-    int thread_num = omp_get_thread_num();
-    Hs[thread_num] += Hi;
-    bs[thread_num] += bi;
-  }
+template <typename PointSource, typename PointTarget>
+double RotVGICP<PointSource, PointTarget>::t3_linearize(const Eigen::Vector3d& trans, const Eigen::Vector3d& init_guess, const Eigen::Vector3d& last_t0, 
+                                                        const double interval_tn, const double interval_tn_1,
+                                                        Eigen::Matrix<double, 6, 6>* H, Eigen::Matrix<double, 6, 1>* b) {
+  // 沿用上一次update_correspondences得到的对应关系，变换只有平移
+  Eigen::Isometry3d transform = Eigen::Isometry3d::Identity();
+  transform.translation() = trans;
+
+  double sums[SUM_SIZE];
+  accumulate_correspondences(transform, H && b ? LinearizeMode::SE3 : LinearizeMode::ERROR, sums);
+
+  // 连续时间约束：每个点的ct_error = (begin_mean_A - transed_mean_A)/interval_tn = -(init_guess + trans)/interval_tn，
+  // 与点无关，其残差和梯度可由sum(w*M)及海森矩阵的平移列直接得到。last_t0/interval_tn_1不参与约束
+  const double k = voxel_correspondences_.empty() ? 0.0 : (double)lambda_ / voxel_correspondences_.size();
+  const Eigen::Vector3d ct_error = -(init_guess + trans) / interval_tn;
+  Eigen::Matrix3d sum_mahalanobis;
+  sum_mahalanobis << sums[SUM_H_TT + 0], sums[SUM_H_TT + 1], sums[SUM_H_TT + 2],
+                     sums[SUM_H_TT + 1], sums[SUM_H_TT + 3], sums[SUM_H_TT + 4],
+                     sums[SUM_H_TT + 2], sums[SUM_H_TT + 4], sums[SUM_H_TT + 5];
+  const double sum_errors = sums[SUM_ERROR] + k * ct_error.dot(sum_mahalanobis * ct_error);
 
   if (H && b) {
-    H->setZero();
-    b->setZero();
-    for (int i = 0; i < num_threads_; i++) {
-      (*H) += Hs[i];
-      (*b) += bs[i];
-    }
+    unpack_linearize_sums(sums, *H, *b);
+    // ct_error的雅可比矩阵为dtdx0/interval_tn，sum(w * J^T * M * ct_error) = -H.col(3..5) * ct_error
+    *b -= k / interval_tn * H->template block<6, 3>(0, 3) * ct_error;
+    *H *= 1.0 + k / (interval_tn * interval_tn);
   }
 
-  // std::cout << "H1: " << *H << std::endl;
-  // std::cout << "b1: " << *b << std::endl;
-  // std::cout << "sum_errors: " << sum_errors << std::endl;
-
   return sum_errors;
 }
 
 template <typename PointSource, typename PointTarget>
 double RotVGICP<PointSource, PointTarget>::compute_t_error(const Eigen::Vector3d& trans, const Eigen::Vector3d& init_guess, const Eigen::Vector3d& last_t0, 
                                                            const double& interval_tn, const double& interval_tn_1){
-
-  // Eigen::Isometry3d tranform = Eigen::Isometry3d::Identity();
-  // tranform.matrix().col(3).head<3>() = trans;
-  // update_correspondences(tranform);
-
-  double sum_errors = 0.0;
-  size_t pt_size = voxel_correspondences_.size();
-
-#pragma omp parallel for num_threads(num_threads_) reduction(+ : sum_errors)
-  for (int i = 0; i < voxel_correspondences_.size(); i++) {
-    const auto& corr = voxel_correspondences_[i];
-    auto target_voxel = corr.second;
-
-    const Eigen::Vector4d mean_A = input_->at(corr.first).getVector4fMap().template cast<double>();
-    const auto& cov_A = source_covs_[corr.first]; // 取协方差矩阵  
-
-    const Eigen::Vector4d mean_B = corr.second->mean_dir; // 体素栅格内的均值和协方差
-
-    Eigen::Isometry3d transform = Eigen::Isometry3d::Identity();
-    transform(0,3) =  trans(0);
-    transform(1,3) =  trans(1);
-    transform(2,3) =  trans(2);
-    
-    Eigen::Isometry3d propagation_transform = Eigen::Isometry3d::Identity();
-    propagation_transform.matrix().col(3).head<3>() = init_guess;
-    Eigen::Vector4d last_transform = Eigen::Vector4d::Identity();
-    last_transform.matrix().col(3).head<3>() = last_t0;
-
-    const Eigen::Vector4d transed_mean_A = transform * mean_A; // 变换点
-
-    const Eigen::Vector4d begin_mean_A = propagation_transform.inverse() * mean_A; // 找到插值前的点
-
-    const Eigen::Vector4d error = mean_B - transed_mean_A; // 均值误差
-
-    const Eigen::Vector4d ct_error = (begin_mean_A - transed_mean_A)/interval_tn - last_transform/interval_tn_1;
-
-    double w = std::sqrt(target_voxel->num_points); // 体素内点越多且越密集，权重越大
-    const Eigen::Vector3d C_vel = (init_guess+trans)/interval_tn - last_t0/interval_tn_1;
-    // double iter_error = w * (error.transpose() * voxel_mahalanobis_[i] * error + lambda/pt_size * C_vel.transpose()*C_vel).value();
-    // sum_errors += iter_error; // 残差计算
-    sum_errors += w * (error.transpose() * voxel_mahalanobis_[i] * error + lambda_/pt_size * ct_error.transpose() * voxel_mahalanobis_[i] * ct_error).value();
-
-  }
-
-  return sum_errors;
+  return t3_linearize(trans, init_guess, last_t0, interval_tn, interval_tn_1, nullptr, nullptr);
 }
 
 }  // namespace fast_gicp
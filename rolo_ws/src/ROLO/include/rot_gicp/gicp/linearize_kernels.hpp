@@ -0,0 +1,222 @@
+#ifndef FAST_GICP_LINEARIZE_KERNELS_HPP
+#define FAST_GICP_LINEARIZE_KERNELS_HPP
+
+// 本文件不依赖Eigen/PCL，可以被以-mavx2 -mfma编译的源文件包含
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <rolo/simdOps.h>
+
+namespace fast_gicp {
+
+/**
+ * @brief Correspondences of RotVGICP in single precision, structure of arrays.
+ *        Source points a are stored untransformed together with the residual e0 = b - T0 * a at the pose T0 the
+ *        correspondences were found at, so that the residual at T is evaluated as e0 + (T0 - T) * a without the
+ *        cancellation of b - T * a in float for points far from the sensor. The mahalanobis matrix (B + R A R^T)^-1
+ *        is stored as its 6 upper-triangular entries already multiplied by the weight sqrt(num_points) of the voxel.
+ *        Every field is padded with zeros to a multiple of kAlign, padding contributes nothing to the sums.
+ */
+class CorrespondenceBuffer {
+public:
+  enum Field { AX, AY, AZ, EX, EY, EZ, M00, M01, M02, M11, M12, M22, kFields };
+  enum : int { kAlign = 8 };
+
+  void resize(int n) {
+    size_ = n;
+    stride_ = (n + kAlign - 1) / kAlign * kAlign;
+    data_.resize((size_t)stride_ * kFields);
+    for (int f = 0; f < kFields; f++) {
+      std::fill(field(f) + size_, field(f) + stride_, 0.0f);
+    }
+  }
+
+  //! T0 as a 3x4 row major matrix
+  void setReferencePose(const double* pose) { std::copy(pose, pose + 12, reference_); }
+  const double* referencePose() const { return reference_; }
+
+  int size() const { return size_; }
+  int stride() const { return stride_; }
+  float* field(int f) { return data_.data() + (size_t)f * stride_; }
+  const float* field(int f) const { return data_.data() + (size_t)f * stride_; }
+  const float* data() const { return data_.data(); }
+
+private:
+  int size_ = 0;
+  int stride_ = 0;
+  double reference_[12] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+  std::vector<float> data_;
+};
+
+enum class LinearizeMode { ERROR, SO3, SE3 };
+
+/**
+ * @brief Layout of the accumulated sums, with the jacobian J = [skew(T*a), -I] of the residual e = b - T*a.
+ *        H = sum J^T M J is stored as its upper triangle in 3x3 blocks (rotation first), g = sum J^T M e.
+ */
+enum LinearizeSum {
+  SUM_H_RR = 0,   // 6, upper triangle of the rotation block
+  SUM_H_RT = 6,   // 9, rotation x translation block, row major
+  SUM_H_TT = 15,  // 6, upper triangle of the translation block, equals sum M
+  SUM_G_R = 21,   // 3
+  SUM_G_T = 24,   // 3
+  SUM_ERROR = 27, // sum e^T M e
+  SUM_SIZE = 28
+};
+
+/**
+ * @brief Accumulate the correspondences [begin, end) of buffer under the transform T (3x4, row major) into sums.
+ *        Only the differences to the reference pose enter the residual, so T is given in double.
+ *        ERROR only fills SUM_ERROR and SUM_H_TT, SO3 additionally SUM_H_RR and SUM_G_R. begin must be a multiple of kAlign.
+ *        The AVX2 version is used when the CPU supports it.
+ */
+void linearizeCorrespondences(const CorrespondenceBuffer& buffer, int begin, int end, const double* T, LinearizeMode mode, double* sums);
+
+//! scalar version for comparison
+void linearizeCorrespondencesScalar(const CorrespondenceBuffer& buffer, int begin, int end, const double* T, LinearizeMode mode, double* sums);
+
+//! whether linearizeCorrespondences uses AVX2 on this CPU
+bool linearizeKernelsUseAvx2();
+
+namespace detail {
+
+/**
+ * @brief Kernel body, instantiated for rolo::simd::ScalarOps/SseOps/Avx2Ops. end - begin must be a multiple of O::width.
+ *        T is the transform for the jacobian, D = T0 - T the difference to the reference pose for the residual.
+ *        Sums are kept in float within a block of kFlushBlock correspondences and added to the double sums per block,
+ *        so that the LM error comparison does not drown in float round-off over ~1e5 correspondences.
+ */
+template <class O, LinearizeMode Mode>
+inline void linearize_kernel(const float* data, int stride, int begin, int end, const float* T, const float* D, double* sums) {
+  typedef typename O::V V;
+  enum : int { kFlushBlock = 256, kWidth = O::width };
+
+  const float* ax = data + (size_t)CorrespondenceBuffer::AX * stride;
+  const float* ay = data + (size_t)CorrespondenceBuffer::AY * stride;
+  const float* az = data + (size_t)CorrespondenceBuffer::AZ * stride;
+  const float* e0x = data + (size_t)CorrespondenceBuffer::EX * stride;
+  const float* e0y = data + (size_t)CorrespondenceBuffer::EY * stride;
+  const float* e0z = data + (size_t)CorrespondenceBuffer::EZ * stride;
+  const float* m00 = data + (size_t)CorrespondenceBuffer::M00 * stride;
+  const float* m01 = data + (size_t)CorrespondenceBuffer::M01 * stride;
+  const float* m02 = data + (size_t)CorrespondenceBuffer::M02 * stride;
+  const float* m11 = data + (size_t)CorrespondenceBuffer::M11 * stride;
+  const float* m12 = data + (size_t)CorrespondenceBuffer::M12 * stride;
+  const float* m22 = data + (size_t)CorrespondenceBuffer::M22 * stride;
+
+  const V r00 = O::set1(T[0]), r01 = O::set1(T[1]), r02 = O::set1(T[2]), t0 = O::set1(T[3]);
+  const V r10 = O::set1(T[4]), r11 = O::set1(T[5]), r12 = O::set1(T[6]), t1 = O::set1(T[7]);
+  const V r20 = O::set1(T[8]), r21 = O::set1(T[9]), r22 = O::set1(T[10]), t2 = O::set1(T[11]);
+  const V d00 = O::set1(D[0]), d01 = O::set1(D[1]), d02 = O::set1(D[2]), d03 = O::set1(D[3]);
+  const V d10 = O::set1(D[4]), d11 = O::set1(D[5]), d12 = O::set1(D[6]), d13 = O::set1(D[7]);
+  const V d20 = O::set1(D[8]), d21 = O::set1(D[9]), d22 = O::set1(D[10]), d23 = O::set1(D[11]);
+
+  for (int block = begin; block < end; block += kFlushBlock) {
+    const int stop = end - block < kFlushBlock ? end : block + kFlushBlock;
+    V acc[SUM_SIZE];
+    for (int k = 0; k < SUM_SIZE; k++) {
+      acc[k] = O::set1(0.0f);
+    }
+
+    for (int i = block; i < stop; i += kWidth) {
+      const V x = O::load(ax + i), y = O::load(ay + i), z = O::load(az + i);
+      const V qx = O::fma(r00, x, O::fma(r01, y, O::fma(r02, z, t0)));
+      const V qy = O::fma(r10, x, O::fma(r11, y, O::fma(r12, z, t1)));
+      const V qz = O::fma(r20, x, O::fma(r21, y, O::fma(r22, z, t2)));
+      // e = b - T * a = e0 + (T0 - T) * a
+      const V ex = O::fma(d00, x, O::fma(d01, y, O::fma(d02, z, O::add(O::load(e0x + i), d03))));
+      const V ey = O::fma(d10, x, O::fma(d11, y, O::fma(d12, z, O::add(O::load(e0y + i), d13))));
+      const V ez = O::fma(d20, x, O::fma(d21, y, O::fma(d22, z, O::add(O::load(e0z + i), d23))));
+
+      const V a00 = O::load(m00 + i), a01 = O::load(m01 + i), a02 = O::load(m02 + i);
+      const V a11 = O::load(m11 + i), a12 = O::load(m12 + i), a22 = O::load(m22 + i);
+      // u = M e
+      const V ux = O::fma(a00, ex, O::fma(a01, ey, O::mul(a02, ez)));
+      const V uy = O::fma(a01, ex, O::fma(a11, ey, O::mul(a12, ez)));
+      const V uz = O::fma(a02, ex, O::fma(a12, ey, O::mul(a22, ez)));
+      acc[SUM_ERROR] = O::fma(ex, ux, O::fma(ey, uy, O::fma(ez, uz, acc[SUM_ERROR])));
+      acc[SUM_H_TT + 0] = O::add(acc[SUM_H_TT + 0], a00);
+      acc[SUM_H_TT + 1] = O::add(acc[SUM_H_TT + 1], a01);
+      acc[SUM_H_TT + 2] = O::add(acc[SUM_H_TT + 2], a02);
+      acc[SUM_H_TT + 3] = O::add(acc[SUM_H_TT + 3], a11);
+      acc[SUM_H_TT + 4] = O::add(acc[SUM_H_TT + 4], a12);
+      acc[SUM_H_TT + 5] = O::add(acc[SUM_H_TT + 5], a22);
+      if (Mode == LinearizeMode::ERROR) {
+        continue;
+      }
+
+      // g_r = skew(q)^T M e = u x q
+      acc[SUM_G_R + 0] = O::sub(O::fma(uy, qz, acc[SUM_G_R + 0]), O::mul(uz, qy));
+      acc[SUM_G_R + 1] = O::sub(O::fma(uz, qx, acc[SUM_G_R + 1]), O::mul(ux, qz));
+      acc[SUM_G_R + 2] = O::sub(O::fma(ux, qy, acc[SUM_G_R + 2]), O::mul(uy, qx));
+
+      // P = skew(q) M，H_rt = P，H_rr = -P skew(q)
+      const V p00 = O::sub(O::mul(qy, a02), O::mul(qz, a01));
+      const V p01 = O::sub(O::mul(qy, a12), O::mul(qz, a11));
+      const V p02 = O::sub(O::mul(qy, a22), O::mul(qz, a12));
+      const V p10 = O::sub(O::mul(qz, a00), O::mul(qx, a02));
+      const V p11 = O::sub(O::mul(qz, a01), O::mul(qx, a12));
+      const V p12 = O::sub(O::mul(qz, a02), O::mul(qx, a22));
+      const V p20 = O::sub(O::mul(qx, a01), O::mul(qy, a00));
+      const V p21 = O::sub(O::mul(qx, a11), O::mul(qy, a01));
+      acc[SUM_H_RR + 0] = O::sub(O::fma(p02, qy, acc[SUM_H_RR + 0]), O::mul(p01, qz));
+      acc[SUM_H_RR + 1] = O::sub(O::fma(p00, qz, acc[SUM_H_RR + 1]), O::mul(p02, qx));
+      acc[SUM_H_RR + 2] = O::sub(O::fma(p01, qx, acc[SUM_H_RR + 2]), O::mul(p00, qy));
+      acc[SUM_H_RR + 3] = O::sub(O::fma(p10, qz, acc[SUM_H_RR + 3]), O::mul(p12, qx));
+      acc[SUM_H_RR + 4] = O::sub(O::fma(p11, qx, acc[SUM_H_RR + 4]), O::mul(p10, qy));
+      acc[SUM_H_RR + 5] = O::sub(O::fma(p21, qx, acc[SUM_H_RR + 5]), O::mul(p20, qy));
+      if (Mode == LinearizeMode::SO3) {
+        continue;
+      }
+
+      const V p22 = O::sub(O::mul(qx, a12), O::mul(qy, a02));
+      acc[SUM_H_RT + 0] = O::add(acc[SUM_H_RT + 0], p00);
+      acc[SUM_H_RT + 1] = O::add(acc[SUM_H_RT + 1], p01);
+      acc[SUM_H_RT + 2] = O::add(acc[SUM_H_RT + 2], p02);
+      acc[SUM_H_RT + 3] = O::add(acc[SUM_H_RT + 3], p10);
+      acc[SUM_H_RT + 4] = O::add(acc[SUM_H_RT + 4], p11);
+      acc[SUM_H_RT + 5] = O::add(acc[SUM_H_RT + 5], p12);
+      acc[SUM_H_RT + 6] = O::add(acc[SUM_H_RT + 6], p20);
+      acc[SUM_H_RT + 7] = O::add(acc[SUM_H_RT + 7], p21);
+      acc[SUM_H_RT + 8] = O::add(acc[SUM_H_RT + 8], p22);
+      // g_t = -M e
+      acc[SUM_G_T + 0] = O::sub(acc[SUM_G_T + 0], ux);
+      acc[SUM_G_T + 1] = O::sub(acc[SUM_G_T + 1], uy);
+      acc[SUM_G_T + 2] = O::sub(acc[SUM_G_T + 2], uz);
+    }
+
+    float lanes[kWidth];
+    for (int k = 0; k < SUM_SIZE; k++) {
+      O::store(lanes, acc[k]);
+      for (int l = 0; l < kWidth; l++) {
+        sums[k] += lanes[l];
+      }
+    }
+  }
+}
+
+template <class O>
+inline void linearize_kernel(const float* data, int stride, int begin, int end, const float* T, const float* D, LinearizeMode mode, double* sums) {
+  switch (mode) {
+    case LinearizeMode::ERROR:
+      return linearize_kernel<O, LinearizeMode::ERROR>(data, stride, begin, end, T, D, sums);
+    case LinearizeMode::SO3:
+      return linearize_kernel<O, LinearizeMode::SO3>(data, stride, begin, end, T, D, sums);
+    case LinearizeMode::SE3:
+      return linearize_kernel<O, LinearizeMode::SE3>(data, stride, begin, end, T, D, sums);
+  }
+}
+
+//! float copies of T and D = T0 - T
+inline void linearize_transforms(const double* reference, const double* T, float* Tf, float* Df) {
+  for (int k = 0; k < 12; k++) {
+    Tf[k] = T[k];
+    Df[k] = reference[k] - T[k];
+  }
+}
+
+}  // namespace detail
+}  // namespace fast_gicp
+
+#endif  // FAST_GICP_LINEARIZE_KERNELS_HPP
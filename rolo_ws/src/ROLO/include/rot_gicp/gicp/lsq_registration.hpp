@@ -1,7 +1,10 @@
 #ifndef FAST_GICP_LSQ_REGISTRATION_HPP
 #define FAST_GICP_LSQ_REGISTRATION_HPP
 
+#include <chrono>
+
 #include <Eigen/Core>
+#include <Eigen/Eigenvalues>
 #include <Eigen/Geometry>
 
 #include <pcl/point_types.h>
@@ -10,7 +13,89 @@
 
 namespace fast_gicp {
 
-enum class LSQ_OPTIMIZER_TYPE { GaussNewton, LevenbergMarquardt, SO3_LevenbergMarquardt };
+/**
+ * @brief SO3_LevenbergMarquardt estimates the rotation only, the translation is left to computeTranslation().
+ *        CT_LevenbergMarquardt estimates rotation and translation together with the continuous-time translation prior
+ *        of computeTranslation() added to the cost, see RotVGICP::setTranslationPrior().
+ */
+enum class LSQ_OPTIMIZER_TYPE { GaussNewton, LevenbergMarquardt, SO3_LevenbergMarquardt, CT_LevenbergMarquardt };
+
+/**
+ * @brief Time spent in the last align() or computeTranslation() call
+ */
+struct RegistrationTiming {
+  double association_ms = 0.0;    // correspondence search and per-correspondence terms
+  double linearization_ms = 0.0;  // H, b and error evaluations
+  double solve_ms = 0.0;          // linear solves of the LM/GN steps
+  int associations = 0;
+  int linearizations = 0;         // including the error-only evaluations of rejected steps
+
+  void reset() { *this = RegistrationTiming(); }
+};
+
+/**
+ * @brief Outcome of the last align(), completed by computeTranslation(). The rotation and translation blocks of the
+ *        Hessian at the solution (left perturbation, as in linearize()) are decomposed with ascending eigenvalues.
+ *        An eigenvector is degenerate when its eigenvalue is below the degeneracy ratio times the largest eigenvalue
+ *        of its block, see LsqRegistration::setDegeneracyThreshold(): the solution moves freely along it, and only
+ *        the initial guess should be trusted there.
+ */
+struct RegistrationResult {
+  Eigen::Matrix3d rotation_hessian = Eigen::Matrix3d::Zero();
+  Eigen::Matrix3d translation_hessian = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d rotation_eigenvalues = Eigen::Vector3d::Zero();
+  Eigen::Vector3d translation_eigenvalues = Eigen::Vector3d::Zero();
+  Eigen::Matrix3d rotation_eigenvectors = Eigen::Matrix3d::Identity();     // columns, in the order of the eigenvalues
+  Eigen::Matrix3d translation_eigenvectors = Eigen::Matrix3d::Identity();
+  int degenerate_mask = 0;      // bit i: rotation eigenvector i, bit 3 + i: translation eigenvector i
+  bool has_rotation = false;    // the block was estimated; SO3_LevenbergMarquardt leaves the translation to computeTranslation()
+  bool has_translation = false;
+  int iterations = 0;           // LM iterations of align() and computeTranslation()
+  double inlier_ratio = 1.0;    // fraction of the source points with a correspondence at the last association
+  bool converged = false;
+  bool rejected = false;        // stopped after the first iteration with the initial guess, see setMinInlierRatio()
+
+  void reset() { *this = RegistrationResult(); }
+
+  bool degenerate() const { return degenerate_mask != 0; }
+  int rotation_mask() const { return degenerate_mask & 7; }
+  int translation_mask() const { return (degenerate_mask >> 3) & 7; }
+
+  //! Projection onto the well-constrained directions, identity when none is degenerate; applied to an update it keeps the
+  //! degenerate components at the initial guess, as the projection matrix of LOAM-style degeneracy handling
+  Eigen::Matrix3d rotation_projection() const { return projection(rotation_eigenvectors, rotation_mask()); }
+  Eigen::Matrix3d translation_projection() const { return projection(translation_eigenvectors, translation_mask()); }
+
+  //! Bit i set when eigenvalues[i] (ascending) is at most ratio times eigenvalues[2]; a zero block is fully degenerate.
+  //! ratio <= 0 disables the analysis and reports none
+  static int degenerate_axes(const Eigen::Vector3d& eigenvalues, double ratio) {
+    if (ratio <= 0.0) {
+      return 0;
+    }
+    int mask = 0;
+    for (int i = 0; i < 3; i++) {
+      if (eigenvalues[i] <= ratio * eigenvalues[2]) {
+        mask |= 1 << i;
+      }
+    }
+    return mask;
+  }
+
+  static Eigen::Matrix3d projection(const Eigen::Matrix3d& eigenvectors, int mask) {
+    Eigen::Matrix3d P = Eigen::Matrix3d::Identity();
+    for (int i = 0; i < 3; i++) {
+      if (mask & (1 << i)) {
+        P -= eigenvectors.col(i) * eigenvectors.col(i).transpose();
+      }
+    }
+    return P;
+  }
+};
+
+//! milliseconds since start
+inline double elapsed_ms(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
 template<typename PointSource, typename PointTarget>
 class LsqRegistration : public pcl::Registration<PointSource, PointTarget, float> {
@@ -54,6 +139,12 @@ public:
 
   const Eigen::Matrix<double, 6, 6>& getFinalHessian() const;
 
+  /**
+   * @brief Covariance of the last 6-DoF estimate, the inverse of the final Hessian (rotation first, then translation).
+   *        Only meaningful after align() with GaussNewton, LevenbergMarquardt or CT_LevenbergMarquardt.
+   */
+  Eigen::Matrix<double, 6, 6> getFinalCovariance() const;
+
   double evaluateCost(const Eigen::Matrix4f& relative_pose, Eigen::Matrix<double, 6, 6>* H = nullptr, Eigen::Matrix<double, 6, 1>* b = nullptr);
 
   virtual void swapSourceAndTarget() {}
@@ -61,6 +152,32 @@ public:
   virtual void clearTarget() {}
   void setOptimizerType(LSQ_OPTIMIZER_TYPE optimizier_type_);
 
+  /**
+   * @brief Keep the correspondences across outer iterations: they are searched again every interval linearizations,
+   *        or earlier once the pose moved more than rotation_threshold (rad) or translation_threshold (m) from the pose
+   *        they were found at. Rejected LM steps never re-associate, and convergence on cached correspondences
+   *        triggers one more association before it is accepted. interval 1 (default) re-associates on every linearization.
+   */
+  void setCorrespondenceUpdate(int interval, double rotation_threshold, double translation_threshold);
+
+  const RegistrationTiming& getTiming() const { return timing_; }
+
+  /**
+   * @brief Eigenvalues of the rotation/translation Hessian blocks below ratio times the largest of the same block are
+   *        reported as degenerate in getResult(). Relative to the block, so independent of the number of
+   *        correspondences and their weights. 0 (default) reports none.
+   */
+  void setDegeneracyThreshold(double ratio);
+
+  /**
+   * @brief Stop align() after the first iteration, keeping the initial guess, when fewer than this fraction of the
+   *        source points found a correspondence: a frame that cannot be registered then costs one association instead
+   *        of a whole optimization. 0 (default) never stops.
+   */
+  void setMinInlierRatio(double ratio);
+
+  const RegistrationResult& getResult() const { return result_; }
+
 protected:
 
   virtual void computeTranslation(PointCloudSource& output, Eigen::Vector3d& trans,
@@ -71,6 +188,13 @@ protected:
 
   virtual void computeTransformation(PointCloudSource& output, const Matrix4& guess) override;
 
+  /**
+   * @brief Iterate step_optimize() from x0 until convergence or max_iterations, starting with fresh correspondences and
+   *        LM damping. The convergence thresholds are multiplied by epsilon_scale. Sets converged_.
+   * @return number of iterations run
+   */
+  int optimize(Eigen::Isometry3d& x0, int max_iterations, double epsilon_scale);
+
   bool is_converged(const Eigen::Isometry3d& delta) const;
 
   virtual double linearize(const Eigen::Isometry3d& trans, Eigen::Matrix<double, 6, 6>* H = nullptr, Eigen::Matrix<double, 6, 1>* b = nullptr) = 0;
@@ -93,8 +217,24 @@ protected:
                        const double& interval_tn, const double& interval_tn_1);
   bool is_t_converged(const Eigen::Vector3d& delta) const;
 
+  /**
+   * @brief Whether the correspondences have to be searched again before linearizing at x, see setCorrespondenceUpdate.
+   *        Counts the linearization, and records x as the association pose when returning true.
+   */
+  bool should_update_correspondences(const Eigen::Isometry3d& x);
+  void invalidate_correspondences() { correspondence_age_ = -1; }
+
+  //! fraction of the source points with a correspondence at the last association
+  virtual double inlier_ratio() const { return 1.0; }
+
+  //! fill result_ after an align() that ran the given iterations
+  void finish_result(int iterations);
+  //! eigen decomposition and degeneracy bits of one Hessian block, shift 0 for rotation and 3 for translation
+  void analyze_block(const Eigen::Matrix3d& H, Eigen::Vector3d& eigenvalues, Eigen::Matrix3d& eigenvectors, int shift);
+
 protected:
   double rotation_epsilon_;
+  double epsilon_scale_;  // scale of the convergence thresholds during optimize()
 
   LSQ_OPTIMIZER_TYPE lsq_optimizer_type_;
   int lm_max_iterations_;
@@ -104,6 +244,19 @@ protected:
 
   Eigen::Matrix<double, 6, 6> final_hessian_;
   Eigen::Matrix<double, 3, 3> so3_final_hessian_;
+  Eigen::Matrix<double, 3, 3> t3_final_hessian_;  // translation block of the last computeTranslation()
+
+  double degeneracy_ratio_;
+  double min_inlier_ratio_;
+  RegistrationResult result_;
+
+  int correspondence_update_interval_;
+  double correspondence_rotation_threshold_;
+  double correspondence_translation_threshold_;
+  int correspondence_age_;                    // linearizations since the last association, -1 when there is none
+  Eigen::Isometry3d correspondence_pose_;
+
+  RegistrationTiming timing_;
 };
 }  // namespace fast_gicp
 
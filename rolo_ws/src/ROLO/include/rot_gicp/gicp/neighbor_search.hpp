@@ -0,0 +1,31 @@
+#ifndef FAST_GICP_NEIGHBOR_SEARCH_HPP
+#define FAST_GICP_NEIGHBOR_SEARCH_HPP
+
+#include <memory>
+#include <Eigen/Core>
+
+namespace fast_gicp {
+
+/**
+ * @brief Neighbor search backend for covariance estimation, used in place of the KdTree
+ *        when the input cloud has a cheaper structure to exploit (e.g. an organized range image)
+ */
+template <typename PointT>
+class NeighborSearch {
+public:
+  using Ptr = std::shared_ptr<NeighborSearch<PointT>>;
+  using ConstPtr = std::shared_ptr<const NeighborSearch<PointT>>;
+
+  virtual ~NeighborSearch() {}
+
+  /**
+   * @brief Find up to k neighbors of query. Neighbors are written to the first columns of neighbors (4 x k)
+   *        as homogeneous points expressed in the frame of the query. Called concurrently from several threads.
+   * @return number of neighbors found (columns of neighbors)
+   */
+  virtual int knn(const PointT& query, int k, Eigen::Matrix<double, 4, -1>& neighbors) const = 0;
+};
+
+}  // namespace fast_gicp
+
+#endif
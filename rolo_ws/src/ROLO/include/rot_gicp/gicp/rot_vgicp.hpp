@@ -1,7 +1,9 @@
 #ifndef ROT_VGICP_HPP
 #define ROT_VGICP_HPP
 
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
@@ -14,12 +16,25 @@
 
 #include <rot_gicp/gicp/lsq_registration.hpp>
 #include <rot_gicp/gicp/gicp_settings.hpp>
+#include <rot_gicp/gicp/covariance_estimation.hpp>
+#include <rot_gicp/gicp/neighbor_search.hpp>
+#include <rot_gicp/gicp/linearize_kernels.hpp>
 #include <rot_gicp/gicp/vmp_voxel.hpp>
+#include <rot_gicp/gicp/worker_pool.hpp>
 
 namespace fast_gicp {
 
 /**
- * @brief Rotation GICP algorithm boosted with OpenMP
+ * @brief One level of the coarse-to-fine voxel pyramid, see RotVGICP::setVoxelPyramid
+ */
+struct VoxelPyramidLevel {
+  double resolution;
+  NeighborSearchMethod search_method;
+  int max_iterations;  // LM iterations on this level, <= 0 for the maximum iterations of the registration
+};
+
+/**
+ * @brief Rotation GICP algorithm, parallel loops run on a persistent WorkerPool
  */
 template<typename PointSource, typename PointTarget>
 class RotVGICP : public LsqRegistration<PointSource, PointTarget> {
@@ -63,10 +78,24 @@ protected:
   typedef pcl::search::KdTree<PointTarget> SearchMethodTarget;
   std::shared_ptr<SearchMethodSource> search_source_;
   std::shared_ptr<SearchMethodTarget> search_target_;
+  // optional backends replacing the KdTree in covariance estimation
+  typename NeighborSearch<PointSource>::ConstPtr source_neighbor_search_;
+  typename NeighborSearch<PointTarget>::ConstPtr target_neighbor_search_;
 
   std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> source_covs_;
   std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> target_covs_;
 
+  double covariance_voxel_size_;
+  // scratch maps of the voxel scatter estimator, kept so that their storage is reused
+  std::unique_ptr<VmfVoxelMap<PointSource>> source_scatter_voxels_;
+  std::unique_ptr<VmfVoxelMap<PointTarget>> target_scatter_voxels_;
+
+  // created on first use with num_threads_ workers unless given by setWorkerPool
+  std::shared_ptr<WorkerPool> pool_;
+  // per-worker neighbor buffers of calculate_covariances, kept so that their storage is reused
+  std::vector<std::vector<int>> worker_indices_;
+  std::vector<std::vector<float>> worker_sq_distances_;
+  std::vector<Eigen::Matrix<double, 4, -1>> worker_neighbors_;
 
 public:
   RotVGICP();
@@ -76,20 +105,73 @@ public:
   void setVoxelAccumulationMode(VoxelAccumulationMode mode);
   void setNeighborSearchMethod(NeighborSearchMethod method);
 
+  /**
+   * @brief Register coarse-to-fine on the given levels (coarsest first), each starting from the result of the previous one.
+   *        All levels are built in one pass over the target. A level ends when converged with the thresholds scaled by
+   *        its resolution relative to the finest level, or after its max_iterations, which bounds the total iterations.
+   *        computeTranslation() and evaluateCost() use the finest level. An empty list (default) registers on one
+   *        level with setResolution() and setNeighborSearchMethod().
+   */
+  void setVoxelPyramid(const std::vector<VoxelPyramidLevel>& levels);
+
   virtual void swapSourceAndTarget() override;
   virtual void setInputTarget(const PointCloudTargetConstPtr& cloud) override;
 
+  //! Number of threads of the worker pool owned by the registration, 0 for all hardware threads; replaces a pool given by setWorkerPool
   void setNumThreads(int n);
+
+  /**
+   * @brief Run the parallel loops on the given pool, e.g. one pinned to the cores reserved for this node or shared
+   *        by several registrations used from the same thread. nullptr returns to an owned pool with as many workers.
+   */
+  void setWorkerPool(const std::shared_ptr<WorkerPool>& pool);
   void setCorrespondenceRandomness(int k);
   void setRegularizationMethod(RegularizationMethod method);
 
+  /**
+   * @brief Estimate covariances from the scatter of the points sharing a voxel of this size instead of the k nearest
+   *        neighbors in a KdTree, see estimate_voxel_covariances(). 0 (default) restores the k nearest neighbors;
+   *        a neighbor search backend given by setSourceNeighborSearch()/setTargetNeighborSearch() takes precedence.
+   */
+  void setCovarianceVoxelSize(double size);
+
   virtual void clearSource() override;
   virtual void clearTarget() override;
 
   virtual void setInputSource(const PointCloudSourceConstPtr& cloud) override;
+
+  /**
+   * @brief Use the current target as the next source without recomputing its covariances.
+   *        cloud must hold the target points, in the same order, transformed by transform (e.g. the previous frame
+   *        propagated by the motion guess); the target covariances are rotated into the source covariances.
+   *        The target is cleared afterwards, the voxel map storage is kept for the next target.
+   * @return false if there is no target with covariances of the same size as cloud; nothing is changed then
+   */
+  bool reuseTargetAsSource(const PointCloudSourceConstPtr& cloud, const Eigen::Isometry3d& transform);
+
+  /**
+   * @brief Register against voxel maps maintained outside, e.g. a local map updated incrementally across frames, instead
+   *        of voxelizing the target cloud: one map per pyramid level, or a single map without pyramid. target_from_map
+   *        maps the voxel statistics into the target frame in which the transformation is estimated, so the rotation
+   *        is still taken about the target origin. The maps must not change during align(). A one-point placeholder
+   *        replaces the target cloud that pcl::Registration::align() requires; setInputTarget() or clearTarget()
+   *        returns to voxelizing a target cloud.
+   */
+  void setTargetVoxelMaps(const std::vector<std::shared_ptr<const VmfVoxelMap<PointTarget>>>& maps, const Eigen::Isometry3d& target_from_map);
+
+  //! Estimate the source covariances now if they are missing, e.g. to insert the source into a map before any align()
+  void calculateSourceCovariances();
+
   virtual void setSourceCovariances(const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covs);
   virtual void setTargetCovariances(const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covs);
 
+  /**
+   * @brief Estimate source/target covariances with the given backend instead of a KdTree built on the input cloud.
+   *        Queries are the points of the input cloud. Reset by clearSource()/clearTarget(), nullptr restores the KdTree.
+   */
+  void setSourceNeighborSearch(const typename NeighborSearch<PointSource>::ConstPtr& search);
+  void setTargetNeighborSearch(const typename NeighborSearch<PointTarget>::ConstPtr& search);
+
   const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& getSourceCovariances() const {
     return source_covs_;
   }
@@ -102,6 +184,15 @@ public:
                           const Eigen::Vector3d& init_guess, const Eigen::Vector3d& last_t0, 
                           const double interval_tn, const double interval_tn_1, const float ct_lambda);
 
+  /**
+   * @brief Continuous-time translation prior of the CT_LevenbergMarquardt optimizer: the same term computeTranslation()
+   *        adds, lambda/N * c^T (sum of the weighted mahalanobis matrices) c with c = -(init_guess + t) / interval_tn,
+   *        where t is the translation of the estimated transformation. With it align() replaces align() with
+   *        SO3_LevenbergMarquardt followed by computeTranslation(): rotation and translation are solved on one set of
+   *        correspondences per iteration and getFinalCovariance() covers both.
+   */
+  void setTranslationPrior(const Eigen::Vector3d& init_guess, double interval_tn, float ct_lambda);
+
 protected:
   virtual void computeTransformation(PointCloudSource& output, const Matrix4& guess) override;
   virtual void update_correspondences(const Eigen::Isometry3d& trans);
@@ -117,16 +208,71 @@ protected:
   template <typename PointT>
   bool calculate_covariances(const typename pcl::PointCloud<PointT>::ConstPtr& cloud, pcl::search::Search<PointT>& kdtree, std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covariances);
 
+  template <typename PointT>
+  bool calculate_covariances(const typename pcl::PointCloud<PointT>::ConstPtr& cloud, const NeighborSearch<PointT>& search, std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covariances);
+
+  //! covariances with the neighbor search backend if given, else from voxel scatter or the KdTree, see setCovarianceVoxelSize
+  template <typename PointT>
+  void estimate_covariances(const typename pcl::PointCloud<PointT>::ConstPtr& cloud, const typename NeighborSearch<PointT>::ConstPtr& search,
+                            pcl::search::Search<PointT>& kdtree, std::unique_ptr<VmfVoxelMap<PointT>>& scatter_voxels,
+                            std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covariances);
+
+  Eigen::Matrix4d regularize_covariance(const Eigen::Matrix4d& cov) const;
+
+  void build_voxelmap();
+
+  //! map used by update_correspondences on the given level
+  const VmfVoxelMap<PointTarget>& voxelmap(int index) const {
+    return target_voxelmaps_.empty() ? *voxelmaps_[index] : *target_voxelmaps_[index];
+  }
+
+  WorkerPool& pool();
+
+  virtual double inlier_ratio() const override { return input_ && !input_->empty() ? (double)matched_points_ / input_->size() : 0.0; }
+
+  int num_levels() const { return pyramid_.empty() ? 1 : (int)pyramid_.size(); }
+  //! resolution, neighbor search and iterations of a pyramid level, the single level when there is no pyramid
+  VoxelPyramidLevel level(int index) const;
+
+  /**
+   * @brief Sum the linearization of the current correspondences under trans with the float kernels, see LinearizeSum.
+   *        Sums of fixed-size chunks are reduced in double in chunk order, so the result does not depend on the threads.
+   */
+  void accumulate_correspondences(const Eigen::Isometry3d& trans, LinearizeMode mode, double* sums);
+
+  /**
+   * @brief Cost of the translation prior at trans from the sums of accumulate_correspondences (SUM_H_TT is filled in
+   *        every mode); adds its Hessian and gradient under the left perturbation of linearize() when H and b are given.
+   */
+  double translation_prior(const Eigen::Isometry3d& trans, const double* sums, Eigen::Matrix<double, 6, 6>* H, Eigen::Matrix<double, 6, 1>* b) const;
+
 protected:
   double voxel_resolution_;
   float lambda_;
+  Eigen::Vector3d ct_init_guess_;   // translation prior of CT_LevenbergMarquardt, see setTranslationPrior
+  double ct_interval_;
   NeighborSearchMethod search_method_;
   VoxelAccumulationMode voxel_mode_;
 
-  std::unique_ptr<VmfVoxelMap<PointTarget>> voxelmap_;
+  std::vector<VoxelPyramidLevel> pyramid_;
+  int level_;  // level used by update_correspondences
+
+  // one map per level, kept across targets so that their hash tables and voxel arrays are reused, rebuilt when voxelmap_valid_ is false
+  std::vector<std::unique_ptr<VmfVoxelMap<PointTarget>>> voxelmaps_;
+  bool voxelmap_valid_;
+
+  // maps given by setTargetVoxelMaps, replacing voxelmaps_ when not empty
+  std::vector<std::shared_ptr<const VmfVoxelMap<PointTarget>>> target_voxelmaps_;
+  Eigen::Isometry3d target_from_map_;
+  PointCloudTargetConstPtr placeholder_target_;
 
-  std::vector<std::pair<int, VmfVoxel::Ptr>> voxel_correspondences_;
-  std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> voxel_mahalanobis_;
+  std::vector<VoxelCorrespondence> voxel_correspondences_;
+  // correspondences found per chunk of source points, concatenated in chunk order; storage reused across updates
+  std::vector<std::vector<VoxelCorrespondence>> chunk_correspondences_;
+  std::vector<double> chunk_sums_;  // per-chunk sums of accumulate_correspondences
+  int matched_points_;              // source points with at least one correspondence
+  // single precision SoA copy of the correspondences with the weighted mahalanobis matrices, filled by update_correspondences
+  CorrespondenceBuffer correspondence_buffer_;
 };
 }  // namespace fast_gicp
 
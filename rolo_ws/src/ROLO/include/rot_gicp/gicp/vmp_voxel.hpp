@@ -3,8 +3,11 @@
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
-#include <unordered_map>
-#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
 #include <rot_gicp/gicp/gicp_settings.hpp>
 
 namespace fast_gicp {
@@ -45,34 +48,73 @@ static std::vector<Eigen::Vector3i, Eigen::aligned_allocator<Eigen::Vector3i>> n
   return offsets27;
 }
 
-class Vector3iHash {
-public:
-  size_t operator()(const Eigen::Vector3i& x) const {
-    size_t seed = 0;
-    boost::hash_combine(seed, x[0]);
-    boost::hash_combine(seed, x[1]);
-    boost::hash_combine(seed, x[2]);
-    return seed;
-  }
-};
 
+//! 莫顿码：x/y/z各取低21位交错排列，空间上相邻的体素编码也相近
+inline uint64_t morton_split3(uint32_t v) {
+  uint64_t x = v & 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffull;
+  x = (x | x << 16) & 0x1f0000ff0000ffull;
+  x = (x | x << 8) & 0x100f00f00f00f00full;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
+}
+
+inline uint64_t morton_code(int x, int y, int z) {
+  return morton_split3((uint32_t)x) | (morton_split3((uint32_t)y) << 1) | (morton_split3((uint32_t)z) << 2);
+}
+
+//! 体素内点的统计量，按值存放在VmfVoxelMap的连续数组中
 struct VmfVoxel {
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  using Ptr = std::shared_ptr<VmfVoxel>;
 
   VmfVoxel() {
+    reset();
+  }
+
+  void append(const Eigen::Vector4d& dir_, const Eigen::Matrix4d& conv_) {
+    num_points++;
+    // dir_是点的坐标，累加量与均值分开保存，点可以再删除
+    sum_dir += dir_;
+    sum_cov += conv_;
+  }
+
+  // 删除之前append过的点，参数须与append时相同
+  void remove(const Eigen::Vector4d& dir_, const Eigen::Matrix4d& conv_) {
+    num_points--;
+    sum_dir -= dir_;
+    sum_cov -= conv_;
+  }
+
+  // 由累加量计算均值和协方差，可以重复调用
+  void finalize() {
+    if (num_points <= 0) {
+      return;
+    }
+    mean_dir = sum_dir / num_points;
+    // mean_dir(3) = 1;
+    r_bar = sum_dir.norm() / num_points;
+    if(r_bar < 1 || r_bar > 1.732051){  // avoid Nan
+      kappa = r_bar * (3-r_bar*r_bar) / (1-r_bar*r_bar);
+    }
+    else{
+      kappa = 3*r_bar*(1 + 0.6*pow(r_bar, 2) + 99.0/175.0 * pow(r_bar, 4));
+    }
+    cov = sum_cov / num_points;
+  }
+
+  void reset() {
     num_points = 0;
     mean_dir.setZero();
     kappa = 0;
     r_bar = 0;
     cov.setZero();
+    sum_dir.setZero();
+    sum_cov.setZero();
+    coord.setZero();
+    pending = false;
   }
-  virtual ~VmfVoxel() {}
-  // 虚函数后面“=0”，代表此函数一个纯虚函数，在子类中必须重写
-  virtual void append(const Eigen::Vector4d& dir_, const Eigen::Matrix4d& conv_) = 0;
-
-  virtual void finalize() = 0;
 
 public:
   int num_points;
@@ -80,35 +122,18 @@ public:
   double r_bar;
   double kappa;
   Eigen::Matrix4d cov;
-};
 
-struct AdditiveVmfVoxel : VmfVoxel {
-public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-
-  AdditiveVmfVoxel() : VmfVoxel() {}
-  virtual ~AdditiveVmfVoxel() {}
-  virtual void append(const Eigen::Vector4d& dir_, const Eigen::Matrix4d& conv_) override {
-    num_points++;
-    // dir_是点的坐标,先转为单位向量
-    mean_dir += dir_;
-    r_bar = mean_dir.norm() / num_points;
-    cov += conv_;
-  }
-  
-  virtual void finalize() override {
-    mean_dir /= num_points;
-    // mean_dir(3) = 1;
-    if(r_bar < 1 || r_bar > 1.732051){  // avoid Nan
-      kappa = r_bar * (3-r_bar*r_bar) / (1-r_bar*r_bar);
-    }
-    else{
-      kappa = 3*r_bar*(1 + 0.6*pow(r_bar, 2) + 99.0/175.0 * pow(r_bar, 4));
-    }
-    cov /= num_points;
-  }
+  Eigen::Vector4d sum_dir;  // 点坐标之和
+  Eigen::Matrix4d sum_cov;  // 协方差之和
+  Eigen::Vector3i coord;    // 体素坐标
+  bool pending;             // 有点插入或删除，尚未finalize
 };
 
+//! 点与体素的对应关系：源点云中的索引，体素在VmfVoxelMap中的索引
+struct VoxelCorrespondence {
+  uint32_t source;
+  uint32_t voxel;
+};
 
 // struct MultiplicativeGaussianVoxel : GaussianVoxel {
 // public:
@@ -155,42 +180,107 @@ public:
 //   }
 // };
 
+
+//! 体素地图：开放寻址（线性探测）哈希表，以体素坐标的莫顿码为哈希，表中只存坐标和体素索引，
+//! 体素本身按值存放在连续数组中。查询时不分配内存、不修改引用计数，可以在多个线程中并发调用
 template<typename PointT>
 class VmfVoxelMap {
 public:
   VmfVoxelMap(double resolution, VoxelAccumulationMode mode) : voxel_resolution_(resolution), voxel_mode_(mode) {}
   //! 为点云创建一个新的体素地图
   void create_voxelmap(const pcl::PointCloud<PointT>& cloud, const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covs) {
-    voxels_.clear();
+    clear();
+    insert(cloud, covs);
+    finalize();
+  }
+
+  //! 增量插入点，之后调用finalize更新受影响的体素
+  void insert(const pcl::PointCloud<PointT>& cloud, const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covs) {
     for(int i = 0; i < cloud.size(); i++) {
-      Eigen::Vector3i coord = voxel_coord(cloud.at(i).getVector4fMap().template cast<double>());
-
-      auto found = voxels_.find(coord);
-      // 未分配体素，则为其新分配一个体素
-      if(found == voxels_.end()) {
-        VmfVoxel::Ptr voxel;
-        switch(voxel_mode_) {
-          case VoxelAccumulationMode::ADDITIVE:
-          case VoxelAccumulationMode::ADDITIVE_WEIGHTED:
-            voxel = std::shared_ptr<AdditiveVmfVoxel>(new AdditiveVmfVoxel);
-            break;
-          case VoxelAccumulationMode::MULTIPLICATIVE:
-            voxel = std::shared_ptr<AdditiveVmfVoxel>(new AdditiveVmfVoxel);
-            break;
-        }
-        // found是一个迭代器指针
-        found = voxels_.insert(found, std::make_pair(coord, voxel));
+      insert(cloud.at(i).getVector4fMap().template cast<double>(), covs[i]);
+    }
+  }
+
+  //! 插入一个点，同一个点云要插入多个体素地图时（如体素金字塔）只需遍历一次点云
+  void insert(const Eigen::Vector4d& point, const Eigen::Matrix4d& cov) {
+    Eigen::Vector3i coord = voxel_coord(point);
+
+    size_t slot = find_slot(coord);
+    // 未分配体素，则为其新分配一个体素
+    if(slots_.empty() || slots_[slot].index == kEmpty) {
+      if((voxels_.size() + 1) * 2 > slots_.size()) {
+        rehash(std::max<size_t>(slots_.size() * 2, kMinSlots));
+        slot = find_slot(coord);
       }
+      slots_[slot] = Slot{coord.x(), coord.y(), coord.z(), (uint32_t)voxels_.size()};
+      voxels_.emplace_back();
+      voxels_.back().coord = coord;
+    }
+
+    VmfVoxel& voxel = voxels_[slots_[slot].index]; // 找到对应体素
+    voxel.append(point, cov); // 存储的值进行更新
+    mark_pending(slots_[slot].index);
+  }
 
-      auto& voxel = found->second; // 找到对应体素
-      voxel->append(cloud.at(i).getVector4fMap().template cast<double>(), covs[i]); // 存储的值进行更新
+  //! 删除之前插入的点，坐标和协方差须与插入时相同；之后调用finalize，点数为0的体素被移除
+  void evict(const pcl::PointCloud<PointT>& cloud, const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>>& covs) {
+    for(int i = 0; i < cloud.size(); i++) {
+      evict(cloud.at(i).getVector4fMap().template cast<double>(), covs[i]);
     }
+  }
+
+  //! 删除一个之前插入的点
+  void evict(const Eigen::Vector4d& point, const Eigen::Matrix4d& cov) {
+    int index = lookup_index(voxel_coord(point));
+    if(index < 0) {
+      return;
+    }
+    voxels_[index].remove(point, cov);
+    mark_pending(index);
+  }
 
-    for(auto& voxel : voxels_) {
-      voxel.second->finalize(); // 归一化
+  //! 只重新计算insert/evict之后变化的体素。移除空体素时，数组末尾的体素移到空出的位置，体素索引随之改变
+  void finalize() {
+    std::vector<uint32_t> empty;
+    for(uint32_t index : pending_) {
+      VmfVoxel& voxel = voxels_[index];
+      voxel.pending = false;
+      if(voxel.num_points <= 0) {
+        empty.push_back(index);
+        continue;
+      }
+      voxel.finalize(); // 归一化
+    }
+    pending_.clear();
+
+    // 从大到小删除，被移动的末尾体素不会是待删除的体素
+    std::sort(empty.begin(), empty.end(), std::greater<uint32_t>());
+    for(uint32_t index : empty) {
+      erase_slot(find_slot(voxels_[index].coord));
+      const uint32_t last = voxels_.size() - 1;
+      if(index != last) {
+        voxels_[index] = voxels_[last];
+        slots_[find_slot(voxels_[index].coord)].index = index;
+      }
+      voxels_.pop_back();
     }
   }
 
+  //! 清空体素，保留哈希表和体素数组的容量，下次插入时复用
+  void clear() {
+    std::fill(slots_.begin(), slots_.end(), Slot{0, 0, 0, kEmpty});
+    voxels_.clear();
+    pending_.clear();
+  }
+
+  size_t size() const {
+    return voxels_.size();
+  }
+
+  double resolution() const {
+    return voxel_resolution_;
+  }
+
   Eigen::Vector3i voxel_coord(const Eigen::Vector4d& x) const {
     return (x.array() / voxel_resolution_ - 0.5).floor().template cast<int>().template head<3>();
   }
@@ -200,21 +290,102 @@ public:
     return Eigen::Vector4d(origin[0], origin[1], origin[2], 1.0f);
   }
 
-  VmfVoxel::Ptr lookup_voxel(const Eigen::Vector3i& coord) const {
-    auto found = voxels_.find(coord);
-    if(found == voxels_.end()) {
-      return nullptr;
+  //! 体素索引，不存在时返回-1
+  int lookup_index(const Eigen::Vector3i& coord) const {
+    if(slots_.empty()) {
+      return -1;
     }
+    const Slot& slot = slots_[find_slot(coord)];
+    return slot.index == kEmpty ? -1 : (int)slot.index;
+  }
 
-    return found->second;
+  const VmfVoxel* lookup_voxel(const Eigen::Vector3i& coord) const {
+    int index = lookup_index(coord);
+    return index < 0 ? nullptr : &voxels_[index];
+  }
+
+  const VmfVoxel& voxel(uint32_t index) const {
+    return voxels_[index];
   }
 
 private:
+  enum : uint32_t { kEmpty = 0xffffffffu, kMinSlots = 1024 };
+
+  struct Slot {
+    int32_t x, y, z;
+    uint32_t index;   // 体素在voxels_中的索引，kEmpty为空槽
+  };
+
+  size_t slot_hash(int x, int y, int z) const {
+    // 莫顿码的低3位是体素在2x2x2块内的位置，块内8个体素落在相邻的槽中；
+    // 块编码乘以黄金分割常数打散，避免线性探测时空间上连续的体素形成长的探测链
+    uint64_t code = morton_code(x, y, z);
+    uint64_t block = (code >> 3) * 0x9e3779b97f4a7c15ull;
+    return (size_t)(((block >> (64 - slot_bits_)) << 3) | (code & 7)) & (slots_.size() - 1);
+  }
+
+  //! coord所在的槽，不存在时为探测序列上的第一个空槽
+  size_t find_slot(const Eigen::Vector3i& coord) const {
+    if(slots_.empty()) {
+      return 0;
+    }
+    const size_t mask = slots_.size() - 1;
+    size_t i = slot_hash(coord.x(), coord.y(), coord.z());
+    while(slots_[i].index != kEmpty && (slots_[i].x != coord.x() || slots_[i].y != coord.y() || slots_[i].z != coord.z())) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  //! 线性探测的删除：把后续槽中可以前移的项前移，不留墓碑
+  void erase_slot(size_t i) {
+    const size_t mask = slots_.size() - 1;
+    size_t j = i;
+    while(true) {
+      j = (j + 1) & mask;
+      if(slots_[j].index == kEmpty) {
+        break;
+      }
+      size_t k = slot_hash(slots_[j].x, slots_[j].y, slots_[j].z);
+      // k在循环区间(i, j]内时，j处的项不能移到i
+      bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+      if(!stays) {
+        slots_[i] = slots_[j];
+        i = j;
+      }
+    }
+    slots_[i].index = kEmpty;
+  }
+
+  void rehash(size_t capacity) {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.assign(capacity, Slot{0, 0, 0, kEmpty});
+    slot_bits_ = 0;
+    while(((size_t)1 << slot_bits_) < capacity) {
+      slot_bits_++;
+    }
+    for(const Slot& slot : old) {
+      if(slot.index != kEmpty) {
+        slots_[find_slot(Eigen::Vector3i(slot.x, slot.y, slot.z))] = slot;
+      }
+    }
+  }
+
+  void mark_pending(uint32_t index) {
+    if(!voxels_[index].pending) {
+      voxels_[index].pending = true;
+      pending_.push_back(index);
+    }
+  }
+
   double voxel_resolution_;
-  VoxelAccumulationMode voxel_mode_;
+  VoxelAccumulationMode voxel_mode_;  // 目前各模式都按ADDITIVE累加
 
-  using VoxelMap = std::unordered_map<Eigen::Vector3i, VmfVoxel::Ptr, Vector3iHash, std::equal_to<Eigen::Vector3i>, Eigen::aligned_allocator<std::pair<const Eigen::Vector3i, VmfVoxel::Ptr>>>;
-  VoxelMap voxels_;
+  std::vector<Slot> slots_;   // 槽数为2的幂，负载不超过1/2
+  int slot_bits_ = 0;
+  std::vector<VmfVoxel, Eigen::aligned_allocator<VmfVoxel>> voxels_;
+  std::vector<uint32_t> pending_; // 待finalize的体素
 };
 
 }  // namespace fast_gicp
@@ -0,0 +1,106 @@
+#ifndef FAST_GICP_WORKER_POOL_HPP
+#define FAST_GICP_WORKER_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fast_gicp {
+
+/**
+ * @brief Persistent worker threads for the parallel loops of the registration, replacing an OpenMP fork/join region
+ *        per loop. A loop is split into chunks of a fixed grain that the workers and the calling thread claim from a
+ *        shared counter, so uneven chunks are balanced without a per-thread schedule. Between loops the workers spin
+ *        briefly before they sleep, which keeps the back-to-back loops of one align() from paying a wake-up each.
+ *        Workers can be pinned to a set of cores so that several nodes do not oversubscribe the same cores.
+ *        Loops submitted from several threads run one after another.
+ */
+class WorkerPool {
+public:
+  using Ptr = std::shared_ptr<WorkerPool>;
+
+  /**
+   * @param num_workers  threads taking part in a loop, including the calling thread; <= 0 for all hardware threads
+   * @param cores        CPU ids, worker i (1..num_workers-1) is pinned to cores[i % cores.size()] so that with as many
+   *                     workers as cores, cores[0] is left to the calling thread, which is not pinned. Empty for no pinning
+   */
+  explicit WorkerPool(int num_workers, const std::vector<int>& cores = std::vector<int>());
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  int num_workers() const { return (int)threads_.size() + 1; }
+  const std::vector<int>& cores() const { return cores_; }
+
+  /**
+   * @brief Call func(worker, begin, end) on the chunks [begin, end) of [0, n) with end - begin = grain except for the
+   *        last one; worker in [0, num_workers()) identifies the thread for per-worker scratch, 0 is the calling
+   *        thread. Returns after all chunks are done.
+   */
+  template <typename Func>
+  void parallel_for(int n, int grain, const Func& func) {
+    if (n <= 0) {
+      return;
+    }
+    grain = std::max(grain, 1);
+    const int chunks = (n + grain - 1) / grain;
+    if (chunks == 1 || threads_.empty()) {
+      for (int c = 0; c < chunks; c++) {
+        func(0, c * grain, std::min(n, (c + 1) * grain));
+      }
+      return;
+    }
+
+    Job job;
+    job.invoke = &invoke<Func>;
+    job.func = &func;
+    job.n = n;
+    job.grain = grain;
+    job.chunks = chunks;
+    run(job);
+  }
+
+  //! Pin the calling thread to cores (any of them), false if not supported or cores is empty
+  static bool pin_current_thread(const std::vector<int>& cores);
+
+private:
+  struct Job {
+    void (*invoke)(const void* func, int worker, int begin, int end) = nullptr;
+    const void* func = nullptr;
+    int n = 0;
+    int grain = 1;
+    int chunks = 0;
+  };
+
+  template <typename Func>
+  static void invoke(const void* func, int worker, int begin, int end) {
+    (*static_cast<const Func*>(func))(worker, begin, end);
+  }
+
+  void run(const Job& job);
+  void worker_loop(int worker);
+  void work(int worker);
+
+  std::vector<std::thread> threads_;
+  std::vector<int> cores_;
+
+  std::mutex submit_mutex_;  // one loop at a time
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  Job job_;
+  std::atomic<uint64_t> generation_;  // incremented for every loop, workers wait for a new value
+  std::atomic<int> next_chunk_;
+  std::atomic<int> active_;           // workers that have not finished the current loop
+  std::atomic<bool> stop_;
+};
+
+}  // namespace fast_gicp
+
+#endif
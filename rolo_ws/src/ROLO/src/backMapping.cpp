@@ -1,4 +1,13 @@
 #include "rolo/utility.h"
+#include "rolo/pipeline.h"
+#include "rolo/incrementalPointMap.h"
+#include "rolo/keyframeCloudCache.h"
+#include "rolo/scanAssociation.h"
+#include "rolo/mappingScheduler.h"
+
+#include <omp.h>
+
+#include <map>
 // #include "rolo/save_map.h"
 
 #include <gtsam/geometry/Rot3.h>
@@ -46,7 +55,23 @@ POINT_CLOUD_REGISTER_POINT_STRUCT (PointXYZIRPYT,
 
 typedef PointXYZIRPYT  PointTypePose;
 
-class backMapping : public ParamLoader
+/*
+* 扫描匹配线程交给因子图线程的关键帧
+*/
+struct KeyframeJob
+{
+    int id;                     // 关键帧索引
+    ros::Time stamp;
+    Eigen::Affine3f pose;       // 扫描匹配得到的位姿，第一个关键帧的先验
+    Eigen::Affine3f relative;   // 相对上一个关键帧的位姿变换，作为里程计因子
+    pcl::PointCloud<PointType>::Ptr corner; // 降采样后的角点和平面点，雷达坐标系
+    pcl::PointCloud<PointType>::Ptr surf;
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::shared_ptr<const KeyframeJob> KeyframeJobConstPtr;
+
+class backMapping : public ParamLoader, public rolo::PipelineStage
 {
 public:
     // gtsam
@@ -79,7 +104,7 @@ public:
     ros::ServiceServer srvSaveMap;
 
     std::deque<nav_msgs::Odometry> gpsQueue;
-    rolo::CloudInfoStamp cloudInfo;
+    rolo::CloudFrameConstPtr cloudInfo;
 
     vector<pcl::PointCloud<PointType>::Ptr> cornerCloudKeyFrames;   // 所有关键帧的角点集合（降采样）
     vector<pcl::PointCloud<PointType>::Ptr> surfCloudKeyFrames; // 所有关键帧的平面点集合（降采样）
@@ -89,9 +114,9 @@ public:
     pcl::PointCloud<PointType>::Ptr copy_cloudKeyPoses3D;
     pcl::PointCloud<PointTypePose>::Ptr copy_cloudKeyPoses6D;
 
-    pcl::PointCloud<PointType>::Ptr laserCloudCornerLast;   // 当前帧的角点集合 // corner feature set from odoOptimization
-    pcl::PointCloud<PointType>::Ptr laserCloudSurfLast;     // 当前帧的平面点集合 // surf feature set from odoOptimization
-    pcl::PointCloud<PointType>::Ptr laserCloudNormalLast;     // 当前帧的普通点集合
+    pcl::PointCloud<PointType>::ConstPtr laserCloudCornerLast;   // 当前帧的角点集合 // corner feature set from odoOptimization
+    pcl::PointCloud<PointType>::ConstPtr laserCloudSurfLast;     // 当前帧的平面点集合 // surf feature set from odoOptimization
+    pcl::PointCloud<PointType>::ConstPtr laserCloudNormalLast;     // 当前帧的普通点集合
     pcl::PointCloud<PointType>::Ptr laserCloudCornerLastDS; // 降采样后的当前帧角点集合 // downsampled corner feature set from odoOptimization
     pcl::PointCloud<PointType>::Ptr laserCloudSurfLastDS;   // 降采样后的当前帧平面点集合 // downsampled surf feature set from odoOptimization
 
@@ -100,25 +125,28 @@ public:
 
     std::vector<PointType> laserCloudOriCornerVec; // 雷达坐标系下，能够作点线匹配的点集// corner point holder for parallel computation
     std::vector<PointType> coeffSelCornerVec;   // 能够作点线匹配的点集的点线参数，线的方向单位向量和距离
-    std::vector<bool> laserCloudOriCornerFlag;  // 筛选出有效点线关系的点集Mask，初始值均为false
+    std::vector<uint8_t> laserCloudOriCornerFlag; // 筛选出有效点线关系的点集Mask，初始值均为0；各线程并发写入，不用vector<bool>
     std::vector<PointType> laserCloudOriSurfVec; // 雷达坐标系下，能够作点面匹配的点集 // surf point holder for parallel computation
     std::vector<PointType> coeffSelSurfVec;     // 能够作点面匹配的点集的点面参数，点到平面的距离和平面法向量
-    std::vector<bool> laserCloudOriSurfFlag;    // 筛选出有效点面关系的点集Mask，初始值均为false
-
-    map<int, pair<pcl::PointCloud<PointType>, pcl::PointCloud<PointType>>> laserCloudMapContainer; // map中的所有关键帧，key为索引值，value：first为角点，second为平面点
-    pcl::PointCloud<PointType>::Ptr laserCloudCornerFromMap;    // 全局坐标系下，周围关键帧的角点集合
-    pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMap;      // 全局坐标系下，周围关键帧的平面点集合
-    pcl::PointCloud<PointType>::Ptr laserCloudCornerFromMapDS;  // 降采样后的周围关键帧特征点云
-    pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMapDS;
-
-    pcl::KdTreeFLANN<PointType>::Ptr kdtreeCornerFromMap;
-    pcl::KdTreeFLANN<PointType>::Ptr kdtreeSurfFromMap;
+    std::vector<uint8_t> laserCloudOriSurfFlag;   // 筛选出有效点面关系的点集Mask，初始值均为0
+    std::vector<std::vector<int>> searchIndices;      // 每个线程的近邻搜索缓冲，预先分配，匹配时不再分配内存
+    std::vector<std::vector<float>> searchSqDistances;
+    std::vector<int> associationOffsets;            // 压缩有效匹配时每个线程写入位置的前缀和
+
+    std::unique_ptr<rolo::IncrementalPointMap<PointType>> cornerMap; // 全局坐标系下，周围关键帧的角点，按mappingCornerLeafSize降采样，增量维护
+    std::unique_ptr<rolo::IncrementalPointMap<PointType>> surfMap;   // 全局坐标系下，周围关键帧的平面点，按mappingSurfLeafSize降采样
+    // 已插入局部地图的关键帧索引，及其点云插入时的位姿：回环校正后与之比较，多次小的校正累积超过容差也会重建局部地图
+    std::map<int, Eigen::Affine3f, std::less<int>, Eigen::aligned_allocator<std::pair<const int, Eigen::Affine3f>>> keyFramesInMap;
+    std::unique_ptr<rolo::KeyframeCloudCache<PointType>> keyframeCloudCache; // 变换到全局坐标系的关键帧点云，回环校正移动了关键帧才失效
+    Eigen::Vector3f mapCenter;      // 上一次删除局部地图立方体以外网格时的位置
+    bool mapCenterValid = false;
 
     pcl::KdTreeFLANN<PointType>::Ptr kdtreeSurroundingKeyPoses;
     pcl::KdTreeFLANN<PointType>::Ptr kdtreeHistoryKeyPoses;
 
     pcl::VoxelGrid<PointType> downSizeFilterCorner;
     pcl::VoxelGrid<PointType> downSizeFilterSurf;
+    pcl::VoxelGrid<PointType> downSizeFilterGround;
     pcl::VoxelGrid<PointType> downSizeFilterICP;
     pcl::VoxelGrid<PointType> downSizeFilterSurroundingKeyPoses; // for surrounding key poses of scan-to-map optimization
     
@@ -130,11 +158,27 @@ public:
     std::mutex mtx;
     std::mutex mtxLoopInfo;
 
+    std::thread loopthread;
+    std::thread visualizeMapThread;
+
+    std::unique_ptr<rolo::StageQueue<rolo::CloudFrameConstPtr>> frameQueue; // 输入帧队列，由扫描匹配线程处理
+    std::unique_ptr<rolo::StageQueue<KeyframeJobConstPtr>> graphQueue;    // 关键帧队列，由因子图线程添加因子、优化
+    std::unique_ptr<rolo::MappingScheduler> scheduler;                    // 按处理耗时决定跳过哪些帧
+
+    // 扫描匹配线程的状态
+    bool hasKeyframe = false;
+    Eigen::Affine3f lastKeyframePose;   // 上一个关键帧的位姿，随因子图的校正一起更新
+    int submittedKeyframes = 0;
+    std::deque<std::pair<int, Eigen::Affine3f>, Eigen::aligned_allocator<std::pair<int, Eigen::Affine3f>>> pendingKeyframes; // 已提交、尚未得到优化结果的关键帧
+
+    // 因子图线程的结果，持有mtx访问
+    int estimateKeyframe = -1;          // 新优化的关键帧索引，扫描匹配线程取走后置为-1
+    Eigen::Affine3f estimatePose;
+    bool localMapStale = false;         // 回环移动了局部地图中的关键帧，局部地图需要重建
+
     bool isDegenerate = false;
-    cv::Mat matP;
+    Eigen::Matrix<double, 6, 6> matP;   // 退化时将更新量投影到非退化方向
 
-    int laserCloudCornerFromMapDSNum = 0;
-    int laserCloudSurfFromMapDSNum = 0;
     int laserCloudCornerLastDSNum = 0;
     int laserCloudSurfLastDSNum = 0;
 
@@ -151,7 +195,7 @@ public:
     Eigen::Affine3f incrementalOdometryAffineFront; // 上一时刻的全局里程计位姿
     Eigen::Affine3f incrementalOdometryAffineBack;
 
-    backMapping(){
+    backMapping(bool intraProcess = false){
         // isam初始化参数
         ISAM2Params parameters;
         parameters.relinearizeThreshold = 0.1;
@@ -164,7 +208,8 @@ public:
         pubLaserOdometryIncremental = nh.advertise<nav_msgs::Odometry> ("rolo/mapping/odometry_incremental", 1);
         pubPath                     = nh.advertise<nav_msgs::Path>("rolo/mapping/path", 1);  // 全局路径
         // Feature extration传过来的cloud_info
-        subCloud = nh.subscribe<rolo::CloudInfoStamp>(odomTopic+"/cloud_info", 1, &backMapping::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
+        if (!intraProcess)
+            subCloud = nh.subscribe<rolo::CloudInfoStamp>(odomTopic+"/cloud_info", frameQueueCapacity, &backMapping::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
 
         // 回环数据
         // subLoop  = nh.subscribe<std_msgs::Float64MultiArray>("lio_loop/loop_closure_detection", 1, &backMapping::loopInfoHandler, this, ros::TransportHints().tcpNoDelay());
@@ -186,10 +231,25 @@ public:
 
         downSizeFilterCorner.setLeafSize(mappingCornerLeafSize, mappingCornerLeafSize, mappingCornerLeafSize);
         downSizeFilterSurf.setLeafSize(mappingSurfLeafSize, mappingSurfLeafSize, mappingSurfLeafSize);
+        downSizeFilterGround.setLeafSize(mappingGroundLeafSize, mappingGroundLeafSize, mappingGroundLeafSize);
         downSizeFilterICP.setLeafSize(mappingSurfLeafSize, mappingSurfLeafSize, mappingSurfLeafSize);
         downSizeFilterSurroundingKeyPoses.setLeafSize(surroundingKeyframeDensity, surroundingKeyframeDensity, surroundingKeyframeDensity); // for surrounding key poses of scan-to-map optimization
         // 为变量分配内存空间，赋初值
         allocateMemory();
+
+        scheduler.reset(new rolo::MappingScheduler(mappingProcessInterval, mappingMaxInterval, mappingTargetLoad));
+        // 因子图积压8个关键帧后，新的关键帧不再提交，扫描匹配不等待因子图
+        graphQueue.reset(new rolo::StageQueue<KeyframeJobConstPtr>(nh, "back_mapping_graph", 8, rolo::QueuePolicy::DROP_NEWEST,
+            std::bind(&backMapping::processKeyframe, this, std::placeholders::_1)));
+        frameQueue.reset(new rolo::StageQueue<rolo::CloudFrameConstPtr>(nh, "back_mapping", frameQueueCapacity, frameQueuePolicy,
+            std::bind(&backMapping::processFrame, this, std::placeholders::_1)));
+    }
+
+    ~backMapping()
+    {
+        // 扫描匹配线程向因子图队列提交关键帧，先结束
+        frameQueue.reset();
+        graphQueue.reset();
     }
 
     //! 对输入值进行限幅输出
@@ -212,7 +272,7 @@ public:
         po->intensity = pi->intensity;
     }
     //! 对给定点云中的空间点进行给定的坐标变换
-    pcl::PointCloud<PointType>::Ptr transformPointCloud(pcl::PointCloud<PointType>::Ptr cloudIn, PointTypePose* transformIn)
+    pcl::PointCloud<PointType>::Ptr transformPointCloud(pcl::PointCloud<PointType>::ConstPtr cloudIn, PointTypePose* transformIn)
     {
         pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
 
@@ -238,6 +298,11 @@ public:
         return gtsam::Pose3(gtsam::Rot3::RzRyRx(double(thisPoint.roll), double(thisPoint.pitch), double(thisPoint.yaw)),
                                   gtsam::Point3(double(thisPoint.x),    double(thisPoint.y),     double(thisPoint.z)));
     }
+    //! 将Eigen的位姿转换为gtsam的pose3格式
+    gtsam::Pose3 affine3fTogtsamPose3(const Eigen::Affine3f& pose)
+    {
+        return gtsam::Pose3(gtsam::Rot3(pose.linear().cast<double>()), gtsam::Point3(pose.translation().cast<double>()));
+    }
     //! 将位姿数组转换为gtsam的pose3格式
     gtsam::Pose3 trans2gtsamPose(float transformIn[])
     {
@@ -249,6 +314,19 @@ public:
     {
         return pcl::getTransformation(thisPoint.x, thisPoint.y, thisPoint.z, thisPoint.roll, thisPoint.pitch, thisPoint.yaw);
     }
+    //! 关键帧key按pose变换到全局坐标系的角点和平面点，位姿未变时取缓存，否则变换后放入缓存
+    void transformedKeyFrame(int key, PointTypePose* pose, pcl::PointCloud<PointType>::ConstPtr& corner,
+                             pcl::PointCloud<PointType>::ConstPtr& surf, Eigen::Affine3f* transformedPose = nullptr)
+    {
+        const Eigen::Affine3f transform = pclPointToAffine3f(*pose);
+        if (transformedPose)
+            *transformedPose = transform;
+        if (keyframeCloudCache->find(key, transform, corner, surf, transformedPose))
+            return;
+        corner = transformPointCloud(cornerCloudKeyFrames[key], pose);
+        surf = transformPointCloud(surfCloudKeyFrames[key], pose);
+        keyframeCloudCache->insert(key, transform, corner, surf);
+    }
     //! 将位姿变换阵转换为eigen库下的矩阵形式
     Eigen::Affine3f trans2Affine3f(float transformIn[])
     {
@@ -292,62 +370,156 @@ public:
         coeffSelSurfVec.resize(N_SCAN * Horizon_SCAN);
         laserCloudOriSurfFlag.resize(N_SCAN * Horizon_SCAN);
 
-        std::fill(laserCloudOriCornerFlag.begin(), laserCloudOriCornerFlag.end(), false);
-        std::fill(laserCloudOriSurfFlag.begin(), laserCloudOriSurfFlag.end(), false);
+        std::fill(laserCloudOriCornerFlag.begin(), laserCloudOriCornerFlag.end(), 0);
+        std::fill(laserCloudOriSurfFlag.begin(), laserCloudOriSurfFlag.end(), 0);
 
-        laserCloudCornerFromMap.reset(new pcl::PointCloud<PointType>());
-        laserCloudSurfFromMap.reset(new pcl::PointCloud<PointType>());
-        laserCloudCornerFromMapDS.reset(new pcl::PointCloud<PointType>());
-        laserCloudSurfFromMapDS.reset(new pcl::PointCloud<PointType>());
+        searchIndices.resize(numberOfCores);
+        searchSqDistances.resize(numberOfCores);
+        for (int i = 0; i < numberOfCores; ++i)
+        {
+            searchIndices[i].reserve(5);
+            searchSqDistances[i].reserve(5);
+        }
+        associationOffsets.resize(numberOfCores + 1);
 
-        kdtreeCornerFromMap.reset(new pcl::KdTreeFLANN<PointType>());
-        kdtreeSurfFromMap.reset(new pcl::KdTreeFLANN<PointType>());
+        // 点线、点面匹配只接受1 m以内的5个近邻，搜索网格取1 m
+        cornerMap.reset(new rolo::IncrementalPointMap<PointType>(mappingCornerLeafSize, 1.0));
+        surfMap.reset(new rolo::IncrementalPointMap<PointType>(mappingSurfLeafSize, 1.0));
+        keyframeCloudCache.reset(new rolo::KeyframeCloudCache<PointType>((size_t)keyframeCacheMemory << 20, keyframeCacheTolerance,
+                                                                         keyframeCacheAngleTolerance * M_PI / 180.0));
 
         for (int i = 0; i < 6; ++i){
             transformTobeMapped[i] = 0;
         }
 
-        matP = cv::Mat(6, 6, CV_32F, cv::Scalar::all(0));
+        matP.setZero();
     }
 
     //! 激光回调函数，
     void laserCloudInfoHandler(const rolo::CloudInfoStampConstPtr& msgIn){
+        // 原始点云只用于可视化，无订阅时不解析
+        pushFrame(rolo::frameFromMsg(msgIn, pubCloudRegisteredRaw.getNumSubscribers() != 0));
+    }
+
+    void pushFrame(const rolo::CloudFrameConstPtr& msgIn) override {
+        frameQueue->push(msgIn);
+    }
+
+    //! 扫描匹配线程：帧到局部地图的匹配，发布里程计；关键帧交给因子图线程，不等待全局优化。
+    //! 局部地图只在持有mtx时读取关键帧，下一帧的局部地图更新与当前关键帧的全局优化并行
+    void processFrame(const rolo::CloudFrameConstPtr& msgIn){
+        // 处理耗时超过帧间隔时，按调度跳过部分帧
+        if (!scheduler->admit(msgIn->header.stamp.toSec()))
+            return;
+        const ros::WallTime processingStart = ros::WallTime::now();
+
         // extract time stamp 提取时间戳
         timeLaserInfoStamp = msgIn->header.stamp;
         timeLaserInfoCur = msgIn->header.stamp.toSec();
 
         // extract info and feature cloud 提取当前帧的特征点云（角点+平面点）
-        cloudInfo = *msgIn;
-        pcl::fromROSMsg(msgIn->extracted_corner,  *laserCloudCornerLast);
-        pcl::fromROSMsg(msgIn->extracted_surface, *laserCloudSurfLast);
-        pcl::fromROSMsg(msgIn->extracted_normal, *laserCloudNormalLast);
-        *laserCloudSurfLast += *laserCloudNormalLast;
-
-        std::lock_guard<std::mutex> lock(mtx);
+        cloudInfo = msgIn;
+        laserCloudCornerLast = msgIn->extractedCorner;
+        laserCloudNormalLast = msgIn->extractedNormal;
+        if (laserCloudNormalLast->empty())
+        {
+            laserCloudSurfLast = msgIn->extractedSurface;
+        }
+        else
+        {
+            // 地面点按mappingGroundLeafSize单独降采样后与平面点合并，输入帧只读，合并到新点云中
+            pcl::PointCloud<PointType>::Ptr surfCur(new pcl::PointCloud<PointType>());
+            downSizeFilterGround.setInputCloud(laserCloudNormalLast);
+            downSizeFilterGround.filter(*surfCur);
+            *surfCur += *msgIn->extractedSurface;
+            laserCloudSurfLast = surfCur;
+        }
 
-        static double timeLastProcessing = -1;
-        // 当时间间隔大于阈值时，才进行后端优化
-        if (timeLaserInfoCur - timeLastProcessing >= mappingProcessInterval)
         {
-            // 更新时间
-            timeLastProcessing = timeLaserInfoCur;
+            std::lock_guard<std::mutex> lock(mtx);
+            // 因子图优化了新的关键帧后，把当前位姿校正到优化结果上
+            applyKeyframeEstimate();
             // 根据前端匹配结果，得到当前时刻的先验位姿估计
             updateInitialGuess();
             // 提取周围的关键帧，并提取其角点和平面点
             extractSurroundingKeyFrames();
-            // 对当前帧的平面点和角点进行降采样
-            downsampleCurrentScan();
-            // 对周围关键帧寻找有效的点线约束和点面约束，构建非线性问题，优化位姿，并于imu数据融合
-            scan2MapOptimization();
-            // 添加因子，全局优化，保存最优状态估计及其对应的特征点
-            saveKeyFramesAndFactor();
-            // 发生回环后，对历史上所有状态进行重新赋值
-            correctPoses();
-            // 发布全局位姿odom和变换关系的odom(incremental),同时发布全局TF
-            publishOdometry();
-            // 发布相关的点云话题
-            publishFrames();
         }
+        // 对当前帧的平面点和角点进行降采样
+        downsampleCurrentScan();
+        // 对周围关键帧寻找有效的点线约束和点面约束，构建非线性问题，优化位姿，并于imu数据融合
+        scan2MapOptimization();
+        // 发布全局位姿odom和变换关系的odom(incremental),同时发布全局TF
+        publishOdometry();
+        // 关键帧交给因子图线程
+        submitKeyframe();
+        // 发布相关的点云话题
+        publishFrames();
+
+        scheduler->processed(timeLaserInfoCur, (ros::WallTime::now() - processingStart).toSec());
+    }
+
+    //! 因子图线程：添加因子，全局优化，保存最优状态估计及其对应的特征点，发生回环后校正历史位姿。
+    //! isam、gtSAMgraph和initialEstimate只属于本线程，关键帧位姿和点云也只由本线程写入，读取不加锁；
+    //! mtx只在取走回环因子、追加关键帧、写入校正后的位姿时持有，iSAM2的优化与扫描匹配线程并行
+    void processKeyframe(const KeyframeJobConstPtr& job)
+    {
+        saveKeyFramesAndFactor(*job);
+        correctPoses();
+        {
+            // 扫描匹配线程在下一帧据此校正位姿
+            std::lock_guard<std::mutex> lock(mtx);
+            estimateKeyframe = job->id;
+            estimatePose = pclPointToAffine3f(cloudKeyPoses6D->back());
+        }
+        publishTrajectory(job->stamp);
+    }
+
+    //! 当前帧为关键帧时提交给因子图线程；因子图积压时跳过该关键帧
+    void submitKeyframe()
+    {
+        if (saveFrame() == false)
+            return;
+
+        const Eigen::Affine3f pose = trans2Affine3f(transformTobeMapped);
+        std::shared_ptr<KeyframeJob> job(new KeyframeJob());
+        job->id = submittedKeyframes;
+        job->stamp = timeLaserInfoStamp;
+        job->pose = pose;
+        job->relative = hasKeyframe ? Eigen::Affine3f(lastKeyframePose.inverse() * pose) : Eigen::Affine3f::Identity();
+        job->corner.reset(new pcl::PointCloud<PointType>(*laserCloudCornerLastDS));
+        job->surf.reset(new pcl::PointCloud<PointType>(*laserCloudSurfLastDS));
+        if (!graphQueue->push(job))
+            return;
+
+        submittedKeyframes++;
+        pendingKeyframes.emplace_back(job->id, pose);
+        lastKeyframePose = pose;
+        hasKeyframe = true;
+    }
+
+    //! 用因子图的最新结果校正扫描匹配的位姿：优化结果与提交时的位姿之差作用于当前位姿和尚未优化的关键帧。
+    //! 提交之后扫描匹配线程已经继续前进，因此不直接用优化结果覆盖当前位姿。调用时持有mtx
+    void applyKeyframeEstimate()
+    {
+        if (estimateKeyframe < 0)
+            return;
+        while (!pendingKeyframes.empty() && pendingKeyframes.front().first < estimateKeyframe)
+            pendingKeyframes.pop_front();
+        if (pendingKeyframes.empty() || pendingKeyframes.front().first != estimateKeyframe)
+        {
+            estimateKeyframe = -1;
+            return;
+        }
+        const Eigen::Affine3f correction = estimatePose * pendingKeyframes.front().second.inverse();
+        pendingKeyframes.pop_front();
+        estimateKeyframe = -1;
+
+        for (auto& pending : pendingKeyframes)
+            pending.second = correction * pending.second;
+        lastKeyframePose = correction * lastKeyframePose;
+        const Eigen::Affine3f transCorrected = correction * trans2Affine3f(transformTobeMapped);
+        pcl::getTranslationAndEulerAngles(transCorrected, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5],
+                                          transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
     }
 
     //! 根据IMU预积分里程计或者后端odom+IMU融合里程计的方式得到当前帧的初始姿态估计
@@ -359,7 +531,7 @@ public:
         // static Eigen::Affine3f lastOdomTransformation; // 上一时刻根据IMU等数据推断的位姿，static变量使得变量在函数结束时不销毁，下次可继续访问
         // initialization
         // 初始化过程
-        if (cloudKeyPoses3D->points.empty())
+        if (!hasKeyframe)
         {
             // 来自前端Odometry数据的估计姿态
             transformTobeMapped[0] = 0.0;
@@ -371,10 +543,10 @@ public:
         // use LiDAR odometry estimation for pose guess
         static bool lastOdomTransAvailable = false; // 直接使用IMU预估计的标志位
         static Eigen::Affine3f lastOdomTransformation; // 上一时刻的IMU预积分里程计
-        if (cloudInfo.odomAvailable == true)    // 如果IMU预积分得到了初始里程计估计
+        if (cloudInfo->odomAvailable == true)    // 如果IMU预积分得到了初始里程计估计
         {   // 将IMU预积分里程计转为eigen矩阵格式
-            Eigen::Affine3f transBack = pcl::getTransformation(cloudInfo.initialGuessX,    cloudInfo.initialGuessY,     cloudInfo.initialGuessZ, 
-                                                               cloudInfo.initialGuessRoll, cloudInfo.initialGuessPitch, cloudInfo.initialGuessYaw);
+            Eigen::Affine3f transBack = pcl::getTransformation(cloudInfo->initialGuessX,    cloudInfo->initialGuessY,     cloudInfo->initialGuessZ, 
+                                                               cloudInfo->initialGuessRoll, cloudInfo->initialGuessPitch, cloudInfo->initialGuessYaw);
             if (lastOdomTransAvailable == false)
             {
                 lastOdomTransformation = transBack;
@@ -398,6 +570,12 @@ public:
         // 如果之前没有提取的关键帧，就返回
         if (cloudKeyPoses3D->points.empty() == true)
             return;
+
+        if (localMapStale)
+        {
+            resetLocalMap();
+            localMapStale = false;
+        }
         
         // if (loopClosureEnableFlag == true)
         // {
@@ -451,53 +629,56 @@ public:
         extractCloud(surroundingKeyPosesDS);
     }
 
-    //! 提取出输入的周围关键帧的中的角点和平面点
+    //! 周围关键帧中尚未插入局部地图的，变换到全局坐标系后插入；离开较远后删除搜索半径以外的网格。
+    //! 每帧的代价与新插入的点数成正比，不再拼接整个局部地图、降采样和重建KD树
     void extractCloud(pcl::PointCloud<PointType>::Ptr cloudToExtract)
     {
-        // fuse the map
-        laserCloudCornerFromMap->clear();
-        laserCloudSurfFromMap->clear();
-        // 遍历最近的关键帧的每一个点
+        const PointType& current = cloudKeyPoses3D->back();
+        // 离开搜索半径的关键帧回到附近时重新插入，体素中已有的点不会重复
+        for (auto it = keyFramesInMap.begin(); it != keyFramesInMap.end();)
+        {
+            if (pointDistance(cloudKeyPoses3D->points[it->first], current) > surroundingKeyframeSearchRadius)
+                it = keyFramesInMap.erase(it);
+            else
+                ++it;
+        }
+
         for (int i = 0; i < (int)cloudToExtract->size(); ++i)
         {
             // 距离滤波
-            if (pointDistance(cloudToExtract->points[i], cloudKeyPoses3D->back()) > surroundingKeyframeSearchRadius)
+            if (pointDistance(cloudToExtract->points[i], current) > surroundingKeyframeSearchRadius)
                 continue;
 
             int thisKeyInd = (int)cloudToExtract->points[i].intensity; // 取索引
-            // 在全局所有关键帧中寻找这个关键帧的某个点
-            if (laserCloudMapContainer.find(thisKeyInd) != laserCloudMapContainer.end()) 
-            {
-                // 找到了这个关键帧
-                // transformed cloud available
-                // 取周围关键帧的角点和平面点
-                *laserCloudCornerFromMap += laserCloudMapContainer[thisKeyInd].first;
-                *laserCloudSurfFromMap   += laserCloudMapContainer[thisKeyInd].second;
-            } else {
-                // 没找到就加入到这个全局关键帧中
-                // transformed cloud not available
-                // 坐标变换到全局坐标系下
-                pcl::PointCloud<PointType> laserCloudCornerTemp = *transformPointCloud(cornerCloudKeyFrames[thisKeyInd],  &cloudKeyPoses6D->points[thisKeyInd]);
-                pcl::PointCloud<PointType> laserCloudSurfTemp = *transformPointCloud(surfCloudKeyFrames[thisKeyInd],    &cloudKeyPoses6D->points[thisKeyInd]);
-                *laserCloudCornerFromMap += laserCloudCornerTemp;
-                *laserCloudSurfFromMap   += laserCloudSurfTemp;
-                laserCloudMapContainer[thisKeyInd] = make_pair(laserCloudCornerTemp, laserCloudSurfTemp);
-            }
-            
+            if (keyFramesInMap.count(thisKeyInd))
+                continue;
+            // 坐标变换到全局坐标系下，插入时按体素降采样
+            pcl::PointCloud<PointType>::ConstPtr corner, surf;
+            Eigen::Affine3f insertedPose;
+            transformedKeyFrame(thisKeyInd, &cloudKeyPoses6D->points[thisKeyInd], corner, surf, &insertedPose);
+            keyFramesInMap.emplace(thisKeyInd, insertedPose);
+            cornerMap->insert(*corner);
+            surfMap->insert(*surf);
         }
 
-        // Downsample the surrounding corner key frames (or map)
-        downSizeFilterCorner.setInputCloud(laserCloudCornerFromMap);
-        downSizeFilterCorner.filter(*laserCloudCornerFromMapDS);
-        laserCloudCornerFromMapDSNum = laserCloudCornerFromMapDS->size();
-        // Downsample the surrounding surf key frames (or map)
-        downSizeFilterSurf.setInputCloud(laserCloudSurfFromMap);
-        downSizeFilterSurf.filter(*laserCloudSurfFromMapDS);
-        laserCloudSurfFromMapDSNum = laserCloudSurfFromMapDS->size();
-
-        // clear map cache if too large
-        if (laserCloudMapContainer.size() > 1000)
-            laserCloudMapContainer.clear();
+        // 删除要遍历所有网格，只在离上次删除的位置超过搜索半径的一成时进行
+        const Eigen::Vector3f position = current.getVector3fMap();
+        if (!mapCenterValid || (position - mapCenter).norm() > 0.1f * surroundingKeyframeSearchRadius)
+        {
+            cornerMap->removeOutside(position, surroundingKeyframeSearchRadius);
+            surfMap->removeOutside(position, surroundingKeyframeSearchRadius);
+            mapCenter = position;
+            mapCenterValid = true;
+        }
+    }
+
+    //! 回环校正移动了局部地图中的关键帧后，地图中的点已失效，下一帧按新位姿重新插入（未移动的关键帧取缓存）
+    void resetLocalMap()
+    {
+        cornerMap->clear();
+        surfMap->clear();
+        keyFramesInMap.clear();
+        mapCenterValid = false;
     }
 
     //! 对当前帧的平面点和角点进行体素滤波（降采样）
@@ -518,14 +699,12 @@ public:
     //! 对周围的关键帧进行搜索，寻找能够有效匹配的点线约束和点面约束，并构建非线性问题，用高斯牛顿法进行求解全局位姿，最后与imu数据加权融合
     void scan2MapOptimization()
     {
-        // 如果没有存储的关键帧就返回
-        if (cloudKeyPoses3D->points.empty())
+        // 因子图还没有保存关键帧，局部地图为空
+        if (cornerMap->empty() && surfMap->empty())
             return;
         // 如果当前帧的特征点足够，才可以开始后端优化
         if (laserCloudCornerLastDSNum > edgeFeatureMinValidNum && laserCloudSurfLastDSNum > surfFeatureMinValidNum)
         {
-            kdtreeCornerFromMap->setInputCloud(laserCloudCornerFromMapDS);
-            kdtreeSurfFromMap->setInputCloud(laserCloudSurfFromMapDS);
             // scan-to-map迭代30次
             for (int iterCount = 0; iterCount < 30; iterCount++)
             {
@@ -563,100 +742,75 @@ public:
         for (int i = 0; i < laserCloudCornerLastDSNum; i++) // 遍历所有降采样当前帧角点
         {
             PointType pointOri, pointSel, coeff;
-            std::vector<int> pointSearchInd;
-            std::vector<float> pointSearchSqDis;
+            std::vector<int>& pointSearchInd = searchIndices[omp_get_thread_num()];
+            std::vector<float>& pointSearchSqDis = searchSqDistances[omp_get_thread_num()];
 
             pointOri = laserCloudCornerLastDS->points[i];
             // 坐标变换到全局map坐标系下
             pointAssociateToMap(&pointOri, &pointSel);
             // PCA算法判断线特征
             // 搜索最近的5个点
-            kdtreeCornerFromMap->nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-
-            cv::Mat matA1(3, 3, CV_32F, cv::Scalar::all(0)); // 5个点与中心点的距离协方差矩阵
-            cv::Mat matD1(1, 3, CV_32F, cv::Scalar::all(0)); // cov矩阵的特征值
-            cv::Mat matV1(3, 3, CV_32F, cv::Scalar::all(0)); // cov矩阵的特征向量
-                    
-            if (pointSearchSqDis[4] < 1.0) {
-                float cx = 0, cy = 0, cz = 0;
-                for (int j = 0; j < 5; j++) {
-                    cx += laserCloudCornerFromMapDS->points[pointSearchInd[j]].x;
-                    cy += laserCloudCornerFromMapDS->points[pointSearchInd[j]].y;
-                    cz += laserCloudCornerFromMapDS->points[pointSearchInd[j]].z;
-                }
-                cx /= 5; cy /= 5;  cz /= 5; // 5个点的中心点
-                // 构造协方差矩阵
-                float a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
-                for (int j = 0; j < 5; j++) {
-                    float ax = laserCloudCornerFromMapDS->points[pointSearchInd[j]].x - cx;
-                    float ay = laserCloudCornerFromMapDS->points[pointSearchInd[j]].y - cy;
-                    float az = laserCloudCornerFromMapDS->points[pointSearchInd[j]].z - cz;
-
-                    a11 += ax * ax; a12 += ax * ay; a13 += ax * az;
-                    a22 += ay * ay; a23 += ay * az;
-                    a33 += az * az;
-                }
-                a11 /= 5; a12 /= 5; a13 /= 5; a22 /= 5; a23 /= 5; a33 /= 5;
-
-                matA1.at<float>(0, 0) = a11; matA1.at<float>(0, 1) = a12; matA1.at<float>(0, 2) = a13;
-                matA1.at<float>(1, 0) = a12; matA1.at<float>(1, 1) = a22; matA1.at<float>(1, 2) = a23;
-                matA1.at<float>(2, 0) = a13; matA1.at<float>(2, 1) = a23; matA1.at<float>(2, 2) = a33;
-
-                cv::eigen(matA1, matD1, matV1); // 计算特征值和特征向量，此方法得到的特征值为降序排列
-
-                if (matD1.at<float>(0, 0) > 3 * matD1.at<float>(0, 1)) { // 说明符合一个线特征，开始点线ICP
-                // 最大特征值所属的特征向量代表这条线的方向向量
-                    // 构建三个点，待匹配的点A+线上的两点B
-                    //        A
-                    //   B        C
-                    // A点坐标
-                    float x0 = pointSel.x;
-                    float y0 = pointSel.y;
-                    float z0 = pointSel.z;
-                    // B点坐标
-                    float x1 = cx + 0.1 * matV1.at<float>(0, 0);
-                    float y1 = cy + 0.1 * matV1.at<float>(0, 1);
-                    float z1 = cz + 0.1 * matV1.at<float>(0, 2);
-                    // C点坐标
-                    float x2 = cx - 0.1 * matV1.at<float>(0, 0);
-                    float y2 = cy - 0.1 * matV1.at<float>(0, 1);
-                    float z2 = cz - 0.1 * matV1.at<float>(0, 2);
-                    // 求(AB X AC)的模，代表ABC三点构成的平行四边形面积
-                    float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) 
-                                    + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1)) * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1)) 
-                                    + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)) * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
-                    // BC的模（BC边长）
-                    float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
-                    // (la,lb,lc）= (BC X (AB X AC))/a012/l12 代表A到BC的垂线方向的单位向量
-                    float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) 
-                              + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
-
-                    float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) 
-                               - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-                    float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1)) 
-                               + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-                    float ld2 = a012 / l12; // A到BC的垂直距离
-                    // 计算权重因子，点到直线的距离越大，s越小，则越不能将它放入点云集合laserCloudOri以及coeffSel中
-                    float s = 1 - 0.9 * fabs(ld2);
-                    // 存储点线的相关参数
-                    // coeff用于保存距离的方向向量
-                    // intensity本质上构成了一个核函数，ld2越接近于1，增长越慢
-                    coeff.x = s * la;
-                    coeff.y = s * lb;
-                    coeff.z = s * lc;
-                    coeff.intensity = s * ld2;
-
-                    // s>0.1 也就是要求点到直线的距离ld2要小于1m
-                    // s越大说明ld2越小(离边缘线越近)，这样就说明点pointOri在直线上
-                    if (s > 0.1) {
-                        // 加入到点集中
-                        laserCloudOriCornerVec[i] = pointOri;
-                        coeffSelCornerVec[i] = coeff;
-                        laserCloudOriCornerFlag[i] = true;
-                    }
-                }
+            int found = cornerMap->nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+            if (found < 5 || pointSearchSqDis[4] >= 1.0)
+                continue;
+
+            Eigen::Vector3f neighbors[5];
+            for (int j = 0; j < 5; j++)
+                neighbors[j] = cornerMap->point(pointSearchInd[j]).getVector3fMap();
+            // 5个点的中心点，以及协方差矩阵最大特征值所属的特征向量，代表这条线的方向向量
+            Eigen::Vector3f center, direction;
+            if (!rolo::fitLine(neighbors, 5, center, direction)) // 不符合线特征
+                continue;
+
+            // 构建三个点，待匹配的点A+线上的两点B
+            //        A
+            //   B        C
+            // A点坐标
+            float x0 = pointSel.x;
+            float y0 = pointSel.y;
+            float z0 = pointSel.z;
+            // B点坐标
+            float x1 = center.x() + 0.1 * direction.x();
+            float y1 = center.y() + 0.1 * direction.y();
+            float z1 = center.z() + 0.1 * direction.z();
+            // C点坐标
+            float x2 = center.x() - 0.1 * direction.x();
+            float y2 = center.y() - 0.1 * direction.y();
+            float z2 = center.z() - 0.1 * direction.z();
+            // 求(AB X AC)的模，代表ABC三点构成的平行四边形面积
+            float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) 
+                            + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1)) * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1)) 
+                            + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)) * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
+            // BC的模（BC边长）
+            float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
+            // (la,lb,lc）= (BC X (AB X AC))/a012/l12 代表A到BC的垂线方向的单位向量
+            float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) 
+                      + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
+
+            float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1)) 
+                       - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+            float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1)) 
+                       + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+            float ld2 = a012 / l12; // A到BC的垂直距离
+            // 计算权重因子，点到直线的距离越大，s越小，则越不能将它放入点云集合laserCloudOri以及coeffSel中
+            float s = 1 - 0.9 * fabs(ld2);
+            // 存储点线的相关参数
+            // coeff用于保存距离的方向向量
+            // intensity本质上构成了一个核函数，ld2越接近于1，增长越慢
+            coeff.x = s * la;
+            coeff.y = s * lb;
+            coeff.z = s * lc;
+            coeff.intensity = s * ld2;
+
+            // s>0.1 也就是要求点到直线的距离ld2要小于1m
+            // s越大说明ld2越小(离边缘线越近)，这样就说明点pointOri在直线上
+            if (s > 0.1) {
+                // 加入到点集中
+                laserCloudOriCornerVec[i] = pointOri;
+                coeffSelCornerVec[i] = coeff;
+                laserCloudOriCornerFlag[i] = 1;
             }
         }
     }
@@ -671,222 +825,185 @@ public:
         for (int i = 0; i < laserCloudSurfLastDSNum; i++)
         {
             PointType pointOri, pointSel, coeff;
-            std::vector<int> pointSearchInd;
-            std::vector<float> pointSearchSqDis;
+            std::vector<int>& pointSearchInd = searchIndices[omp_get_thread_num()];
+            std::vector<float>& pointSearchSqDis = searchSqDistances[omp_get_thread_num()];
 
             pointOri = laserCloudSurfLastDS->points[i];
             // 坐标变换到全局坐标系下
             pointAssociateToMap(&pointOri, &pointSel); 
             // 取5个点进行平面拟合
-            kdtreeSurfFromMap->nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-
-            Eigen::Matrix<float, 5, 3> matA0;
-            Eigen::Matrix<float, 5, 1> matB0;
-            Eigen::Vector3f matX0;
-
-            matA0.setZero();
-            matB0.fill(-1);
-            matX0.setZero();
-
-            if (pointSearchSqDis[4] < 1.0) {
-                for (int j = 0; j < 5; j++) {
-                    matA0(j, 0) = laserCloudSurfFromMapDS->points[pointSearchInd[j]].x;
-                    matA0(j, 1) = laserCloudSurfFromMapDS->points[pointSearchInd[j]].y;
-                    matA0(j, 2) = laserCloudSurfFromMapDS->points[pointSearchInd[j]].z;
-                }
-                // 求用QR分解，平面法向量matX0
-                matX0 = matA0.colPivHouseholderQr().solve(matB0);
-
-                float pa = matX0(0, 0);
-                float pb = matX0(1, 0);
-                float pc = matX0(2, 0);
-                float pd = 1;
-
-                float ps = sqrt(pa * pa + pb * pb + pc * pc);
-                // 单位化
-                pa /= ps; pb /= ps; pc /= ps; pd /= ps;
-
-                bool planeValid = true;
-                // 检查平面是否合格，如果5个点中有点到平面的距离超过0.2m，那么认为这些点太分散了，不构成平面
-                for (int j = 0; j < 5; j++) {
-                    if (fabs(pa * laserCloudSurfFromMapDS->points[pointSearchInd[j]].x +
-                             pb * laserCloudSurfFromMapDS->points[pointSearchInd[j]].y +
-                             pc * laserCloudSurfFromMapDS->points[pointSearchInd[j]].z + pd) > 0.2) {
-                        planeValid = false;
-                        break;
-                    }
-                }
+            int found = surfMap->nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+            if (found < 5 || pointSearchSqDis[4] >= 1.0)
+                continue;
 
-                if (planeValid) {
-                    // 待匹配的平面点到拟合平面的距离
-                    float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
-
-                    float s = 1 - 0.9 * fabs(pd2) / sqrt(sqrt(pointOri.x * pointOri.x
-                            + pointOri.y * pointOri.y + pointOri.z * pointOri.z));
-                    // coeff存储点到平面的法向量（带惩罚因子），intensity为点到平面的距离
-                    coeff.x = s * pa;
-                    coeff.y = s * pb;
-                    coeff.z = s * pc;
-                    coeff.intensity = s * pd2;
-                    //如果s>0.1,代表伪距离<1，即点距离平面越近，越有效
-                    if (s > 0.1) {
-                        laserCloudOriSurfVec[i] = pointOri;
-                        coeffSelSurfVec[i] = coeff;
-                        laserCloudOriSurfFlag[i] = true;
-                    }
-                }
+            Eigen::Vector3f neighbors[5];
+            for (int j = 0; j < 5; j++)
+                neighbors[j] = surfMap->point(pointSearchInd[j]).getVector3fMap();
+            // 单位法向量(pa,pb,pc)和pd，5个点中有点到平面的距离超过0.2m则不构成平面
+            Eigen::Vector4f plane;
+            if (!rolo::fitPlane(neighbors, 5, 0.2, plane))
+                continue;
+            float pa = plane(0);
+            float pb = plane(1);
+            float pc = plane(2);
+            float pd = plane(3);
+
+            // 待匹配的平面点到拟合平面的距离
+            float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
+
+            float s = 1 - 0.9 * fabs(pd2) / sqrt(sqrt(pointOri.x * pointOri.x
+                    + pointOri.y * pointOri.y + pointOri.z * pointOri.z));
+            // coeff存储点到平面的法向量（带惩罚因子），intensity为点到平面的距离
+            coeff.x = s * pa;
+            coeff.y = s * pb;
+            coeff.z = s * pc;
+            coeff.intensity = s * pd2;
+            //如果s>0.1,代表伪距离<1，即点距离平面越近，越有效
+            if (s > 0.1) {
+                laserCloudOriSurfVec[i] = pointOri;
+                coeffSelSurfVec[i] = coeff;
+                laserCloudOriSurfFlag[i] = 1;
             }
         }
     }
 
-    //! 提取出当前帧能够有效用于匹配的特征点
+    //! 提取出当前帧能够有效用于匹配的特征点：角点在前、平面点在后，按原顺序压缩到laserCloudOri和coeffSel中。
+    //! 各线程先统计自己一段中的有效点数，前缀和得到写入位置后并行写入，同时重置Mask
     void combineOptimizationCoeffs()
     {
-        // 提取有效匹配角点
-        // combine corner coeffs
-        for (int i = 0; i < laserCloudCornerLastDSNum; ++i){
-            if (laserCloudOriCornerFlag[i] == true){
-                laserCloudOri->push_back(laserCloudOriCornerVec[i]);
-                coeffSel->push_back(coeffSelCornerVec[i]);
-            }
-        }
-        // 提取有效匹配平面点
-        // combine surf coeffs
-        for (int i = 0; i < laserCloudSurfLastDSNum; ++i){
-            if (laserCloudOriSurfFlag[i] == true){
-                laserCloudOri->push_back(laserCloudOriSurfVec[i]);
-                coeffSel->push_back(coeffSelSurfVec[i]);
+        const int cornerNum = laserCloudCornerLastDSNum;
+        const int totalNum = laserCloudCornerLastDSNum + laserCloudSurfLastDSNum;
+        associationOffsets[0] = 0;
+
+        #pragma omp parallel num_threads(numberOfCores)
+        {
+            const int thread = omp_get_thread_num();
+            const int threads = omp_get_num_threads();
+            const int begin = (int)((long)totalNum * thread / threads);
+            const int end = (int)((long)totalNum * (thread + 1) / threads);
+
+            int count = 0;
+            for (int i = begin; i < end; ++i)
+                count += i < cornerNum ? laserCloudOriCornerFlag[i] : laserCloudOriSurfFlag[i - cornerNum];
+            associationOffsets[thread + 1] = count;
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                for (int t = 0; t < threads; ++t)
+                    associationOffsets[t + 1] += associationOffsets[t];
+                laserCloudOri->resize(associationOffsets[threads]);
+                coeffSel->resize(associationOffsets[threads]);
+            } // single结束时隐式同步
+
+            int index = associationOffsets[thread];
+            for (int i = begin; i < end; ++i)
+            {
+                if (i < cornerNum)
+                {
+                    if (!laserCloudOriCornerFlag[i])
+                        continue;
+                    laserCloudOri->points[index] = laserCloudOriCornerVec[i];
+                    coeffSel->points[index] = coeffSelCornerVec[i];
+                    laserCloudOriCornerFlag[i] = 0;
+                }
+                else
+                {
+                    if (!laserCloudOriSurfFlag[i - cornerNum])
+                        continue;
+                    laserCloudOri->points[index] = laserCloudOriSurfVec[i - cornerNum];
+                    coeffSel->points[index] = coeffSelSurfVec[i - cornerNum];
+                    laserCloudOriSurfFlag[i - cornerNum] = 0;
+                }
+                ++index;
             }
         }
-        // reset flag for next iteration
-        // Mask重置
-        std::fill(laserCloudOriCornerFlag.begin(), laserCloudOriCornerFlag.end(), false);
-        std::fill(laserCloudOriSurfFlag.begin(), laserCloudOriSurfFlag.end(), false);
     }
     //! 使用高斯牛顿法，对构建的非线性问题进行迭代求解
+    //! 位姿按左扰动更新：R <- Exp(w)*R，t <- t + v，残差对扰动(w, v)的雅可比为 [(R*p) x n, n]，p为雷达坐标系下的点，n为coeff的方向。
+    //! 各线程直接累加 J^T*J 和 J^T*r 后归约，不生成Nx6的雅可比矩阵；mappingRobustKernel不为none时按残差加权
     bool LMOptimization(int iterCount)
     {
-        // This optimization is from the original loam_velodyne by Ji Zhang, need to cope with coordinate transformation
-        // lidar <- camera      ---     camera <- lidar
-        // x = z                ---     x = y
-        // y = x                ---     y = z
-        // z = y                ---     z = x
-        // roll = yaw           ---     roll = pitch
-        // pitch = roll         ---     pitch = yaw
-        // yaw = pitch          ---     yaw = roll
-
-        // lidar -> camera
-        float srx = sin(transformTobeMapped[1]);
-        float crx = cos(transformTobeMapped[1]);
-        float sry = sin(transformTobeMapped[2]);
-        float cry = cos(transformTobeMapped[2]);
-        float srz = sin(transformTobeMapped[0]);
-        float crz = cos(transformTobeMapped[0]);
         // 如果能匹配的特征点过少，则返回，不进行优化
         int laserCloudSelNum = laserCloudOri->size();
         if (laserCloudSelNum < 50) {
             return false;
         }
-        // 矩阵A为误差对平移和旋转的雅可比矩阵
-        // 矩阵B为残差项
-        cv::Mat matA(laserCloudSelNum, 6, CV_32F, cv::Scalar::all(0)); // 矩阵A
-        cv::Mat matAt(6, laserCloudSelNum, CV_32F, cv::Scalar::all(0));// A的转置
-        cv::Mat matAtA(6, 6, CV_32F, cv::Scalar::all(0));   // A的转置 X A
-        cv::Mat matB(laserCloudSelNum, 1, CV_32F, cv::Scalar::all(0)); // 矩阵B
-        cv::Mat matAtB(6, 1, CV_32F, cv::Scalar::all(0));   // A的转置 X B
-        cv::Mat matX(6, 1, CV_32F, cv::Scalar::all(0)); // 矩阵X
-
-        PointType pointOri, coeff;
-
-        for (int i = 0; i < laserCloudSelNum; i++) {
-            // lidar -> camera
-            pointOri.x = laserCloudOri->points[i].y;
-            pointOri.y = laserCloudOri->points[i].z;
-            pointOri.z = laserCloudOri->points[i].x;
-            // lidar -> camera
-            coeff.x = coeffSel->points[i].y;
-            coeff.y = coeffSel->points[i].z;
-            coeff.z = coeffSel->points[i].x;
-            coeff.intensity = coeffSel->points[i].intensity;
-            // in camera
-            // 计算雅可比矩阵的每一个元素值
-            float arx = (crx*sry*srz*pointOri.x + crx*crz*sry*pointOri.y - srx*sry*pointOri.z) * coeff.x
-                      + (-srx*srz*pointOri.x - crz*srx*pointOri.y - crx*pointOri.z) * coeff.y
-                      + (crx*cry*srz*pointOri.x + crx*cry*crz*pointOri.y - cry*srx*pointOri.z) * coeff.z;
-
-            float ary = ((cry*srx*srz - crz*sry)*pointOri.x 
-                      + (sry*srz + cry*crz*srx)*pointOri.y + crx*cry*pointOri.z) * coeff.x
-                      + ((-cry*crz - srx*sry*srz)*pointOri.x 
-                      + (cry*srz - crz*srx*sry)*pointOri.y - crx*sry*pointOri.z) * coeff.z;
-
-            float arz = ((crz*srx*sry - cry*srz)*pointOri.x + (-cry*crz-srx*sry*srz)*pointOri.y)*coeff.x
-                      + (crx*crz*pointOri.x - crx*srz*pointOri.y) * coeff.y
-                      + ((sry*srz + cry*crz*srx)*pointOri.x + (crz*sry-cry*srx*srz)*pointOri.y)*coeff.z;
-            // camera -> lidar
-            matA.at<float>(i, 0) = arz;
-            matA.at<float>(i, 1) = arx;
-            matA.at<float>(i, 2) = ary;
-            matA.at<float>(i, 3) = coeff.z;
-            matA.at<float>(i, 4) = coeff.x;
-            matA.at<float>(i, 5) = coeff.y;
-            matB.at<float>(i, 0) = -coeff.intensity; // 负号是为了后面的GN算法
+
+        const Eigen::Affine3f transCur = trans2Affine3f(transformTobeMapped);
+        const Eigen::Matrix3f rotation = transCur.linear();
+        Eigen::Matrix<double, 6, 6> JtJ = Eigen::Matrix<double, 6, 6>::Zero(); // 近似海森矩阵
+        Eigen::Matrix<double, 6, 1> Jtr = Eigen::Matrix<double, 6, 1>::Zero();
+        // 退化判断用不加权的 J^T*J：权重小于1会缩小特征值，固定的阈值会把更多帧判为退化
+        const bool weighted = mappingRobustKernel != rolo::RobustKernel::NONE;
+        const bool separateDegeneracy = iterCount == 0 && weighted;
+        Eigen::Matrix<double, 6, 6> unweightedJtJ = Eigen::Matrix<double, 6, 6>::Zero();
+
+        #pragma omp parallel num_threads(numberOfCores)
+        {
+            Eigen::Matrix<double, 6, 6> threadJtJ = Eigen::Matrix<double, 6, 6>::Zero();
+            Eigen::Matrix<double, 6, 1> threadJtr = Eigen::Matrix<double, 6, 1>::Zero();
+            Eigen::Matrix<double, 6, 6> threadUnweightedJtJ = Eigen::Matrix<double, 6, 6>::Zero();
+            #pragma omp for nowait
+            for (int i = 0; i < laserCloudSelNum; i++) {
+                const PointType& coeff = coeffSel->points[i];
+                // 绕当前位置旋转，只需要旋转到全局坐标系方向的点
+                const Eigen::Vector3f rotated = rotation * laserCloudOri->points[i].getVector3fMap();
+                const Eigen::Vector3f normal(coeff.x, coeff.y, coeff.z);
+                Eigen::Matrix<double, 6, 1> J;
+                J << rotated.cross(normal).cast<double>(), normal.cast<double>();
+                const double residual = coeff.intensity;
+                const double weight = rolo::robustWeight(mappingRobustKernel, residual, mappingRobustDelta);
+                threadJtJ.noalias() += weight * J * J.transpose();
+                threadJtr.noalias() -= (weight * residual) * J;
+                if (separateDegeneracy)
+                    threadUnweightedJtJ.noalias() += J * J.transpose();
+            }
+            #pragma omp critical
+            {
+                JtJ += threadJtJ;
+                Jtr += threadJtr;
+                unweightedJtJ += threadUnweightedJtJ;
+            }
         }
 
-        // 利用高斯牛顿法进行求解，
-        // 高斯牛顿法的原型是J^(T)*J * delta(x) = -J*f(x)
-        // J是雅克比矩阵，这里是A，J^(T)*J为近似的海森矩阵，f(x)是优化目标，这里是-B(符号在给B赋值时候就放进去了)
-        // 通过QR分解的方式，求解matAtA*matX=matAtB，得到解matX
-        cv::transpose(matA, matAt); // 得到A的转置
-        matAtA = matAt * matA;
-        matAtB = matAt * matB;
-        cv::solve(matAtA, matAtB, matX, cv::DECOMP_QR);
+        // 高斯牛顿法：J^T*J * delta = -J^T*r，6x6对称正定，LDLT求解
+        Eigen::Matrix<double, 6, 1> delta = JtJ.ldlt().solve(Jtr);
 
         if (iterCount == 0) {   // 如果是第一次优化，需要初始化，并判断退化，即约束中较小的偏移会导致解所在的局部区域发生较大的变化
-            // 海森矩阵，在这里为matAtA
-            cv::Mat matE(1, 6, CV_32F, cv::Scalar::all(0)); // 海森矩阵的特征值
-            cv::Mat matV(6, 6, CV_32F, cv::Scalar::all(0)); // 海森矩阵的特征向量
-            cv::Mat matV2(6, 6, CV_32F, cv::Scalar::all(0));
-
-            cv::eigen(matAtA, matE, matV);  // 求近似海森矩阵的特征值和特征向量
-            matV.copyTo(matV2);
+            // 近似海森矩阵的特征值（升序）和特征向量
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 6, 6>> solver(separateDegeneracy ? unweightedJtJ : JtJ);
+            Eigen::Matrix<double, 6, 6> kept = solver.eigenvectors();
             //TODO 这一部分待深究
             isDegenerate = false;
-            float eignThre[6] = {100, 100, 100, 100, 100, 100};
-            for (int i = 5; i >= 0; i--) {
-                if (matE.at<float>(0, i) < eignThre[i]) {
-                    for (int j = 0; j < 6; j++) {
-                        matV2.at<float>(i, j) = 0;
-                    }
+            const double eignThre = 100;
+            for (int i = 0; i < 6; i++) {
+                if (solver.eigenvalues()(i) < eignThre) {
+                    kept.col(i).setZero();
                     isDegenerate = true;
                 } else {
                     break;
                 }
             }
-            matP = matV.inv() * matV2;
+            matP = kept * solver.eigenvectors().transpose();
         }
         //TODO
         if (isDegenerate)
         {
-            cv::Mat matX2(6, 1, CV_32F, cv::Scalar::all(0));
-            matX.copyTo(matX2);
-            matX = matP * matX2;
+            delta = matP * delta;
         }
-        // 更新当前位姿 x = x + delta_x
-        transformTobeMapped[0] += matX.at<float>(0, 0);
-        transformTobeMapped[1] += matX.at<float>(1, 0);
-        transformTobeMapped[2] += matX.at<float>(2, 0);
-        transformTobeMapped[3] += matX.at<float>(3, 0);
-        transformTobeMapped[4] += matX.at<float>(4, 0);
-        transformTobeMapped[5] += matX.at<float>(5, 0);
+        // 更新当前位姿 R = Exp(w)*R, t = t + v
+        const Eigen::Vector3d w = delta.head<3>();
+        const double angle = w.norm();
+        Eigen::Affine3f transNew = transCur;
+        if (angle > 1e-12)
+            transNew.linear() = Eigen::AngleAxisd(angle, w / angle).toRotationMatrix().cast<float>() * rotation;
+        transNew.translation() += delta.tail<3>().cast<float>();
+        pcl::getTranslationAndEulerAngles(transNew, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5],
+                                          transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
         // 计算平移和旋转变化量
-        float deltaR = sqrt(
-                            pow(pcl::rad2deg(matX.at<float>(0, 0)), 2) +
-                            pow(pcl::rad2deg(matX.at<float>(1, 0)), 2) +
-                            pow(pcl::rad2deg(matX.at<float>(2, 0)), 2));
-        float deltaT = sqrt(
-                            pow(matX.at<float>(3, 0) * 100, 2) +
-                            pow(matX.at<float>(4, 0) * 100, 2) +
-                            pow(matX.at<float>(5, 0) * 100, 2));
+        float deltaR = pcl::rad2deg(angle);
+        float deltaT = delta.tail<3>().norm() * 100;
         // 如果变化量足够小，说明算法收敛，则终止优化过程
         if (deltaR < 0.05 && deltaT < 0.05) {
             return true; // converged
@@ -908,10 +1025,10 @@ public:
     //! 判断当前帧是否可以被保存为关键帧
     bool saveFrame()
     {
-        if (cloudKeyPoses3D->points.empty()) // 无关键帧则跳过
+        if (!hasKeyframe) // 第一帧作为关键帧
             return true;
 
-        Eigen::Affine3f transStart = pclPointToAffine3f(cloudKeyPoses6D->back());   // 上一个关键帧的位姿
+        Eigen::Affine3f transStart = lastKeyframePose;   // 上一个关键帧的位姿
         // 当前帧的优化位姿
         Eigen::Affine3f transFinal = pcl::getTransformation(transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5], 
                                                             transformTobeMapped[0], transformTobeMapped[1], transformTobeMapped[2]);
@@ -929,15 +1046,11 @@ public:
     }
 
     //! 添加因子（里程计，GPS，回环）并进行全局优化，然后将当前关键帧的状态最优估计保存起来，并保存其对应的特征点
-    void saveKeyFramesAndFactor()
+    void saveKeyFramesAndFactor(const KeyframeJob& job)
     {
-        // 判断关键帧是否可以保存
-        if (saveFrame() == false)
-            return;
-
         // odom factor
         // 如果是初始则添加第一个先验因子，否则，添加k-1到k帧的里程计因子
-        addOdomFactor();
+        addOdomFactor(job);
 
         // loop factor
         // 添加回环因子
@@ -977,7 +1090,6 @@ public:
         thisPose3D.y = latestEstimate.translation().y();
         thisPose3D.z = latestEstimate.translation().z();
         thisPose3D.intensity = cloudKeyPoses3D->size(); // this can be used as index
-        cloudKeyPoses3D->push_back(thisPose3D);
         // 保存当前时刻的状态最优估计到cloudKeyPoses6D
         thisPose6D.x = thisPose3D.x;
         thisPose6D.y = thisPose3D.y;
@@ -986,8 +1098,7 @@ public:
         thisPose6D.roll  = latestEstimate.rotation().roll();
         thisPose6D.pitch = latestEstimate.rotation().pitch();
         thisPose6D.yaw   = latestEstimate.rotation().yaw();
-        thisPose6D.time = timeLaserInfoCur;
-        cloudKeyPoses6D->push_back(thisPose6D);
+        thisPose6D.time = job.stamp.toSec();
 
         // cout << "****************************************************" << endl;
         // cout << "Pose covariance:" << endl;
@@ -995,25 +1106,18 @@ public:
         // 得到当前时刻的协方差矩阵
         poseCovariance = isam->marginalCovariance(isamCurrentEstimate.size()-1);
 
-        // save updated transform
-        // 保存到全局位姿
-        transformTobeMapped[0] = latestEstimate.rotation().roll();
-        transformTobeMapped[1] = latestEstimate.rotation().pitch();
-        transformTobeMapped[2] = latestEstimate.rotation().yaw();
-        transformTobeMapped[3] = latestEstimate.translation().x();
-        transformTobeMapped[4] = latestEstimate.translation().y();
-        transformTobeMapped[5] = latestEstimate.translation().z();
-
-        // save all the received edge and surf points
-        pcl::PointCloud<PointType>::Ptr thisCornerKeyFrame(new pcl::PointCloud<PointType>());
-        pcl::PointCloud<PointType>::Ptr thisSurfKeyFrame(new pcl::PointCloud<PointType>());
-        pcl::copyPointCloud(*laserCloudCornerLastDS,  *thisCornerKeyFrame);
-        pcl::copyPointCloud(*laserCloudSurfLastDS,    *thisSurfKeyFrame);
+        // 优化后的位姿由扫描匹配线程在下一帧取用（applyKeyframeEstimate）
 
         // save key frame cloud
-        // 保存当前帧中所对应的角点和平面点
-        cornerCloudKeyFrames.push_back(thisCornerKeyFrame);
-        surfCloudKeyFrames.push_back(thisSurfKeyFrame);
+        {
+            // 追加关键帧时扫描匹配线程可能正在读取，持有mtx
+            std::lock_guard<std::mutex> lock(mtx);
+            cloudKeyPoses3D->push_back(thisPose3D);
+            cloudKeyPoses6D->push_back(thisPose6D);
+            // 保存当前帧中所对应的角点和平面点，提交时已经复制
+            cornerCloudKeyFrames.push_back(job.corner);
+            surfCloudKeyFrames.push_back(job.surf);
+        }
 
         // save path for visualization
         // 更新path，可视化
@@ -1021,22 +1125,24 @@ public:
     }
 
     //! 如果是初始则添加第一个先验因子，否则，添加k-1到k帧的里程计因子
-    void addOdomFactor()
+    void addOdomFactor(const KeyframeJob& job)
     {
         if (cloudKeyPoses3D->points.empty()) // 无关键帧，说明是系统初始，首先要添加一个当前位置的先验因子
         {
             // 定义噪声模型为Diagonal，对角线元素符合高斯白噪声
             noiseModel::Diagonal::shared_ptr priorNoise = noiseModel::Diagonal::Variances((Vector(6) << 1e-2, 1e-2, M_PI*M_PI, 1e8, 1e8, 1e8).finished()); // rad*rad, meter*meter
             // 加入第一个位置先验因子
-            gtSAMgraph.add(PriorFactor<Pose3>(0, trans2gtsamPose(transformTobeMapped), priorNoise));
+            gtSAMgraph.add(PriorFactor<Pose3>(0, affine3fTogtsamPose3(job.pose), priorNoise));
             // 加入Value保存
-            initialEstimate.insert(0, trans2gtsamPose(transformTobeMapped));
+            initialEstimate.insert(0, affine3fTogtsamPose3(job.pose));
         }else{
             noiseModel::Diagonal::shared_ptr odometryNoise = noiseModel::Diagonal::Variances((Vector(6) << 1e-6, 1e-6, 1e-6, 1e-4, 1e-4, 1e-4).finished());
+            // 扫描匹配给出的是相对上一个关键帧的变换，与提交后因子图对位姿的校正无关
             gtsam::Pose3 poseFrom = pclPointTogtsamPose3(cloudKeyPoses6D->points.back());
-            gtsam::Pose3 poseTo   = trans2gtsamPose(transformTobeMapped);
+            gtsam::Pose3 poseBetween = affine3fTogtsamPose3(job.relative);
+            gtsam::Pose3 poseTo   = poseFrom.compose(poseBetween);
             // 添加一个从k-1帧到k帧的里程计因子
-            gtSAMgraph.add(BetweenFactor<Pose3>(cloudKeyPoses3D->size()-1, cloudKeyPoses3D->size(), poseFrom.between(poseTo), odometryNoise));
+            gtSAMgraph.add(BetweenFactor<Pose3>(cloudKeyPoses3D->size()-1, cloudKeyPoses3D->size(), poseBetween, odometryNoise));
             // 将当前位姿存入Value
             initialEstimate.insert(cloudKeyPoses3D->size(), poseTo);
         }
@@ -1044,26 +1150,34 @@ public:
 
     void addLoopFactor()
     {
-        if (loopIndexQueue.empty()) // 如果没有匹配的回环帧，则不添加因子
+        // 回环线程写入的回环对，持有mtx取走后再添加因子
+        vector<pair<int, int>> loopIndices;
+        vector<gtsam::Pose3> loopPoses;
+        vector<gtsam::noiseModel::Diagonal::shared_ptr> loopNoises;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            loopIndices.swap(loopIndexQueue);
+            loopPoses.swap(loopPoseQueue);
+            loopNoises.swap(loopNoiseQueue);
+        }
+        if (loopIndices.empty()) // 如果没有匹配的回环帧，则不添加因子
             return;
 
-        for (int i = 0; i < (int)loopIndexQueue.size(); ++i) // 遍历所有回环对
+        for (int i = 0; i < (int)loopIndices.size(); ++i) // 遍历所有回环对
         {
-            int indexFrom = loopIndexQueue[i].first; // 取历史帧
-            int indexTo = loopIndexQueue[i].second;  // 取当前帧
-            gtsam::Pose3 poseBetween = loopPoseQueue[i];  // 取位姿变换矩阵
-            gtsam::noiseModel::Diagonal::shared_ptr noiseBetween = loopNoiseQueue[i];
+            int indexFrom = loopIndices[i].first; // 取历史帧
+            int indexTo = loopIndices[i].second;  // 取当前帧
+            gtsam::Pose3 poseBetween = loopPoses[i];  // 取位姿变换矩阵
+            gtsam::noiseModel::Diagonal::shared_ptr noiseBetween = loopNoises[i];
             // 添加回环因子
             gtSAMgraph.add(BetweenFactor<Pose3>(indexFrom, indexTo, poseBetween, noiseBetween));
         }
 
-        loopIndexQueue.clear();
-        loopPoseQueue.clear();
-        loopNoiseQueue.clear();
         aLoopIsClosed = true;   // 回环因子添加标志位
     }
 
-    //! 若发生回环，则更新历史所有关键帧状态位姿列表，若为回环，则无操作
+    //! 若发生回环，则更新历史所有关键帧状态位姿列表，若为回环，则无操作。
+    //! 校正后的位姿在锁外由优化结果计算，持有mtx只写入位姿、检查局部地图
     void correctPoses()
     {
         if (cloudKeyPoses3D->points.empty())
@@ -1071,30 +1185,51 @@ public:
 
         if (aLoopIsClosed == true) // 发生回环后，才会校正历史位姿
         {
-            // clear map cache
-            laserCloudMapContainer.clear();
-            // clear path
-            // 清除当前轨迹
-            globalPath.poses.clear();
-            // update key poses
             // 遍历优化后的所有存储位姿，重新进行关键帧状态保存
             int numPoses = isamCurrentEstimate.size();
+            std::vector<PointTypePose> corrected(numPoses);
             for (int i = 0; i < numPoses; ++i)
             {
-                cloudKeyPoses3D->points[i].x = isamCurrentEstimate.at<Pose3>(i).translation().x();
-                cloudKeyPoses3D->points[i].y = isamCurrentEstimate.at<Pose3>(i).translation().y();
-                cloudKeyPoses3D->points[i].z = isamCurrentEstimate.at<Pose3>(i).translation().z();
-
-                cloudKeyPoses6D->points[i].x = cloudKeyPoses3D->points[i].x;
-                cloudKeyPoses6D->points[i].y = cloudKeyPoses3D->points[i].y;
-                cloudKeyPoses6D->points[i].z = cloudKeyPoses3D->points[i].z;
-                cloudKeyPoses6D->points[i].roll  = isamCurrentEstimate.at<Pose3>(i).rotation().roll();
-                cloudKeyPoses6D->points[i].pitch = isamCurrentEstimate.at<Pose3>(i).rotation().pitch();
-                cloudKeyPoses6D->points[i].yaw   = isamCurrentEstimate.at<Pose3>(i).rotation().yaw();
-                // 添加到Path中
-                updatePath(cloudKeyPoses6D->points[i]);
+                const Pose3& estimate = isamCurrentEstimate.at<Pose3>(i);
+                corrected[i] = cloudKeyPoses6D->points[i];
+                corrected[i].x = estimate.translation().x();
+                corrected[i].y = estimate.translation().y();
+                corrected[i].z = estimate.translation().z();
+                corrected[i].roll  = estimate.rotation().roll();
+                corrected[i].pitch = estimate.rotation().pitch();
+                corrected[i].yaw   = estimate.rotation().yaw();
+            }
+
+            bool localMapMoved = false;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                for (int i = 0; i < numPoses; ++i)
+                {
+                    const Eigen::Affine3f poseBefore = pclPointToAffine3f(cloudKeyPoses6D->points[i]);
+                    cloudKeyPoses3D->points[i].x = corrected[i].x;
+                    cloudKeyPoses3D->points[i].y = corrected[i].y;
+                    cloudKeyPoses3D->points[i].z = corrected[i].z;
+                    cloudKeyPoses6D->points[i] = corrected[i];
+                    // 位姿变化超过容差的关键帧，其缓存的点云失效
+                    const Eigen::Affine3f poseAfter = pclPointToAffine3f(corrected[i]);
+                    if (!keyframeCloudCache->samePose(poseBefore, poseAfter))
+                        keyframeCloudCache->invalidate(i, poseAfter);
+                    // 局部地图中的点按插入时的位姿变换，与之比较而不是与本次校正前的位姿比较
+                    auto inMap = keyFramesInMap.find(i);
+                    if (inMap != keyFramesInMap.end() && !keyframeCloudCache->samePose(inMap->second, poseAfter))
+                        localMapMoved = true;
+                }
+                // 局部地图属于扫描匹配线程，在其下一帧重建
+                if (localMapMoved)
+                    localMapStale = true;
             }
 
+            // clear path
+            // 清除当前轨迹，Path只在本线程中使用
+            globalPath.poses.clear();
+            for (int i = 0; i < numPoses; ++i)
+                updatePath(corrected[i]); // 添加到Path中
+
             aLoopIsClosed = false; // 重置回环标志位
         }
     }
@@ -1170,17 +1305,35 @@ public:
         pubLaserOdometryIncremental.publish(laserOdomIncremental);
     }
 
-    //! 发布相关的点云话题
-    void publishFrames()
+    //! 发布关键帧位姿和全局Path，在因子图线程中调用
+    void publishTrajectory(const ros::Time& stamp)
     {
-        if (cloudKeyPoses3D->points.empty())
-            return;
         // publish key poses
         // 发布所有的关键帧的状态点云
-        publishCloud(pubKeyPoses, cloudKeyPoses3D, timeLaserInfoStamp, odometryFrame);
+        publishCloud(pubKeyPoses, cloudKeyPoses3D, stamp, odometryFrame);
+        // publish path
+        // 发布全局Path
+        if (pubPath.getNumSubscribers() != 0)
+        {
+            globalPath.header.stamp = stamp;
+            globalPath.header.frame_id = odometryFrame;
+            pubPath.publish(globalPath);
+        }
+    }
+
+    //! 发布相关的点云话题，在扫描匹配线程中调用
+    void publishFrames()
+    {
+        if (!hasKeyframe)
+            return;
         // Publish surrounding key frames
         // 发布周围关键帧的平面点云
-        publishCloud(pubRecentKeyFrames, laserCloudSurfFromMapDS, timeLaserInfoStamp, odometryFrame);
+        if (pubRecentKeyFrames.getNumSubscribers() != 0)
+        {
+            pcl::PointCloud<PointType>::Ptr localMapOut(new pcl::PointCloud<PointType>());
+            surfMap->toCloud(*localMapOut);
+            publishCloud(pubRecentKeyFrames, localMapOut, timeLaserInfoStamp, odometryFrame);
+        }
         // publish registered key frame
         if (pubRecentKeyFrame.getNumSubscribers() != 0)
         {
@@ -1195,21 +1348,11 @@ public:
         // publish registered high-res raw cloud
         if (pubCloudRegisteredRaw.getNumSubscribers() != 0)
         {
-            pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
-            pcl::fromROSMsg(cloudInfo.cloud_projected, *cloudOut);
             PointTypePose thisPose6D = trans2PointTypePose(transformTobeMapped);
-            *cloudOut = *transformPointCloud(cloudOut,  &thisPose6D);
+            pcl::PointCloud<PointType>::Ptr cloudOut = transformPointCloud(cloudInfo->cloudProjected,  &thisPose6D);
             // 发布去畸变的点云
             publishCloud(pubCloudRegisteredRaw, cloudOut, timeLaserInfoStamp, odometryFrame);
         }
-        // publish path
-        // 发布全局Path
-        if (pubPath.getNumSubscribers() != 0)
-        {
-            globalPath.header.stamp = timeLaserInfoStamp;
-            globalPath.header.frame_id = odometryFrame;
-            pubPath.publish(globalPath);
-        }
         // publish SLAM infomation for 3rd-party usage
         // static int lastSLAMInfoPubSize = -1;
         // if (pubSLAMInfo.getNumSubscribers() != 0)
@@ -1441,7 +1584,8 @@ public:
         for (int i = 0; i < (int)pointSearchIndLoop.size(); ++i) // 优先和时间间隔较长的历史帧匹配
         {
             int id = pointSearchIndLoop[i];
-            if (abs(copy_cloudKeyPoses6D->points[id].time - timeLaserInfoCur) > historyKeyframeSearchTimeDiff)
+            // 与当前关键帧比较时间，不读取扫描匹配线程的时间戳
+            if (abs(copy_cloudKeyPoses6D->points[id].time - copy_cloudKeyPoses6D->back().time) > historyKeyframeSearchTimeDiff)
             {
                 loopKeyPre = id;
                 break;
@@ -1523,8 +1667,10 @@ public:
             if (keyNear < 0 || keyNear >= cloudSize )   // 边界检测
                 continue;
             // 将周围的历史帧所对应的特征点变换到全局坐标系下，并加入到同一个集合中
-            *nearKeyframes += *transformPointCloud(cornerCloudKeyFrames[keyNear], &copy_cloudKeyPoses6D->points[keyNear]);
-            *nearKeyframes += *transformPointCloud(surfCloudKeyFrames[keyNear],   &copy_cloudKeyPoses6D->points[keyNear]);
+            pcl::PointCloud<PointType>::ConstPtr corner, surf;
+            transformedKeyFrame(keyNear, &copy_cloudKeyPoses6D->points[keyNear], corner, surf);
+            *nearKeyframes += *corner;
+            *nearKeyframes += *surf;
         }
 
         if (nearKeyframes->empty()) // 周围没有历史帧
@@ -1612,8 +1758,31 @@ public:
         tum_file.close();
         printf("Saved .tum file!\n");
     }
+
+    //! 启动回环检测和全局地图可视化线程
+    void startThreads() override
+    {
+        loopthread = std::thread(&backMapping::loopClosureThread, this);
+        visualizeMapThread = std::thread(&backMapping::visualizeGlobalMapThread, this);
+    }
+
+    //! ROS退出后等待线程结束，并保存轨迹
+    void stopThreads() override
+    {
+        if (loopthread.joinable())
+            loopthread.join();
+        if (visualizeMapThread.joinable())
+            visualizeMapThread.join();
+        saveTUM();
+    }
 };
 
+rolo::PipelineStagePtr rolo::createBackMapping(bool intraProcess)
+{
+    return std::make_shared<backMapping>(intraProcess);
+}
+
+#ifndef ROLO_PIPELINE
 int main(int argc, char** argv)
 {
     ros::init(argc, argv, "rolo");
@@ -1622,13 +1791,11 @@ int main(int argc, char** argv)
 
     ROS_INFO("\033[1;32m----> Map Optimization Started.\033[0m");
     
-    std::thread loopthread(&backMapping::loopClosureThread, &BM);
-    std::thread visualizeMapThread(&backMapping::visualizeGlobalMapThread, &BM);
+    BM.startThreads();
 
     ros::spin();
 
-    loopthread.join();
-    visualizeMapThread.join();
-    BM.saveTUM();
+    BM.stopThreads();
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
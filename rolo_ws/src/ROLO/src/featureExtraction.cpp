@@ -1,17 +1,31 @@
 #include "rolo/utility.h"
+#include "rolo/pipeline.h"
+#include "rolo/featureKernels.h"
+
+#include <omp.h>
 
 struct smoothness_ind{ 
     float value;    // 平滑度大小
     size_t ind;     // 在点云中的索引
 };
 
-struct comp_rule{ 
+struct comp_rule{ // 按平滑度从大到小排列
     bool operator()(smoothness_ind const &left, smoothness_ind const &right) { 
-        return left.value < right.value;
+        return left.value > right.value;
     }
 };
 
-class FeatureExtraction : public ParamLoader
+//! 一条扫瞄线的特征点索引
+struct ring_features{
+    std::vector<int> corner;
+    std::vector<int> surface;
+};
+
+// 每个扇区最多选20个角点，每选中一个角点最多屏蔽两侧10个点，因此按平滑度取前20*11个候选即可得到与完整排序相同的结果
+static const int kMaxCornerPerSector = 20;
+static const size_t kCornerCandidateNum = kMaxCornerPerSector * 11;
+
+class FeatureExtraction : public ParamLoader, public rolo::PipelineStage
 {
 public:
 
@@ -22,26 +36,34 @@ public:
     ros::Publisher pubSurfacePoints;
     ros::Publisher pubNormalPoints;
 
-    pcl::PointCloud<PointType>::Ptr extractedCloud; // 输入点云
+    pcl::PointCloud<PointType>::ConstPtr extractedCloud; // 输入点云
     pcl::PointCloud<PointType>::Ptr cornerCloud;    // 角点集合
     pcl::PointCloud<PointType>::Ptr surfaceCloud;   // 平面点集合
     pcl::PointCloud<PointType>::Ptr normalCloud;    // 地面点集合
 
+    pcl::PointCloud<PointType>::Ptr surfaceCloudScan;  // 当前帧所有扫瞄线的原始平面点，滤波前
+    pcl::PointCloud<PointType>::Ptr groundCloudScan;   // 当前帧的原始地面点，滤波前
     pcl::VoxelGrid<PointType> downSizeFilter;
+    pcl::VoxelGrid<PointType> downSizeFilterGround;
 
 
-    rolo::CloudInfoStamp cloudInfo;
+    rolo::CloudFrameConstPtr cloudInfo;
     std_msgs::Header cloudHeader;
 
-    std::vector<smoothness_ind> cloudSmoothness;  // 存储输入点云里每个点的平滑度和索引值，并按照平滑度从小到大排序
-    float *cloudCurvature;      // 数组，存储输入点云的平滑度
-    int *cloudNeighborPicked;   // 数组，用来标记有效点，选择过的点和异常点，0表示当前点可选为特征点，1代表当前点不可选为特征点
-    int *cloudLabel;            // 数组，用来标记特征点类型，0为普通点，1为角点，-1为平面点, -2为平面点+地面点
+    rolo::FeatureBuffer featureBuffer;  // 每个点的平滑度、是否可选、特征点类型，SoA格式
+    const uint8_t* groundFlag = nullptr; // 当前帧每个点是否为地面点，输入帧没有地面标记时为空
+
+    // 各扫瞄线相互独立，并行提取；缓冲区预先分配，每帧复用
+    std::vector<ring_features> ringFeatures;                  // 每条扫瞄线的特征点索引
+    std::vector<std::vector<smoothness_ind>> threadCandidates; // 每个线程的角点候选缓冲区
+
+    std::unique_ptr<rolo::StageQueue<rolo::CloudFrameConstPtr>> frameQueue; // 输入帧队列
     
-    FeatureExtraction()
+    FeatureExtraction(bool intraProcess = false)
     {
         //! 输入：image_projection传来的cloud_info，输出：角点点云，平面点点云，feature_cloud_info
-        subLaserCloudInfo = nh.subscribe<rolo::CloudInfoStamp>("rolo/cloud_info", 1, &FeatureExtraction::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
+        if (!intraProcess)
+            subLaserCloudInfo = nh.subscribe<rolo::CloudInfoStamp>("rolo/cloud_info", frameQueueCapacity, &FeatureExtraction::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
 
         pubLaserCloudInfo = nh.advertise<rolo::CloudInfoStamp> ("rolo/feature/cloud_info", 1);
         pubCornerPoints = nh.advertise<sensor_msgs::PointCloud2>("rolo/feature/cloud_corner", 1);
@@ -49,245 +71,252 @@ public:
         pubNormalPoints = nh.advertise<sensor_msgs::PointCloud2>("rolo/feature/cloud_normal", 1);
 
         initializationValue();
+
+        frameQueue.reset(new rolo::StageQueue<rolo::CloudFrameConstPtr>(nh, "feature_extraction", frameQueueCapacity, frameQueuePolicy,
+            std::bind(&FeatureExtraction::processFrame, this, std::placeholders::_1)));
+    }
+
+    ~FeatureExtraction()
+    {
+        frameQueue.reset();
     }
     //! 初始参数，体素滤波器，变量
     void initializationValue()
     {
-        cloudSmoothness.resize(N_SCAN*Horizon_SCAN);
-
         downSizeFilter.setLeafSize(odometrySurfLeafSize, odometrySurfLeafSize, odometrySurfLeafSize);
+        // 地面点由里程计和建图模块各自再降采样，这里只按两者中较小的体素滤波
+        float groundLeafSize = std::min(odometryGroundLeafSize, mappingGroundLeafSize);
+        downSizeFilterGround.setLeafSize(groundLeafSize, groundLeafSize, groundLeafSize);
 
-        extractedCloud.reset(new pcl::PointCloud<PointType>());
         cornerCloud.reset(new pcl::PointCloud<PointType>());
         surfaceCloud.reset(new pcl::PointCloud<PointType>());
         normalCloud.reset(new pcl::PointCloud<PointType>());
+        surfaceCloudScan.reset(new pcl::PointCloud<PointType>());
+        surfaceCloudScan->reserve(N_SCAN*Horizon_SCAN);
+        groundCloudScan.reset(new pcl::PointCloud<PointType>());
 
+        featureBuffer.resize(N_SCAN*Horizon_SCAN);
 
-        cloudCurvature = new float[N_SCAN*Horizon_SCAN];
-        cloudNeighborPicked = new int[N_SCAN*Horizon_SCAN];
-        cloudLabel = new int[N_SCAN*Horizon_SCAN];
+        ringFeatures.resize(N_SCAN);
+        for (ring_features& ring : ringFeatures)
+        {
+            ring.corner.reserve(6 * kMaxCornerPerSector);
+            ring.surface.reserve(Horizon_SCAN);
+        }
+        threadCandidates.resize(std::max(numberOfCores, 1));
+        for (std::vector<smoothness_ind>& candidates : threadCandidates)
+            candidates.reserve(Horizon_SCAN);
     }
     //! range_image回调函数，主要完成：平滑度计算，特征提取，输出点云
     void laserCloudInfoHandler(const rolo::CloudInfoStampConstPtr& cloudIn)
     {
-        // 存储msgIn
-        cloudInfo = *cloudIn; // new cloud info
-        cloudHeader = cloudIn->header; // new cloud header
-        pcl::fromROSMsg(cloudIn->cloud_projected, *extractedCloud); // new cloud for extraction
-        // 遍历输入点云，计算每个点的平滑度，并存储
+        pushFrame(rolo::frameFromMsg(cloudIn));
+    }
+
+    void pushFrame(const rolo::CloudFrameConstPtr& frame) override
+    {
+        frameQueue->push(frame);
+    }
+
+    void processFrame(const rolo::CloudFrameConstPtr& frame)
+    {
+        // 存储输入帧，只引用不拷贝
+        cloudInfo = frame; // new cloud info
+        cloudHeader = frame->header; // new cloud header
+        extractedCloud = frame->cloudProjected; // new cloud for extraction
+        const bool hasGround = frame->pointGround && !frame->pointGround->empty() && frame->pointGround->size() == extractedCloud->size();
+        groundFlag = hasGround ? frame->pointGround->data() : nullptr;
+        // 遍历输入点云，计算每个点的平滑度，并标记异常点，保证异常点不被提取为特征
         calculateSmoothness();
-        // 标记异常点，保证异常点不被提取为特征
-        markOccludedPoints();
         // 提取角点和平面点
         extractFeatures();
         // 发布输出点云消息
         publishFeatureCloud();
     }
-    //! 遍历输入点云，计算每个点的平滑度，并标记存储
+    //! 遍历输入点云，计算每个点的平滑度，标记异常点（遮挡点和平行点），并存储
     void calculateSmoothness()
     {
+        // 使用和LOAM相同的平滑度计算公式，向量化实现，两遍顺序扫描
         int cloudSize = extractedCloud->points.size();
-        // 使用和LOAM相同的平滑度计算公式
-        for (int i = 5; i < cloudSize - 5; i++)
-        {
-            float diffRange = cloudInfo.pointRange[i-5] + cloudInfo.pointRange[i-4]
-                            + cloudInfo.pointRange[i-3] + cloudInfo.pointRange[i-2]
-                            + cloudInfo.pointRange[i-1] - cloudInfo.pointRange[i] * 10
-                            + cloudInfo.pointRange[i+1] + cloudInfo.pointRange[i+2]
-                            + cloudInfo.pointRange[i+3] + cloudInfo.pointRange[i+4]
-                            + cloudInfo.pointRange[i+5];            
-
-            cloudCurvature[i] = diffRange*diffRange;//diffX * diffX + diffY * diffY + diffZ * diffZ;
-            // 标记取过邻居的点
-            cloudNeighborPicked[i] = 0;
-            // 标记计算过平滑度的点
-            cloudLabel[i] = 0;
-            // cloudSmoothness for sorting
-            // 存储点的平滑度
-            cloudSmoothness[i].value = cloudCurvature[i];
-            cloudSmoothness[i].ind = i;
-        }
-    }
-    //! 标记当前输入点云中的异常点（遮挡点和平行点）
-    void markOccludedPoints()
-    {
-        int cloudSize = extractedCloud->points.size();
-        // mark occluded points and parallel beam points
-        for (int i = 5; i < cloudSize - 6; ++i)
-        {
-            // occluded points
-            // 相邻索引，判断遮挡点
-            float depth1 = cloudInfo.pointRange[i];
-            float depth2 = cloudInfo.pointRange[i+1];
-            int columnDiff = std::abs(int(cloudInfo.pointColInd[i+1] - cloudInfo.pointColInd[i]));
-            // 筛选并剔除被遮挡的点，因为被遮挡的点可能在下一帧就没有了，不能选为特征点
-            if (columnDiff < 10){
-                // 10 pixel diff in range image
-                if (depth1 - depth2 > 0.3){ // depth1所代表的第i个点把第i+1个点遮挡了，因此剔除第i前面的几个点
-                    cloudNeighborPicked[i - 5] = 1;
-                    cloudNeighborPicked[i - 4] = 1;
-                    cloudNeighborPicked[i - 3] = 1;
-                    cloudNeighborPicked[i - 2] = 1;
-                    cloudNeighborPicked[i - 1] = 1;
-                    cloudNeighborPicked[i] = 1;
-                }else if (depth2 - depth1 > 0.3){ // depth1所代表的第i个点把第i+1个点遮挡了，因此剔除第i+1后面的几个点
-                    cloudNeighborPicked[i + 1] = 1;
-                    cloudNeighborPicked[i + 2] = 1;
-                    cloudNeighborPicked[i + 3] = 1;
-                    cloudNeighborPicked[i + 4] = 1;
-                    cloudNeighborPicked[i + 5] = 1;
-                    cloudNeighborPicked[i + 6] = 1;
-                }
-            }
-            // parallel beam
-            // 筛选并剔除平行点
-            float diff1 = std::abs(float(cloudInfo.pointRange[i-1] - cloudInfo.pointRange[i]));
-            float diff2 = std::abs(float(cloudInfo.pointRange[i+1] - cloudInfo.pointRange[i]));
-            // 如果i+1到i的连线与激光线接近平行，那么i+1和i的深度差将会很大
-            if (diff1 > 0.02 * cloudInfo.pointRange[i] && diff2 > 0.02 * cloudInfo.pointRange[i])
-                cloudNeighborPicked[i] = 1; // 标记平行点
-        }
+        rolo::computeFeatureFlags(cloudInfo->pointRange->data(), cloudInfo->pointColInd->data(), cloudSize, featureBuffer);
     }
     
     //! 根据平滑度，提取输入点云中的角点和平面点，并存储
     void extractFeatures()
     {
-        cornerCloud->clear();
-        surfaceCloud->clear();
-        normalCloud->clear();
-
-        pcl::PointCloud<PointType>::Ptr surfaceCloudScan(new pcl::PointCloud<PointType>());     // 当前帧原始平面点
-        pcl::PointCloud<PointType>::Ptr surfaceCloudScanDS(new pcl::PointCloud<PointType>());   // 滤波后的平面点
-        pcl::PointCloud<PointType>::Ptr normalCloudScan(new pcl::PointCloud<PointType>());     // 当前帧原始地面点
-        pcl::PointCloud<PointType>::Ptr normalCloudScanDS(new pcl::PointCloud<PointType>());   // 滤波后的地面点
-        
-        // 筛选角点和平面点，方法类似LOAM
+        // 输出点云交给下游模块持有，每帧重新分配
+        cornerCloud.reset(new pcl::PointCloud<PointType>());
+        surfaceCloud.reset(new pcl::PointCloud<PointType>());
+        normalCloud.reset(new pcl::PointCloud<PointType>());
+
+        // 筛选角点和平面点，方法类似LOAM。各扫瞄线的点在索引上互不重叠，可以并行处理
+        #pragma omp parallel for num_threads(numberOfCores) schedule(dynamic)
         for (int i = 0; i < N_SCAN; i++)
         {
-            surfaceCloudScan->clear();
-            normalCloudScan->clear();
-            // 横向上分为6个扇区
-            for (int j = 0; j < 6; j++)
-            {
-                // 求每个扇区的起始索引和结束索引
-                int sp = (cloudInfo.startRingIndex[i] * (6 - j) + cloudInfo.endRingIndex[i] * j) / 6;
-                int ep = (cloudInfo.startRingIndex[i] * (5 - j) + cloudInfo.endRingIndex[i] * (j + 1)) / 6 - 1;
+            extractRingFeatures(i, threadCandidates[omp_get_thread_num()], ringFeatures[i]);
+        }
+
+        // 按扫瞄线顺序合并，整帧的平面点只做一次体素滤波
+        size_t cornerNum = 0, surfaceNum = 0;
+        for (const ring_features& ring : ringFeatures)
+        {
+            cornerNum += ring.corner.size();
+            surfaceNum += ring.surface.size();
+        }
+        cornerCloud->reserve(cornerNum);
+        surfaceCloudScan->clear();
+        surfaceCloudScan->reserve(surfaceNum);
+        for (const ring_features& ring : ringFeatures)
+        {
+            for (int ind : ring.corner)
+                cornerCloud->push_back(extractedCloud->points[ind]);
+            for (int ind : ring.surface)
+                surfaceCloudScan->push_back(extractedCloud->points[ind]);
+        }
+        // 对筛选的平面点进行体素滤波，减少点的数量
+        downSizeFilter.setInputCloud(surfaceCloudScan);
+        downSizeFilter.filter(*surfaceCloud);
+
+        // 地面点不参与角点和平面点的筛选，单独作为extracted_normal输出
+        if (groundFlag == nullptr)
+            return;
+        groundCloudScan->clear();
+        for (size_t k = 0; k < extractedCloud->size(); ++k)
+        {
+            if (groundFlag[k])
+                groundCloudScan->push_back(extractedCloud->points[k]);
+        }
+        downSizeFilterGround.setInputCloud(groundCloudScan);
+        downSizeFilterGround.filter(*normalCloud);
+    }
 
-                if (sp >= ep)
+    //! 提取第i条扫瞄线的角点和平面点索引，candidates为当前线程的候选缓冲区
+    void extractRingFeatures(int i, std::vector<smoothness_ind>& candidates, ring_features& features)
+    {
+        const std::vector<int32_t>& startRingIndex = *cloudInfo->startRingIndex;
+        const std::vector<int32_t>& endRingIndex = *cloudInfo->endRingIndex;
+        const std::vector<int32_t>& pointColInd = *cloudInfo->pointColInd;
+        const std::vector<float>& cloudCurvature = featureBuffer.curvature;
+        std::vector<int32_t>& cloudNeighborPicked = featureBuffer.picked;
+        std::vector<int32_t>& cloudLabel = featureBuffer.label;
+
+        features.corner.clear();
+        features.surface.clear();
+        // 当前扫瞄线的点在[ringBegin, ringEnd]中，标记邻近点时不越过这个范围
+        const int ringBegin = startRingIndex[i] - 4;
+        const int ringEnd = endRingIndex[i] + 5;
+
+        // 横向上分为6个扇区
+        for (int j = 0; j < 6; j++)
+        {
+            // 求每个扇区的起始索引和结束索引
+            int sp = (startRingIndex[i] * (6 - j) + endRingIndex[i] * j) / 6;
+            int ep = (startRingIndex[i] * (5 - j) + endRingIndex[i] * (j + 1)) / 6 - 1;
+
+            if (sp >= ep)
+                continue;
+            // 只对可选的角点候选按平滑度由大到小做部分排序
+            candidates.clear();
+            for (int k = sp; k <= ep; k++)
+            {
+                if (cloudNeighborPicked[k] == 0 && cloudCurvature[k] > edgeThreshold && !(groundFlag && groundFlag[k]))
+                    candidates.push_back({cloudCurvature[k], (size_t)k});
+            }
+            size_t candidateNum = std::min(candidates.size(), kCornerCandidateNum);
+            std::partial_sort(candidates.begin(), candidates.begin() + candidateNum, candidates.end(), comp_rule());
+            // 筛选角点
+            int largestPickedNum = 0;
+            for (size_t k = 0; k < candidateNum && largestPickedNum < kMaxCornerPerSector; k++)
+            {
+                int ind = candidates[k].ind;
+                if (cloudNeighborPicked[ind] != 0) // 已被之前选中的角点屏蔽
                     continue;
-                // 按照平滑度由小到大排序
-                std::sort(cloudSmoothness.begin()+sp, cloudSmoothness.begin()+ep, comp_rule());
-                // 筛选角点
-                int largestPickedNum = 0;
-                for (int k = ep; k >= sp; k--)
+                largestPickedNum++;
+                cloudLabel[ind] = 1;    // 标记为角点
+                features.corner.push_back(ind);
+                // 标记选过的点，周围的点不再选择
+                cloudNeighborPicked[ind] = 1;
+                // 检查ind周围的节点
+                for (int l = 1; l <= 5 && ind + l <= ringEnd; l++)
                 {
-                    int ind = cloudSmoothness[k].ind;
-                    if (cloudNeighborPicked[ind] == 0 && cloudCurvature[ind] > edgeThreshold)
-                    {
-                        largestPickedNum++;
-                        if (largestPickedNum <= 20){
-                            cloudLabel[ind] = 1;    // 标记为角点
-                            cornerCloud->push_back(extractedCloud->points[ind]);
-                        } else {
-                            break;
-                        }
-                        // 标记选过的点，周围的点不再选择
-                        cloudNeighborPicked[ind] = 1;
-                        // 检查ind周围的节点
-                        for (int l = 1; l <= 5; l++)
-                        {
-                            int columnDiff = std::abs(int(cloudInfo.pointColInd[ind + l] - cloudInfo.pointColInd[ind + l - 1]));
-                            if (columnDiff > 10) // 说明两点横向上相差较远，不需要再标记邻近节点
-                                break;
-                            cloudNeighborPicked[ind + l] = 1; // 周围的点不再选择
-                        }
-                        for (int l = -1; l >= -5; l--)
-                        {
-                            int columnDiff = std::abs(int(cloudInfo.pointColInd[ind + l] - cloudInfo.pointColInd[ind + l + 1]));
-                            if (columnDiff > 10)
-                                break;
-                            cloudNeighborPicked[ind + l] = 1;
-                        }
-                    }
+                    int columnDiff = std::abs(int(pointColInd[ind + l] - pointColInd[ind + l - 1]));
+                    if (columnDiff > 10) // 说明两点横向上相差较远，不需要再标记邻近节点
+                        break;
+                    cloudNeighborPicked[ind + l] = 1; // 周围的点不再选择
                 }
-                // 筛选平面点
-                for (int k = sp; k <= ep; k++)
+                for (int l = -1; l >= -5 && ind + l >= ringBegin; l--)
                 {
-                    int ind = cloudSmoothness[k].ind;
-                    if (cloudNeighborPicked[ind] == 0 && cloudCurvature[ind] < surfThreshold)
-                    {
-                        cloudLabel[ind] = -1;           // 标记为平面点
-                        cloudNeighborPicked[ind] = 1;   // 标记为选择过的点
-                        // 周围点不再选择
-                        for (int l = 1; l <= 5; l++) {
-
-                            int columnDiff = std::abs(int(cloudInfo.pointColInd[ind + l] - cloudInfo.pointColInd[ind + l - 1]));
-                            if (columnDiff > 10)
-                                break;
-
-                            cloudNeighborPicked[ind + l] = 1;
-                        }
-                        for (int l = -1; l >= -5; l--) {
-
-                            int columnDiff = std::abs(int(cloudInfo.pointColInd[ind + l] - cloudInfo.pointColInd[ind + l + 1]));
-                            if (columnDiff > 10)
-                                break;
-
-                            cloudNeighborPicked[ind + l] = 1;
-                        }
-                    }
-                }
-
-                for (int k = sp; k <= ep; k++)
-                {
-                    if (cloudLabel[k] <= 0){
-                        surfaceCloudScan->push_back(extractedCloud->points[k]);
-                        // if(cloudLabel[k] == -2){
-                        //     normalCloudScan->push_back(extractedCloud->points[k]);
-                        // }
-                    }
-
-                    // if(cloudLabel[k] == 0){
-                    //     normalCloudScan->push_back(extractedCloud->points[k]);
-                    // }
+                    int columnDiff = std::abs(int(pointColInd[ind + l] - pointColInd[ind + l + 1]));
+                    if (columnDiff > 10)
+                        break;
+                    cloudNeighborPicked[ind + l] = 1;
                 }
             }
-            // 对筛选的平面点进行体素滤波，减少点的数量
-            surfaceCloudScanDS->clear();
-            downSizeFilter.setInputCloud(surfaceCloudScan);
-            downSizeFilter.filter(*surfaceCloudScanDS);
-            normalCloudScanDS->clear();
-            downSizeFilter.setInputCloud(normalCloudScan);
-            downSizeFilter.filter(*normalCloudScanDS);
-
-            *surfaceCloud += *surfaceCloudScanDS;
-            *normalCloud += *normalCloudScanDS;
+            // 角点和地面点以外的点都作为平面点
+            for (int k = sp; k <= ep; k++)
+            {
+                if (cloudLabel[k] <= 0 && !(groundFlag && groundFlag[k]))
+                    features.surface.push_back(k);
+            }
         }
     }
-    //! 特征提取完成后，清除输入点云中的无用信息
-    void freeCloudInfoMemory()
-    {
-        cloudInfo.startRingIndex.clear();
-        cloudInfo.endRingIndex.clear();
-        cloudInfo.pointColInd.clear();
-        cloudInfo.pointRange.clear();
-    }
     //! 发布输出点云消息
     void publishFeatureCloud()
     {
-        // free cloud info memory 清除输入点云中的无用信息
-        freeCloudInfoMemory();
+        if (hasFrameSink())
+        {
+            // 后续模块不再需要逐点的距离信息，行列号只在里程计使用距离图像估计协方差时保留
+            rolo::CloudFramePtr frame = std::make_shared<rolo::CloudFrame>(*cloudInfo);
+            frame->startRingIndex.reset();
+            frame->endRingIndex.reset();
+            if (!rangeImageCovariance)
+            {
+                frame->pointRowInd.reset();
+                frame->pointColInd.reset();
+            }
+            frame->pointRange.reset();
+            frame->pointGround.reset();
+            frame->extractedCorner = cornerCloud;
+            frame->extractedSurface = surfaceCloud;
+            frame->extractedNormal = normalCloud;
+            frameSink(frame);
+
+            // 可视化话题只在有订阅时才转换
+            if (pubCornerPoints.getNumSubscribers() != 0)
+                publishCloud(pubCornerPoints,  cornerCloud,  cloudHeader.stamp, lidarFrame);
+            if (pubSurfacePoints.getNumSubscribers() != 0)
+                publishCloud(pubSurfacePoints, surfaceCloud, cloudHeader.stamp, lidarFrame);
+            if (pubNormalPoints.getNumSubscribers() != 0)
+                publishCloud(pubNormalPoints, normalCloud, cloudHeader.stamp, lidarFrame);
+            return;
+        }
+
+        // 逐点信息不再转发，cloud_projected直接沿用输入消息
+        rolo::CloudInfoStamp cloudInfoOut;
+        rolo::frameInfoToMsg(*cloudInfo, cloudInfoOut);
+        cloudInfoOut.cloud_projected = cloudInfo->sourceMsg->cloud_projected;
+        if (rangeImageCovariance)
+        {
+            cloudInfoOut.pointRowInd = cloudInfo->sourceMsg->pointRowInd;
+            cloudInfoOut.pointColInd = cloudInfo->sourceMsg->pointColInd;
+        }
         // save newly extracted features
-        cloudInfo.extracted_corner  = publishCloud(pubCornerPoints,  cornerCloud,  cloudHeader.stamp, lidarFrame);
-        cloudInfo.extracted_surface = publishCloud(pubSurfacePoints, surfaceCloud, cloudHeader.stamp, lidarFrame);
-        cloudInfo.extracted_normal = publishCloud(pubNormalPoints, normalCloud, cloudHeader.stamp, lidarFrame);
+        cloudInfoOut.extracted_corner  = publishCloud(pubCornerPoints,  cornerCloud,  cloudHeader.stamp, lidarFrame);
+        cloudInfoOut.extracted_surface = publishCloud(pubSurfacePoints, surfaceCloud, cloudHeader.stamp, lidarFrame);
+        cloudInfoOut.extracted_normal = publishCloud(pubNormalPoints, normalCloud, cloudHeader.stamp, lidarFrame);
 
         // publish to mapOptimization
-        pubLaserCloudInfo.publish(cloudInfo);
+        pubLaserCloudInfo.publish(cloudInfoOut);
     }
     
 };
 
+rolo::PipelineStagePtr rolo::createFeatureExtraction(bool intraProcess)
+{
+    return std::make_shared<FeatureExtraction>(intraProcess);
+}
+
+#ifndef ROLO_PIPELINE
 int main(int argc, char** argv)
 {
     ros::init(argc, argv, "rolo");
@@ -299,4 +328,5 @@ int main(int argc, char** argv)
     ros::spin();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
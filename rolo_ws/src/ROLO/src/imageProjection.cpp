@@ -1,45 +1,17 @@
 #include "rolo/utility.h"
+#include "rolo/pipeline.h"
+#include "rolo/rangeProjection.h"
+#include "rolo/deskew.h"
+#include "rolo/pointAdapters.h"
+#include "rolo/groundSegmentation.h"
 
 #include "rolo/CloudInfoStamp.h"
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/Image.h>
 
-struct VelodynePointXYZIRT
-{
-    PCL_ADD_POINT4D     // 添加XYZ;
-    PCL_ADD_INTENSITY;  // 添加inetnsity
-    uint16_t ring;      // 添加扫瞄线数
-    float time;         // 添加时间戳，扫描到当前这个点所花的时间
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW // 确保new操作符内存对齐
-} EIGEN_ALIGN16;    // 确保正确的内存分配
-
-POINT_CLOUD_REGISTER_POINT_STRUCT (VelodynePointXYZIRT,
-    (float, x, x) (float, y, y) (float, z, z) (float, intensity, intensity)
-    (uint16_t, ring, ring) (float, time, time)
-)
-
-struct OusterPointXYZIRT {
-    PCL_ADD_POINT4D;
-    float intensity;
-    uint32_t t;
-    uint16_t reflectivity;
-    uint8_t ring;
-    uint16_t noise;
-    uint32_t range;
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-} EIGEN_ALIGN16;
-POINT_CLOUD_REGISTER_POINT_STRUCT(OusterPointXYZIRT,
-    (float, x, x) (float, y, y) (float, z, z) (float, intensity, intensity)
-    (uint32_t, t, t) (uint16_t, reflectivity, reflectivity)
-    (uint8_t, ring, ring) (uint16_t, noise, noise) (uint32_t, range, range)
-)
-
-// Use the Velodyne point format as a common representation
-using PointXYZIRT = VelodynePointXYZIRT;
-
 const int queueLength = 2000;
 
-class ImageProjection : public ParamLoader
+class ImageProjection : public ParamLoader, public rolo::PipelineStage
 {
 private:
 
@@ -51,42 +23,48 @@ private:
     ros::Publisher pubLaserCloudInfo;
     ros::Publisher pubLaserRangeImg;
 
-    std::deque<sensor_msgs::PointCloud2> cloudQueue;
-    std::deque<nav_msgs::Odometry> odomQueue;
+    std::unique_ptr<rolo::StageQueue<sensor_msgs::PointCloud2ConstPtr>> cloudQueue; // 原始点云输入队列
+    std::deque<sensor_msgs::PointCloud2ConstPtr> cloudHoldQueue; // 延后处理的点云，长度为cloudHoldBack
+    rolo::PoseBuffer odomBuffer;    // 前端里程计位姿历史，用于去畸变插值
     std::mutex odomLock;
-    sensor_msgs::PointCloud2 currentCloudMsg;
+    sensor_msgs::PointCloud2ConstPtr currentCloudMsg;
 
     bool firstPointFlag;
     Eigen::Affine3f transStartInverse;
 
-    pcl::PointCloud<PointXYZIRT>::Ptr laserCloudIn;
-    pcl::PointCloud<OusterPointXYZIRT>::Ptr tmpOusterCloudIn;
-    pcl::PointCloud<PointType>::Ptr   deskewCloud;
+    std::unique_ptr<rolo::CloudAdapter> pointAdapter; // 按雷达驱动从PointCloud2字节流读取点
+    bool layoutChecked = false;     // 已根据第一帧的字段确定ring/time是否可用
     pcl::PointCloud<PointType>::Ptr   fullCloud;
     pcl::PointCloud<PointType>::Ptr   extractedCloud;
 
-    cv::Mat rangeMat;   // 将一帧点云平铺，形成一个矩阵，行数为扫瞄线数，列数由水平扫描角度求得
-
-    rolo::CloudInfoStamp cloudInfoStamp;
+    std::vector<float> rangeImage;  // 将一帧点云平铺，行优先存储，行数为扫瞄线数，列数由水平扫描角度求得
+    rolo::RangeProjector rangeProjector;
+    rolo::PointSoA cloudSoA;        // 投影输入，由原始消息直接转换，SoA格式便于向量化
+    rolo::DeskewTable deskewTable;  // 当前帧按时间分段的去畸变变换
+    bool deskewActive = false;      // 当前帧是否去畸变，在deskewCloudInfo中确定
+    std::vector<uint8_t> groundMask;    // 距离图像中的地面点标记，只有最下方groundScanInd+1行会被写入
+
+    // 每帧新分配，发布后由下游模块持有
+    std::shared_ptr<std::vector<int32_t>> startRingIndex;
+    std::shared_ptr<std::vector<int32_t>> endRingIndex;
+    std::shared_ptr<std::vector<int32_t>> pointRowInd;
+    std::shared_ptr<std::vector<int32_t>> pointColInd;
+    std::shared_ptr<std::vector<float>> pointRange;
+    std::shared_ptr<std::vector<uint8_t>> pointGround;
     double timeScanCur; // 当前帧第一个点扫描的时间
     double timeScanEnd; // 当前帧最后一个点扫描的时间
     std_msgs::Header cloudHeader;
 
     vector<int> columnIdnCountVec;
 
-    std::string timeField; 
-    int timeFlag = 0;
     float scanPeriod = 0.1;
-    double odomTimeDiff = -1.0;
-    float odomIncreX, odomIncreY, odomIncreZ, odomIncreRoll, odomIncrePitch, odomIncreYaw;
-    bool odomAvailable = false;
 
 public:
     //! 初始化输入输出，和点云变量
     ImageProjection()
     {
         // 输入：激光点云原数据, 前端里程计数据
-        subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>(pointCloudTopic, 10, &ImageProjection::cloudHandler, this, ros::TransportHints().tcpNoDelay());
+        subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>(pointCloudTopic, frameQueueCapacity, &ImageProjection::cloudHandler, this, ros::TransportHints().tcpNoDelay());
         subOdom = nh.subscribe<nav_msgs::Odometry>(odomTopic+"_incremental", 2000, &ImageProjection::odometryHandler, this, ros::TransportHints().tcpNoDelay());
         // 输出：cloud_info
         // cloud_info为从去畸变点云中提取的有效点云信息：行列数，距离和坐标，方便后续提取特征
@@ -95,26 +73,64 @@ public:
         // 重置各变量，初始化
         allocateMemory();
         resetParameters();
-        timeField = "time";
         pcl::console::setVerbosityLevel(pcl::console::L_ERROR);
+        // 处理线程，回调中只入队
+        cloudQueue.reset(new rolo::StageQueue<sensor_msgs::PointCloud2ConstPtr>(nh, "image_projection", frameQueueCapacity, frameQueuePolicy,
+            std::bind(&ImageProjection::processCloud, this, std::placeholders::_1)));
     }
 
-    ~ImageProjection(){}
+    ~ImageProjection()
+    {
+        // 先结束处理线程，再释放其余成员
+        cloudQueue.reset();
+    }
 
     void allocateMemory(){
-        laserCloudIn.reset(new pcl::PointCloud<PointXYZIRT>());
-        tmpOusterCloudIn.reset(new pcl::PointCloud<OusterPointXYZIRT>());
-        deskewCloud.reset(new pcl::PointCloud<PointType>());
+        switch (sensor)
+        {
+            case lidarType::OUSTER: pointAdapter.reset(new rolo::CloudAdapterImpl<rolo::OusterTraits>()); break;
+            case lidarType::LIVOX:  pointAdapter.reset(new rolo::CloudAdapterImpl<rolo::LivoxTraits>()); break;
+            case lidarType::HESAI:  pointAdapter.reset(new rolo::CloudAdapterImpl<rolo::HesaiTraits>()); break;
+            default:                pointAdapter.reset(new rolo::CloudAdapterImpl<rolo::VelodyneTraits>()); break;
+        }
         fullCloud.reset(new pcl::PointCloud<PointType>());
-        extractedCloud.reset(new pcl::PointCloud<PointType>());
 
         fullCloud->points.resize(N_SCAN*Horizon_SCAN);
-
-        cloudInfoStamp.startRingIndex.assign(N_SCAN, 0);
-        cloudInfoStamp.endRingIndex.assign(N_SCAN, 0);
-
-        cloudInfoStamp.pointColInd.assign(N_SCAN*Horizon_SCAN, 0);
-        cloudInfoStamp.pointRange.assign(N_SCAN*Horizon_SCAN, 0);
+        groundMask.assign(N_SCAN*Horizon_SCAN, 0);
+
+        rolo::RangeProjectionParams projectionParams;
+        projectionParams.rows = N_SCAN;
+        projectionParams.cols = Horizon_SCAN;
+        projectionParams.downsampleRate = downsampleRate;
+        projectionParams.minRange = lidarMinRange;
+        projectionParams.maxRange = lidarMaxRange;
+        rangeProjector.setParams(projectionParams);
+
+        // 行号由扫瞄线标定表决定；未指定标定文件时，若点云带ring字段则在收到第一帧后改用ring
+        if (!beamAngleFile.empty())
+        {
+            std::string path = beamAngleFile;
+            if (path[0] != '/' && !beamDirectory.empty())
+                path = beamDirectory + "/" + path;
+            rolo::BeamTable beams;
+            std::string error;
+            if (!beams.load(path, error))
+            {
+                ROS_ERROR_STREAM(error);
+                ros::shutdown();
+            }
+            else
+            {
+                if (beams.beams() != N_SCAN)
+                    ROS_WARN_STREAM("Beam angle file " << path << " has " << beams.beams() << " beams, N_SCAN is " << N_SCAN);
+                rangeProjector.setBeamTable(beams);
+            }
+        }
+        else
+        {
+            // 原公式int((angle + 15) / 2 + 0.5)
+            rangeProjector.setBeamTable(rolo::BeamTable::uniform(N_SCAN, -15.0f, 2.0f));
+        }
 
         resetParameters();
     }
@@ -122,40 +138,46 @@ public:
     // 重置各点云变量的初值，标志位
     void resetParameters()
     {
-        deskewCloud->clear();
-        laserCloudIn->clear();
-        extractedCloud->clear();
+        // 上一帧的输出可能仍被下游模块引用，不能原地清空
+        extractedCloud.reset(new pcl::PointCloud<PointType>());
+        extractedCloud->reserve(N_SCAN*Horizon_SCAN);
+        startRingIndex = std::make_shared<std::vector<int32_t>>(N_SCAN, 0);
+        endRingIndex = std::make_shared<std::vector<int32_t>>(N_SCAN, 0);
+        // 只保存有效点，长度与extractedCloud一致
+        pointRowInd = std::make_shared<std::vector<int32_t>>();
+        pointRowInd->reserve(N_SCAN*Horizon_SCAN);
+        pointColInd = std::make_shared<std::vector<int32_t>>();
+        pointColInd->reserve(N_SCAN*Horizon_SCAN);
+        pointRange = std::make_shared<std::vector<float>>();
+        pointRange->reserve(N_SCAN*Horizon_SCAN);
+        pointGround = std::make_shared<std::vector<uint8_t>>();
+        if (groundScanInd > 0)
+            pointGround->reserve(N_SCAN*Horizon_SCAN);
         // reset range matrix for range image projection
         // 距离矩阵为一个以雷电点云线数为行数，每根扫瞄线的点数为列数，元素为到雷达原点的距离
-        rangeMat = cv::Mat(N_SCAN, Horizon_SCAN, CV_32F, cv::Scalar::all(FLT_MAX));
+        rangeImage.assign(N_SCAN*Horizon_SCAN, FLT_MAX);
 
         columnIdnCountVec.assign(N_SCAN, 0);
     }
 
-    //! 获取给定odom消息所代表的变换矩阵
-    Eigen::Affine3f odom2affine(nav_msgs::Odometry odom) // Eigen::Affine3f为仿射变换矩阵，旋转矩阵和平移矩阵的结合
-    {
-        double x, y, z, roll, pitch, yaw;
-        x = odom.pose.pose.position.x;
-        y = odom.pose.pose.position.y;
-        z = odom.pose.pose.position.z;
-        tf::Quaternion orientation;
-        tf::quaternionMsgToTF(odom.pose.pose.orientation, orientation);
-        tf::Matrix3x3(orientation).getRPY(roll, pitch, yaw);
-        return pcl::getTransformation(x, y, z, roll, pitch, yaw);
-    }
-
-
     void odometryHandler(const nav_msgs::OdometryConstPtr& odomMsg)
     {
+        const geometry_msgs::Pose& pose = odomMsg->pose.pose;
         std::lock_guard<std::mutex> lock2(odomLock);
-        odomQueue.push_back(*odomMsg);
-        if(odomQueue.size() >= 2)
-            odomAvailable = true;
+        odomBuffer.push(odomMsg->header.stamp.toSec(),
+                        Eigen::Quaterniond(pose.orientation.w, pose.orientation.x, pose.orientation.y, pose.orientation.z),
+                        Eigen::Vector3d(pose.position.x, pose.position.y, pose.position.z));
+        // 只保留最近一段历史
+        odomBuffer.trimBefore(odomMsg->header.stamp.toSec() - 1.0);
     }
 
 
     void cloudHandler(const sensor_msgs::PointCloud2ConstPtr& laserCloudMsg)
+    {
+        cloudQueue->push(laserCloudMsg);
+    }
+
+    void processCloud(const sensor_msgs::PointCloud2ConstPtr& laserCloudMsg)
     {
         // 存储点云，转换格式
         if (!cachePointCloud(laserCloudMsg)){
@@ -167,6 +189,8 @@ public:
         }
         // 投影到range image，去畸变
         projectPointCloud();
+        // 在距离图像上标记地面点
+        segmentGround();
         // 提取有效点的相关信息，方便后续提取特征
         cloudExtraction();
         // 发布点云和cloud_info
@@ -179,286 +203,126 @@ public:
     bool cachePointCloud(const sensor_msgs::PointCloud2ConstPtr& laserCloudMsg)
     {
         // cache point cloud
-        cloudQueue.push_back(*laserCloudMsg);
-        if (cloudQueue.size() <= 2) // 存储三帧以上点云后，进行后续操作
+        cloudHoldQueue.push_back(laserCloudMsg);
+        if ((int)cloudHoldQueue.size() <= cloudHoldBack) // 延后cloudHoldBack帧再处理
             return false;
         // convert cloud
-        currentCloudMsg = std::move(cloudQueue.front()); // 相当于引用，只不过不用占用新内存
-        cloudQueue.pop_front();
-        // 根据雷达类型，转换为相应的点云格式
-        if (sensor == lidarType::VELODYNE)
-        {
-            pcl::moveFromROSMsg(currentCloudMsg, *laserCloudIn);
-        }
-        else if (sensor == lidarType::OUSTER)
-        {
-            timeField = "t";
-            // Convert to Velodyne format
-            pcl::moveFromROSMsg(currentCloudMsg, *tmpOusterCloudIn);
-            laserCloudIn->points.resize(tmpOusterCloudIn->size());
-            laserCloudIn->is_dense = tmpOusterCloudIn->is_dense;
-            for (size_t i = 0; i < tmpOusterCloudIn->size(); i++)
-            {
-                auto &src = tmpOusterCloudIn->points[i];
-                auto &dst = laserCloudIn->points[i];
-                dst.x = src.x;
-                dst.y = src.y;
-                dst.z = src.z;
-                dst.intensity = src.intensity;
-                dst.ring = src.ring;
-                dst.time = src.t * 1e-9f;
-                // dst.time = src.t * 1.0f;
-            }
-        }
-        else
+        currentCloudMsg = cloudHoldQueue.front(); // 只持有指针，不拷贝点云数据
+        cloudHoldQueue.pop_front();
+        // 根据雷达类型，直接从消息的字节流读取到SoA，不经过中间的PCL点云
+        if (!pointAdapter->convert(*currentCloudMsg, cloudSoA))
         {
-            ROS_ERROR_STREAM("Unknown sensor type: " << int(sensor));
+            ROS_ERROR("Point cloud has no x/y/z fields!");
             ros::shutdown();
+            return false;
         }
+        // 坐标非有限的点在转换时已丢弃
+        if (cloudSoA.size() == 0)
+            return false;
 
         // get timestamp
         // scanPeriod = cloudHeader.stamp.toSec() - timeScanCur; 
-        cloudHeader = currentCloudMsg.header;
+        cloudHeader = currentCloudMsg->header;
         timeScanCur = cloudHeader.stamp.toSec(); // 当前帧第一个点扫描的时间
         // 扫描完最后一个点的时间
-        timeScanEnd = timeScanCur + laserCloudIn->points.back().time;
+        timeScanEnd = timeScanCur + cloudSoA.time.back();
 
-        // check dense flag 检查点云有效性
-        if (laserCloudIn->is_dense == false)
+        // check ring and time channel, 只在第一帧检查
+        if (!layoutChecked)
         {
-            ROS_ERROR("Point cloud is not in dense format, please remove NaN points first!");
-            ros::shutdown();
-        }
-        static int ringFlag =0;
-        // check ring channel
-        if (ringFlag == 0)
-        {
-            ringFlag = -1;
-            // 检查点云消息中的fields中是否有ring字段，velodyne雷达消息默认会有
-            for (int i = 0; i < (int)currentCloudMsg.fields.size(); ++i)
-            {
-                if (currentCloudMsg.fields[i].name == "ring")
-                {
-                    ringFlag = 1;
-                    ROS_WARN("Point cloud ring field available!");
-                    break;
-                }
-            }
-        }
-        // check point time field
-        if (timeFlag == 0)
-        {
-            timeFlag = -1;
-            for (int i = 0; i < (int)currentCloudMsg.fields.size(); ++i)
-            {
-                if (currentCloudMsg.fields[i].name == timeField)
-                {
-                    timeFlag = 1;
-                    ROS_WARN("Point cloud time field available!");
-                    break;
-                }
-            }
+            layoutChecked = true;
+            const rolo::PointLayout& layout = pointAdapter->layout();
+            if (layout.hasRing())
+                ROS_WARN("Point cloud ring field available!");
+            if (layout.hasTime())
+                ROS_WARN("Point cloud time field available!");
+            if (!layout.typed)
+                ROS_WARN_STREAM("Point cloud field types differ from the " << pointAdapter->name() << " driver, converting field by field");
+            // Velodyne的ring 0为最下方的线，Ouster、Hesai的ring 0为最上方的线
+            if (pointAdapter->ringIsBeam() && beamAngleFile.empty())
+                rangeProjector.setBeamTable(rolo::BeamTable::ringOnly(N_SCAN, pointAdapter->ringDescending()));
         }
         return true;
     }
 
-    //! 对当前点云进行去畸变操作
+    //! 计算每个点相对第一个点的时间，并由里程计位姿历史构造当前帧的去畸变变换表
     bool deskewCloudInfo()
     {
-        if(deskewEnabled && odomAvailable){
-            int cloudSize = laserCloudIn->points.size();
-            if(timeFlag == -1){
-                bool halfPassed = false;
-                float startOri = -atan2(laserCloudIn->points[0].y,laserCloudIn->points[0].x); 
-                float endOri   = -atan2(laserCloudIn->points[cloudSize - 1].y, laserCloudIn->points[cloudSize - 1].x) + 2 * M_PI;
-                if (endOri - startOri > 3 * M_PI) {
-                    endOri -= 2 * M_PI;
-                } else if (endOri - startOri < M_PI)
-                    endOri += 2 * M_PI;
-                float orientationDiff = endOri - startOri;
-                
-                PointType point;
-                deskewCloud->points.resize(cloudSize);
-
-                // 根据前端里程计信息进行点云去畸变，匀速插值
-                // 时间标定
-                while (!odomQueue.empty())
-                {
-                    // 前端里程和后端里程进行时间标定
-                    if (fabs(timeScanCur - odomQueue.front().header.stamp.toSec()) > 0.25)
-                        odomQueue.pop_front();
-                    else
-                        break;
-                }
-
-                Eigen::Affine3f lidarOdomAffineFront = odom2affine(odomQueue.front());
-                Eigen::Affine3f lidarOdomAffineBack = odom2affine(odomQueue.back());
-                // 求前后两帧lidar里程计位姿的变换关系
-                Eigen::Affine3f lidarOdomAffineIncre = lidarOdomAffineFront.inverse() * lidarOdomAffineBack;
-                odomTimeDiff = odomQueue.back().header.stamp.toSec() - odomQueue.front().header.stamp.toSec();
-                pcl::getTranslationAndEulerAngles(lidarOdomAffineIncre, odomIncreX, odomIncreY, odomIncreZ, odomIncreRoll, odomIncrePitch, odomIncreYaw);
-                
-                for (int i = 0; i < cloudSize; i++) {
-
-                    point.x = laserCloudIn->points[i].y;
-                    point.y = laserCloudIn->points[i].z;
-                    point.z = laserCloudIn->points[i].x;
-
-                    float ori = -atan2(point.x, point.z);
-                    if (!halfPassed) {
-                        if (ori < startOri - M_PI / 2)
-                            ori += 2 * M_PI;
-                        else if (ori > startOri + M_PI * 3 / 2)
-                            ori -= 2 * M_PI;
-
-                        if (ori - startOri > M_PI)
-                            halfPassed = true;
-                    } else {
+        int cloudSize = cloudSoA.size();
+        deskewActive = false;
+        if (!deskewEnabled)
+            return true;
+
+        float scanDuration = scanPeriod;
+        if(!pointAdapter->layout().hasTime()){
+            // 没有时间字段，按水平角在扫描周期内线性估计
+            bool halfPassed = false;
+            float startOri = -atan2(cloudSoA.y[0], cloudSoA.x[0]); 
+            float endOri   = -atan2(cloudSoA.y[cloudSize - 1], cloudSoA.x[cloudSize - 1]) + 2 * M_PI;
+            if (endOri - startOri > 3 * M_PI) {
+                endOri -= 2 * M_PI;
+            } else if (endOri - startOri < M_PI)
+                endOri += 2 * M_PI;
+            float orientationDiff = endOri - startOri;
+
+            for (int i = 0; i < cloudSize; i++) {
+                float ori = -atan2(cloudSoA.y[i], cloudSoA.x[i]);
+                if (!halfPassed) {
+                    if (ori < startOri - M_PI / 2)
                         ori += 2 * M_PI;
+                    else if (ori > startOri + M_PI * 3 / 2)
+                        ori -= 2 * M_PI;
 
-                        if (ori < endOri - M_PI * 3 / 2)
-                            ori += 2 * M_PI;
-                        else if (ori > endOri + M_PI / 2)
-                            ori -= 2 * M_PI;
-                    }
-                    float relTime = (ori - startOri) / orientationDiff;
-                    point.intensity = scanPeriod * relTime;
-                    deskewCloud->points[i] = point;
-                }
-            }
-            else{
-                // 点云自带时间戳
-                
-                PointType point;
-                deskewCloud->points.resize(cloudSize);
-
-                // 根据前端里程计信息进行点云去畸变，匀速插值
-                // 时间标定
-                while (!odomQueue.empty())
-                {
-                    // 前端里程和后端里程进行时间标定
-                    if (fabs(timeScanCur - odomQueue.front().header.stamp.toSec()) > 0.3) // 至少保证有两个元素
-                        odomQueue.pop_front();
-                    else
-                        break;
-                }
+                    if (ori - startOri > M_PI)
+                        halfPassed = true;
+                } else {
+                    ori += 2 * M_PI;
 
-                Eigen::Affine3f lidarOdomAffineFront = odom2affine(odomQueue.front());
-                Eigen::Affine3f lidarOdomAffineBack = odom2affine(odomQueue.back());
-                // 求前后两帧lidar里程计位姿的变换关系
-                Eigen::Affine3f lidarOdomAffineIncre = lidarOdomAffineFront.inverse() * lidarOdomAffineBack;
-                odomTimeDiff = odomQueue.back().header.stamp.toSec() - odomQueue.front().header.stamp.toSec();
-                pcl::getTranslationAndEulerAngles(lidarOdomAffineIncre, odomIncreX, odomIncreY, odomIncreZ, odomIncreRoll, odomIncrePitch, odomIncreYaw);
-                
-                for (int i = 0; i < cloudSize; i++) {
-
-                    point.x = laserCloudIn->points[i].y;
-                    point.y = laserCloudIn->points[i].z;
-                    point.z = laserCloudIn->points[i].x;
-
-                    float relTime = fabs(laserCloudIn->points[i].time);
-                    point.intensity = relTime;
-                    deskewCloud->points[i] = point;
+                    if (ori < endOri - M_PI * 3 / 2)
+                        ori += 2 * M_PI;
+                    else if (ori > endOri + M_PI / 2)
+                        ori -= 2 * M_PI;
                 }
+                float relTime = (ori - startOri) / orientationDiff;
+                cloudSoA.time[i] = scanPeriod * relTime;
             }
         }
-        return true;
-    }
+        else{
+            // 点云自带时间戳
+            float lastTime = 0.0f;
+            for (int i = 0; i < cloudSize; i++) {
+                cloudSoA.time[i] = fabs(cloudSoA.time[i]);
+                lastTime = std::max(lastTime, cloudSoA.time[i]);
+            }
+            if (lastTime > 0)
+                scanDuration = lastTime;
+        }
 
-    PointType deskewPoint(PointType *point, double relTime)
-    {
-        // 如果不满足去畸变条件，则跳过
-        if (!deskewEnabled || odomAvailable == false)
-            return *point;
-
-        double pointTime = timeScanCur + relTime; // relTime是距离第一个点的是时间差
-
-        float rotXCur, rotYCur, rotZCur;
-        float posXCur, posYCur, posZCur;
-
-        // transform points to start
-        float ratio = relTime/scanPeriod;
-        Eigen::Matrix<float, 6, 1> trans;
-        trans.col(0) << odomIncreX, odomIncreY, odomIncreZ, odomIncreRoll, odomIncrePitch, odomIncreYaw;
-        trans = trans.eval() * (scanPeriod/odomTimeDiff) * ratio;
-        // trans = trans.eval() * ratio;
-        // Eigen::Affine3f transBt = pcl::getTransformation(-trans(0), -trans(1), -trans(2), -trans(3), -trans(4), -trans(5));
-        Eigen::Affine3f transBt = pcl::getTransformation(0.0, 0.0, 0.0, -trans(3), -trans(4), -trans(5));
-
-        // 进行去畸变处理
-        PointType newPoint;
-        newPoint.x = transBt(0,0) * point->x + transBt(0,1) * point->y + transBt(0,2) * point->z + transBt(0,3);
-        newPoint.y = transBt(1,0) * point->x + transBt(1,1) * point->y + transBt(1,2) * point->z + transBt(1,3);
-        newPoint.z = transBt(2,0) * point->x + transBt(2,1) * point->y + transBt(2,2) * point->z + transBt(2,3);
-        newPoint.intensity = point->intensity;
-
-        return newPoint;
+        // 点云在处理线程中去畸变，odomBuffer同时由里程计回调写入
+        // 在位姿历史上插值扫描期间每一列时刻的位姿，每帧只计算Horizon_SCAN+1个变换（包括平移）
+        std::lock_guard<std::mutex> lock(odomLock);
+        odomBuffer.trimBefore(timeScanCur - 0.3); // 至少保证有两个元素
+        deskewActive = rolo::buildDeskewTable(odomBuffer, timeScanCur, scanDuration, Horizon_SCAN, deskewTable);
+        return true;
     }
 
     //! 将当前帧点云投影到一个range image中，像素值为到雷达坐标系原点的距离，并对所有点进行去畸变操作。
     void projectPointCloud()
     {
-        int cloudSize = laserCloudIn->points.size();
-        // range image projection
+        int cloudSize = cloudSoA.size();
+        // SoA已在cachePointCloud中转换，时间已在deskewCloudInfo中计算
         for (int i = 0; i < cloudSize; ++i)
         {
-            PointType thisPoint;
-            thisPoint.x = laserCloudIn->points[i].x;
-            thisPoint.y = laserCloudIn->points[i].y;
-            thisPoint.z = laserCloudIn->points[i].z;
-            // thisPoint.intensity = laserCloudIn->points[i].intensity;
-            thisPoint.intensity = laserCloudIn->points[i].ring*laserCloudIn->points[i].z;
-
-            float range = pointDistance(thisPoint); // 到雷达原点的距离
-            // 距离滤波
-            if (range < lidarMinRange || range > lidarMaxRange)
-                continue;
-            // 行索引为扫瞄线数
-            float angle = atan(laserCloudIn->points[i].z / sqrt(laserCloudIn->points[i].x * laserCloudIn->points[i].x + laserCloudIn->points[i].y * laserCloudIn->points[i].y)) * 180 / M_PI; // 点到基座的俯仰角，单位：degree
-            int scanID = 0;
-            // 判断一个点属于哪个线上的点，scanID为线数的序列号
-            scanID = int((angle + 15) / 2 + 0.5);
-            // std::cout << "point ring: " << scanID << std::endl;
-            if (scanID > (N_SCAN - 1) || scanID < 0)
-            {
-                continue;
-            }
-            int rowIdn = scanID;
-            // int rowIdn = laserCloudIn->points[i].ring;
-            if (rowIdn < 0 || rowIdn >= N_SCAN)
-                continue;
-
-            if (rowIdn % downsampleRate != 0)
-                continue;
-
-            int columnIdn = -1;
-            if (sensor == lidarType::VELODYNE || sensor == lidarType::OUSTER)
-            {
-                // 以水平方位角划分，得到列索引
-                float horizonAngle = atan2(thisPoint.x, thisPoint.y) * 180 / M_PI;
-                static float ang_res_x = 360.0/float(Horizon_SCAN);
-                // 列索引公式，下面式子是以y轴负半轴为0的列索引，使一帧激光点云沿y轴负半轴展开
-                columnIdn = -round((horizonAngle-90.0)/ang_res_x) + Horizon_SCAN/2;
-                // columnIdn = round(horizonAngle/ang_res_x) + Horizon_SCAN/2;
-                if (columnIdn >= Horizon_SCAN)
-                    columnIdn -= Horizon_SCAN; // 为了能够首尾相接
-            }
-            
-            if (columnIdn < 0 || columnIdn >= Horizon_SCAN)
-                continue;
-
-            // 填充过的像素位置，不再填充新的值
-            if (rangeMat.at<float>(rowIdn, columnIdn) != FLT_MAX)
-                continue;
-
-            thisPoint = deskewPoint(&thisPoint, deskewCloud->points[i].intensity);
-            // rangeMat填充
-            rangeMat.at<float>(rowIdn, columnIdn) = range;
-            // fullCloud点云由一维数组进行有序排列，索引公式为：c + r * width
-            int index = columnIdn + rowIdn * Horizon_SCAN;
-            fullCloud->points[index] = thisPoint;
+            // 与原实现一致，强度替换为ring*z，驱动给出的强度不再使用
+            cloudSoA.intensity[i] = cloudSoA.ring[i]*cloudSoA.z[i];
         }
+        // 向量化计算行列索引（行：按俯仰角或ring查标定表，列：以y轴负半轴为0的水平方位角）和去畸变坐标（每列一个变换，点按时间查表），
+        // 再按点的顺序填充，已填充的像素不再覆盖
+        // fullCloud点云由一维数组进行有序排列，索引公式为：c + r * width
+        rangeProjector.project(cloudSoA, deskewActive ? &deskewTable : nullptr, rangeImage.data(), fullCloud->points.data());
+
         if(pubLaserRangeImg.getNumSubscribers()!=0){
+            cv::Mat rangeMat(N_SCAN, Horizon_SCAN, CV_32F, rangeImage.data()); // 只包装，不拷贝
             cv::Mat rangeMatInit;
             rangeMat.convertTo(rangeMatInit, CV_16UC1);
             int row, col;
@@ -473,6 +337,18 @@ public:
         }
     }
 
+    //! 按列比较最下方几条扫瞄线上相邻点的坡度，标记地面点，结果供特征提取模块单独输出地面点云
+    void segmentGround()
+    {
+        if (groundScanInd <= 0)
+            return;
+        rolo::GroundSegmentationParams params;
+        params.groundRows = groundScanInd;
+        params.maxSlope = groundDegreeThre;
+        params.sensorMountAngle = sensorMountAngle;
+        rolo::segmentGround(params, N_SCAN, Horizon_SCAN, fullCloud->points.data(), rangeImage.data(), groundMask.data(), numberOfCores);
+    }
+
     //! 对去畸变后的点云进行提取标记，方便后续提取特征，标记好每条扫瞄线的提取的点的行列和位置信息
     void cloudExtraction()
     {
@@ -482,16 +358,21 @@ public:
         for (int i = 0; i < N_SCAN; ++i)
         {
             // 这条扫瞄线可以计算曲率的起始点（计算曲率需要左右各五个点）
-            cloudInfoStamp.startRingIndex[i] = count - 1 + 5;
+            (*startRingIndex)[i] = count - 1 + 5;
 
             for (int j = 0; j < Horizon_SCAN; ++j)
             {
-                if (rangeMat.at<float>(i,j) != FLT_MAX)
+                float range = rangeImage[j + i*Horizon_SCAN];
+                if (range != FLT_MAX)
                 {
                     // mark the points' column index for marking occlusion later
-                    cloudInfoStamp.pointColInd[count] = j; // 列数信息
+                    // 行列号保留了距离图像的结构，下游可以在图像上搜索近邻而不必建立KD树
+                    pointRowInd->push_back(i); // 行数信息
+                    pointColInd->push_back(j); // 列数信息
                     // save range info
-                    cloudInfoStamp.pointRange[count] = rangeMat.at<float>(i,j);  // range信息
+                    pointRange->push_back(range);  // range信息
+                    if (groundScanInd > 0)
+                        pointGround->push_back(groundMask[j + i*Horizon_SCAN]); // 地面点标记
                     // save extracted cloud
                     extractedCloud->push_back(fullCloud->points[j + i*Horizon_SCAN]);   // 3维坐标信息
                     // size of extracted cloud
@@ -500,19 +381,48 @@ public:
                 }
             }
             // 这条扫瞄线可以计算曲率的终点
-            cloudInfoStamp.endRingIndex[i] = count -1 - 5;
+            (*endRingIndex)[i] = count -1 - 5;
         }
     }
     //! 发布去畸变点云和cloud_info
     void publishClouds()
     {
+        if (hasFrameSink())
+        {
+            // 同一进程内直接把点云指针交给特征提取模块
+            rolo::CloudFramePtr frame = std::make_shared<rolo::CloudFrame>();
+            frame->header = cloudHeader;
+            frame->startRingIndex = startRingIndex;
+            frame->endRingIndex = endRingIndex;
+            frame->pointRowInd = pointRowInd;
+            frame->pointColInd = pointColInd;
+            frame->pointRange = pointRange;
+            frame->pointGround = pointGround;
+            frame->cloudProjected = extractedCloud;
+            frameSink(frame);
+            return;
+        }
+
+        rolo::CloudInfoStamp cloudInfoStamp;
         cloudInfoStamp.header = cloudHeader;
+        cloudInfoStamp.startRingIndex.swap(*startRingIndex);
+        cloudInfoStamp.endRingIndex.swap(*endRingIndex);
+        cloudInfoStamp.pointRowInd.swap(*pointRowInd);
+        cloudInfoStamp.pointColInd.swap(*pointColInd);
+        cloudInfoStamp.pointRange.swap(*pointRange);
+        cloudInfoStamp.pointGround.swap(*pointGround);
         cloudInfoStamp.cloud_projected  = publishCloud(pubExtractedCloud, extractedCloud, cloudHeader.stamp, lidarFrame);
         pubLaserCloudInfo.publish(cloudInfoStamp);
     }
 
 };
 
+rolo::PipelineStagePtr rolo::createImageProjection()
+{
+    return std::make_shared<ImageProjection>();
+}
+
+#ifndef ROLO_PIPELINE
 int main(int argc, char** argv)
 {
     ros::init(argc, argv, "image_projection");
@@ -526,3 +436,4 @@ int main(int argc, char** argv)
     
     return 0;
 }
+#endif
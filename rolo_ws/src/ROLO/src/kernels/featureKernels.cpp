@@ -0,0 +1,106 @@
+#include "rolo/featureKernels.h"
+
+namespace rolo
+{
+
+#ifdef ROLO_HAVE_AVX2
+// featureKernels_avx2.cpp，以-mavx2 -mfma编译，只处理完整的8个点，返回处理到的位置
+int featureEventKernelAvx2(const float* r, const int32_t* col, int begin, int end,
+                           float* curvature, float* occludedBack, float* occludedFront, float* parallel);
+int featurePickedKernelAvx2(const float* occludedBack, const float* occludedFront, const float* parallel,
+                            int begin, int end, int32_t* picked, int32_t* label);
+#endif
+
+bool featureKernelsUseAvx2()
+{
+#if defined(ROLO_HAVE_AVX2) && defined(__GNUC__)
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+//! 第一遍的向量部分，返回处理到的位置
+static int eventKernelVectorized(const float* range, const int32_t* col, int begin, int end,
+                                 float* curvature, float* back, float* front, float* parallel)
+{
+    int i = begin;
+#ifdef ROLO_HAVE_AVX2
+    if (featureKernelsUseAvx2())
+        i = featureEventKernelAvx2(range, col, i, end, curvature, back, front, parallel);
+#endif
+#if defined(__SSE2__)
+    i = detail::featureEventKernel<simd::SseOps>(range, col, i, end, curvature, back, front, parallel);
+#endif
+    return i;
+}
+
+//! 第二遍的向量部分，返回处理到的位置
+static int pickedKernelVectorized(const float* back, const float* front, const float* parallel,
+                                  int begin, int end, int32_t* picked, int32_t* label)
+{
+    int j = begin;
+#ifdef ROLO_HAVE_AVX2
+    if (featureKernelsUseAvx2())
+        j = featurePickedKernelAvx2(back, front, parallel, j, end, picked, label);
+#endif
+#if defined(__SSE2__)
+    j = detail::featurePickedKernel<simd::SseOps>(back, front, parallel, j, end, picked, label);
+#endif
+    return j;
+}
+
+static void computeFeatureFlagsImpl(const float* range, const int32_t* col, int n, FeatureBuffer& buffer, bool vectorized)
+{
+    const int pad = FeatureBuffer::kPad;
+    // 两遍按块交替进行，第二遍落后第一遍几个点，事件数组在读回时仍在L1缓存中
+    const int block = 2048;
+    buffer.resize(n);
+    float* curvature = buffer.curvature.data();
+    float* back = buffer.occludedBack.data() + pad;
+    float* front = buffer.occludedFront.data() + pad;
+    float* parallel = buffer.parallel.data() + pad;
+    int32_t* picked = buffer.picked.data();
+    int32_t* label = buffer.label.data();
+
+    // 平滑度在[5, n-5)中计算，遮挡和平行点在[5, n-6)中判断，范围以外的事件置0，第二遍可以不做边界判断
+    const int begin = 5;
+    const int end = std::max(n - 5, begin);
+    const int tail = std::max(n - 6, begin);
+    for (float* events : {back, front, parallel})
+        std::fill(events - pad, events + begin, 0.0f);
+    std::fill(curvature, curvature + std::min(begin, n), 0.0f);
+    std::fill(curvature + std::min(end, n), curvature + n, 0.0f);
+
+    int i = begin, j = 0;
+    while (vectorized && i < end)
+    {
+        int stop = std::min(i + block, end);
+        int done = eventKernelVectorized(range, col, i, stop, curvature, back, front, parallel);
+        if (done == i)
+            break;  // 剩余不足一个向量宽度
+        i = done;
+        // picked[j]需要事件[j-6, j+5]，并且不能读到tail处尚未置0的事件
+        j = pickedKernelVectorized(back, front, parallel, j, std::max(j, std::min(i - 6, tail - 5)), picked, label);
+    }
+    detail::featureEventKernel<simd::ScalarOps>(range, col, i, end, curvature, back, front, parallel);
+    for (float* events : {back, front, parallel})
+        std::fill(events + tail, events + n + pad, 0.0f);
+
+    if (vectorized)
+        j = pickedKernelVectorized(back, front, parallel, j, n, picked, label);
+    detail::featurePickedKernel<simd::ScalarOps>(back, front, parallel, j, n, picked, label);
+}
+
+void computeFeatureFlags(const float* range, const int32_t* col, int n, FeatureBuffer& buffer)
+{
+    computeFeatureFlagsImpl(range, col, n, buffer, true);
+}
+
+void computeFeatureFlagsScalar(const float* range, const int32_t* col, int n, FeatureBuffer& buffer)
+{
+    computeFeatureFlagsImpl(range, col, n, buffer, false);
+}
+
+} // namespace rolo
@@ -0,0 +1,20 @@
+// 本文件单独以-mavx2 -mfma编译，只能包含不依赖Eigen/PCL的头文件，并且只实例化Avx2Ops版本的模板。
+// 不足8个点的尾部由featureKernels.cpp中的SSE和标量版本处理。
+#include "rolo/featureKernels.h"
+
+namespace rolo
+{
+
+int featureEventKernelAvx2(const float* r, const int32_t* col, int begin, int end,
+                           float* curvature, float* occludedBack, float* occludedFront, float* parallel)
+{
+    return detail::featureEventKernel<simd::Avx2Ops>(r, col, begin, end, curvature, occludedBack, occludedFront, parallel);
+}
+
+int featurePickedKernelAvx2(const float* occludedBack, const float* occludedFront, const float* parallel,
+                            int begin, int end, int32_t* picked, int32_t* label)
+{
+    return detail::featurePickedKernel<simd::Avx2Ops>(occludedBack, occludedFront, parallel, begin, end, picked, label);
+}
+
+} // namespace rolo
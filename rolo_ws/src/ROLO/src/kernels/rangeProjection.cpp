@@ -0,0 +1,76 @@
+#include "rolo/rangeProjection.h"
+
+namespace rolo
+{
+
+#ifdef ROLO_HAVE_AVX2
+// rangeProjection_avx2.cpp，以-mavx2 -mfma编译
+void computeProjectionIndicesAvx2(const RangeProjectionParams& params, const BeamLookup& beams,
+                                  const float* x, const float* y, const float* z, const float* ring,
+                                  int n, int32_t* index, float* range);
+void computeDeskewAvx2(const float* table, int bins, float invBinTime, const float* time,
+                       const float* x, const float* y, const float* z, int n, float* ox, float* oy, float* oz);
+#endif
+
+bool projectionUsesAvx2()
+{
+#if defined(ROLO_HAVE_AVX2) && defined(__GNUC__)
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+void computeProjectionIndicesScalar(const RangeProjectionParams& params, const BeamLookup& beams, const PointSoA& points,
+                                    int32_t* index, float* range)
+{
+    detail::projectionIndicesKernel<simd::ScalarOps>(params, beams, points.x.data(), points.y.data(), points.z.data(),
+                                                     points.ring.data(), 0, points.size(), index, range);
+}
+
+void computeProjectionIndices(const RangeProjectionParams& params, const BeamLookup& beams, const PointSoA& points,
+                              int32_t* index, float* range)
+{
+    const float* x = points.x.data();
+    const float* y = points.y.data();
+    const float* z = points.z.data();
+    const float* ring = points.ring.data();
+    int n = points.size();
+#ifdef ROLO_HAVE_AVX2
+    if (projectionUsesAvx2())
+    {
+        computeProjectionIndicesAvx2(params, beams, x, y, z, ring, n, index, range);
+        return;
+    }
+#endif
+    int done = 0;
+#if defined(__SSE2__)
+    done = detail::projectionIndicesKernel<simd::SseOps>(params, beams, x, y, z, ring, 0, n, index, range);
+#endif
+    detail::projectionIndicesKernel<simd::ScalarOps>(params, beams, x, y, z, ring, done, n, index, range);
+}
+
+void computeDeskew(const DeskewTable& deskew, const PointSoA& points, float* ox, float* oy, float* oz)
+{
+    const float* table = deskew.data();
+    const float* time = points.time.data();
+    const float* x = points.x.data();
+    const float* y = points.y.data();
+    const float* z = points.z.data();
+    int n = points.size();
+#ifdef ROLO_HAVE_AVX2
+    if (projectionUsesAvx2())
+    {
+        computeDeskewAvx2(table, deskew.bins(), deskew.invBinTime(), time, x, y, z, n, ox, oy, oz);
+        return;
+    }
+#endif
+    int done = 0;
+#if defined(__SSE2__)
+    done = detail::deskewKernel<simd::SseOps>(table, deskew.bins(), deskew.invBinTime(), time, x, y, z, 0, n, ox, oy, oz);
+#endif
+    detail::deskewKernel<simd::ScalarOps>(table, deskew.bins(), deskew.invBinTime(), time, x, y, z, done, n, ox, oy, oz);
+}
+
+} // namespace rolo
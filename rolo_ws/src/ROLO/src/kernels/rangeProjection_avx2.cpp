@@ -0,0 +1,51 @@
+// 本文件单独以-mavx2 -mfma编译，只能包含不依赖Eigen/PCL的头文件。
+// 这里只实例化Avx2Ops版本的模板；尾部不足8个的点补齐后同样走AVX2，避免生成与其他编译单元同名的标量实例。
+#include <cstring>
+
+#include "rolo/rangeProjection.h"
+
+namespace rolo
+{
+
+void computeProjectionIndicesAvx2(const RangeProjectionParams& params, const BeamLookup& beams,
+                                  const float* x, const float* y, const float* z, const float* ring,
+                                  int n, int32_t* index, float* range)
+{
+    const int width = simd::Avx2Ops::width;
+    int done = detail::projectionIndicesKernel<simd::Avx2Ops>(params, beams, x, y, z, ring, 0, n, index, range);
+    int rest = n - done;
+    if (rest <= 0)
+        return;
+
+    float tx[width] = {0}, ty[width] = {0}, tz[width] = {0}, tring[width] = {0}, trange[width];
+    int32_t tindex[width];
+    std::memcpy(tx, x + done, rest * sizeof(float));
+    std::memcpy(ty, y + done, rest * sizeof(float));
+    std::memcpy(tz, z + done, rest * sizeof(float));
+    std::memcpy(tring, ring + done, rest * sizeof(float));
+    detail::projectionIndicesKernel<simd::Avx2Ops>(params, beams, tx, ty, tz, tring, 0, width, tindex, trange);
+    std::memcpy(index + done, tindex, rest * sizeof(int32_t));
+    std::memcpy(range + done, trange, rest * sizeof(float));
+}
+
+void computeDeskewAvx2(const float* table, int bins, float invBinTime, const float* time,
+                       const float* x, const float* y, const float* z, int n, float* ox, float* oy, float* oz)
+{
+    const int width = simd::Avx2Ops::width;
+    int done = detail::deskewKernel<simd::Avx2Ops>(table, bins, invBinTime, time, x, y, z, 0, n, ox, oy, oz);
+    int rest = n - done;
+    if (rest <= 0)
+        return;
+
+    float tt[width] = {0}, tx[width] = {0}, ty[width] = {0}, tz[width] = {0}, rx[width], ry[width], rz[width];
+    std::memcpy(tt, time + done, rest * sizeof(float));
+    std::memcpy(tx, x + done, rest * sizeof(float));
+    std::memcpy(ty, y + done, rest * sizeof(float));
+    std::memcpy(tz, z + done, rest * sizeof(float));
+    detail::deskewKernel<simd::Avx2Ops>(table, bins, invBinTime, tt, tx, ty, tz, 0, width, rx, ry, rz);
+    std::memcpy(ox + done, rx, rest * sizeof(float));
+    std::memcpy(oy + done, ry, rest * sizeof(float));
+    std::memcpy(oz + done, rz, rest * sizeof(float));
+}
+
+} // namespace rolo
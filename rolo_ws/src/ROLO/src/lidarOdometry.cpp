@@ -1,4 +1,5 @@
 #include "rolo/utility.h"
+#include "rolo/pipeline.h"
 #include "std_msgs/Float64MultiArray.h"
 #include <gtsam/geometry/Rot3.h>
 #include <gtsam/geometry/Pose3.h>
@@ -23,6 +24,8 @@
 #include <pcl/registration/ndt.h>
 #include <pcl/registration/gicp.h>
 #include <rot_gicp/gicp/rot_vgicp.hpp>
+#include "rolo/rangeImageSearch.h"
+#include "rolo/localVoxelMap.h"
 
 using namespace Eigen;
 
@@ -205,7 +208,7 @@ public:
     }
 };
 
-class LidarOdometry : public ParamLoader
+class LidarOdometry : public ParamLoader, public rolo::PipelineStage
 {
 private:
     mutex mtx;
@@ -241,25 +244,32 @@ private:
     geometry_msgs::PoseStamped laser_pose;
     pcl::PointCloud<PointType>::Ptr RegCloud;
     
-    // 当前帧数据
-    rolo::CloudInfoStamp laserCloudInfoLast;
-    pcl::PointCloud<PointType>::Ptr FullCloudLast;
-    pcl::PointCloud<PointType>::Ptr CloudCornerLast;
-    pcl::PointCloud<PointType>::Ptr CloudSurfLast;
-    pcl::PointCloud<PointType>::Ptr CloudGroundLast;
+    // 当前帧数据，点云由输入帧共享，只读
+    rolo::CloudFrameConstPtr laserCloudInfoLast;
+    pcl::PointCloud<PointType>::ConstPtr FullCloudLast;
+    pcl::PointCloud<PointType>::ConstPtr CloudCornerLast;
+    pcl::PointCloud<PointType>::ConstPtr CloudSurfLast;
+    pcl::PointCloud<PointType>::Ptr CloudGroundLast;    // 降采样后的地面点
     pcl::PointCloud<PointType>::Ptr ground_and_cornerLast;
-    pcl::PointCloud<PointType>::Ptr featureLast;
-
-    // 上一帧数据
-    rolo::CloudInfoStamp laserCloudInfoOld;
-    pcl::PointCloud<PointType>::Ptr FullCloudOld;
-    pcl::PointCloud<PointType>::Ptr CloudCornerOld;
-    pcl::PointCloud<PointType>::Ptr CloudSurfOld;
+    pcl::PointCloud<PointType>::ConstPtr featureLast;
+    pcl::VoxelGrid<PointType> downSizeFilterGround;     // 地面点按odometryGroundLeafSize单独降采样
+    rolo::RangeImageSearch<PointType>::Ptr imageSearchLast; // FullCloudLast的距离图像，rangeImageCovariance关闭时为空
+
+    // 上一帧数据，新旧交换时只交换指针
+    rolo::CloudFrameConstPtr laserCloudInfoOld;
+    pcl::PointCloud<PointType>::ConstPtr FullCloudOld;
+    pcl::PointCloud<PointType>::ConstPtr CloudCornerOld;
+    pcl::PointCloud<PointType>::ConstPtr CloudSurfOld;
     pcl::PointCloud<PointType>::Ptr CloudGroundOld;
     pcl::PointCloud<PointType>::Ptr ground_and_cornerOld;
-    pcl::PointCloud<PointType>::Ptr featureOld;
+    pcl::PointCloud<PointType>::ConstPtr featureOld;
+    rolo::RangeImageSearch<PointType>::Ptr imageSearchOld;
+
+    std::unique_ptr<rolo::StageQueue<rolo::CloudFrameConstPtr>> frameQueue; // 输入帧队列，满时按frameQueuePolicy丢帧
 
-    std::queue<rolo::CloudInfoStamp> laserCloudInfoBuf;
+    // 配准对象跨帧保留：本帧的目标点云是下一帧的源点云，其协方差在下一帧直接复用
+    fast_gicp::RotVGICP<PointType, PointType> rot_vgicp;
+    std::unique_ptr<rolo::LocalVoxelMap<PointType>> localMap; // localMapFrames>0时代替上一帧作为配准目标
     
     Matrix3d Rotation;
     Vector3d Translation;
@@ -268,7 +278,7 @@ private:
 
 
 public:  
-    LidarOdometry():
+    LidarOdometry(bool intraProcess = false):
     doneFirstOpt(true),
     doneBackOpt(false),
     isFirstFrame(true),
@@ -278,7 +288,8 @@ public:
         // mapOptimization传来的里程计数据
         subOdometryMapped = nh.subscribe<nav_msgs::Odometry>("rolo/mapping/odometry", 10, &LidarOdometry::odometryHandler, this, ros::TransportHints().tcpNoDelay());
         // 接受imu原始数据
-        subCloudInfo = nh.subscribe<rolo::CloudInfoStamp>("rolo/feature/cloud_info", 10, &LidarOdometry::cloudHandler, this, ros::TransportHints().tcpNoDelay());
+        if (!intraProcess)
+            subCloudInfo = nh.subscribe<rolo::CloudInfoStamp>("rolo/feature/cloud_info", frameQueueCapacity, &LidarOdometry::cloudHandler, this, ros::TransportHints().tcpNoDelay());
         // 发布imu预测里程计
         pubFrontCloudInfo = nh.advertise<rolo::CloudInfoStamp>(odomTopic+"/cloud_info", 2000);
         pubLidarOdometry = nh.advertise<nav_msgs::Odometry> (odomTopic+"_incremental", 2000);
@@ -287,8 +298,14 @@ public:
         pubRegScan = nh.advertise<sensor_msgs::PointCloud2> (odomTopic+"/registration_scan", 10);
         pubPlotData = nh.advertise<std_msgs::Float64MultiArray> ("rolo/data_test", 10);
         Init();
+
+        frameQueue.reset(new rolo::StageQueue<rolo::CloudFrameConstPtr>(nh, "lidar_odometry", frameQueueCapacity, frameQueuePolicy,
+            std::bind(&LidarOdometry::processFrame, this, std::placeholders::_1)));
+    }
+    ~LidarOdometry()
+    {
+        frameQueue.reset();
     }
-    ~LidarOdometry(){}
 
     void Init(){
         Rotation = Matrix3d::Identity();
@@ -315,6 +332,37 @@ public:
         CloudGroundOld.reset(new pcl::PointCloud<PointType>());
         ground_and_cornerOld.reset(new pcl::PointCloud<PointType>());
         featureOld.reset(new pcl::PointCloud<PointType>());
+        downSizeFilterGround.setLeafSize(odometryGroundLeafSize, odometryGroundLeafSize, odometryGroundLeafSize);
+        rot_vgicp.setResolution(1.0);
+        if (!voxelPyramidResolutions.empty())
+        {
+            // 粗层用DIRECT7扩大收敛域，最细层用DIRECT1
+            std::vector<fast_gicp::VoxelPyramidLevel> levels;
+            for (size_t i = 0; i < voxelPyramidResolutions.size(); ++i)
+            {
+                bool finest = i + 1 == voxelPyramidResolutions.size();
+                int iterations = i < voxelPyramidIterations.size() ? voxelPyramidIterations[i] : 0;
+                levels.push_back(fast_gicp::VoxelPyramidLevel{voxelPyramidResolutions[i],
+                    finest ? fast_gicp::NeighborSearchMethod::DIRECT1 : fast_gicp::NeighborSearchMethod::DIRECT7, iterations});
+            }
+            rot_vgicp.setVoxelPyramid(levels);
+        }
+        // 配准在常驻的工作线程上并行，可以绑定到里程计专用的核，避免与后端争抢
+        int threads = odometryThreads > 0 ? odometryThreads : (odometryCores.empty() ? omp_get_max_threads() : (int)odometryCores.size());
+        rot_vgicp.setWorkerPool(std::make_shared<fast_gicp::WorkerPool>(threads, odometryCores));
+        rot_vgicp.setCovarianceVoxelSize(covarianceVoxelSize);
+        rot_vgicp.setOptimizerType(jointRegistration ? fast_gicp::LSQ_OPTIMIZER_TYPE::CT_LevenbergMarquardt
+                                                     : fast_gicp::LSQ_OPTIMIZER_TYPE::SO3_LevenbergMarquardt);
+        rot_vgicp.setCorrespondenceUpdate(correspondenceUpdateInterval, correspondenceUpdateAngle * M_PI / 180.0,
+                                          correspondenceUpdateDistance);
+        rot_vgicp.setDegeneracyThreshold(degeneracyRatio);
+        rot_vgicp.setMinInlierRatio(minInlierRatio);
+        if (localMapFrames > 0)
+        {
+            // 局部地图每层金字塔一张体素地图
+            std::vector<double> resolutions = voxelPyramidResolutions.empty() ? std::vector<double>{1.0} : voxelPyramidResolutions;
+            localMap.reset(new rolo::LocalVoxelMap<PointType>(resolutions, localMapFrames, localMapRadius));
+        }
         start_time = std::chrono::system_clock::now();
 
     }
@@ -328,8 +376,63 @@ public:
         doneBackOpt = true;
     }
 
+    //! 配准各阶段的耗时，调试级别输出
+    static void printTiming(const fast_gicp::RegistrationTiming& timing)
+    {
+        ROS_DEBUG("Registration timing: association %.3f ms (%d), linearization %.3f ms (%d), solve %.3f ms",
+                  timing.association_ms, timing.associations, timing.linearization_ms, timing.linearizations, timing.solve_ms);
+    }
+
+    //! 迭代次数、匹配率和各块海森矩阵最小与最大特征值之比，调试级别输出；比值低于degeneracyRatio的方向为退化方向，限频警告
+    static void printResult(const fast_gicp::RegistrationResult& result)
+    {
+        const Eigen::Vector3d& rot = result.rotation_eigenvalues;
+        const Eigen::Vector3d& trans = result.translation_eigenvalues;
+        const double rotRatio = rot[2] > 0.0 ? rot[0] / rot[2] : 0.0;
+        const double transRatio = trans[2] > 0.0 ? trans[0] / trans[2] : 0.0;
+        ROS_DEBUG("Registration result: %d iterations, %.1f%% inliers, rotation %.1e, translation %.1e, degenerate 0x%02x",
+                  result.iterations, result.inlier_ratio * 100.0, rotRatio, transRatio, result.degenerate_mask);
+        if (result.degenerate())
+            ROS_WARN_THROTTLE(1.0, "Scan registration degenerate (rotation axes 0x%x, translation axes 0x%x), "
+                              "keeping the predicted motion along them", result.rotation_mask(), result.translation_mask());
+    }
+
+    //! 匹配点太少时配准在第一次迭代后已终止，保留状态预测得到的帧间运动
+    bool registrationRejected()
+    {
+        const fast_gicp::RegistrationResult& result = rot_vgicp.getResult();
+        if (!result.rejected)
+            return false;
+        ROS_WARN_THROTTLE(1.0, "Scan registration rejected with %.1f%% inliers, keeping the predicted motion",
+                          result.inlier_ratio * 100.0);
+        return true;
+    }
+
+    //! 去掉修正量在退化方向上的分量，退化方向上保持初值，与后端LMOptimization中matP的作用相同
+    Eigen::Matrix3d constrainRotation(const Eigen::Matrix3d& correction) const
+    {
+        const fast_gicp::RegistrationResult& result = rot_vgicp.getResult();
+        if (!result.rotation_mask())
+            return correction;
+        Eigen::AngleAxisd angleAxis(correction);
+        Eigen::Vector3d omega = result.rotation_projection() * (angleAxis.angle() * angleAxis.axis());
+        if (omega.norm() < 1e-12)
+            return Eigen::Matrix3d::Identity();
+        return Eigen::AngleAxisd(omega.norm(), omega.normalized()).toRotationMatrix();
+    }
+
+    Eigen::Vector3d constrainTranslation(const Eigen::Vector3d& correction) const
+    {
+        return rot_vgicp.getResult().translation_projection() * correction;
+    }
+
     void scanRegeistration(){
         auto start = std::chrono::system_clock::now();
+        if (localMap)
+        {
+            localMapRegistration(start);
+            return;
+        }
         // std::chrono::duration<double> elapsed_seconds = end - start;
         // printf("Solver Duration: %f ms.\n" ,elapsed_seconds.count() * 1000);
 
@@ -340,24 +443,46 @@ public:
         feature_rotated->clear();
         // 先平移插值，使中心对齐
         pcl::transformPointCloud(*featureOld, *feature_propagated, transformation_interpolated);
-        fast_gicp::RotVGICP<PointType, PointType> rot_vgicp;
-        rot_vgicp.setResolution(1.0);
-        rot_vgicp.setNumThreads(omp_get_max_threads());
+        // 上一帧配准的目标点云就是featureOld时，其协方差按初值旋转后作为源点云的协方差，不再重新估计
+        Eigen::Isometry3d propagation(transformation_interpolated.matrix().cast<double>());
+        if (rot_vgicp.getInputTarget() != featureOld || !rot_vgicp.reuseTargetAsSource(feature_propagated, propagation))
+        {
+            rot_vgicp.clearSource();
+            rot_vgicp.setInputSource(feature_propagated);
+            if (imageSearchOld)
+            {
+                // 特征点的协方差在原始点云的距离图像上估计，不再为特征点云建立KD树
+                // 源点云已按初值变换，查询时先变换回上一帧的雷达坐标系
+                Eigen::Isometry3f oldFromPropagated;
+                oldFromPropagated.matrix() = transformation_interpolated.inverse().matrix();
+                imageSearchOld->setQueryTransform(oldFromPropagated);
+                rot_vgicp.setSourceNeighborSearch(imageSearchOld);
+            }
+        }
         rot_vgicp.clearTarget();
-        rot_vgicp.clearSource();
         rot_vgicp.setInputTarget(featureLast);
-        rot_vgicp.setInputSource(feature_propagated);
+        if (imageSearchLast)
+            rot_vgicp.setTargetNeighborSearch(imageSearchLast);
+        if (jointRegistration)
+        {
+            jointRegistrationStep(start, *aligned);
+            return;
+        }
         rot_vgicp.align(*aligned);
+        if (registrationRejected())
+            return;
         Eigen::Matrix4f trans = rot_vgicp.getFinalTransformation(); // 旋转估计
         // Rotation = trans.block<3, 3>(0, 0).cast<float>() * Rotation.eval();
         Eigen::Affine3f transformStep;
         transformStep.matrix() = trans.cast<float>();
+        transformStep.linear() = constrainRotation(trans.block<3, 3>(0, 0).cast<double>()).cast<float>();
         transformation_interpolated = transformation_interpolated * transformStep;
         Rotation = transformation_interpolated.rotation().cast<double>();
         Translation = transformation_interpolated.translation().cast<double>();
         auto r_end = std::chrono::system_clock::now();
         std::chrono::duration<double> r_elapsed_seconds = r_end - start;
         printf("Rotation Solver Duration: %f ms.\n" ,r_elapsed_seconds.count() * 1000);
+        printTiming(rot_vgicp.getTiming());
 
         // Eigen::Vector3f rotation_euler;
         // float x, y, z;
@@ -378,45 +503,158 @@ public:
         auto t_end = std::chrono::system_clock::now();
         std::chrono::duration<double> t_elapsed_seconds = t_end - r_end;
         printf("Translation Solver Duration: %f ms.\n" ,t_elapsed_seconds.count() * 1000);
+        printTiming(rot_vgicp.getTiming());
+        printResult(rot_vgicp.getResult());
+
+        Translation += constrainTranslation(Reg_translation);
+    }
 
-        Translation += Reg_translation;
+    //! 旋转和连续时间平移在一次配准中联合求解，代替align+computeTranslation两步
+    //! 平移约束与两步法相同，得到的旋转和平移增量按两步法的方式更新Rotation和Translation
+    void jointRegistrationStep(const std::chrono::system_clock::time_point &start, pcl::PointCloud<PointType> &aligned)
+    {
+        rot_vgicp.setTranslationPrior(transformation_interpolated.translation().cast<double>(), 0.1, CT_lambda);
+        rot_vgicp.align(aligned);
+        if (registrationRejected())
+            return;
+        Eigen::Matrix4f step = rot_vgicp.getFinalTransformation();
+        Eigen::Affine3f transformStep = Eigen::Affine3f::Identity();
+        transformStep.linear() = constrainRotation(step.block<3, 3>(0, 0).cast<double>()).cast<float>();
+        transformation_interpolated = transformation_interpolated * transformStep;
+        Rotation = transformation_interpolated.rotation().cast<double>();
+        Translation = transformation_interpolated.translation().cast<double>() + constrainTranslation(step.block<3, 1>(0, 3).cast<double>());
+
+        std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start;
+        Eigen::Matrix<double, 6, 1> sigma = rot_vgicp.getFinalCovariance().diagonal().cwiseSqrt();
+        ROS_DEBUG("Joint Solver Duration: %f ms, sigma rot %.4f deg, trans %.4f m.", elapsed_seconds.count() * 1000,
+                  sigma.head<3>().maxCoeff() * 180.0 / M_PI, sigma.tail<3>().maxCoeff());
+        printTiming(rot_vgicp.getTiming());
+        printResult(rot_vgicp.getResult());
+    }
+
+    //! LaserOdomPose表示的雷达位姿，局部地图所在的世界坐标系
+    Eigen::Isometry3d odomPose() const
+    {
+        Affine3f pose = pcl::getTransformation(LaserOdomPose[0], LaserOdomPose[1], LaserOdomPose[2],
+                                               LaserOdomPose[3], LaserOdomPose[4], LaserOdomPose[5]);
+        return Eigen::Isometry3d(pose.matrix().cast<double>());
+    }
+
+    //! 当前帧作为源点云，协方差在其距离图像上估计（rangeImageCovariance关闭时用KD树）
+    void setCurrentFrameAsSource()
+    {
+        if (rot_vgicp.getInputSource() == featureLast)
+            return;
+        rot_vgicp.clearSource();
+        rot_vgicp.setInputSource(featureLast);
+        if (imageSearchLast)
+            rot_vgicp.setSourceNeighborSearch(imageSearchLast);
+    }
+
+    //! 当前帧与局部地图配准。目标坐标系P为按初值预测的当前帧雷达坐标系，地图体素变换到P中，旋转仍绕雷达中心估计；
+    //! 配准得到当前帧到P的变换，帧间变换为其逆乘以初值。平移约束与帧间配准相同，约束的都是帧间平移
+    void localMapRegistration(const std::chrono::system_clock::time_point &start)
+    {
+        Eigen::Isometry3d predicted(transformation_interpolated.matrix().cast<double>());
+        Eigen::Isometry3d worldFromPredicted = odomPose() * predicted.inverse();
+        setCurrentFrameAsSource();
+        rot_vgicp.setTargetVoxelMaps(localMap->voxelMaps(), worldFromPredicted.inverse());
+
+        pcl::PointCloud<PointType> aligned;
+        Eigen::Isometry3d step;
+        if (jointRegistration)
+        {
+            rot_vgicp.setTranslationPrior(-predicted.translation(), 0.1, CT_lambda);
+            rot_vgicp.align(aligned);
+            if (registrationRejected())
+                return;
+            step = Eigen::Isometry3d(rot_vgicp.getFinalTransformation().cast<double>());
+        }
+        else
+        {
+            rot_vgicp.align(aligned);
+            if (registrationRejected())
+                return;
+            step = Eigen::Isometry3d(rot_vgicp.getFinalTransformation().cast<double>());
+            printTiming(rot_vgicp.getTiming());
+            Eigen::Vector3d regTranslation = Eigen::Vector3d::Zero();
+            rot_vgicp.computeTranslation(aligned, regTranslation, -predicted.translation(), TranslationOld, 0.1, 0.1, CT_lambda);
+            step.translation() = regTranslation;
+        }
+        // 修正量的退化分量去掉后，退化方向上的帧间运动等于预测
+        step.linear() = constrainRotation(step.linear());
+        step.translation() = constrainTranslation(step.translation());
+        Eigen::Isometry3d motion = step.inverse() * predicted;
+        transformation_interpolated.matrix() = motion.matrix().cast<float>();
+        Rotation = motion.linear();
+        Translation = motion.translation();
+
+        std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start;
+        ROS_DEBUG("Local Map Solver Duration: %f ms, %d frames, %zu voxels.", elapsed_seconds.count() * 1000,
+                  localMap->frames(), localMap->voxelMaps().back()->size());
+        printTiming(rot_vgicp.getTiming());
+        printResult(rot_vgicp.getResult());
+    }
+
+    //! 当前帧按更新后的位姿插入局部地图，最旧的帧和过远的帧被删除
+    void updateLocalMap()
+    {
+        if (!localMap)
+            return;
+        setCurrentFrameAsSource();
+        rot_vgicp.calculateSourceCovariances();
+        localMap->addFrame(*featureLast, rot_vgicp.getSourceCovariances(), odomPose());
     }
 
     void cloudHandler(const rolo::CloudInfoStampConstPtr &cloudIn){
-        // 取时间戳,入buffer
+        pushFrame(rolo::frameFromMsg(cloudIn));
+    }
+
+    void pushFrame(const rolo::CloudFrameConstPtr &cloudIn) override {
+        frameQueue->push(cloudIn);
+    }
+
+    void processFrame(const rolo::CloudFrameConstPtr &cloudIn){
+        // 取时间戳，积压的旧帧已由输入队列按策略丢弃
+        laserCloudInfoLast = cloudIn;
         cloudTimeStamp = cloudIn->header.stamp;
         cloudTimeCur = cloudIn->header.stamp.toSec();
-        laserCloudInfoBuf.push(*cloudIn);
-        // 进行时间匹配
-        ros::Time TimeCur = ros::Time::now();
-        for(int i=0; i<laserCloudInfoBuf.size(); i++){
-            laserCloudInfoLast = laserCloudInfoBuf.front();
-            laserCloudInfoBuf.pop();
-            cloudTimeStamp = laserCloudInfoLast.header.stamp;
-            cloudTimeCur = laserCloudInfoLast.header.stamp.toSec();
-            if(std::fabs((TimeCur-cloudTimeStamp).toSec()) < 0.1){
-                break;
-            }
-        }
 
         // 提取当前帧特征点云
-        pcl::fromROSMsg(laserCloudInfoLast.extracted_corner,  *CloudCornerLast);
-        pcl::fromROSMsg(laserCloudInfoLast.extracted_surface, *CloudSurfLast);
-        pcl::fromROSMsg(laserCloudInfoLast.cloud_projected, *FullCloudLast);
-        *featureLast = *CloudCornerLast + *CloudSurfLast;
+        CloudCornerLast = laserCloudInfoLast->extractedCorner;
+        CloudSurfLast = laserCloudInfoLast->extractedSurface;
+        FullCloudLast = laserCloudInfoLast->cloudProjected;
+        pcl::PointCloud<PointType>::Ptr featureCur(new pcl::PointCloud<PointType>());
+        *featureCur = *CloudCornerLast + *CloudSurfLast;
+        // 地面点比平面点更稠密且约束单一，配准时用更大的体素
+        CloudGroundLast.reset(new pcl::PointCloud<PointType>());
+        if (laserCloudInfoLast->extractedNormal && !laserCloudInfoLast->extractedNormal->empty())
+        {
+            downSizeFilterGround.setInputCloud(laserCloudInfoLast->extractedNormal);
+            downSizeFilterGround.filter(*CloudGroundLast);
+            *featureCur += *CloudGroundLast;
+        }
+        featureLast = featureCur;
+        buildImageSearch();
 
         if(isFirstFrame){
             isFirstFrame = false;
-            *FullCloudOld = *FullCloudLast;
-            *CloudCornerOld = *CloudCornerLast;
-            *CloudSurfOld = *CloudSurfLast;
-            *featureOld = *featureLast;
+            laserCloudInfoOld = laserCloudInfoLast;
+            FullCloudOld = FullCloudLast;
+            CloudCornerOld = CloudCornerLast;
+            CloudSurfOld = CloudSurfLast;
+            featureOld = featureLast;
+            imageSearchOld = imageSearchLast;
+            updateLocalMap();
             return;
         }
 
         // 是否完成第一次全图优化
         // if (doneFirstOpt == false)
         if (lastOdomTime == -1.0){
+            // 后端未初始化时位姿不更新，局部地图只保留最新一帧
+            if (localMap)
+                localMap->clear();
             updateTransform();
             pubMessage();
             return;
@@ -446,11 +684,27 @@ public:
             pubTranform();
         }
         else{
-            printf(" Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n Failure Transformation! Resetting! \n "); 
+            ROS_WARN("Failure transformation, resetting");
             failureFrameFlag = false;
         }
     }
 
+    //! 用当前帧原始点云的行列号建立距离图像近邻搜索，缺少行列号时退回KD树
+    void buildImageSearch(){
+        imageSearchLast.reset();
+        if (!rangeImageCovariance)
+            return;
+        const auto& rowInd = laserCloudInfoLast->pointRowInd;
+        const auto& colInd = laserCloudInfoLast->pointColInd;
+        if (!rowInd || !colInd || rowInd->size() != FullCloudLast->size() || colInd->size() != FullCloudLast->size())
+        {
+            ROS_WARN_THROTTLE(10.0, "rangeImageCovariance is enabled but the cloud carries no row/col index, using KD-tree");
+            return;
+        }
+        imageSearchLast = std::make_shared<rolo::RangeImageSearch<PointType>>(N_SCAN, Horizon_SCAN);
+        imageSearchLast->setInputCloud(FullCloudLast, *rowInd, *colInd);
+    }
+
     void updateTransform(){
         Matrix4d trans = Matrix4d::Identity();
         trans << Rotation;
@@ -497,13 +751,16 @@ public:
                                           LaserOdomPose[3], 
                                           LaserOdomPose[4], 
                                           LaserOdomPose[5]);                            
+        updateLocalMap();
 
         
         // 新旧信息交换
-        *FullCloudOld = *FullCloudLast;
-        *CloudCornerOld = *CloudCornerLast;
-        *CloudSurfOld = *CloudSurfLast;
-        *featureOld = *featureLast;
+        laserCloudInfoOld = laserCloudInfoLast;
+        FullCloudOld = FullCloudLast;
+        CloudCornerOld = CloudCornerLast;
+        CloudSurfOld = CloudSurfLast;
+        featureOld = featureLast;
+        imageSearchOld = imageSearchLast;
         TranslationOld = Translation;
     }
 
@@ -535,7 +792,8 @@ public:
     }
 
     void pubMessage(){
-        publishCloud(pubRegScan, RegCloud, cloudTimeStamp, baselinkFrame);
+        if (pubRegScan.getNumSubscribers() != 0)
+            publishCloud(pubRegScan, RegCloud, cloudTimeStamp, baselinkFrame);
         
         // 发布位姿
         laser_pose.header.frame_id = odometryFrame;
@@ -566,16 +824,23 @@ public:
         pubLidarOdometry.publish(laser_odom_incremental);
 
         // 发布初始位姿估计
-        rolo::CloudInfoStamp odometry_cloud;
-        odometry_cloud = laserCloudInfoLast;
-        odometry_cloud.initialGuessX = LaserOdomPose[0];
-        odometry_cloud.initialGuessY = LaserOdomPose[1];
-        odometry_cloud.initialGuessZ = LaserOdomPose[2];
-        odometry_cloud.initialGuessRoll = LaserOdomPose[3];
-        odometry_cloud.initialGuessPitch = LaserOdomPose[4];
-        odometry_cloud.initialGuessYaw = LaserOdomPose[5];
-        odometry_cloud.odomAvailable = true;
-        pubFrontCloudInfo.publish(odometry_cloud);
+        rolo::CloudFramePtr odometry_cloud = std::make_shared<rolo::CloudFrame>(*laserCloudInfoLast);
+        odometry_cloud->initialGuessX = LaserOdomPose[0];
+        odometry_cloud->initialGuessY = LaserOdomPose[1];
+        odometry_cloud->initialGuessZ = LaserOdomPose[2];
+        odometry_cloud->initialGuessRoll = LaserOdomPose[3];
+        odometry_cloud->initialGuessPitch = LaserOdomPose[4];
+        odometry_cloud->initialGuessYaw = LaserOdomPose[5];
+        odometry_cloud->odomAvailable = true;
+        if (hasFrameSink())
+        {
+            frameSink(odometry_cloud);
+            return;
+        }
+        // 单独运行时转发原消息，点云无需重新序列化
+        rolo::CloudInfoStamp odometry_msg = *laserCloudInfoLast->sourceMsg;
+        rolo::frameInfoToMsg(*odometry_cloud, odometry_msg);
+        pubFrontCloudInfo.publish(odometry_msg);
     }
 
     //! 针对上一时刻的后端变换进行线性插值
@@ -594,6 +859,22 @@ public:
     }
 };
 
+//! rolo_pipeline中的里程计模块，与单独运行时一样附带TransformFusion
+class LidarOdometryStage : public LidarOdometry
+{
+public:
+    LidarOdometryStage(bool intraProcess) : LidarOdometry(intraProcess) {}
+
+private:
+    TransformFusion TF;
+};
+
+rolo::PipelineStagePtr rolo::createLidarOdometry(bool intraProcess)
+{
+    return std::make_shared<LidarOdometryStage>(intraProcess);
+}
+
+#ifndef ROLO_PIPELINE
 int main(int argc, char** argv)
 {
     ros::init(argc, argv, "rolo");
@@ -608,4 +889,5 @@ int main(int argc, char** argv)
     // ros::spin();
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
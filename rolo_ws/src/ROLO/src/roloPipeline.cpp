@@ -0,0 +1,29 @@
+#include "rolo/utility.h"
+#include "rolo/pipeline.h"
+
+//! 四个模块运行在同一进程中，cloud_info不再经过ROS序列化，上游直接把帧指针交给下游
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "rolo");
+
+    rolo::PipelineStagePtr BM = rolo::createBackMapping(true);
+    rolo::PipelineStagePtr LO = rolo::createLidarOdometry(true);
+    rolo::PipelineStagePtr FE = rolo::createFeatureExtraction(true);
+    rolo::PipelineStagePtr IP = rolo::createImageProjection();
+
+    // imageProjection -> featureExtraction -> lidarOdometry -> backMapping
+    IP->setFrameSink([FE](const rolo::CloudFrameConstPtr& frame) { FE->pushFrame(frame); });
+    FE->setFrameSink([LO](const rolo::CloudFrameConstPtr& frame) { LO->pushFrame(frame); });
+    LO->setFrameSink([BM](const rolo::CloudFrameConstPtr& frame) { BM->pushFrame(frame); });
+
+    ROS_INFO("\033[1;32m----> ROLO Pipeline Started.\033[0m");
+
+    BM->startThreads();
+
+    // 每个模块在自己的队列线程中处理帧，ROS回调只负责入队和接收里程计
+    ros::MultiThreadedSpinner spinner(2);
+    spinner.spin();
+
+    BM->stopThreads();
+    return 0;
+}
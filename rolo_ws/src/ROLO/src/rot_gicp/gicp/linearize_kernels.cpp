@@ -0,0 +1,47 @@
+#include <rot_gicp/gicp/linearize_kernels.hpp>
+
+namespace fast_gicp {
+
+#ifdef ROLO_HAVE_AVX2
+// linearize_kernels_avx2.cpp，以-mavx2 -mfma编译，end - begin为8的倍数
+void linearizeCorrespondencesAvx2(const float* data, int stride, int begin, int end, const float* T, const float* D, LinearizeMode mode, double* sums);
+#endif
+
+bool linearizeKernelsUseAvx2() {
+#if defined(ROLO_HAVE_AVX2) && defined(__GNUC__)
+  static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+void linearizeCorrespondences(const CorrespondenceBuffer& buffer, int begin, int end, const double* T, LinearizeMode mode, double* sums) {
+  float Tf[12], Df[12];
+  detail::linearize_transforms(buffer.referencePose(), T, Tf, Df);
+  // 缓冲区补齐到8的倍数，补齐部分为0，向量版本可以直接处理到补齐后的末尾
+  if (end == buffer.size()) {
+    end = buffer.stride();
+  }
+#ifdef ROLO_HAVE_AVX2
+  if (linearizeKernelsUseAvx2()) {
+    const int stop = begin + (end - begin) / 8 * 8;
+    linearizeCorrespondencesAvx2(buffer.data(), buffer.stride(), begin, stop, Tf, Df, mode, sums);
+    begin = stop;
+  }
+#endif
+#if defined(__SSE2__)
+  const int stop = begin + (end - begin) / 4 * 4;
+  detail::linearize_kernel<rolo::simd::SseOps>(buffer.data(), buffer.stride(), begin, stop, Tf, Df, mode, sums);
+  begin = stop;
+#endif
+  detail::linearize_kernel<rolo::simd::ScalarOps>(buffer.data(), buffer.stride(), begin, end, Tf, Df, mode, sums);
+}
+
+void linearizeCorrespondencesScalar(const CorrespondenceBuffer& buffer, int begin, int end, const double* T, LinearizeMode mode, double* sums) {
+  float Tf[12], Df[12];
+  detail::linearize_transforms(buffer.referencePose(), T, Tf, Df);
+  detail::linearize_kernel<rolo::simd::ScalarOps>(buffer.data(), buffer.stride(), begin, end, Tf, Df, mode, sums);
+}
+
+}  // namespace fast_gicp
@@ -0,0 +1,11 @@
+// 本文件单独以-mavx2 -mfma编译，只能包含不依赖Eigen/PCL的头文件，并且只实例化Avx2Ops版本的模板。
+// 不足8个对应关系的部分由linearize_kernels.cpp中的SSE和标量版本处理。
+#include <rot_gicp/gicp/linearize_kernels.hpp>
+
+namespace fast_gicp {
+
+void linearizeCorrespondencesAvx2(const float* data, int stride, int begin, int end, const float* T, const float* D, LinearizeMode mode, double* sums) {
+  detail::linearize_kernel<rolo::simd::Avx2Ops>(data, stride, begin, end, T, D, mode, sums);
+}
+
+}  // namespace fast_gicp
@@ -0,0 +1,132 @@
+#include <rot_gicp/gicp/worker_pool.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace fast_gicp {
+
+namespace {
+
+// 两次循环之间的自旋次数，约几十微秒，超过后工作线程休眠
+const int kSpinIterations = 4096;
+
+// 自旋时定期让出，线程多于可用的核时不占满其他线程的时间片
+inline void cpu_relax(int spin) {
+  if ((spin & 63) == 63) {
+    std::this_thread::yield();
+    return;
+  }
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_ia32_pause();
+#endif
+}
+
+#ifdef __linux__
+bool pin_thread(pthread_t thread, const std::vector<int>& cores) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int core : cores) {
+    if (core >= 0 && core < CPU_SETSIZE) {
+      CPU_SET(core, &set);
+    }
+  }
+  return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+#endif
+
+}  // namespace
+
+WorkerPool::WorkerPool(int num_workers, const std::vector<int>& cores) : cores_(cores), generation_(0), next_chunk_(0), active_(0), stop_(false) {
+  if (num_workers <= 0) {
+    num_workers = std::max(1, (int)std::thread::hardware_concurrency());
+  }
+
+  threads_.reserve(num_workers - 1);
+  for (int worker = 1; worker < num_workers; worker++) {
+    threads_.emplace_back(&WorkerPool::worker_loop, this, worker);
+#ifdef __linux__
+    if (!cores_.empty()) {
+      pin_thread(threads_.back().native_handle(), std::vector<int>{cores_[worker % cores_.size()]});
+    }
+#endif
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+bool WorkerPool::pin_current_thread(const std::vector<int>& cores) {
+#ifdef __linux__
+  return pin_thread(pthread_self(), cores);
+#else
+  return false;
+#endif
+}
+
+void WorkerPool::run(const Job& job) {
+  std::lock_guard<std::mutex> submit(submit_mutex_);
+  {
+    // job_在锁内写入，工作线程看到新的generation_后才读取
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = job;
+    next_chunk_.store(0, std::memory_order_relaxed);
+    active_.store((int)threads_.size(), std::memory_order_relaxed);
+    generation_.fetch_add(1, std::memory_order_release);
+  }
+  start_cv_.notify_all();
+
+  // 调用线程也参与分块
+  work(0);
+
+  for (int spin = 0; spin < kSpinIterations && active_.load(std::memory_order_acquire) > 0; spin++) {
+    cpu_relax(spin);
+  }
+  if (active_.load(std::memory_order_acquire) > 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return active_.load(std::memory_order_acquire) == 0; });
+  }
+}
+
+void WorkerPool::worker_loop(int worker) {
+  uint64_t seen = 0;
+  while (true) {
+    for (int spin = 0; spin < kSpinIterations && generation_.load(std::memory_order_acquire) == seen && !stop_; spin++) {
+      cpu_relax(spin);
+    }
+    if (generation_.load(std::memory_order_acquire) == seen) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cv_.wait(lock, [&] { return stop_ || generation_.load(std::memory_order_acquire) != seen; });
+    }
+    if (stop_) {
+      return;
+    }
+    seen = generation_.load(std::memory_order_acquire);
+
+    work(worker);
+
+    if (active_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // 在锁内通知，调用线程检查条件和进入等待之间不会漏掉
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_cv_.notify_one();
+    }
+  }
+}
+
+void WorkerPool::work(int worker) {
+  const Job& job = job_;
+  for (int c = next_chunk_.fetch_add(1, std::memory_order_relaxed); c < job.chunks; c = next_chunk_.fetch_add(1, std::memory_order_relaxed)) {
+    job.invoke(job.func, worker, c * job.grain, std::min(job.n, (c + 1) * job.grain));
+  }
+}
+
+}  // namespace fast_gicp
@@ -0,0 +1,287 @@
+// 后端点线、点面匹配的性能对比：原实现（每点分配近邻缓冲、迭代求解3x3特征分解、5x3列主元QR拟合平面、串行遍历Mask压缩）
+// vs 每线程预分配缓冲、闭式特征分解、法方程拟合平面、前缀和并行压缩
+// 用法：association_benchmark [--corners N] [--surfs N] [--rounds N] [--threads N] [--offset m]
+// 原实现中的cv::eigen以Eigen的迭代求解代替，使基准不依赖OpenCV。输出每1k个特征点的匹配耗时，以及两种实现接受的匹配一致的比例
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "rolo/incrementalPointMap.h"
+#include "rolo/scanAssociation.h"
+
+#include "benchmark_common.h"
+
+typedef pcl::PointXYZI PointT;
+typedef rolo::IncrementalPointMap<PointT> Map;
+
+//! 地面、两侧的墙和竖直的杆，整体平移offset，模拟远离原点的全局坐标
+static void makeMaps(float offset, std::mt19937& rng, Map& cornerMap, Map& surfMap)
+{
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    for (int i = 0; i < 400000; ++i)
+    {
+        PointT p;
+        const float x = offset - 50.0f + 100.0f * u(rng);
+        if (u(rng) < 0.5f) { p.x = x; p.y = offset - 10.0f + 20.0f * u(rng); p.z = -1.8f + noise(rng); }
+        else { p.x = x; p.y = offset + (u(rng) < 0.5f ? -10.0f : 10.0f) + noise(rng); p.z = -1.8f + 6.0f * u(rng); }
+        surfMap.insert(p);
+    }
+    for (int pole = -10; pole < 10; ++pole)
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            PointT p;
+            p.x = offset + 5.0f * pole + noise(rng); p.y = offset + 5.0f + noise(rng); p.z = -1.8f + 4.0f * u(rng);
+            cornerMap.insert(p);
+        }
+    }
+}
+
+//! 匹配结果：雷达坐标系下的点和系数，Mask标记有效
+struct Association
+{
+    std::vector<PointT> ori, coeff;
+    std::vector<uint8_t> flag;
+    pcl::PointCloud<PointT> outOri, outCoeff;
+};
+
+static bool lineCoeff(const PointT& sel, const Eigen::Vector3f& c, const Eigen::Vector3f& v, PointT& coeff)
+{
+    const Eigen::Vector3f a = sel.getVector3fMap(), b = c + 0.1f * v, d = c - 0.1f * v;
+    const Eigen::Vector3f cross = (a - b).cross(a - d);
+    const float a012 = cross.norm(), l12 = (b - d).norm();
+    const Eigen::Vector3f l = (b - d).cross(cross) / a012 / l12;
+    const float ld2 = a012 / l12, s = 1 - 0.9f * std::fabs(ld2);
+    coeff.x = s * l.x(); coeff.y = s * l.y(); coeff.z = s * l.z(); coeff.intensity = s * ld2;
+    return s > 0.1f;
+}
+
+static bool planeCoeff(const PointT& pointOri, const PointT& sel, const Eigen::Vector4f& plane, PointT& coeff)
+{
+    const float pd2 = plane.head<3>().dot(sel.getVector3fMap()) + plane(3);
+    const float s = 1 - 0.9f * std::fabs(pd2) / std::sqrt(pointOri.getVector3fMap().norm());
+    coeff.x = s * plane(0); coeff.y = s * plane(1); coeff.z = s * plane(2); coeff.intensity = s * pd2;
+    return s > 0.1f;
+}
+
+static void reference(const pcl::PointCloud<PointT>& corners, const pcl::PointCloud<PointT>& surfs, const Map& cornerMap,
+                      const Map& surfMap, int threads, Association& out)
+{
+    const int cornerNum = corners.size(), surfNum = surfs.size();
+    #pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < cornerNum; ++i)
+    {
+        std::vector<int> ind;
+        std::vector<float> dis;
+        if (cornerMap.nearestKSearch(corners[i], 5, ind, dis) < 5 || dis[4] >= 1.0f)
+            continue;
+        Eigen::Vector3f c = Eigen::Vector3f::Zero();
+        for (int j = 0; j < 5; ++j) c += cornerMap.point(ind[j]).getVector3fMap();
+        c /= 5;
+        Eigen::Matrix3f cov = Eigen::Matrix3f::Zero();
+        for (int j = 0; j < 5; ++j)
+        {
+            const Eigen::Vector3f d = cornerMap.point(ind[j]).getVector3fMap() - c;
+            cov += d * d.transpose();
+        }
+        cov /= 5;
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> solver(cov);
+        if (!(solver.eigenvalues()(2) > 3 * solver.eigenvalues()(1)))
+            continue;
+        PointT coeff;
+        if (lineCoeff(corners[i], c, solver.eigenvectors().col(2), coeff))
+        {
+            out.ori[i] = corners[i]; out.coeff[i] = coeff; out.flag[i] = 1;
+        }
+    }
+    #pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < surfNum; ++i)
+    {
+        std::vector<int> ind;
+        std::vector<float> dis;
+        if (surfMap.nearestKSearch(surfs[i], 5, ind, dis) < 5 || dis[4] >= 1.0f)
+            continue;
+        Eigen::Matrix<float, 5, 3> A;
+        Eigen::Matrix<float, 5, 1> b;
+        b.fill(-1);
+        for (int j = 0; j < 5; ++j) A.row(j) = surfMap.point(ind[j]).getVector3fMap().transpose();
+        const Eigen::Vector3f X = A.colPivHouseholderQr().solve(b);
+        Eigen::Vector4f plane;
+        plane << X / X.norm(), 1.0f / X.norm();
+        bool valid = true;
+        for (int j = 0; j < 5 && valid; ++j)
+            valid = std::fabs(plane.head<3>().dot(A.row(j).transpose()) + plane(3)) <= 0.2f;
+        PointT coeff;
+        if (valid && planeCoeff(surfs[i], surfs[i], plane, coeff))
+        {
+            out.ori[cornerNum + i] = surfs[i]; out.coeff[cornerNum + i] = coeff; out.flag[cornerNum + i] = 1;
+        }
+    }
+    out.outOri.clear();
+    out.outCoeff.clear();
+    for (int i = 0; i < cornerNum + surfNum; ++i)
+    {
+        if (out.flag[i])
+        {
+            out.outOri.push_back(out.ori[i]);
+            out.outCoeff.push_back(out.coeff[i]);
+        }
+    }
+}
+
+static void optimized(const pcl::PointCloud<PointT>& corners, const pcl::PointCloud<PointT>& surfs, const Map& cornerMap,
+                      const Map& surfMap, int threads, std::vector<std::vector<int>>& indices,
+                      std::vector<std::vector<float>>& distances, std::vector<int>& offsets, Association& out)
+{
+    const int cornerNum = corners.size(), totalNum = corners.size() + surfs.size();
+    #pragma omp parallel num_threads(threads)
+    {
+        const int thread = omp_get_thread_num();
+        std::vector<int>& ind = indices[thread];
+        std::vector<float>& dis = distances[thread];
+        #pragma omp for
+        for (int i = 0; i < totalNum; ++i)
+        {
+            const bool corner = i < cornerNum;
+            const PointT& p = corner ? corners[i] : surfs[i - cornerNum];
+            const Map& map = corner ? cornerMap : surfMap;
+            if (map.nearestKSearch(p, 5, ind, dis) < 5 || dis[4] >= 1.0f)
+                continue;
+            Eigen::Vector3f neighbors[5];
+            for (int j = 0; j < 5; ++j) neighbors[j] = map.point(ind[j]).getVector3fMap();
+            PointT coeff;
+            bool valid;
+            if (corner)
+            {
+                Eigen::Vector3f c, v;
+                valid = rolo::fitLine(neighbors, 5, c, v) && lineCoeff(p, c, v, coeff);
+            }
+            else
+            {
+                Eigen::Vector4f plane;
+                valid = rolo::fitPlane(neighbors, 5, 0.2f, plane) && planeCoeff(p, p, plane, coeff);
+            }
+            if (valid)
+            {
+                out.ori[i] = p; out.coeff[i] = coeff; out.flag[i] = 1;
+            }
+        }
+
+        const int nt = omp_get_num_threads();
+        const int begin = (int)((long)totalNum * thread / nt), end = (int)((long)totalNum * (thread + 1) / nt);
+        int count = 0;
+        for (int i = begin; i < end; ++i) count += out.flag[i];
+        offsets[thread + 1] = count;
+        #pragma omp barrier
+        #pragma omp single
+        {
+            offsets[0] = 0;
+            for (int t = 0; t < nt; ++t) offsets[t + 1] += offsets[t];
+            out.outOri.resize(offsets[nt]);
+            out.outCoeff.resize(offsets[nt]);
+        }
+        int index = offsets[thread];
+        for (int i = begin; i < end; ++i)
+        {
+            if (!out.flag[i]) continue;
+            out.outOri.points[index] = out.ori[i];
+            out.outCoeff.points[index] = out.coeff[i];
+            ++index;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int cornerNum = 2000;
+    int surfNum = 10000;
+    int rounds = 30;
+    int threads = omp_get_max_threads();
+    float offset = 0.0f;
+    const rolo::bench::Args args(argc, argv);
+    args.get("--corners", cornerNum);
+    args.get("--surfs", surfNum);
+    args.get("--rounds", rounds);
+    args.get("--threads", threads);
+    args.get("--offset", offset);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    Map cornerMap(0.2f, 1.0f), surfMap(0.4f, 1.0f);
+    makeMaps(offset, rng, cornerMap, surfMap);
+
+    // 当前帧特征点，直接取全局坐标（雷达坐标系与全局坐标系重合）
+    pcl::PointCloud<PointT> corners, surfs;
+    for (int i = 0; i < cornerNum; ++i)
+    {
+        PointT p;
+        p.x = offset + 5.0f * (int)(-10 + 20 * u(rng)) + noise(rng); p.y = offset + 5.0f + noise(rng); p.z = -1.8f + 4.0f * u(rng);
+        corners.push_back(p);
+    }
+    for (int i = 0; i < surfNum; ++i)
+    {
+        PointT p;
+        p.x = offset - 40.0f + 80.0f * u(rng);
+        if (u(rng) < 0.5f) { p.y = offset - 9.0f + 18.0f * u(rng); p.z = -1.8f + noise(rng); }
+        else { p.y = offset + (u(rng) < 0.5f ? -10.0f : 10.0f) + noise(rng); p.z = -1.5f + 5.0f * u(rng); }
+        surfs.push_back(p);
+    }
+
+    const int totalNum = cornerNum + surfNum;
+    Association result[2];
+    for (auto& r : result)
+    {
+        r.ori.resize(totalNum); r.coeff.resize(totalNum); r.flag.assign(totalNum, 0);
+    }
+    std::vector<std::vector<int>> indices(threads);
+    std::vector<std::vector<float>> distances(threads);
+    for (int t = 0; t < threads; ++t) { indices[t].reserve(5); distances[t].reserve(5); }
+    std::vector<int> offsets(threads + 1);
+
+    double ms[2] = {0.0, 0.0};
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (auto& a : result) std::fill(a.flag.begin(), a.flag.end(), 0);
+        auto start = std::chrono::steady_clock::now();
+        reference(corners, surfs, cornerMap, surfMap, threads, result[0]);
+        ms[0] += rolo::bench::elapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        optimized(corners, surfs, cornerMap, surfMap, threads, indices, distances, offsets, result[1]);
+        ms[1] += rolo::bench::elapsedMs(start);
+    }
+
+    long agree = 0;
+    float maxCoeffDiff = 0.0f;
+    for (int i = 0; i < totalNum; ++i)
+    {
+        agree += result[0].flag[i] == result[1].flag[i];
+        if (result[0].flag[i] && result[1].flag[i])
+        {
+            const Eigen::Vector4f a = result[0].coeff[i].getVector4fMap(), b = result[1].coeff[i].getVector4fMap();
+            // 直线方向的符号不影响系数
+            maxCoeffDiff = std::max(maxCoeffDiff, std::min((a - b).cwiseAbs().maxCoeff(), (a + b).cwiseAbs().maxCoeff()));
+        }
+    }
+
+    printf("%d corners, %d surfs, %d threads, offset %.0f m, %d rounds\n", cornerNum, surfNum, threads, offset, rounds);
+    printf("%14s %16s %12s\n", "", "ms per 1k feat", "matched");
+    const char* names[2] = {"reference", "optimized"};
+    for (int m = 0; m < 2; ++m)
+        printf("%14s %16.4f %12zu\n", names[m], ms[m] / rounds / (totalNum / 1000.0), result[m].outOri.size());
+    printf("acceptance agreement %.2f%%, max coefficient difference %.2e\n", 100.0 * agree / totalNum, maxCoeffDiff);
+    return 0;
+}
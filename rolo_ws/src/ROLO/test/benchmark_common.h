@@ -0,0 +1,80 @@
+#pragma once
+#ifndef _ROLO_BENCHMARK_COMMON_H_
+#define _ROLO_BENCHMARK_COMMON_H_
+
+// test/下各个性能对比程序共用的计时和命令行参数解析，只依赖标准库
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+namespace rolo
+{
+namespace bench
+{
+
+//! 从start到现在经过的毫秒数
+inline double elapsedMs(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//! "--name value"形式的命令行参数，未给出的参数保持调用方的默认值
+class Args
+{
+public:
+    Args(int argc, char** argv) : argc_(argc), argv_(argv) {}
+
+    bool get(const char* name, int& value) const
+    {
+        const char* v = find(name);
+        if (v)
+            value = atoi(v);
+        return v != nullptr;
+    }
+
+    bool get(const char* name, float& value) const
+    {
+        const char* v = find(name);
+        if (v)
+            value = (float)atof(v);
+        return v != nullptr;
+    }
+
+    bool get(const char* name, double& value) const
+    {
+        const char* v = find(name);
+        if (v)
+            value = atof(v);
+        return v != nullptr;
+    }
+
+    bool get(const char* name, std::string& value) const
+    {
+        const char* v = find(name);
+        if (v)
+            value = v;
+        return v != nullptr;
+    }
+
+private:
+    //! 参数name之后的值，多次给出时取最后一个
+    const char* find(const char* name) const
+    {
+        const char* value = nullptr;
+        for (int i = 1; i + 1 < argc_; ++i)
+        {
+            if (std::string(argv_[i]) == name)
+                value = argv_[++i];
+        }
+        return value;
+    }
+
+    int argc_;
+    char** argv_;
+};
+
+} // namespace bench
+} // namespace rolo
+
+#endif
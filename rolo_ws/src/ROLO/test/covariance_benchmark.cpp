@@ -0,0 +1,187 @@
+// 点协方差估计性能对比：原实现（循环内分配近邻缓存和4xK矩阵，JacobiSVD正则化）vs 线程内复用缓存、闭式3x3特征分解，以及体素散布矩阵
+// 用法：covariance_benchmark [--points N] [--k N] [--voxel m] [--repeat N] [--threads N]
+// 输出耗时，以及与原实现的PLANE协方差的差异（kNN应一致；体素散布的邻域不同，给出法向夹角的统计，
+// 点数不足3个的体素得到各向同性的协方差，不计入夹角统计，单独给出其比例）
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+
+#include <rot_gicp/gicp/covariance_estimation.hpp>
+
+#include "benchmark_common.h"
+
+typedef pcl::PointXYZ PointT;
+typedef std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> CovarianceList;
+
+//! 原实现：每个点分配近邻缓存，SVD正则化
+namespace reference
+{
+
+void calculateCovariances(const pcl::PointCloud<PointT>::ConstPtr& cloud, pcl::search::KdTree<PointT>& kdtree, int k, int threads,
+                          CovarianceList& covariances)
+{
+    covariances.resize(cloud->size());
+    #pragma omp parallel for num_threads(threads) schedule(guided, 8)
+    for (int i = 0; i < (int)cloud->size(); i++)
+    {
+        std::vector<int> k_indices;
+        std::vector<float> k_sq_distances;
+        kdtree.nearestKSearch(cloud->at(i), k, k_indices, k_sq_distances);
+
+        Eigen::Matrix<double, 4, -1> neighbors(4, k);
+        for (int j = 0; j < (int)k_indices.size(); j++)
+            neighbors.col(j) = cloud->at(k_indices[j]).getVector4fMap().cast<double>();
+        neighbors.colwise() -= neighbors.rowwise().mean().eval();
+        Eigen::Matrix4d cov = neighbors * neighbors.transpose() / k;
+
+        Eigen::JacobiSVD<Eigen::Matrix3d> svd(cov.block<3, 3>(0, 0), Eigen::ComputeFullU | Eigen::ComputeFullV);
+        covariances[i].setZero();
+        covariances[i].block<3, 3>(0, 0) = svd.matrixU() * Eigen::Vector3d(1, 1, 1e-3).asDiagonal() * svd.matrixV().transpose();
+    }
+}
+
+} // namespace reference
+
+//! 与RotVGICP::calculate_covariances相同：工作线程复用近邻缓存，以查询点为原点累加散布矩阵
+void calculateCovariances(const pcl::PointCloud<PointT>::ConstPtr& cloud, pcl::search::KdTree<PointT>& kdtree, int k, fast_gicp::WorkerPool& pool,
+                          std::vector<std::vector<int>>& indices, std::vector<std::vector<float>>& sqDistances, CovarianceList& covariances)
+{
+    covariances.resize(cloud->size());
+    indices.resize(pool.num_workers());
+    sqDistances.resize(pool.num_workers());
+    pool.parallel_for(cloud->size(), 64, [&](int worker, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            kdtree.nearestKSearch(cloud->at(i), k, indices[worker], sqDistances[worker]);
+            const Eigen::Vector3d query = cloud->at(i).getVector3fMap().cast<double>();
+            fast_gicp::ScatterAccumulator scatter;
+            for (int index : indices[worker])
+                scatter.add(cloud->at(index).getVector3fMap().cast<double>() - query);
+            covariances[i] = fast_gicp::regularize_point_covariance(scatter.covariance(), fast_gicp::RegularizationMethod::PLANE);
+        }
+    });
+}
+
+//! PLANE协方差最小特征值对应的方向，即法向
+Eigen::Vector3d normalOf(const Eigen::Matrix4d& cov)
+{
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eig;
+    eig.computeDirect(cov.block<3, 3>(0, 0));
+    return eig.eigenvectors().col(0);
+}
+
+//! 仿真一帧降采样后的特征点：地面、墙面和杆，范围约±50 m
+pcl::PointCloud<PointT>::Ptr makeCloud(int n)
+{
+    std::mt19937 rng(n);
+    std::uniform_real_distribution<float> uni(-1.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>);
+    for (int i = 0; i < n; ++i)
+    {
+        PointT p;
+        float kind = 0.5f * (uni(rng) + 1.0f);
+        if (kind < 0.5f)
+        {
+            float r = 50.0f * std::pow(0.5f * (uni(rng) + 1.0f), 2.0f) + 2.0f;
+            float a = (float)M_PI * uni(rng);
+            p.x = r * std::cos(a); p.y = r * std::sin(a); p.z = -1.8f + noise(rng);
+        }
+        else if (kind < 0.9f)
+        {
+            int wall = (int)(4.0f * (uni(rng) + 1.0f)) % 8;
+            float offset = 8.0f + 5.0f * wall;
+            float along = 40.0f * uni(rng);
+            p.x = (wall % 2) ? offset + noise(rng) : along;
+            p.y = (wall % 2) ? along : -offset + noise(rng);
+            p.z = -1.8f + 3.0f * (uni(rng) + 1.0f);
+        }
+        else
+        {
+            int pole = (int)(10.0f * (uni(rng) + 1.0f)) % 20;
+            float a = (float)M_PI * uni(rng);
+            p.x = -30.0f + 3.0f * pole + 0.1f * std::cos(a);
+            p.y = 4.0f + 0.1f * std::sin(a);
+            p.z = -1.8f + 2.5f * (uni(rng) + 1.0f);
+        }
+        cloud->push_back(p);
+    }
+    return cloud;
+}
+
+int main(int argc, char** argv)
+{
+    int points = 20000;
+    int k = 20;
+    double voxel = 1.0;
+    int repeat = 10;
+    int threads = omp_get_max_threads();
+    const rolo::bench::Args args(argc, argv);
+    args.get("--points", points);
+    args.get("--k", k);
+    args.get("--voxel", voxel);
+    args.get("--repeat", repeat);
+    args.get("--threads", threads);
+
+    pcl::PointCloud<PointT>::Ptr cloud = makeCloud(points);
+    pcl::search::KdTree<PointT> kdtree;
+    kdtree.setInputCloud(cloud);
+    fast_gicp::VmfVoxelMap<PointT> scatterVoxels(voxel, fast_gicp::VoxelAccumulationMode::ADDITIVE);
+    fast_gicp::WorkerPool pool(threads);
+    std::vector<std::vector<int>> indices;
+    std::vector<std::vector<float>> sqDistances;
+
+    // KdTree已建立，只比较逐点估计的部分；体素散布不需要KdTree，其耗时包含建立体素
+    CovarianceList covs[3];
+    double ms[3] = {0, 0, 0};
+    for (int it = 0; it < repeat; ++it)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        reference::calculateCovariances(cloud, kdtree, k, threads, covs[0]);
+        auto t1 = std::chrono::steady_clock::now();
+        calculateCovariances(cloud, kdtree, k, pool, indices, sqDistances, covs[1]);
+        auto t2 = std::chrono::steady_clock::now();
+        fast_gicp::estimate_voxel_covariances(*cloud, fast_gicp::RegularizationMethod::PLANE, scatterVoxels, covs[2], pool);
+        auto t3 = std::chrono::steady_clock::now();
+        ms[0] += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        ms[1] += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        ms[2] += std::chrono::duration<double, std::milli>(t3 - t2).count();
+    }
+
+    printf("points %d, k %d, voxel %.2f m, threads %d, PLANE regularization\n", points, k, voxel, threads);
+    printf("%20s %10s %9s | %12s %14s %14s %10s\n", "", "ms", "speedup", "max |dC|", "normal deg p50", "normal deg p95",
+           "isotropic");
+    const char* names[3] = {"knn + svd", "knn + closed form", "voxel scatter"};
+    for (int m = 0; m < 3; ++m)
+    {
+        double maxDiff = 0.0;
+        std::vector<double> angles;
+        for (int i = 0; i < points; ++i)
+        {
+            maxDiff = std::max(maxDiff, (covs[m][i] - covs[0][i]).cwiseAbs().maxCoeff());
+            if (covs[m][i].block<3, 3>(0, 0).isIdentity())
+                continue;
+            double c = std::fabs(normalOf(covs[m][i]).dot(normalOf(covs[0][i])));
+            angles.push_back(std::acos(std::min(1.0, c)) * 180.0 / M_PI);
+        }
+        std::sort(angles.begin(), angles.end());
+        if (angles.empty())
+            angles.push_back(0.0);
+        printf("%20s %10.3f %8.2fx | %12.2e %14.3f %14.3f %9.1f%%\n", names[m], ms[m] / repeat, ms[0] / ms[m], maxDiff,
+               angles[angles.size() / 2], angles[(size_t)(0.95 * (angles.size() - 1))], 100.0 - 100.0 * angles.size() / points);
+    }
+    return 0;
+}
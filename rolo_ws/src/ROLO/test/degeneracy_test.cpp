@@ -0,0 +1,42 @@
+// RegistrationResult::degenerate_axes的检查：阈值为0时不报告任何退化方向（包括零和负的特征值），
+// 阈值为正时与最大特征值之比不超过阈值的方向为退化方向
+// 用法：degeneracy_test，全部通过返回0
+#include <cstdio>
+
+#include <Eigen/Core>
+
+#include <rot_gicp/gicp/lsq_registration.hpp>
+
+static int failures = 0;
+
+static void expectMask(const char* name, const Eigen::Vector3d& eigenvalues, double ratio, int expected)
+{
+    const int mask = fast_gicp::RegistrationResult::degenerate_axes(eigenvalues, ratio);
+    if (mask != expected)
+    {
+        printf("FAIL %s: mask 0x%x, expected 0x%x\n", name, mask, expected);
+        failures++;
+    }
+}
+
+int main()
+{
+    const Eigen::Vector3d zero = Eigen::Vector3d::Zero();
+    const Eigen::Vector3d negative(-1e-12, 0.0, 1.0);
+    const Eigen::Vector3d corridor(2e-3, 0.5, 1.0);
+    const Eigen::Vector3d wellConstrained(0.1, 0.5, 1.0);
+
+    // 阈值为0（默认）时不做检测
+    expectMask("ratio 0, zero block", zero, 0.0, 0);
+    expectMask("ratio 0, negative eigenvalue", negative, 0.0, 0);
+    expectMask("ratio 0, corridor", corridor, 0.0, 0);
+    expectMask("negative ratio", negative, -1.0, 0);
+
+    expectMask("zero block", zero, 0.003, 7);
+    expectMask("negative eigenvalue", negative, 0.003, 3);
+    expectMask("corridor", corridor, 0.003, 1);
+    expectMask("well constrained", wellConstrained, 0.003, 0);
+
+    printf("%s\n", failures ? "degeneracy_test failed" : "degeneracy_test passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+// 平滑度与遮挡点标记性能对比：原FeatureExtraction::calculateSmoothness + markOccludedPoints vs computeFeatureFlags
+// 用法：feature_kernel_benchmark [--cols N] [--repeat N]
+// 分别仿真32、64、128线的距离图像，输出每个点的耗时（ns和CPU周期）以及与原实现的差异
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <x86intrin.h>
+
+#include "rolo/featureKernels.h"
+
+#include "benchmark_common.h"
+
+//! 原实现，逐点计算，结果写入三个独立数组
+void flagsReference(const std::vector<float>& pointRange, const std::vector<int32_t>& pointColInd,
+                    float* cloudCurvature, int* cloudNeighborPicked, int* cloudLabel)
+{
+    int cloudSize = pointRange.size();
+    for (int i = 5; i < cloudSize - 5; i++)
+    {
+        float diffRange = pointRange[i-5] + pointRange[i-4]
+                        + pointRange[i-3] + pointRange[i-2]
+                        + pointRange[i-1] - pointRange[i] * 10
+                        + pointRange[i+1] + pointRange[i+2]
+                        + pointRange[i+3] + pointRange[i+4]
+                        + pointRange[i+5];
+        cloudCurvature[i] = diffRange*diffRange;
+        cloudNeighborPicked[i] = 0;
+        cloudLabel[i] = 0;
+    }
+    for (int i = 5; i < cloudSize - 6; ++i)
+    {
+        float depth1 = pointRange[i];
+        float depth2 = pointRange[i+1];
+        int columnDiff = std::abs(int(pointColInd[i+1] - pointColInd[i]));
+        if (columnDiff < 10){
+            if (depth1 - depth2 > 0.3){
+                for (int k = 0; k <= 5; ++k)
+                    cloudNeighborPicked[i - k] = 1;
+            }else if (depth2 - depth1 > 0.3){
+                for (int k = 1; k <= 6; ++k)
+                    cloudNeighborPicked[i + k] = 1;
+            }
+        }
+        float diff1 = std::abs(float(pointRange[i-1] - pointRange[i]));
+        float diff2 = std::abs(float(pointRange[i+1] - pointRange[i]));
+        if (diff1 > 0.02 * pointRange[i] && diff2 > 0.02 * pointRange[i])
+            cloudNeighborPicked[i] = 1;
+    }
+}
+
+//! 仿真一帧距离图像：分段平滑的墙面，段间有深度跳变，约10%的像素无回波
+void makeRangeImage(int rows, int cols, std::vector<float>& range, std::vector<int32_t>& col)
+{
+    std::mt19937 rng(rows);
+    std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+    range.clear();
+    col.clear();
+    for (int r = 0; r < rows; ++r)
+    {
+        float base = 5.0f + 30.0f * uni(rng);
+        float slope = 0.02f * (uni(rng) - 0.5f);
+        for (int c = 0; c < cols; ++c)
+        {
+            if (uni(rng) < 0.02f)
+            {
+                base = 5.0f + 30.0f * uni(rng);
+                slope = 0.02f * (uni(rng) - 0.5f);
+            }
+            base += slope;
+            if (uni(rng) < 0.1f || base < 1.0f)
+                continue;
+            range.push_back(base + 0.01f * (uni(rng) - 0.5f));
+            col.push_back(c);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int cols = 2048;
+    int repeat = 50;
+    const rolo::bench::Args args(argc, argv);
+    args.get("--cols", cols);
+    args.get("--repeat", repeat);
+    printf("AVX2 kernel: %s\n", rolo::featureKernelsUseAvx2() ? "yes" : "no");
+    printf("%6s %9s | %22s | %22s | %22s | %s\n", "beams", "points",
+           "reference ns (cyc)/pt", "scalar ns (cyc)/pt", "vector ns (cyc)/pt", "curvature / picked mismatches");
+
+    for (int rows : {32, 64, 128})
+    {
+        std::vector<float> range;
+        std::vector<int32_t> col;
+        makeRangeImage(rows, cols, range, col);
+        int n = range.size();
+
+        std::vector<float> curvature(n, 0.0f);
+        std::vector<int> picked(n, 0), label(n, 0);
+        rolo::FeatureBuffer scalarBuffer, vectorBuffer;
+
+        double t[3] = {0, 0, 0};
+        unsigned long long cycles[3] = {0, 0, 0};
+        for (int it = 0; it < repeat; ++it)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                unsigned long long c0 = __rdtsc();
+                if (k == 0)
+                    flagsReference(range, col, curvature.data(), picked.data(), label.data());
+                else if (k == 1)
+                    rolo::computeFeatureFlagsScalar(range.data(), col.data(), n, scalarBuffer);
+                else
+                    rolo::computeFeatureFlags(range.data(), col.data(), n, vectorBuffer);
+                cycles[k] += __rdtsc() - c0;
+                t[k] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+            }
+        }
+
+        size_t curvatureDiff = 0, pickedDiff = 0;
+        for (int i = 5; i < n - 5; ++i)
+        {
+            curvatureDiff += curvature[i] != vectorBuffer.curvature[i] || curvature[i] != scalarBuffer.curvature[i];
+            pickedDiff += picked[i] != vectorBuffer.picked[i] || picked[i] != scalarBuffer.picked[i];
+        }
+
+        double per = double(n) * repeat;
+        printf("%6d %9d | %10.3f (%8.2f) | %10.3f (%8.2f) | %10.3f (%8.2f) | %zu / %zu\n", rows, n,
+               t[0] / per, cycles[0] / per, t[1] / per, cycles[1] / per, t[2] / per, cycles[2] / per,
+               curvatureDiff, pickedDiff);
+    }
+    return 0;
+}
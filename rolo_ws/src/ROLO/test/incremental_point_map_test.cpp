@@ -0,0 +1,165 @@
+// IncrementalPointMap的检查：cellSize以内的近邻与暴力搜索一致，removeOutside按网格删除，删除的点位被复用
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <pcl/point_types.h>
+
+#include "rolo/incrementalPointMap.h"
+
+typedef pcl::PointXYZI PointType;
+typedef rolo::IncrementalPointMap<PointType> PointMap;
+
+static PointType makePoint(float x, float y, float z)
+{
+    PointType p;
+    p.x = x;
+    p.y = y;
+    p.z = z;
+    p.intensity = 0;
+    return p;
+}
+
+static std::vector<PointType> randomPoints(int n, float halfSize, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(-halfSize, halfSize);
+    std::vector<PointType> points;
+    for (int i = 0; i < n; i++)
+        points.push_back(makePoint(uniform(rng), uniform(rng), uniform(rng)));
+    return points;
+}
+
+TEST(IncrementalPointMap, NearestKMatchesBruteForceWithinCellSize)
+{
+    const float cellSize = 1.0f;
+    PointMap map(0.05f, cellSize);
+    for (const PointType& p : randomPoints(20000, 5.0f, 1))
+        map.insert(p);
+
+    // 降采样后地图中保留的点
+    pcl::PointCloud<PointType> cloud;
+    map.toCloud(cloud);
+    ASSERT_EQ(cloud.size(), map.size());
+
+    const int k = 5;
+    std::vector<int> indices;
+    std::vector<float> sqDistances;
+    for (const PointType& query : randomPoints(500, 4.0f, 2))
+    {
+        std::vector<float> brute;
+        for (const PointType& p : cloud.points)
+            brute.push_back((p.getVector3fMap() - query.getVector3fMap()).squaredNorm());
+        std::sort(brute.begin(), brute.end());
+
+        const int found = map.nearestKSearch(query, k, indices, sqDistances);
+        ASSERT_EQ(found, (int)indices.size());
+        ASSERT_EQ(found, (int)sqDistances.size());
+        ASSERT_TRUE(std::is_sorted(sqDistances.begin(), sqDistances.end()));
+        for (int j = 0; j < found; j++)
+        {
+            EXPECT_FLOAT_EQ(sqDistances[j],
+                            (map.point(indices[j]).getVector3fMap() - query.getVector3fMap()).squaredNorm());
+            // 距离不超过cellSize的近邻是精确的
+            if (brute[j] <= cellSize * cellSize)
+            {
+                EXPECT_FLOAT_EQ(sqDistances[j], brute[j]);
+            }
+        }
+        // cellSize以内的点至少有k个时，一定都找到
+        if (brute[k - 1] <= cellSize * cellSize)
+        {
+            EXPECT_EQ(found, k);
+        }
+    }
+}
+
+TEST(IncrementalPointMap, DownsamplesWithinLeaf)
+{
+    PointMap map(1.0f, 2.0f);
+    EXPECT_TRUE(map.insert(makePoint(0.9f, 0.9f, 0.9f)));
+    // 同一体素中离中心更近的点替换原来的点，不新增
+    EXPECT_FALSE(map.insert(makePoint(0.5f, 0.5f, 0.6f)));
+    EXPECT_FALSE(map.insert(makePoint(0.1f, 0.1f, 0.1f)));
+    EXPECT_EQ(map.size(), 1u);
+
+    std::vector<int> indices;
+    std::vector<float> sqDistances;
+    ASSERT_EQ(map.nearestKSearch(makePoint(0, 0, 0), 1, indices, sqDistances), 1);
+    EXPECT_FLOAT_EQ(map.point(indices[0]).z, 0.6f);
+
+    // 非有限的点不插入
+    EXPECT_FALSE(map.insert(makePoint(NAN, 0, 0)));
+    EXPECT_EQ(map.size(), 1u);
+}
+
+TEST(IncrementalPointMap, ZeroKFindsNothing)
+{
+    PointMap map(0.1f, 1.0f);
+    map.insert(makePoint(0, 0, 0));
+    std::vector<int> indices(3, -1);
+    std::vector<float> sqDistances(3, -1);
+    EXPECT_EQ(map.nearestKSearch(makePoint(0, 0, 0), 0, indices, sqDistances), 0);
+    EXPECT_TRUE(indices.empty());
+    EXPECT_TRUE(sqDistances.empty());
+}
+
+TEST(IncrementalPointMap, RemoveOutsideDropsWholeCells)
+{
+    const float cellSize = 1.0f;
+    PointMap map(0.1f, cellSize);
+    // 网格(0,0,0)和(5,0,0)中各一个点
+    map.insert(makePoint(0.5f, 0.5f, 0.5f));
+    map.insert(makePoint(5.5f, 0.5f, 0.5f));
+    ASSERT_EQ(map.size(), 2u);
+
+    // 立方体[-1, 2]^3与网格(0,0,0)相交，与网格(5,0,0)不相交
+    EXPECT_EQ(map.removeOutside(Eigen::Vector3f(0.5f, 0.5f, 0.5f), 1.5f), 1u);
+    EXPECT_EQ(map.size(), 1u);
+
+    std::vector<int> indices;
+    std::vector<float> sqDistances;
+    EXPECT_EQ(map.nearestKSearch(makePoint(5.5f, 0.5f, 0.5f), 1, indices, sqDistances), 0);
+    ASSERT_EQ(map.nearestKSearch(makePoint(0.5f, 0.5f, 0.5f), 1, indices, sqDistances), 1);
+    EXPECT_FLOAT_EQ(sqDistances[0], 0.0f);
+
+    // 删除的体素可以重新插入
+    EXPECT_TRUE(map.insert(makePoint(5.5f, 0.5f, 0.5f)));
+    EXPECT_EQ(map.size(), 2u);
+}
+
+TEST(IncrementalPointMap, RemovedSlotsAreReused)
+{
+    PointMap map(0.1f, 1.0f);
+    // 体素0.1的网格中每个点各占一个体素
+    for (int i = 0; i < 100; i++)
+        map.insert(makePoint(100.05f + 0.1f * (i % 10), 0.05f + 0.1f * (i / 10), 0.05f));
+    const int count = (int)map.size();
+    ASSERT_EQ(count, 100);
+
+    // 全部删除后再插入同样数量的点，点位都来自删除的点位
+    EXPECT_EQ(map.removeOutside(Eigen::Vector3f::Zero(), 10.0f), (size_t)count);
+    EXPECT_TRUE(map.empty());
+    for (int i = 0; i < 100; i++)
+        map.insert(makePoint(0.05f + 0.1f * (i % 10), 0.05f + 0.1f * (i / 10), 0.05f));
+    ASSERT_EQ((int)map.size(), count);
+
+    pcl::PointCloud<PointType> cloud;
+    map.toCloud(cloud);
+    std::vector<int> indices;
+    std::vector<float> sqDistances;
+    for (const PointType& p : cloud.points)
+    {
+        ASSERT_EQ(map.nearestKSearch(p, 1, indices, sqDistances), 1);
+        EXPECT_LT(indices[0], count);
+        EXPECT_FLOAT_EQ(sqDistances[0], 0.0f);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
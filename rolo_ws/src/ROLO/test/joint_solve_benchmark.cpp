@@ -0,0 +1,218 @@
+// 帧间配准对比：两步法（SO3旋转配准 + 连续时间平移配准）vs 旋转平移联合求解（CT_LevenbergMarquardt）
+// 用法：joint_solve_benchmark --bag file.bag [--topic /velodyne_points] [--frames N] [--leaf m] [--ct-lambda w]
+//                              [--update-interval N] [--threads N]
+// 从bag中读取原始点云，体素降采样后对相邻两帧配准，初值为上一帧的参考运动（匀速模型），与里程计前端相同。
+// 参考运动由SE3 LM（DIRECT7，每次迭代重新建立对应关系，更严格的收敛阈值）以两步法的结果为初值求得，
+// 输出两种方法的耗时、关联/线性化次数，以及与参考运动的旋转和平移差异。
+// 两步法和联合求解都带连续时间平移约束，参考运动不带，--ct-lambda 0 可以只比较求解方式本身的差异。
+// 两种方法的对应关系更新与默认配置相同（每3次线性化或位姿变化超过0.5度/0.1 m时重新建立），--update-interval 1为每次都重新建立
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/common/transforms.h>
+#include <pcl/filters/filter.h>
+#include <pcl/filters/voxel_grid.h>
+
+#include <rot_gicp/gicp/rot_vgicp.hpp>
+
+#include "benchmark_common.h"
+
+typedef pcl::PointXYZ PointT;
+typedef fast_gicp::RotVGICP<PointT, PointT> Registration;
+
+//! 一种方法在所有帧上的统计
+struct Stats
+{
+    std::vector<double> ms;
+    std::vector<double> rotError;     // 度
+    std::vector<double> transError;   // 米
+    long associations = 0;
+    long linearizations = 0;
+
+    void add(double elapsed, const Eigen::Isometry3d& estimate, const Eigen::Isometry3d& reference)
+    {
+        Eigen::Isometry3d diff = estimate.inverse() * reference;
+        ms.push_back(elapsed);
+        rotError.push_back(Eigen::AngleAxisd(diff.linear()).angle() * 180.0 / M_PI);
+        transError.push_back((estimate.translation() - reference.translation()).norm());
+    }
+};
+
+double mean(const std::vector<double>& v)
+{
+    double sum = 0.0;
+    for (double x : v)
+        sum += x;
+    return v.empty() ? 0.0 : sum / v.size();
+}
+
+double percentile(std::vector<double> v, double p)
+{
+    if (v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+void setupRegistration(Registration& reg, int threads, int updateInterval)
+{
+    reg.setResolution(1.0);
+    reg.setNumThreads(threads);
+    reg.setCorrespondenceUpdate(updateInterval, 0.5 * M_PI / 180.0, 0.1);
+}
+
+//! 与前端相同的配准输入：源点云为按初值变换后的上一帧
+void setInputs(Registration& reg, const pcl::PointCloud<PointT>::Ptr& propagated, const pcl::PointCloud<PointT>::Ptr& target)
+{
+    reg.clearSource();
+    reg.setInputSource(propagated);
+    reg.clearTarget();
+    reg.setInputTarget(target);
+}
+
+int main(int argc, char** argv)
+{
+    std::string bagFile;
+    std::string topic = "/velodyne_points";
+    int frames = 300;
+    double leaf = 0.5;
+    float ctLambda = 0.3f;
+    int updateInterval = 3;
+    int threads = omp_get_max_threads();
+    const rolo::bench::Args args(argc, argv);
+    args.get("--bag", bagFile);
+    args.get("--topic", topic);
+    args.get("--frames", frames);
+    args.get("--leaf", leaf);
+    args.get("--ct-lambda", ctLambda);
+    args.get("--update-interval", updateInterval);
+    args.get("--threads", threads);
+    if (bagFile.empty())
+    {
+        fprintf(stderr, "usage: %s --bag file.bag [--topic /velodyne_points] [--frames N] [--leaf m] [--ct-lambda w] "
+                        "[--update-interval N] [--threads N]\n", argv[0]);
+        return 1;
+    }
+
+    // 读取并降采样点云
+    std::vector<pcl::PointCloud<PointT>::Ptr> clouds;
+    double scanPeriod = 0.1;
+    {
+        rosbag::Bag bag(bagFile, rosbag::bagmode::Read);
+        rosbag::View view(bag, rosbag::TopicQuery(topic));
+        pcl::VoxelGrid<PointT> voxel;
+        voxel.setLeafSize(leaf, leaf, leaf);
+        double firstStamp = -1.0, lastStamp = -1.0;
+        for (const rosbag::MessageInstance& m : view)
+        {
+            sensor_msgs::PointCloud2::ConstPtr msg = m.instantiate<sensor_msgs::PointCloud2>();
+            if (!msg)
+                continue;
+            pcl::PointCloud<PointT>::Ptr raw(new pcl::PointCloud<PointT>), cloud(new pcl::PointCloud<PointT>);
+            pcl::fromROSMsg(*msg, *raw);
+            std::vector<int> indices;
+            pcl::removeNaNFromPointCloud(*raw, *raw, indices);
+            voxel.setInputCloud(raw);
+            voxel.filter(*cloud);
+            clouds.push_back(cloud);
+            if (firstStamp < 0.0)
+                firstStamp = msg->header.stamp.toSec();
+            lastStamp = msg->header.stamp.toSec();
+            if ((int)clouds.size() > frames)
+                break;
+        }
+        if (clouds.size() > 1)
+            scanPeriod = (lastStamp - firstStamp) / (clouds.size() - 1);
+    }
+    if (clouds.size() < 2)
+    {
+        fprintf(stderr, "less than two clouds on %s in %s\n", topic.c_str(), bagFile.c_str());
+        return 1;
+    }
+
+    Registration twoStage, joint, reference;
+    setupRegistration(twoStage, threads, updateInterval);
+    setupRegistration(joint, threads, updateInterval);
+    setupRegistration(reference, threads, 1);
+    twoStage.setOptimizerType(fast_gicp::LSQ_OPTIMIZER_TYPE::SO3_LevenbergMarquardt);
+    joint.setOptimizerType(fast_gicp::LSQ_OPTIMIZER_TYPE::CT_LevenbergMarquardt);
+    reference.setOptimizerType(fast_gicp::LSQ_OPTIMIZER_TYPE::LevenbergMarquardt);
+    reference.setNeighborSearchMethod(fast_gicp::NeighborSearchMethod::DIRECT7);
+    reference.setTransformationEpsilon(1e-6);
+    reference.setRotationEpsilon(1e-6);
+
+    Stats stats[2];
+    Eigen::Isometry3d motion = Eigen::Isometry3d::Identity();
+    Eigen::Vector3d lastTranslation = Eigen::Vector3d::Zero();
+    pcl::PointCloud<PointT> aligned;
+    for (size_t f = 1; f < clouds.size(); ++f)
+    {
+        // 匀速模型的初值
+        pcl::PointCloud<PointT>::Ptr propagated(new pcl::PointCloud<PointT>);
+        const Eigen::Matrix4f guess = motion.matrix().cast<float>();
+        pcl::transformPointCloud(*clouds[f - 1], *propagated, guess);
+        const Eigen::Vector3d priorGuess = motion.translation();
+
+        // 两步法：旋转配准后，沿用最后一次的对应关系做平移配准
+        auto t0 = std::chrono::steady_clock::now();
+        setInputs(twoStage, propagated, clouds[f]);
+        twoStage.align(aligned);
+        fast_gicp::RegistrationTiming rotationTiming = twoStage.getTiming();
+        Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+        twoStage.computeTranslation(aligned, translation, priorGuess, lastTranslation, scanPeriod, scanPeriod, ctLambda);
+        auto t1 = std::chrono::steady_clock::now();
+        Eigen::Isometry3d twoStageStep = Eigen::Isometry3d(twoStage.getFinalTransformation().cast<double>());
+        twoStageStep.translation() = translation;
+        stats[0].associations += rotationTiming.associations + twoStage.getTiming().associations;
+        stats[0].linearizations += rotationTiming.linearizations + twoStage.getTiming().linearizations;
+
+        // 联合求解
+        auto t2 = std::chrono::steady_clock::now();
+        setInputs(joint, propagated, clouds[f]);
+        joint.setTranslationPrior(priorGuess, scanPeriod, ctLambda);
+        joint.align(aligned);
+        auto t3 = std::chrono::steady_clock::now();
+        Eigen::Isometry3d jointStep = Eigen::Isometry3d(joint.getFinalTransformation().cast<double>());
+        stats[1].associations += joint.getTiming().associations;
+        stats[1].linearizations += joint.getTiming().linearizations;
+
+        // 参考运动，以两步法的结果为初值
+        setInputs(reference, clouds[f - 1], clouds[f]);
+        reference.align(aligned, (twoStageStep * motion).matrix().cast<float>());
+        Eigen::Isometry3d referenceMotion = Eigen::Isometry3d(reference.getFinalTransformation().cast<double>());
+
+        // 源点云先按初值变换，配准得到的是其后的增量
+        stats[0].add(std::chrono::duration<double, std::milli>(t1 - t0).count(), twoStageStep * motion, referenceMotion);
+        stats[1].add(std::chrono::duration<double, std::milli>(t3 - t2).count(), jointStep * motion, referenceMotion);
+
+        lastTranslation = referenceMotion.translation();
+        motion = referenceMotion;
+    }
+
+    const int pairs = (int)clouds.size() - 1;
+    printf("%s %s: %d frame pairs, leaf %.2f m, scan period %.3f s, ct lambda %.2f, update interval %d, threads %d\n",
+           bagFile.c_str(), topic.c_str(), pairs, leaf, scanPeriod, ctLambda, updateInterval, threads);
+    printf("%10s | %9s %9s | %7s %7s | %21s | %21s\n", "", "ms mean", "ms p95", "assoc", "linear",
+           "rot err deg mean/max", "trans err cm mean/max");
+    const char* names[2] = {"two-stage", "joint"};
+    for (int k = 0; k < 2; ++k)
+    {
+        const Stats& s = stats[k];
+        printf("%10s | %9.3f %9.3f | %7.1f %7.1f | %10.4f %10.4f | %10.3f %10.3f\n", names[k], mean(s.ms), percentile(s.ms, 0.95),
+               (double)s.associations / pairs, (double)s.linearizations / pairs,
+               mean(s.rotError), percentile(s.rotError, 1.0), 100.0 * mean(s.transError), 100.0 * percentile(s.transError, 1.0));
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+// 后端关键帧点云缓存的性能对比：每次取用都变换关键帧点云 vs 按位姿缓存的变换结果
+// 用法：keyframe_cache_benchmark [--keyframes N] [--points N] [--window N] [--loops N] [--moved r] [--memory MB]
+// 模拟建图时反复取用最近window个关键帧（局部地图重建、回环的near keyframes），每隔keyframes/loops帧发生一次回环，
+// 回环只移动比例为moved的较新的关键帧。输出两种方式的总耗时、缓存命中率和占用的内存
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/common/transforms.h>
+
+#include "rolo/keyframeCloudCache.h"
+
+#include "benchmark_common.h"
+
+typedef pcl::PointXYZI PointT;
+typedef pcl::PointCloud<PointT> Cloud;
+
+static Cloud::Ptr makeKeyframe(int points, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> u(-30.0f, 30.0f);
+    Cloud::Ptr cloud(new Cloud());
+    cloud->resize(points);
+    for (auto& p : cloud->points)
+    {
+        p.x = u(rng); p.y = u(rng); p.z = 0.1f * u(rng); p.intensity = 0.0f;
+    }
+    return cloud;
+}
+
+static Cloud::ConstPtr transformed(const Cloud::Ptr& cloud, const Eigen::Affine3f& pose)
+{
+    Cloud::Ptr out(new Cloud());
+    pcl::transformPointCloud(*cloud, *out, pose);
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    int keyframes = 1000;
+    int points = 8000;
+    int window = 50;
+    int loops = 10;
+    float moved = 0.2f;
+    int memory = 512;
+    const rolo::bench::Args args(argc, argv);
+    args.get("--keyframes", keyframes);
+    args.get("--points", points);
+    args.get("--window", window);
+    args.get("--loops", loops);
+    args.get("--moved", moved);
+    args.get("--memory", memory);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+    std::vector<Cloud::Ptr> corner, surf;
+    std::vector<Eigen::Affine3f, Eigen::aligned_allocator<Eigen::Affine3f>> poses;
+    rolo::KeyframeCloudCache<PointT> cache((size_t)memory << 20, 0.01f, 0.05f * M_PI / 180.0f);
+
+    double ms[2] = {0.0, 0.0};
+    size_t checksum[2] = {0, 0};
+    const int loopEvery = std::max(1, keyframes / std::max(1, loops));
+    for (int k = 0; k < keyframes; ++k)
+    {
+        corner.push_back(makeKeyframe(points / 5, rng));
+        surf.push_back(makeKeyframe(points, rng));
+        poses.push_back(Eigen::Translation3f(2.0f * k, 0.0f, 0.0f) * Eigen::AngleAxisf(0.01f * k, Eigen::Vector3f::UnitZ()));
+
+        // 回环：较新的关键帧移动，其余的位姿不变
+        if (k > 0 && k % loopEvery == 0)
+        {
+            for (int i = (int)((1.0f - moved) * k); i <= k; ++i)
+            {
+                poses[i] = Eigen::Translation3f(0.1f * u(rng), 0.1f * u(rng), 0.0f) * poses[i];
+                cache.invalidate(i, poses[i]);
+            }
+        }
+
+        const int first = std::max(0, k - window + 1);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = first; i <= k; ++i)
+            checksum[0] += transformed(corner[i], poses[i])->size() + transformed(surf[i], poses[i])->size();
+        ms[0] += rolo::bench::elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        for (int i = first; i <= k; ++i)
+        {
+            Cloud::ConstPtr c, s;
+            if (!cache.find(i, poses[i], c, s))
+            {
+                c = transformed(corner[i], poses[i]);
+                s = transformed(surf[i], poses[i]);
+                cache.insert(i, poses[i], c, s);
+            }
+            checksum[1] += c->size() + s->size();
+        }
+        ms[1] += rolo::bench::elapsedMs(start);
+    }
+
+    printf("%d keyframes, %d points per keyframe, window %d, %d loops moving %.0f%% of keyframes, budget %d MB\n",
+           keyframes, points + points / 5, window, loops, 100.0f * moved, memory);
+    printf("%14s %12s\n", "", "ms per frame");
+    printf("%14s %12.3f\n", "transform", ms[0] / keyframes);
+    printf("%14s %12.3f\n", "cache", ms[1] / keyframes);
+    printf("hit rate %.2f%%, %zu entries, %.1f MB, points %s\n", 100.0 * cache.hits() / (cache.hits() + cache.misses()),
+           cache.size(), cache.bytes() / 1048576.0, checksum[0] == checksum[1] ? "match" : "MISMATCH");
+    return 0;
+}
@@ -0,0 +1,143 @@
+// KeyframeCloudCache的检查：按内存上限淘汰最久未使用的条目，位姿在容差内命中，invalidate只删除位姿变化的条目
+#include <cmath>
+
+#include <gtest/gtest.h>
+#include <pcl/point_types.h>
+
+#include "rolo/keyframeCloudCache.h"
+
+typedef pcl::PointXYZI PointType;
+typedef rolo::KeyframeCloudCache<PointType> Cache;
+
+static Cache::CloudConstPtr makeCloud(int n)
+{
+    pcl::PointCloud<PointType>::Ptr cloud(new pcl::PointCloud<PointType>());
+    for (int i = 0; i < n; i++)
+    {
+        PointType p;
+        p.x = p.y = p.z = (float)i;
+        p.intensity = 0;
+        cloud->push_back(p);
+    }
+    return cloud;
+}
+
+static Eigen::Affine3f makePose(float x, float yaw)
+{
+    Eigen::Affine3f pose = Eigen::Affine3f::Identity();
+    pose.translation() = Eigen::Vector3f(x, 0, 0);
+    pose.linear() = Eigen::AngleAxisf(yaw, Eigen::Vector3f::UnitZ()).toRotationMatrix();
+    return pose;
+}
+
+TEST(KeyframeCloudCache, EvictsLeastRecentlyUsedOverBudget)
+{
+    // 每个条目10个点，上限容纳3个条目
+    const size_t entryBytes = 10 * sizeof(PointType);
+    Cache cache(3 * entryBytes, 0.01f, 0.01f);
+    const Eigen::Affine3f pose = makePose(0, 0);
+    for (int id = 0; id < 3; id++)
+        cache.insert(id, pose, makeCloud(5), makeCloud(5));
+    EXPECT_EQ(cache.size(), 3u);
+    EXPECT_EQ(cache.bytes(), 3 * entryBytes);
+
+    // 使用0之后，1是最久未使用的
+    Cache::CloudConstPtr corner, surf;
+    ASSERT_TRUE(cache.find(0, pose, corner, surf));
+    EXPECT_EQ(corner->size(), 5u);
+    EXPECT_EQ(surf->size(), 5u);
+
+    cache.insert(3, pose, makeCloud(5), makeCloud(5));
+    EXPECT_EQ(cache.size(), 3u);
+    EXPECT_EQ(cache.bytes(), 3 * entryBytes);
+    EXPECT_FALSE(cache.find(1, pose, corner, surf));
+    EXPECT_TRUE(cache.find(0, pose, corner, surf));
+    EXPECT_TRUE(cache.find(2, pose, corner, surf));
+    EXPECT_TRUE(cache.find(3, pose, corner, surf));
+    EXPECT_EQ(cache.hits(), 4u);
+    EXPECT_EQ(cache.misses(), 1u);
+}
+
+TEST(KeyframeCloudCache, KeepsNewestEntryAboveBudget)
+{
+    const size_t entryBytes = 10 * sizeof(PointType);
+    Cache cache(entryBytes, 0.01f, 0.01f);
+    const Eigen::Affine3f pose = makePose(0, 0);
+    cache.insert(0, pose, makeCloud(5), makeCloud(5));
+    // 单个条目超过上限时淘汰其它条目，但保留它自己
+    cache.insert(1, pose, makeCloud(20), makeCloud(20));
+    EXPECT_EQ(cache.size(), 1u);
+    EXPECT_EQ(cache.bytes(), 4 * entryBytes);
+
+    Cache::CloudConstPtr corner, surf;
+    EXPECT_TRUE(cache.find(1, pose, corner, surf));
+    EXPECT_FALSE(cache.find(0, pose, corner, surf));
+}
+
+TEST(KeyframeCloudCache, ReplacingEntryUpdatesBytes)
+{
+    const size_t entryBytes = 10 * sizeof(PointType);
+    Cache cache(10 * entryBytes, 0.01f, 0.01f);
+    const Eigen::Affine3f pose = makePose(0, 0);
+    cache.insert(0, pose, makeCloud(5), makeCloud(5));
+    cache.insert(0, pose, makeCloud(10), makeCloud(10));
+    EXPECT_EQ(cache.size(), 1u);
+    EXPECT_EQ(cache.bytes(), 2 * entryBytes);
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_EQ(cache.bytes(), 0u);
+}
+
+TEST(KeyframeCloudCache, SamePoseUsesTolerances)
+{
+    Cache cache(1 << 20, 0.01f, 0.01f);
+    const Eigen::Affine3f pose = makePose(1, 0.5f);
+    EXPECT_TRUE(cache.samePose(pose, pose));
+    EXPECT_TRUE(cache.samePose(pose, makePose(1.005f, 0.505f)));
+    EXPECT_FALSE(cache.samePose(pose, makePose(1.02f, 0.5f)));
+    EXPECT_FALSE(cache.samePose(pose, makePose(1, 0.52f)));
+    EXPECT_FALSE(cache.samePose(pose, makePose(1, 0.5f - 0.02f)));
+}
+
+TEST(KeyframeCloudCache, FindWithinToleranceReturnsCachedPose)
+{
+    Cache cache(1 << 20, 0.01f, 0.01f);
+    const Eigen::Affine3f pose = makePose(1, 0.5f);
+    cache.insert(7, pose, makeCloud(3), makeCloud(4));
+
+    Cache::CloudConstPtr corner, surf;
+    Eigen::Affine3f cachedPose = Eigen::Affine3f::Identity();
+    ASSERT_TRUE(cache.find(7, makePose(1.005f, 0.5f), corner, surf, &cachedPose));
+    EXPECT_TRUE(cachedPose.isApprox(pose));
+    EXPECT_EQ(corner->size(), 3u);
+    EXPECT_EQ(surf->size(), 4u);
+
+    // 位姿超出容差时不命中
+    EXPECT_FALSE(cache.find(7, makePose(1.1f, 0.5f), corner, surf));
+}
+
+TEST(KeyframeCloudCache, InvalidateOnlyMovedEntries)
+{
+    Cache cache(1 << 20, 0.01f, 0.01f);
+    const Eigen::Affine3f pose = makePose(1, 0.5f);
+    cache.insert(0, pose, makeCloud(3), makeCloud(3));
+
+    // 位姿未变（容差内）时保留
+    EXPECT_FALSE(cache.invalidate(0, makePose(1.005f, 0.5f)));
+    EXPECT_EQ(cache.size(), 1u);
+    // 不存在的条目
+    EXPECT_FALSE(cache.invalidate(1, makePose(5, 0)));
+    // 回环移动了关键帧
+    EXPECT_TRUE(cache.invalidate(0, makePose(1.5f, 0.5f)));
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_EQ(cache.bytes(), 0u);
+
+    Cache::CloudConstPtr corner, surf;
+    EXPECT_FALSE(cache.find(0, pose, corner, surf));
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
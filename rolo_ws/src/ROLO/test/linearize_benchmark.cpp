@@ -0,0 +1,183 @@
+// RotVGICP线性化性能对比：原实现（double，4x4马氏矩阵，逐对应关系构造4x6雅可比矩阵）vs 单精度SoA核函数
+// 用法：linearize_benchmark [--correspondences N] [--repeat N]
+// 单线程分别计算SE3的H、b和误差，输出耗时以及与原实现的相对误差和求解出的增量的差异
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include <rot_gicp/gicp/linearize_kernels.hpp>
+
+#include "benchmark_common.h"
+
+typedef std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> MatrixList;
+typedef std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d>> VectorList;
+typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+//! 原实现的线性化
+namespace reference
+{
+
+inline Eigen::Matrix3d skewd(const Eigen::Vector3d& x) {
+  Eigen::Matrix3d skew = Eigen::Matrix3d::Zero();
+  skew(0, 1) = -x[2];
+  skew(0, 2) = x[1];
+  skew(1, 0) = x[2];
+  skew(1, 2) = -x[0];
+  skew(2, 0) = -x[1];
+  skew(2, 1) = x[0];
+  return skew;
+}
+
+double linearize(const VectorList& source, const VectorList& target, const MatrixList& mahalanobis, const std::vector<int>& num_points,
+                 const Eigen::Isometry3d& trans, Matrix6d& H, Vector6d& b) {
+  double sum_errors = 0.0;
+  H.setZero();
+  b.setZero();
+  for (size_t i = 0; i < source.size(); i++) {
+    const Eigen::Vector4d transed_mean_A = trans * source[i];
+    const Eigen::Vector4d error = target[i] - transed_mean_A;
+    double w = std::sqrt(num_points[i]);
+    sum_errors += w * error.transpose() * mahalanobis[i] * error;
+
+    Eigen::Matrix<double, 4, 6> dtdx0 = Eigen::Matrix<double, 4, 6>::Zero();
+    dtdx0.block<3, 3>(0, 0) = skewd(transed_mean_A.head<3>());
+    dtdx0.block<3, 3>(0, 3) = -Eigen::Matrix3d::Identity();
+    H += w * dtdx0.transpose() * mahalanobis[i] * dtdx0;
+    b += w * dtdx0.transpose() * mahalanobis[i] * error;
+  }
+  return sum_errors;
+}
+
+} // namespace reference
+
+//! 由核函数的累加量恢复完整的H和b
+void unpack(const double* sums, Matrix6d& H, Vector6d& b)
+{
+    const int upper[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            H(r, c) = sums[fast_gicp::SUM_H_RR + upper[r][c]];
+            H(r, 3 + c) = H(3 + c, r) = sums[fast_gicp::SUM_H_RT + 3 * r + c];
+            H(3 + r, 3 + c) = sums[fast_gicp::SUM_H_TT + upper[r][c]];
+        }
+        b(r) = sums[fast_gicp::SUM_G_R + r];
+        b(3 + r) = sums[fast_gicp::SUM_G_T + r];
+    }
+}
+
+//! 平面状的协方差，与PLANE正则化相同
+Eigen::Matrix4d planeCovariance(std::mt19937& rng)
+{
+    std::normal_distribution<double> normal(0.0, 1.0);
+    Eigen::Quaterniond q(normal(rng), normal(rng), normal(rng), normal(rng));
+    Eigen::Matrix3d R = q.normalized().toRotationMatrix();
+    Eigen::Matrix4d cov = Eigen::Matrix4d::Zero();
+    cov.block<3, 3>(0, 0) = R * Eigen::Vector3d(1.0, 1.0, 1e-3).asDiagonal() * R.transpose();
+    return cov;
+}
+
+int main(int argc, char** argv)
+{
+    int n = 200000;
+    int repeat = 20;
+    const rolo::bench::Args args(argc, argv);
+    args.get("--correspondences", n);
+    args.get("--repeat", repeat);
+
+    // 对应关系在pose0下建立，在附近的pose下线性化，点的范围约±60 m
+    Eigen::Isometry3d pose0 = Eigen::Isometry3d::Identity();
+    pose0.linear() = Eigen::AngleAxisd(0.1, Eigen::Vector3d(0.2, 0.3, 1.0).normalized()).toRotationMatrix();
+    pose0.translation() << 0.5, -0.3, 0.1;
+    Eigen::Isometry3d pose = Eigen::Isometry3d(Eigen::AngleAxisd(0.002, Eigen::Vector3d::UnitZ())) * pose0;
+    pose.translation() += Eigen::Vector3d(0.02, 0.01, -0.01);
+
+    std::mt19937 rng(n);
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+    VectorList source(n), target(n);
+    MatrixList mahalanobis(n);
+    std::vector<int> numPoints(n);
+    fast_gicp::CorrespondenceBuffer buffer;
+    buffer.resize(n);
+    double reference[12];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+            reference[4 * r + c] = pose0.matrix()(r, c);
+    buffer.setReferencePose(reference);
+
+    for (int i = 0; i < n; ++i)
+    {
+        source[i] << (float)(60.0 * uni(rng)), (float)(60.0 * uni(rng)), (float)(5.0 * uni(rng)), 1.0;
+        target[i] = pose0 * source[i];
+        target[i].head<3>() += 0.05 * Eigen::Vector3d(uni(rng), uni(rng), uni(rng));
+        numPoints[i] = 1 + rng() % 30;
+        Eigen::Matrix4d covA = planeCovariance(rng), covB = planeCovariance(rng);
+
+        Eigen::Matrix4d RCR = covB + pose0.matrix() * covA * pose0.matrix().transpose();
+        RCR(3, 3) = 1.0;
+        mahalanobis[i] = RCR.inverse();
+        mahalanobis[i](3, 3) = 0.0;
+
+        Eigen::Matrix3d weighted = std::sqrt((double)numPoints[i]) * mahalanobis[i].block<3, 3>(0, 0);
+        Eigen::Vector4d error = target[i] - pose0 * source[i];
+        const float values[fast_gicp::CorrespondenceBuffer::kFields] = {
+            (float)source[i].x(), (float)source[i].y(), (float)source[i].z(),
+            (float)error.x(), (float)error.y(), (float)error.z(),
+            (float)weighted(0, 0), (float)weighted(0, 1), (float)weighted(0, 2),
+            (float)weighted(1, 1), (float)weighted(1, 2), (float)weighted(2, 2)};
+        for (int f = 0; f < fast_gicp::CorrespondenceBuffer::kFields; ++f)
+            buffer.field(f)[i] = values[f];
+    }
+    double T[12];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+            T[4 * r + c] = pose.matrix()(r, c);
+
+    Matrix6d H[3];
+    Vector6d b[3];
+    double error[3];
+    double ms[3] = {0, 0, 0};
+    for (int it = 0; it < repeat; ++it)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        error[0] = reference::linearize(source, target, mahalanobis, numPoints, pose, H[0], b[0]);
+        auto t1 = std::chrono::steady_clock::now();
+        double sums[2][fast_gicp::SUM_SIZE] = {};
+        fast_gicp::linearizeCorrespondencesScalar(buffer, 0, n, T, fast_gicp::LinearizeMode::SE3, sums[0]);
+        auto t2 = std::chrono::steady_clock::now();
+        fast_gicp::linearizeCorrespondences(buffer, 0, n, T, fast_gicp::LinearizeMode::SE3, sums[1]);
+        auto t3 = std::chrono::steady_clock::now();
+        for (int k = 0; k < 2; ++k)
+        {
+            unpack(sums[k], H[k + 1], b[k + 1]);
+            error[k + 1] = sums[k][fast_gicp::SUM_ERROR];
+        }
+        ms[0] += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        ms[1] += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        ms[2] += std::chrono::duration<double, std::milli>(t3 - t2).count();
+    }
+
+    const char* names[3] = {"reference", "float scalar", fast_gicp::linearizeKernelsUseAvx2() ? "float avx2" : "float sse"};
+    Vector6d step0 = H[0].ldlt().solve(-b[0]);
+    printf("correspondences %d, single thread, SE3\n", n);
+    printf("%14s %10s %9s | %10s %10s %10s %10s\n", "", "ms", "speedup", "|dH|/|H|", "|db|/|b|", "d error", "d step");
+    for (int k = 0; k < 3; ++k)
+    {
+        Vector6d step = H[k].ldlt().solve(-b[k]);
+        printf("%14s %10.3f %8.2fx | %10.2e %10.2e %10.2e %10.2e\n", names[k], ms[k] / repeat, ms[0] / ms[k],
+               (H[k] - H[0]).norm() / H[0].norm(), (b[k] - b[0]).norm() / b[0].norm(),
+               std::fabs(error[k] - error[0]) / error[0], (step - step0).norm() / step0.norm());
+    }
+    return 0;
+}
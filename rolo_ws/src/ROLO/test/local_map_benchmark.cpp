@@ -0,0 +1,150 @@
+// 后端局部地图性能对比：原实现（每帧拼接周围关键帧、VoxelGrid降采样、重建KD树）vs 体素哈希的增量局部地图
+// 用法：local_map_benchmark [--frames N] [--points N] [--spacing m] [--radius m] [--leaf m] [--queries N]
+// 沿直线走廊每隔spacing生成一个关键帧，每帧插入一个关键帧，两种实现都保留radius以内的部分。输出每帧建图和5近邻查询的耗时、地图点数，
+// 以及两种实现的匹配条件（第5近邻在1 m以内）一致的比例
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include "rolo/incrementalPointMap.h"
+
+#include "benchmark_common.h"
+
+typedef pcl::PointXYZI PointT;
+
+//! 关键帧：位置x处的全局坐标系点云，走廊两侧的墙、地面和随机的杆
+static pcl::PointCloud<PointT>::Ptr makeKeyframe(float x, int points, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+    cloud->reserve(points);
+    for (int i = 0; i < points; ++i)
+    {
+        PointT p;
+        const float k = u(rng);
+        const float along = x - 40.0f + 80.0f * u(rng);
+        if (k < 0.4f)
+        {
+            p.x = along; p.y = -10.0f + 20.0f * u(rng); p.z = -1.8f + noise(rng);
+        }
+        else if (k < 0.8f)
+        {
+            p.x = along; p.y = (u(rng) < 0.5f ? -10.0f : 10.0f) + noise(rng); p.z = -1.8f + 6.0f * u(rng);
+        }
+        else
+        {
+            const float pole = std::floor(along / 5.0f) * 5.0f;
+            const float angle = 6.2832f * u(rng);
+            p.x = pole + 0.2f * std::cos(angle); p.y = 5.0f + 0.2f * std::sin(angle); p.z = -1.8f + 4.0f * u(rng);
+        }
+        p.intensity = 0.0f;
+        cloud->push_back(p);
+    }
+    return cloud;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 200;
+    int points = 20000;
+    float spacing = 2.0f;
+    float radius = 50.0f;
+    float leaf = 0.4f;
+    int queries = 5000;
+    const rolo::bench::Args args(argc, argv);
+    args.get("--frames", frames);
+    args.get("--points", points);
+    args.get("--spacing", spacing);
+    args.get("--radius", radius);
+    args.get("--leaf", leaf);
+    args.get("--queries", queries);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+    std::deque<std::pair<float, pcl::PointCloud<PointT>::Ptr>> window; // 原实现：radius以内的关键帧
+    rolo::IncrementalPointMap<PointT> map(leaf, 1.0f);
+    pcl::VoxelGrid<PointT> downSizeFilter;
+    downSizeFilter.setLeafSize(leaf, leaf, leaf);
+    pcl::KdTreeFLANN<PointT> kdtree;
+    float mapCenter = 0.0f;
+
+    double buildMs[2] = {0.0, 0.0};
+    double queryMs[2] = {0.0, 0.0};
+    size_t mapPoints[2] = {0, 0};
+    long agree = 0, total = 0;
+    std::vector<int> indices;
+    std::vector<float> sqDistances;
+    for (int f = 0; f < frames; ++f)
+    {
+        const float x = spacing * f;
+        pcl::PointCloud<PointT>::Ptr keyframe = makeKeyframe(x, points, rng);
+        window.emplace_back(x, keyframe);
+        while (x - window.front().first > radius)
+            window.pop_front();
+
+        // 原实现：拼接、降采样、建KD树
+        auto start = std::chrono::steady_clock::now();
+        pcl::PointCloud<PointT>::Ptr merged(new pcl::PointCloud<PointT>());
+        for (const auto& frame : window)
+            *merged += *frame.second;
+        pcl::PointCloud<PointT>::Ptr mergedDS(new pcl::PointCloud<PointT>());
+        downSizeFilter.setInputCloud(merged);
+        downSizeFilter.filter(*mergedDS);
+        kdtree.setInputCloud(mergedDS);
+        buildMs[0] += rolo::bench::elapsedMs(start);
+        mapPoints[0] += mergedDS->size();
+
+        // 增量地图：只插入新关键帧，移动超过半径的一成时删除立方体以外的网格
+        start = std::chrono::steady_clock::now();
+        map.insert(*keyframe);
+        if (f == 0 || std::fabs(x - mapCenter) > 0.1f * radius)
+        {
+            map.removeOutside(Eigen::Vector3f(x, 0.0f, 0.0f), radius);
+            mapCenter = x;
+        }
+        buildMs[1] += rolo::bench::elapsedMs(start);
+        mapPoints[1] += map.size();
+
+        std::vector<PointT> querySet(queries);
+        for (auto& q : querySet)
+        {
+            q.x = x + 30.0f * u(rng); q.y = 10.0f * u(rng); q.z = -1.8f + 3.0f * (u(rng) + 1.0f);
+        }
+        std::vector<char> matched(queries);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < queries; ++i)
+        {
+            kdtree.nearestKSearch(querySet[i], 5, indices, sqDistances);
+            matched[i] = sqDistances.size() == 5 && sqDistances[4] < 1.0f;
+        }
+        queryMs[0] += rolo::bench::elapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < queries; ++i)
+        {
+            bool ok = map.nearestKSearch(querySet[i], 5, indices, sqDistances) == 5 && sqDistances[4] < 1.0f;
+            agree += ok == (bool)matched[i];
+        }
+        queryMs[1] += rolo::bench::elapsedMs(start);
+        total += queries;
+    }
+
+    printf("frames %d, %d points per keyframe, spacing %.1f m, radius %.1f m, leaf %.2f m, %d queries per frame\n",
+           frames, points, spacing, radius, leaf, queries);
+    printf("%14s %12s %12s %14s\n", "", "build ms", "query ms", "map points");
+    const char* names[2] = {"rebuild", "incremental"};
+    for (int m = 0; m < 2; ++m)
+        printf("%14s %12.3f %12.3f %14zu\n", names[m], buildMs[m] / frames, queryMs[m] / frames, mapPoints[m] / frames);
+    printf("match condition agreement %.2f%%\n", 100.0 * agree / total);
+    return 0;
+}
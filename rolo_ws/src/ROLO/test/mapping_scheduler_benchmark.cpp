@@ -0,0 +1,108 @@
+// 后端调度的模拟对比：固定的处理间隔门限 vs 按处理耗时自适应的调度（rolo::MappingScheduler）
+// 用法：mapping_scheduler_benchmark [--rate Hz] [--interval s] [--capacity N] [--load r]
+// 输入帧按rate到达，经过容量capacity、丢弃最旧帧的队列后串行处理。处理耗时分三段：轻载、过载（超过帧周期）、中等负载。
+// 输出每段处理的帧比例、队列丢弃的帧数、从帧到达到处理完成的平均和最大延迟
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+
+#include "rolo/mappingScheduler.h"
+
+#include "benchmark_common.h"
+
+struct PhaseStats
+{
+    int frames = 0;
+    int processed = 0;
+    int dropped = 0;
+    double latencySum = 0.0;
+    double latencyMax = 0.0;
+};
+
+//! 模拟一种调度：adaptive为false时只处理与上一处理帧间隔不小于interval的帧
+static void simulate(bool adaptive, double rate, double interval, size_t capacity, double load, PhaseStats stats[3])
+{
+    const double period = 1.0 / rate;
+    const int framesPerPhase = (int)(60.0 * rate);
+    const double cost[3] = {0.4 * period, 1.8 * period, 0.7 * period}; // 各段处理一帧的平均耗时
+    std::mt19937 rng(7);
+    std::normal_distribution<double> jitter(1.0, 0.1);
+
+    rolo::MappingScheduler scheduler(adaptive ? 0.0 : interval, adaptive ? 1.0 : interval, load);
+    double lastProcessed = -1.0;
+    std::deque<int> queue;
+    double busyUntil = 0.0;
+    const int total = 3 * framesPerPhase;
+    int next = 0;
+    while (next < total || !queue.empty())
+    {
+        // 处理线程空闲之前到达的帧入队，队满丢弃最旧的
+        while (next < total && (queue.empty() || next * period <= busyUntil))
+        {
+            stats[next / framesPerPhase].frames++;
+            queue.push_back(next++);
+            if (queue.size() > capacity)
+            {
+                stats[queue.front() / framesPerPhase].dropped++;
+                queue.pop_front();
+            }
+        }
+        const int frame = queue.front();
+        queue.pop_front();
+        const double stamp = frame * period;
+        const double start = std::max(busyUntil, stamp);
+        bool admitted;
+        if (adaptive)
+            admitted = scheduler.admit(stamp);
+        else
+            admitted = lastProcessed < 0 || stamp - lastProcessed >= interval;
+        if (!admitted)
+        {
+            busyUntil = start;
+            continue;
+        }
+        const int phase = frame / framesPerPhase;
+        const double seconds = cost[phase] * std::max(jitter(rng), 0.2);
+        busyUntil = start + seconds;
+        lastProcessed = stamp;
+        scheduler.processed(stamp, seconds);
+        PhaseStats& s = stats[phase];
+        s.processed++;
+        s.latencySum += busyUntil - stamp;
+        s.latencyMax = std::max(s.latencyMax, busyUntil - stamp);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double rate = 10.0;
+    double interval = 0.15;
+    int capacity = 2;
+    double load = 0.9;
+    const rolo::bench::Args args(argc, argv);
+    args.get("--rate", rate);
+    args.get("--interval", interval);
+    args.get("--capacity", capacity);
+    args.get("--load", load);
+
+    printf("%.1f Hz input, queue capacity %d, fixed interval %.3f s, target load %.2f\n", rate, capacity, interval, load);
+    printf("phase costs 0.4 / 1.8 / 0.7 frame periods, 60 s each\n");
+    printf("%10s %8s %12s %10s %16s %16s\n", "", "phase", "processed %", "dropped", "mean latency ms", "max latency ms");
+    const char* names[2] = {"fixed", "adaptive"};
+    for (int m = 0; m < 2; ++m)
+    {
+        PhaseStats stats[3];
+        simulate(m == 1, rate, interval, capacity, load, stats);
+        for (int p = 0; p < 3; ++p)
+        {
+            const PhaseStats& s = stats[p];
+            printf("%10s %8d %12.1f %10d %16.1f %16.1f\n", names[m], p, 100.0 * s.processed / std::max(s.frames, 1), s.dropped,
+                   1000.0 * s.latencySum / std::max(s.processed, 1), 1000.0 * s.latencyMax);
+        }
+    }
+    return 0;
+}
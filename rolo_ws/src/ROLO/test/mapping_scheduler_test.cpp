@@ -0,0 +1,96 @@
+// MappingScheduler的检查：第一帧和时间戳回退时处理，间隔随处理耗时变化并限制在[minInterval, maxInterval]内
+#include <gtest/gtest.h>
+
+#include "rolo/mappingScheduler.h"
+
+TEST(MappingScheduler, AdmitsFirstFrameAndEveryFrameWhenIdle)
+{
+    rolo::MappingScheduler scheduler(0.0, 1.0, 0.8);
+    EXPECT_DOUBLE_EQ(scheduler.interval(), 0.0);
+    // 10Hz输入，处理耗时远小于帧周期时每一帧都处理
+    for (int i = 0; i < 50; i++)
+    {
+        const double stamp = 100.0 + 0.1 * i;
+        ASSERT_TRUE(scheduler.admit(stamp)) << "frame " << i;
+        scheduler.processed(stamp, 0.01);
+    }
+    EXPECT_NEAR(scheduler.period(), 0.1, 1e-9);
+    EXPECT_NEAR(scheduler.cost(), 0.01, 1e-9);
+    EXPECT_NEAR(scheduler.interval(), 0.01 / 0.8, 1e-9);
+}
+
+TEST(MappingScheduler, IntervalFollowsSmoothedCost)
+{
+    rolo::MappingScheduler scheduler(0.0, 10.0, 0.5);
+    scheduler.admit(0.0);
+    scheduler.processed(0.0, 0.1);
+    EXPECT_DOUBLE_EQ(scheduler.cost(), 0.1);
+    EXPECT_DOUBLE_EQ(scheduler.interval(), 0.2);
+
+    // 滑动平均 0.8*cost + 0.2*seconds
+    scheduler.admit(1.0);
+    scheduler.processed(1.0, 0.6);
+    EXPECT_DOUBLE_EQ(scheduler.cost(), 0.8 * 0.1 + 0.2 * 0.6);
+    EXPECT_DOUBLE_EQ(scheduler.interval(), (0.8 * 0.1 + 0.2 * 0.6) / 0.5);
+}
+
+TEST(MappingScheduler, SkipsFramesUnderLoad)
+{
+    rolo::MappingScheduler scheduler(0.0, 1.0, 1.0);
+    // 处理一帧需要0.25s，10Hz输入下大约每3帧处理一帧
+    int processed = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        const double stamp = 0.1 * i;
+        if (scheduler.admit(stamp))
+        {
+            scheduler.processed(stamp, 0.25);
+            processed++;
+        }
+    }
+    EXPECT_NEAR(scheduler.interval(), 0.25, 1e-9);
+    EXPECT_GE(processed, 30);
+    EXPECT_LE(processed, 40);
+}
+
+TEST(MappingScheduler, IntervalIsClamped)
+{
+    rolo::MappingScheduler scheduler(0.2, 0.5, 1.0);
+    EXPECT_DOUBLE_EQ(scheduler.interval(), 0.2);
+    scheduler.admit(0.0);
+    scheduler.processed(0.0, 0.01);
+    EXPECT_DOUBLE_EQ(scheduler.interval(), 0.2);
+    for (int i = 1; i < 50; i++)
+        scheduler.processed(i, 5.0);
+    EXPECT_DOUBLE_EQ(scheduler.interval(), 0.5);
+
+    // targetLoad限制在[0.1, 1]内
+    rolo::MappingScheduler lowLoad(0.0, 100.0, 0.0);
+    lowLoad.processed(0.0, 1.0);
+    EXPECT_DOUBLE_EQ(lowLoad.interval(), 10.0);
+    rolo::MappingScheduler highLoad(0.0, 100.0, 4.0);
+    highLoad.processed(0.0, 1.0);
+    EXPECT_DOUBLE_EQ(highLoad.interval(), 1.0);
+
+    // maxInterval小于minInterval时取minInterval
+    rolo::MappingScheduler inverted(0.3, 0.1, 1.0);
+    inverted.processed(0.0, 5.0);
+    EXPECT_DOUBLE_EQ(inverted.interval(), 0.3);
+}
+
+TEST(MappingScheduler, AdmitsAfterTimestampGoesBackwards)
+{
+    rolo::MappingScheduler scheduler(0.0, 10.0, 0.1);
+    scheduler.admit(50.0);
+    scheduler.processed(50.0, 0.5);
+    ASSERT_DOUBLE_EQ(scheduler.interval(), 5.0);
+    EXPECT_FALSE(scheduler.admit(50.1));
+    // 回放重新开始
+    EXPECT_TRUE(scheduler.admit(0.0));
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
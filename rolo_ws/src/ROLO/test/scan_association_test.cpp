@@ -0,0 +1,82 @@
+// fitLine、fitPlane的检查：已知的直线和平面上的点拟合出对应的方向和平面，分散的点被拒绝
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include "rolo/scanAssociation.h"
+
+TEST(ScanAssociation, FitLineAlongKnownDirection)
+{
+    const Eigen::Vector3f origin(10, -3, 2);
+    const Eigen::Vector3f axis = Eigen::Vector3f(1, 2, -1).normalized();
+    Eigen::Vector3f points[5];
+    for (int j = 0; j < 5; j++)
+        points[j] = origin + (j - 2) * 0.2f * axis;
+    // 垂直于直线的小扰动
+    points[1] += 0.005f * axis.unitOrthogonal();
+
+    Eigen::Vector3f center, direction;
+    ASSERT_TRUE(rolo::fitLine(points, 5, center, direction));
+    EXPECT_NEAR(direction.norm(), 1.0f, 1e-5f);
+    EXPECT_NEAR(std::fabs(direction.dot(axis)), 1.0f, 1e-4f);
+    EXPECT_LT((center - origin).norm(), 2e-3f);
+}
+
+TEST(ScanAssociation, FitLineRejectsIsotropicPoints)
+{
+    // 立方体的顶点，协方差各向同性
+    Eigen::Vector3f points[8];
+    for (int j = 0; j < 8; j++)
+        points[j] = Eigen::Vector3f(j & 1 ? 1.f : -1.f, j & 2 ? 1.f : -1.f, j & 4 ? 1.f : -1.f);
+    Eigen::Vector3f center, direction;
+    EXPECT_FALSE(rolo::fitLine(points, 8, center, direction));
+}
+
+TEST(ScanAssociation, FitPlaneOnKnownPlane)
+{
+    // 平面 z = 2，即 0*x + 0*y + 1*z - 2 = 0；在较大的全局坐标处检查精度
+    const Eigen::Vector3f points[5] = {{100.0f, 50.0f, 2.0f}, {100.5f, 50.0f, 2.0f}, {100.0f, 50.5f, 2.0f},
+                                       {100.5f, 50.5f, 2.0f}, {100.2f, 50.3f, 2.0f}};
+    Eigen::Vector4f plane;
+    ASSERT_TRUE(rolo::fitPlane(points, 5, 0.2f, plane));
+    EXPECT_NEAR(plane.head<3>().norm(), 1.0f, 1e-5f);
+    // 法向量的符号由 d = 1/|X| > 0 决定
+    EXPECT_NEAR(plane(2), -1.0f, 1e-4f);
+    EXPECT_NEAR(plane(3), 2.0f, 1e-3f);
+    for (const Eigen::Vector3f& p : points)
+        EXPECT_NEAR(plane.head<3>().dot(p) + plane(3), 0.0f, 1e-3f);
+}
+
+TEST(ScanAssociation, FitPlaneOnTiltedPlane)
+{
+    const Eigen::Vector3f normal = Eigen::Vector3f(1, -2, 3).normalized();
+    const float d = -4.0f;
+    const Eigen::Vector3f u = normal.unitOrthogonal();
+    const Eigen::Vector3f v = normal.cross(u);
+    const Eigen::Vector3f origin = -d * normal;
+    Eigen::Vector3f points[5];
+    for (int j = 0; j < 5; j++)
+        points[j] = origin + 0.3f * std::cos(j * 1.3f) * u + 0.3f * std::sin(j * 1.3f) * v;
+
+    Eigen::Vector4f plane;
+    ASSERT_TRUE(rolo::fitPlane(points, 5, 0.2f, plane));
+    const float sign = plane(3) * d > 0 ? 1.0f : -1.0f;
+    EXPECT_LT((plane.head<3>() - sign * normal).norm(), 1e-4f);
+    EXPECT_NEAR(plane(3), sign * d, 1e-4f);
+}
+
+TEST(ScanAssociation, FitPlaneRejectsScatteredPoints)
+{
+    // 一个点离其余四点所在的平面0.5m
+    const Eigen::Vector3f points[5] = {{5.0f, 0.0f, 1.0f}, {5.5f, 0.0f, 1.0f}, {5.0f, 0.5f, 1.0f},
+                                       {5.5f, 0.5f, 1.0f}, {5.2f, 0.2f, 1.5f}};
+    Eigen::Vector4f plane;
+    EXPECT_FALSE(rolo::fitPlane(points, 5, 0.05f, plane));
+    EXPECT_TRUE(rolo::fitPlane(points, 5, 1.0f, plane));
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
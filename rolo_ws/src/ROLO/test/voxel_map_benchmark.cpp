@@ -0,0 +1,251 @@
+// 体素地图性能对比：原VmfVoxelMap（unordered_map + shared_ptr体素 + boost::hash_combine）vs 开放寻址的莫顿码哈希表
+// 用法：voxel_map_benchmark [--points N] [--repeat N] [--threads N]
+// 分别在0.5、1.0、2.0 m分辨率下建图并按DIRECT7建立对应关系，输出耗时以及两种实现的体素数、对应关系数和体素统计量的差异
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <omp.h>
+#include <boost/functional/hash.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <rot_gicp/gicp/vmp_voxel.hpp>
+
+#include "benchmark_common.h"
+
+typedef std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> CovarianceList;
+
+//! 原实现：体素在堆上分配，通过虚函数累加，对应关系中保存shared_ptr
+namespace reference
+{
+
+class Vector3iHash {
+public:
+  size_t operator()(const Eigen::Vector3i& x) const {
+    size_t seed = 0;
+    boost::hash_combine(seed, x[0]);
+    boost::hash_combine(seed, x[1]);
+    boost::hash_combine(seed, x[2]);
+    return seed;
+  }
+};
+
+struct VmfVoxel {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  using Ptr = std::shared_ptr<VmfVoxel>;
+  VmfVoxel() : num_points(0), r_bar(0), kappa(0) {
+    mean_dir.setZero();
+    cov.setZero();
+  }
+  virtual ~VmfVoxel() {}
+  virtual void append(const Eigen::Vector4d& dir_, const Eigen::Matrix4d& conv_) = 0;
+  virtual void finalize() = 0;
+
+  int num_points;
+  Eigen::Vector4d mean_dir;
+  double r_bar;
+  double kappa;
+  Eigen::Matrix4d cov;
+};
+
+struct AdditiveVmfVoxel : VmfVoxel {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  virtual void append(const Eigen::Vector4d& dir_, const Eigen::Matrix4d& conv_) override {
+    num_points++;
+    mean_dir += dir_;
+    r_bar = mean_dir.norm() / num_points;
+    cov += conv_;
+  }
+  virtual void finalize() override {
+    mean_dir /= num_points;
+    if (r_bar < 1 || r_bar > 1.732051) {
+      kappa = r_bar * (3 - r_bar * r_bar) / (1 - r_bar * r_bar);
+    } else {
+      kappa = 3 * r_bar * (1 + 0.6 * pow(r_bar, 2) + 99.0 / 175.0 * pow(r_bar, 4));
+    }
+    cov /= num_points;
+  }
+};
+
+class VmfVoxelMap {
+public:
+  explicit VmfVoxelMap(double resolution) : voxel_resolution_(resolution) {}
+
+  void create_voxelmap(const pcl::PointCloud<pcl::PointXYZ>& cloud, const CovarianceList& covs) {
+    voxels_.clear();
+    for (int i = 0; i < (int)cloud.size(); i++) {
+      Eigen::Vector3i coord = voxel_coord(cloud.at(i).getVector4fMap().cast<double>());
+      auto found = voxels_.find(coord);
+      if (found == voxels_.end()) {
+        VmfVoxel::Ptr voxel = std::shared_ptr<AdditiveVmfVoxel>(new AdditiveVmfVoxel);
+        found = voxels_.insert(found, std::make_pair(coord, voxel));
+      }
+      found->second->append(cloud.at(i).getVector4fMap().cast<double>(), covs[i]);
+    }
+    for (auto& voxel : voxels_) {
+      voxel.second->finalize();
+    }
+  }
+
+  Eigen::Vector3i voxel_coord(const Eigen::Vector4d& x) const {
+    return (x.array() / voxel_resolution_ - 0.5).floor().cast<int>().head<3>();
+  }
+
+  VmfVoxel::Ptr lookup_voxel(const Eigen::Vector3i& coord) const {
+    auto found = voxels_.find(coord);
+    return found == voxels_.end() ? nullptr : found->second;
+  }
+
+  size_t size() const { return voxels_.size(); }
+
+private:
+  double voxel_resolution_;
+  std::unordered_map<Eigen::Vector3i, VmfVoxel::Ptr, Vector3iHash, std::equal_to<Eigen::Vector3i>,
+                     Eigen::aligned_allocator<std::pair<const Eigen::Vector3i, VmfVoxel::Ptr>>> voxels_;
+};
+
+} // namespace reference
+
+//! 仿真一帧特征点：地面、若干墙面和杆状物，范围约±60 m
+void makeCloud(int n, pcl::PointCloud<pcl::PointXYZ>& cloud, CovarianceList& covs)
+{
+    std::mt19937 rng(n);
+    std::uniform_real_distribution<float> uni(-1.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    cloud.clear();
+    covs.clear();
+    for (int i = 0; i < n; ++i)
+    {
+        pcl::PointXYZ p;
+        float kind = 0.5f * (uni(rng) + 1.0f);
+        if (kind < 0.5f)
+        {
+            // 地面，点密度随距离衰减
+            float r = 60.0f * std::pow(0.5f * (uni(rng) + 1.0f), 2.0f) + 2.0f;
+            float a = (float)M_PI * uni(rng);
+            p.x = r * std::cos(a); p.y = r * std::sin(a); p.z = -1.8f + noise(rng);
+        }
+        else if (kind < 0.9f)
+        {
+            // 8面墙
+            int wall = (int)(4.0f * (uni(rng) + 1.0f)) % 8;
+            float offset = 8.0f + 5.0f * wall;
+            float along = 40.0f * uni(rng);
+            p.x = (wall % 2) ? offset + noise(rng) : along;
+            p.y = (wall % 2) ? along : -offset + noise(rng);
+            p.z = -1.8f + 3.0f * (uni(rng) + 1.0f);
+        }
+        else
+        {
+            // 杆
+            int pole = (int)(10.0f * (uni(rng) + 1.0f)) % 20;
+            p.x = -30.0f + 3.0f * pole + 0.1f * uni(rng);
+            p.y = 4.0f + 0.1f * uni(rng);
+            p.z = -1.8f + 2.5f * (uni(rng) + 1.0f);
+        }
+        cloud.push_back(p);
+        Eigen::Matrix4d cov = Eigen::Matrix4d::Zero();
+        Eigen::Matrix3d a = Eigen::Matrix3d::Random();
+        cov.block<3, 3>(0, 0) = a * a.transpose() + 1e-3 * Eigen::Matrix3d::Identity();
+        covs.push_back(cov);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int points = 60000;
+    int repeat = 20;
+    int threads = omp_get_max_threads();
+    const rolo::bench::Args args(argc, argv);
+    args.get("--points", points);
+    args.get("--repeat", repeat);
+    args.get("--threads", threads);
+
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    CovarianceList covs;
+    makeCloud(points, cloud, covs);
+    const auto offsets = fast_gicp::neighbor_offsets(fast_gicp::NeighborSearchMethod::DIRECT7);
+
+    printf("points %d, threads %d, DIRECT7 correspondences\n", points, threads);
+    printf("%5s %8s | %21s | %21s | %21s | %s\n", "res", "voxels",
+           "build ms (ref / new)", "corr ms (ref / new)", "total speedup", "voxel / corr / stat mismatches");
+
+    for (double resolution : {0.5, 1.0, 2.0})
+    {
+        reference::VmfVoxelMap refMap(resolution);
+        fast_gicp::VmfVoxelMap<pcl::PointXYZ> newMap(resolution, fast_gicp::VoxelAccumulationMode::ADDITIVE);
+        std::vector<std::vector<std::pair<int, reference::VmfVoxel::Ptr>>> refCorrs(threads);
+        std::vector<std::vector<fast_gicp::VoxelCorrespondence>> newCorrs(threads);
+
+        double build[2] = {0, 0}, corr[2] = {0, 0};
+        for (int it = 0; it < repeat; ++it)
+        {
+            // 原实现
+            auto t0 = std::chrono::steady_clock::now();
+            refMap.create_voxelmap(cloud, covs);
+            auto t1 = std::chrono::steady_clock::now();
+            for (auto& c : refCorrs) c.clear();
+            #pragma omp parallel for num_threads(threads) schedule(guided, 8)
+            for (int i = 0; i < (int)cloud.size(); i++)
+            {
+                Eigen::Vector3i coord = refMap.voxel_coord(cloud.at(i).getVector4fMap().cast<double>());
+                for (const auto& offset : offsets)
+                {
+                    auto voxel = refMap.lookup_voxel(coord + offset);
+                    if (voxel != nullptr)
+                        refCorrs[omp_get_thread_num()].push_back(std::make_pair(i, voxel));
+                }
+            }
+            auto t2 = std::chrono::steady_clock::now();
+
+            // 开放寻址哈希表，体素连续存放，对应关系为索引对
+            newMap.create_voxelmap(cloud, covs);
+            auto t3 = std::chrono::steady_clock::now();
+            for (auto& c : newCorrs) c.clear();
+            #pragma omp parallel for num_threads(threads) schedule(guided, 8)
+            for (int i = 0; i < (int)cloud.size(); i++)
+            {
+                Eigen::Vector3i coord = newMap.voxel_coord(cloud.at(i).getVector4fMap().cast<double>());
+                for (const auto& offset : offsets)
+                {
+                    int voxel = newMap.lookup_index(coord + offset);
+                    if (voxel >= 0)
+                        newCorrs[omp_get_thread_num()].push_back(fast_gicp::VoxelCorrespondence{(uint32_t)i, (uint32_t)voxel});
+                }
+            }
+            auto t4 = std::chrono::steady_clock::now();
+
+            build[0] += std::chrono::duration<double, std::milli>(t1 - t0).count();
+            corr[0] += std::chrono::duration<double, std::milli>(t2 - t1).count();
+            build[1] += std::chrono::duration<double, std::milli>(t3 - t2).count();
+            corr[1] += std::chrono::duration<double, std::milli>(t4 - t3).count();
+        }
+
+        // 逐体素比较统计量，对应关系只比较总数（线程分块顺序不同）
+        size_t voxelDiff = refMap.size() != newMap.size();
+        size_t refCorrNum = 0, newCorrNum = 0, statDiff = 0;
+        for (const auto& c : refCorrs) refCorrNum += c.size();
+        for (const auto& c : newCorrs) newCorrNum += c.size();
+        for (int i = 0; i < (int)cloud.size(); i++)
+        {
+            Eigen::Vector3i coord = refMap.voxel_coord(cloud.at(i).getVector4fMap().cast<double>());
+            auto a = refMap.lookup_voxel(coord);
+            const fast_gicp::VmfVoxel* b = newMap.lookup_voxel(coord);
+            if (!a || !b || a->num_points != b->num_points ||
+                (a->mean_dir - b->mean_dir).cwiseAbs().maxCoeff() > 1e-9 || (a->cov - b->cov).cwiseAbs().maxCoeff() > 1e-9)
+                statDiff++;
+        }
+
+        printf("%5.1f %8zu | %9.3f / %9.3f | %9.3f / %9.3f | %20.2fx | %zu / %zu / %zu\n", resolution, newMap.size(),
+               build[0] / repeat, build[1] / repeat, corr[0] / repeat, corr[1] / repeat,
+               (build[0] + corr[0]) / (build[1] + corr[1]), voxelDiff, refCorrNum != newCorrNum ? (size_t)1 : (size_t)0, statDiff);
+    }
+    return 0;
+}